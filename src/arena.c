@@ -0,0 +1,95 @@
+/**
+   dd_reader
+   arena.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "arena.h"
+
+// All allocations are aligned to this many bytes
+#define ARENA_ALIGN 8
+
+static arena_block *arena_new_block(size_t cap) {
+	arena_block *blk = (arena_block*)malloc(sizeof(arena_block) + cap);
+	blk->next = NULL;
+	blk->used = 0;
+	blk->cap = cap;
+	return blk;
+}
+
+/*
+ * Create a new arena
+ *
+ * @param block_size Number of bytes to reserve at a time. If 0, ARENA_DEFAULT_BLOCK_SIZE is used
+ * @return New arena with one empty block
+ */
+arena *arena_new(size_t block_size) {
+	arena *a = (arena*)malloc(sizeof(arena));
+	a->block_size = (block_size != 0) ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+	a->head = arena_new_block(a->block_size);
+	return a;
+}
+
+// Release every block owned by the arena and the arena itself
+void arena_free(arena *a) {
+	arena_block *blk = a->head, *next = NULL;
+	while(blk != NULL) {
+		next = blk->next;
+		free(blk);
+		blk = next;
+	}
+
+	free(a);
+}
+
+/*
+ * Reserve len bytes from the arena. Requests larger than the block size get a dedicated block
+ *
+ * @return Pointer to len bytes of uninitialized memory valid until arena_free()
+ */
+void *arena_alloc(arena *a, size_t len) {
+	len = (len + (ARENA_ALIGN - 1)) & ~((size_t)ARENA_ALIGN - 1);
+
+	// Oversized requests are linked behind the current block so its remaining space is not abandoned
+	if(len > a->block_size) {
+		arena_block *big = arena_new_block(len);
+		big->used = len;
+		big->next = a->head->next;
+		a->head->next = big;
+		return big->data;
+	}
+
+	if(a->head->used + len > a->head->cap) {
+		arena_block *blk = arena_new_block(a->block_size);
+		blk->next = a->head;
+		a->head = blk;
+	}
+
+	void *ret = a->head->data + a->head->used;
+	a->head->used += len;
+	return ret;
+}
+
+char *arena_strdup(arena *a, const char *str) {
+	return arena_strndup(a, str, strlen(str));
+}
+
+// Copy at most len characters of str into the arena and NUL terminate the result
+char *arena_strndup(arena *a, const char *str, size_t len) {
+	char *ret = (char*)arena_alloc(a, len + 1);
+	memcpy(ret, str, len);
+	ret[len] = '\0';
+	return ret;
+}
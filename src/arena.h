@@ -0,0 +1,55 @@
+/**
+   dd_reader
+   arena.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Default size of each arena block if no size is provided
+#define ARENA_DEFAULT_BLOCK_SIZE (1024 * 1024)
+
+/*
+ * Bump allocator used for the many small, long lived allocations made while parsing a volume (names, paths).
+ * Everything allocated from an arena is released at once by arena_free()
+ */
+typedef struct arena_block_t {
+	struct arena_block_t *next;
+	size_t used;
+	size_t cap;
+	uint8_t data[];
+} arena_block;
+
+typedef struct arena_t {
+	arena_block *head; // Block currently being allocated from. Older blocks follow via next
+	size_t block_size;
+} arena;
+
+/*
+ * Arena functions
+ */
+
+arena *arena_new(size_t block_size);
+void arena_free(arena *a);
+void *arena_alloc(arena *a, size_t len);
+char *arena_strdup(arena *a, const char *str);
+char *arena_strndup(arena *a, const char *str, size_t len);
+
+#endif
@@ -16,6 +16,13 @@
    limitations under the License.
 */
 
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // MAP_NORESERVE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "bytebuffer.h"
 
 // Wrap around an existing buf - will not copy buf
@@ -23,6 +30,7 @@ byte_buffer *bb_new_wrap(uint8_t *buf, size_t len) {
 	byte_buffer *bb = (byte_buffer*)malloc(sizeof(byte_buffer));
 	bb->pos = 0;
 	bb->wrapped = true;
+	bb->mapped = false;
 	bb->len = len;
 	bb->buf = buf;
 	return bb;
@@ -33,6 +41,7 @@ byte_buffer *bb_new_copy(uint8_t *buf, size_t len) {
 	byte_buffer *bb = (byte_buffer*)malloc(sizeof(byte_buffer));
 	bb->pos = 0;
 	bb->wrapped = false;
+	bb->mapped = false;
 	bb->len = len;
 	bb->buf = (uint8_t*)malloc(len);
 	memcpy(bb->buf, buf, len);
@@ -43,6 +52,7 @@ byte_buffer *bb_new(size_t len) {
 	byte_buffer *bb = (byte_buffer*)malloc(sizeof(byte_buffer));
 	bb->pos = 0;
 	bb->wrapped = false;
+	bb->mapped = false;
 	bb->len = len;
 	bb->buf = (uint8_t*)calloc(len, sizeof(uint8_t));
 	return bb;
@@ -85,10 +95,52 @@ byte_buffer *bb_new_from_file(const char *path, const char *fopen_opts) {
 	return bb;
 }
 
+/*
+ * Map a file instead of reading it into memory, so only the pages that are used are ever read from disk. The file is
+ * opened read only and writes to the buffer stay private to the process
+ */
+byte_buffer *bb_new_map(const char *path) {
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		printf("Could not open file %s\n", path);
+		return NULL;
+	}
+
+	struct stat sb;
+	if(fstat(fd, &sb) != 0) {
+		printf("Could not get the size of the file %s\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	// An empty file cannot be mapped
+	if(sb.st_size == 0) {
+		close(fd);
+		return bb_new(0);
+	}
+
+	// The mapping is writable, so without MAP_NORESERVE images larger than memory could not be mapped at all
+	int flags = MAP_PRIVATE;
+#ifdef MAP_NORESERVE
+	flags |= MAP_NORESERVE;
+#endif
+	uint8_t *map = (uint8_t*)mmap(NULL, (size_t)sb.st_size, PROT_READ | PROT_WRITE, flags, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		printf("Could not map file %s\n", path);
+		return NULL;
+	}
+
+	byte_buffer *bb = bb_new_wrap(map, (size_t)sb.st_size);
+	bb->mapped = true;
+	return bb;
+}
+
 byte_buffer *bb_new_default() {
 	byte_buffer *bb = (byte_buffer*)malloc(sizeof(byte_buffer));
 	bb->pos = 0;
 	bb->wrapped = false;
+	bb->mapped = false;
 	bb->len = BB_DEFAULT_SIZE;
 	bb->buf = (uint8_t*)calloc(BB_DEFAULT_SIZE, sizeof(uint8_t));
 	return bb;
@@ -120,12 +172,27 @@ bool bb_resize(byte_buffer* bb, size_t new_len) {
 }
 
 void bb_free(byte_buffer *bb) {
-	if(!bb->wrapped)
+	if(bb->mapped)
+		munmap(bb->buf, bb->len);
+	else if(!bb->wrapped)
 		free(bb->buf);
 
 	free(bb);
 }
 
+/*
+ * Ask the kernel to start reading part of a buffer from bb_new_map() in the background, so it arrives in one large
+ * read instead of a page fault per touched page. Only a hint, nothing is read here
+ *
+ * @param addr First byte of the range, anywhere within the mapping
+ */
+void bb_prefetch(const uint8_t *addr, size_t len) {
+	uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)addr & ~(page - 1);
+	if(len > 0)
+		posix_madvise((void*)start, (uintptr_t)addr + len - start, POSIX_MADV_WILLNEED);
+}
+
 void bb_skip(byte_buffer *bb, size_t len) {
 	bb->pos += len;
 }
@@ -30,8 +30,9 @@
 #define BB_DEFAULT_SIZE 4096
 
 typedef struct byte_buffer_t {
-    uint32_t pos; // Read/Write position
+    size_t pos; // Read/Write position
     bool wrapped; // True if this byte buffer is a wrapping buf
+    bool mapped; // True if buf is a mapping of a file. See bb_new_map()
     size_t len; // Length of buf array
     uint8_t *buf;
 } byte_buffer;
@@ -41,11 +42,13 @@ byte_buffer *bb_new_wrap(uint8_t *buf, size_t len);
 byte_buffer *bb_new_copy(uint8_t *buf, size_t len);
 byte_buffer *bb_new(size_t len);
 byte_buffer *bb_new_from_file(const char *path, const char *fopen_opts);
+byte_buffer *bb_new_map(const char *path);
 byte_buffer *bb_new_default();
 bool bb_resize(byte_buffer* bb, size_t new_len);
 void bb_free(byte_buffer *bb);
 
 // Utility
+void bb_prefetch(const uint8_t *addr, size_t len);
 void bb_skip(byte_buffer *bb, size_t len);
 size_t bb_bytes_left(byte_buffer *bb);
 void bb_clear(byte_buffer *bb);
@@ -0,0 +1,184 @@
+/**
+   dd_reader
+   cache.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "cache.h"
+
+static inline uint32_t cache_hash(uint64_t key) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return (uint32_t)key;
+}
+
+/*
+ * Create a cache
+ *
+ * @param block_size Size of each cached block (cluster) in bytes
+ * @param max_bytes Upper bound on the memory used for cached data. At least one block is always kept
+ * @param fill Called to load a block on a miss
+ * @param fill_ctx Passed to fill
+ */
+block_cache *cache_new(uint32_t block_size, uint64_t max_bytes, cache_fill_fn fill, void *fill_ctx) {
+	block_cache *c = (block_cache*)malloc(sizeof(block_cache));
+	memset(c, 0, sizeof(block_cache));
+	pthread_mutex_init(&(c->lock), NULL);
+
+	c->block_size = block_size;
+	c->num_blocks = (uint32_t)(max_bytes / block_size);
+	if(c->num_blocks == 0)
+		c->num_blocks = 1;
+
+	c->data = (uint8_t*)malloc((size_t)c->num_blocks * block_size);
+	c->keys = (uint64_t*)malloc(c->num_blocks * sizeof(uint64_t));
+	c->referenced = (uint8_t*)calloc(c->num_blocks, sizeof(uint8_t));
+	for(uint32_t i = 0; i < c->num_blocks; i++)
+		c->keys[i] = CACHE_EMPTY;
+
+	uint32_t map_size = 16;
+	while(map_size < c->num_blocks * 2)
+		map_size *= 2;
+	c->map = (uint32_t*)calloc(map_size, sizeof(uint32_t));
+	c->map_mask = map_size - 1;
+
+	c->fill = fill;
+	c->fill_ctx = fill_ctx;
+
+	return c;
+}
+
+void cache_free(block_cache *c) {
+	pthread_mutex_destroy(&(c->lock));
+	free(c->data);
+	free(c->keys);
+	free(c->referenced);
+	free(c->map);
+	free(c);
+}
+
+// Map slot holding key, or the empty slot where it would be inserted
+static uint32_t cache_slot(block_cache *c, uint64_t key) {
+	uint32_t s = cache_hash(key) & c->map_mask;
+	while(c->map[s] != 0 && c->keys[c->map[s] - 1] != key)
+		s = (s + 1) & c->map_mask;
+	return s;
+}
+
+// Remove a key from the map, shifting later entries of the probe sequence back so lookups never hit a hole
+static void cache_unmap(block_cache *c, uint64_t key) {
+	uint32_t s = cache_slot(c, key);
+	if(c->map[s] == 0)
+		return;
+
+	uint32_t next = s;
+	c->map[s] = 0;
+	while(true) {
+		next = (next + 1) & c->map_mask;
+		if(c->map[next] == 0)
+			return;
+
+		uint32_t home = cache_hash(c->keys[c->map[next] - 1]) & c->map_mask;
+		// Move the entry back if its home slot is not between the hole and its current slot
+		if(((next - home) & c->map_mask) >= ((next - s) & c->map_mask)) {
+			c->map[s] = c->map[next];
+			c->map[next] = 0;
+			s = next;
+		}
+	}
+}
+
+/*
+ * Find the block holding key, loading it on a miss. Must hold the lock
+ *
+ * @return Block index, or -1 if the block could not be loaded
+ */
+static int64_t cache_get(block_cache *c, uint64_t key) {
+	uint32_t s = cache_slot(c, key);
+	if(c->map[s] != 0) {
+		uint32_t b = c->map[s] - 1;
+		c->referenced[b] = 1;
+		c->hits++;
+		return b;
+	}
+
+	c->misses++;
+
+	// CLOCK: advance past recently referenced blocks, clearing their bit
+	while(c->referenced[c->hand]) {
+		c->referenced[c->hand] = 0;
+		c->hand = (c->hand + 1) % c->num_blocks;
+	}
+	uint32_t b = c->hand;
+	c->hand = (c->hand + 1) % c->num_blocks;
+
+	if(c->keys[b] != CACHE_EMPTY) {
+		cache_unmap(c, c->keys[b]);
+		c->keys[b] = CACHE_EMPTY;
+	}
+
+	if(!c->fill(c->fill_ctx, key, c->data + (size_t)b * c->block_size))
+		return -1;
+
+	c->keys[b] = key;
+	c->referenced[b] = 1;
+	c->map[cache_slot(c, key)] = b + 1;
+	return b;
+}
+
+/*
+ * Copy part of a block out of the cache, loading the block if it isn't cached
+ *
+ * @param key Block (cluster) to read
+ * @param offset Offset within the block
+ * @param dest Destination buffer
+ * @param len Number of bytes. offset + len must not exceed the block size
+ * @return False if the block could not be loaded
+ */
+bool cache_read(block_cache *c, uint64_t key, uint32_t offset, uint8_t *dest, uint32_t len) {
+	pthread_mutex_lock(&(c->lock));
+
+	int64_t b = cache_get(c, key);
+	if(b >= 0)
+		memcpy(dest, c->data + (size_t)b * c->block_size + offset, len);
+
+	pthread_mutex_unlock(&(c->lock));
+	return b >= 0;
+}
+
+/*
+ * Load blocks ahead of their use (readahead). Blocks already cached are left alone.
+ * Prefetched blocks start with their reference bit clear so an unused readahead is the first thing evicted
+ */
+void cache_prefetch(block_cache *c, const uint64_t *keys, uint32_t count) {
+	pthread_mutex_lock(&(c->lock));
+
+	// Never let a readahead cycle the whole cache
+	if(count > c->num_blocks / 2)
+		count = c->num_blocks / 2;
+
+	for(uint32_t i = 0; i < count; i++) {
+		if(c->map[cache_slot(c, keys[i])] != 0)
+			continue;
+
+		int64_t b = cache_get(c, keys[i]);
+		if(b >= 0)
+			c->referenced[b] = 0;
+		c->misses--; // Not a demand miss
+	}
+
+	pthread_mutex_unlock(&(c->lock));
+}
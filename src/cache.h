@@ -0,0 +1,71 @@
+/**
+   dd_reader
+   cache.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Key of an unused block
+#define CACHE_EMPTY UINT64_MAX
+
+/*
+ * Loads block key into dest (block_size bytes). Return false if the block can't be read
+ */
+typedef bool (*cache_fill_fn)(void *ctx, uint64_t key, uint8_t *dest);
+
+/*
+ * Fixed size block cache shared by every reader of a volume, keyed by cluster number.
+ * Blocks are evicted with the CLOCK (second chance) algorithm. All operations take the cache lock,
+ * so handles on different threads share one copy of each cached cluster
+ */
+typedef struct block_cache_t {
+	pthread_mutex_t lock;
+
+	uint32_t block_size;
+	uint32_t num_blocks;
+	uint8_t *data; // num_blocks * block_size
+	uint64_t *keys; // Key held by each block, CACHE_EMPTY if unused
+	uint8_t *referenced; // CLOCK reference bit of each block
+	uint32_t hand; // CLOCK hand
+
+	// Open addressing (linear probing) map from key to block index
+	uint32_t *map; // Block index + 1, 0 if the slot is empty
+	uint32_t map_mask;
+
+	cache_fill_fn fill;
+	void *fill_ctx;
+
+	uint64_t hits;
+	uint64_t misses;
+} block_cache;
+
+/*
+ * Cache functions
+ */
+
+block_cache *cache_new(uint32_t block_size, uint64_t max_bytes, cache_fill_fn fill, void *fill_ctx);
+void cache_free(block_cache *c);
+bool cache_read(block_cache *c, uint64_t key, uint32_t offset, uint8_t *dest, uint32_t len);
+void cache_prefetch(block_cache *c, const uint64_t *keys, uint32_t count);
+
+#endif
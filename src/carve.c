@@ -0,0 +1,373 @@
+/**
+   dd_reader
+   carve.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "carve.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define MB (1024ULL * 1024ULL)
+
+/*
+ * Built in signatures. Several entries may share a name (GIF has two headers)
+ */
+typedef struct carve_builtin_t {
+	const char *name;
+	const char *ext;
+	const char *header;
+	uint32_t header_len;
+	const char *footer;
+	uint32_t footer_len;
+	uint32_t footer_extra;
+	uint64_t max_size;
+	uint8_t sizer;
+} carve_builtin;
+
+static const carve_builtin carve_builtins[] = {
+	{ "jpeg", "jpg", "\xFF\xD8\xFF", 3, "\xFF\xD9", 2, 0, 20 * MB, CARVE_SIZE_FOOTER },
+	{ "png", "png", "\x89PNG\r\n\x1A\n", 8, "IEND\xAE\x42\x60\x82", 8, 0, 50 * MB, CARVE_SIZE_FOOTER },
+	{ "gif", "gif", "GIF89a", 6, "\x00\x3B", 2, 0, 20 * MB, CARVE_SIZE_FOOTER },
+	{ "gif", "gif", "GIF87a", 6, "\x00\x3B", 2, 0, 20 * MB, CARVE_SIZE_FOOTER },
+	{ "pdf", "pdf", "%PDF-", 5, "%%EOF", 5, 0, 100 * MB, CARVE_SIZE_FOOTER },
+	{ "zip", "zip", "PK\x03\x04", 4, "PK\x05\x06", 4, 18, 100 * MB, CARVE_SIZE_FOOTER }, // End of central directory record
+	{ "sqlite", "sqlite", "SQLite format 3\0", 16, NULL, 0, 0, 1024 * MB, CARVE_SIZE_SQLITE },
+	{ NULL, NULL, NULL, 0, NULL, 0, 0, 0, 0 }
+};
+
+carve_set *carve_set_new() {
+	carve_set *set = (carve_set*)malloc(sizeof(carve_set));
+	memset(set, 0, sizeof(carve_set));
+
+	return set;
+}
+
+void carve_set_free(carve_set *set) {
+	free(set);
+}
+
+static carve_sig *carve_set_next(carve_set *set) {
+	if(set->count == CARVE_MAX_SIGS) {
+		printf("Too many carving signatures, at most %i are supported\n", CARVE_MAX_SIGS);
+		return NULL;
+	}
+
+	carve_sig *sig = &(set->sigs[set->count]);
+	memset(sig, 0, sizeof(carve_sig));
+	return sig;
+}
+
+/*
+ * Add built in signatures by type name
+ *
+ * @param name Type name (jpeg, png, gif, pdf, zip, sqlite) or "all"
+ * @return False if there is no such type
+ */
+bool carve_set_add_builtin(carve_set *set, const char *name) {
+	bool found = false;
+
+	for(const carve_builtin *b = carve_builtins; b->name != NULL; b++) {
+		if(strcmp(name, "all") != 0 && strcmp(name, b->name) != 0)
+			continue;
+
+		carve_sig *sig = carve_set_next(set);
+		if(sig == NULL)
+			return false;
+
+		snprintf(sig->name, sizeof(sig->name), "%s", b->name);
+		snprintf(sig->ext, sizeof(sig->ext), "%s", b->ext);
+		memcpy(sig->header, b->header, b->header_len);
+		sig->header_len = b->header_len;
+		if(b->footer != NULL)
+			memcpy(sig->footer, b->footer, b->footer_len);
+		sig->footer_len = b->footer_len;
+		sig->footer_extra = b->footer_extra;
+		sig->max_size = b->max_size;
+		sig->sizer = b->sizer;
+		set->count++;
+		found = true;
+	}
+
+	return found;
+}
+
+// Decode a hex string into dest. Returns the number of bytes, 0 if invalid or longer than CARVE_MAX_MAGIC
+static uint32_t carve_parse_hex(const char *hex, uint8_t *dest) {
+	uint32_t n = 0;
+	size_t len = strlen(hex);
+
+	if(len == 0 || len % 2 != 0 || len / 2 > CARVE_MAX_MAGIC)
+		return 0;
+
+	for(size_t i = 0; i < len; i += 2) {
+		unsigned int v = 0;
+		if(sscanf(hex + i, "%2x", &v) != 1)
+			return 0;
+		dest[n++] = (uint8_t)v;
+	}
+
+	return n;
+}
+
+/*
+ * Add signatures from a text file. One per line: NAME EXT HEADER_HEX FOOTER_HEX MAX_SIZE
+ * FOOTER_HEX is '-' for types without a footer. Blank lines and lines starting with '#' are skipped
+ *
+ * @return False if the file could not be read or has an invalid line
+ */
+bool carve_set_load(carve_set *set, const char *path) {
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL) {
+		printf("Could not open signature file %s\n", path);
+		return false;
+	}
+
+	char line[512], header[128], footer[128];
+	unsigned long long max_size = 0;
+	uint32_t line_num = 0;
+	bool ok = true;
+	while(ok && fgets(line, sizeof(line), fp) != NULL) {
+		line_num++;
+		if(line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+			continue;
+
+		carve_sig *sig = carve_set_next(set);
+		if(sig == NULL || sscanf(line, "%15s %7s %127s %127s %llu", sig->name, sig->ext, header, footer, &max_size) != 5) {
+			printf("Invalid signature on line %u of %s\n", line_num, path);
+			ok = false;
+			break;
+		}
+
+		sig->header_len = carve_parse_hex(header, sig->header);
+		sig->footer_len = (strcmp(footer, "-") == 0) ? 0 : carve_parse_hex(footer, sig->footer);
+		sig->max_size = max_size;
+		sig->sizer = CARVE_SIZE_FOOTER;
+		if(sig->header_len == 0 || (sig->footer_len == 0 && strcmp(footer, "-") != 0) || max_size < sig->header_len) {
+			printf("Invalid signature on line %u of %s\n", line_num, path);
+			ok = false;
+			break;
+		}
+		set->count++;
+	}
+
+	fclose(fp);
+	return ok;
+}
+
+// Build the first byte buckets used by the prefilter. Must be called after the last signature is added
+void carve_set_prepare(carve_set *set) {
+	memset(set->bucket, CARVE_NO_SIG, sizeof(set->bucket));
+	set->num_first = 0;
+
+	// Insert in reverse so each bucket lists its signatures in the order they were added
+	for(int i = (int)set->count - 1; i >= 0; i--) {
+		uint8_t b = set->sigs[i].header[0];
+		if(set->bucket[b] == CARVE_NO_SIG)
+			set->first[set->num_first++] = b;
+		set->next[i] = set->bucket[b];
+		set->bucket[b] = (int8_t)i;
+	}
+}
+
+// Offset of the first occurrence of needle in hay, UINT64_MAX if none
+static uint64_t carve_find(const uint8_t *hay, uint64_t len, const uint8_t *needle, uint32_t needle_len) {
+	const uint8_t *p = hay, *end = hay + len;
+
+	while((uint64_t)(end - p) >= needle_len) {
+		p = (const uint8_t*)memchr(p, needle[0], (end - p) - needle_len + 1);
+		if(p == NULL)
+			return UINT64_MAX;
+		if(memcmp(p + 1, needle + 1, needle_len - 1) == 0)
+			return (uint64_t)(p - hay);
+		p++;
+	}
+
+	return UINT64_MAX;
+}
+
+/*
+ * Length of the file starting with sig's header at off
+ *
+ * @return True if the end of the file was found, false if it was cut at max_size or the end of the image
+ */
+static bool carve_length(const carve_sig *sig, const uint8_t *img, uint64_t img_len, uint64_t off, uint64_t *len) {
+	uint64_t avail = img_len - off;
+	uint64_t max = (sig->max_size < avail) ? sig->max_size : avail;
+
+	if(sig->sizer == CARVE_SIZE_SQLITE && avail >= 32) {
+		const uint8_t *h = img + off;
+		uint64_t page = ((uint32_t)h[16] << 8) | h[17];
+		uint64_t pages = ((uint32_t)h[28] << 24) | ((uint32_t)h[29] << 16) | ((uint32_t)h[30] << 8) | h[31];
+		if(page == 1)
+			page = 65536;
+		if(page >= 512 && (page & (page - 1)) == 0 && pages > 0 && page * pages <= max) {
+			*len = page * pages;
+			return true;
+		}
+	} else if(sig->footer_len > 0) {
+		uint64_t f = carve_find(img + off + sig->header_len, max - sig->header_len, sig->footer, sig->footer_len);
+		if(f != UINT64_MAX) {
+			uint64_t e = sig->header_len + f + sig->footer_len + sig->footer_extra;
+			*len = (e < avail) ? e : avail;
+			return true;
+		}
+	}
+
+	*len = max;
+	return false;
+}
+
+/*
+ * State of one carve_scan() call
+ */
+typedef struct carve_job_t {
+	carve_set *set;
+	const char *out_dir;
+	par_list *hits; // carve_hit lists of par_lists_new()
+} carve_job;
+
+static void carve_add_hit(par_list *hits, uint64_t offset, uint64_t length, uint32_t sig, bool complete) {
+	carve_hit *hit = (carve_hit*)par_list_add(hits, sizeof(carve_hit));
+	hit->offset = offset;
+	hit->length = length;
+	hit->sig = sig;
+	hit->complete = complete;
+}
+
+// Verify the signatures whose first byte matched at off and carve what is found
+static void carve_check(carve_job *job, const scan_chunk *chunk, uint64_t off) {
+	carve_set *set = job->set;
+	const uint8_t *img = chunk->img;
+
+	for(int s = set->bucket[img[off]]; s != CARVE_NO_SIG; s = set->next[s]) {
+		carve_sig *sig = &(set->sigs[s]);
+		if(sig->header_len > chunk->img_len - off || memcmp(img + off + 1, sig->header + 1, sig->header_len - 1) != 0)
+			continue;
+
+		uint64_t len = 0;
+		bool complete = carve_length(sig, img, chunk->img_len, off, &len);
+		carve_add_hit(&(job->hits[chunk->thread]), off, len, (uint32_t)s, complete);
+
+		if(job->out_dir != NULL) {
+			char path[4096];
+			snprintf(path, sizeof(path), "%s/%014llu.%s", job->out_dir, (unsigned long long)off, sig->ext);
+			FILE *fp = fopen(path, "wb");
+			if(fp == NULL) {
+				printf("Could not open file %s to write a carved file\n", path);
+				continue;
+			}
+			fwrite(img + off, 1, len, fp);
+			fclose(fp);
+		}
+	}
+}
+
+/*
+ * Scan one chunk for headers. Only headers starting inside the chunk are carved, though they may be verified and
+ * carved using bytes past its end
+ */
+static void carve_chunk(void *ctx, const scan_chunk *chunk) {
+	carve_job *job = (carve_job*)ctx;
+	carve_set *set = job->set;
+	const uint8_t *img = chunk->img;
+	uint64_t pos = chunk->start, end = chunk->end;
+
+#if defined(__SSE2__)
+	// Compare 16 bytes at a time against every distinct first header byte. Only matching positions are verified
+	if(set->num_first <= 16) {
+		__m128i first[16];
+		for(uint32_t k = 0; k < set->num_first; k++) {
+			first[k] = _mm_set1_epi8((char)set->first[k]);
+		}
+
+		for(; pos + 16 <= end; pos += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(img + pos));
+			__m128i m = _mm_cmpeq_epi8(v, first[0]);
+			for(uint32_t k = 1; k < set->num_first; k++) {
+				m = _mm_or_si128(m, _mm_cmpeq_epi8(v, first[k]));
+			}
+
+			uint32_t mask = (uint32_t)_mm_movemask_epi8(m);
+			while(mask != 0) {
+				carve_check(job, chunk, pos + __builtin_ctz(mask));
+				mask &= mask - 1;
+			}
+		}
+	}
+#endif
+
+	for(; pos < end; pos++) {
+		if(set->bucket[img[pos]] != CARVE_NO_SIG)
+			carve_check(job, chunk, pos);
+	}
+}
+
+static int carve_hit_cmp(const void *a, const void *b) {
+	const carve_hit *x = (const carve_hit*)a, *y = (const carve_hit*)b;
+	if(x->offset != y->offset)
+		return (x->offset < y->offset) ? -1 : 1;
+	return (x->sig > y->sig) - (x->sig < y->sig);
+}
+
+/*
+ * Search the image for every signature of the set at once, in parallel chunks, and carve each file found
+ *
+ * @param set Signatures. carve_set_prepare() is called on it
+ * @param ranges Byte ranges headers may start in (start, length in bytes). NULL to search the whole image
+ * @param num_ranges Number of ranges
+ * @param out_dir Directory the carved files are written to, created if needed. NULL to only report hits
+ * @return Hits sorted by offset. Release with carve_free()
+ */
+carve_result *carve_scan(carve_set *set, const uint8_t *img, uint64_t img_len, const extent *ranges, uint32_t num_ranges, const char *out_dir) {
+	carve_result *res = (carve_result*)malloc(sizeof(carve_result));
+	memset(res, 0, sizeof(carve_result));
+
+	if(set->count == 0)
+		return res;
+	carve_set_prepare(set);
+
+	if(out_dir != NULL && mkdir(out_dir, 0755) != 0 && errno != EEXIST) {
+		printf("Could not create output directory %s\n", out_dir);
+		return res;
+	}
+
+	carve_job job;
+	job.set = set;
+	job.out_dir = out_dir;
+	job.hits = par_lists_new();
+
+	scan_image(img, img_len, ranges, num_ranges, carve_chunk, &job);
+
+	uint64_t count = 0;
+	res->hits = (carve_hit*)par_lists_merge(job.hits, sizeof(carve_hit), &count);
+	res->count = res->cap = (uint32_t)count;
+
+	qsort(res->hits, res->count, sizeof(carve_hit), carve_hit_cmp);
+	return res;
+}
+
+void carve_free(carve_result *res) {
+	if(res->hits != NULL)
+		free(res->hits);
+
+	free(res);
+}
@@ -0,0 +1,93 @@
+/**
+   dd_reader
+   carve.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _CARVE_H_
+#define _CARVE_H_
+
+#include "extent.h"
+#include "scan.h"
+#include "shared.h"
+
+#define CARVE_MAX_SIGS 64
+#define CARVE_MAX_MAGIC 32 // Longest header or footer
+#define CARVE_NO_SIG -1
+
+/*
+ * How the length of a carved file is determined
+ */
+#define CARVE_SIZE_FOOTER 0 // Up to and including the first footer after the header (or max_size if none)
+#define CARVE_SIZE_SQLITE 1 // Page size * page count from the database header
+
+/*
+ * A file type to carve, identified by the bytes it starts with
+ */
+typedef struct carve_sig_t {
+	char name[16];
+	char ext[8]; // Extension of the carved files
+	uint8_t header[CARVE_MAX_MAGIC];
+	uint32_t header_len;
+	uint8_t footer[CARVE_MAX_MAGIC];
+	uint32_t footer_len; // 0 if the type has no footer
+	uint32_t footer_extra; // Bytes after the footer that still belong to the file
+	uint64_t max_size; // Longest file carved
+	uint8_t sizer; // See CARVE_SIZE_*
+} carve_sig;
+
+/*
+ * Signatures to search for simultaneously, bucketed by first header byte for the prefilter
+ */
+typedef struct carve_set_t {
+	carve_sig sigs[CARVE_MAX_SIGS];
+	uint32_t count;
+
+	// Built by carve_set_prepare()
+	uint8_t first[CARVE_MAX_SIGS]; // Distinct first header bytes
+	uint32_t num_first;
+	int8_t bucket[256]; // First signature for each first byte, CARVE_NO_SIG if none
+	int8_t next[CARVE_MAX_SIGS]; // Next signature with the same first byte
+} carve_set;
+
+/*
+ * A carved file
+ */
+typedef struct carve_hit_t {
+	uint64_t offset; // Absolute byte offset of the header in the image
+	uint64_t length;
+	uint32_t sig;
+	bool complete; // Footer found or size read from the header, rather than cut at max_size
+} carve_hit;
+
+typedef struct carve_result_t {
+	carve_hit *hits; // Sorted by offset
+	uint32_t count;
+	uint32_t cap;
+} carve_result;
+
+/*
+ * Carving functions
+ */
+
+carve_set *carve_set_new();
+void carve_set_free(carve_set *set);
+bool carve_set_add_builtin(carve_set *set, const char *name);
+bool carve_set_load(carve_set *set, const char *path);
+void carve_set_prepare(carve_set *set);
+carve_result *carve_scan(carve_set *set, const uint8_t *img, uint64_t img_len, const extent *ranges, uint32_t num_ranges, const char *out_dir);
+void carve_free(carve_result *res);
+
+#endif
@@ -0,0 +1,353 @@
+/**
+   dd_reader
+   cdc.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#include <math.h>
+
+#include "cdc.h"
+
+// Random 64 bit value per byte value. Filled from a fixed seed so chunk boundaries are the same on every run
+static uint64_t cdc_gear[256];
+static bool cdc_gear_ready = false;
+
+static uint64_t cdc_splitmix64(uint64_t *state) {
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+// Mask of the top bits of the gear hash, which depend on the last 64 bytes rather than just the last few
+static uint64_t cdc_mask(uint32_t bits) {
+	return ((1ULL << bits) - 1) << (64 - bits);
+}
+
+/*
+ * Set up the chunker for an average chunk size. Normalized chunking: the cut condition is one bit harder than the
+ * average calls for before avg_size and one bit easier after it, which narrows the chunk size distribution
+ *
+ * @param avg_size Power of two between CDC_AVG_MIN and CDC_AVG_MAX
+ * @return False if avg_size is not valid
+ */
+bool cdc_params_init(cdc_params *params, uint32_t avg_size) {
+	if(avg_size < CDC_AVG_MIN || avg_size > CDC_AVG_MAX || (avg_size & (avg_size - 1)) != 0)
+		return false;
+
+	if(!cdc_gear_ready) {
+		uint64_t state = 0x6464726561646572ULL;
+		for(int i = 0; i < 256; i++) {
+			cdc_gear[i] = cdc_splitmix64(&state);
+		}
+		cdc_gear_ready = true;
+	}
+
+	uint32_t bits = 0;
+	while((1U << bits) < avg_size)
+		bits++;
+
+	params->min_size = avg_size / 4;
+	params->avg_size = avg_size;
+	params->max_size = avg_size * 8;
+	params->mask_s = cdc_mask(bits + 1);
+	params->mask_l = cdc_mask(bits - 1);
+
+	// Zero runs are common in images and always chunk the same way
+	uint8_t *zeros = (uint8_t*)calloc(params->max_size, 1);
+	params->zero_len = 0;
+	params->zero_len = cdc_next_cut(params, zeros, params->max_size);
+	params->zero_fp = cdc_fingerprint(zeros, params->zero_len);
+	free(zeros);
+	return true;
+}
+
+/*
+ * Find the end of the chunk starting at p with the gear rolling hash
+ *
+ * @param len Bytes available from p
+ * @return Length of the chunk
+ */
+uint32_t cdc_next_cut(const cdc_params *params, const uint8_t *p, uint64_t len) {
+	if(len <= params->min_size)
+		return (uint32_t)len;
+
+	// A chunk that is all zero bytes up to the cut found for zeros has that same cut, found here without hashing
+	if(params->zero_len != 0 && len >= params->max_size && zeromap_all_zero(p, params->zero_len))
+		return params->zero_len;
+
+	uint32_t n = (len < params->max_size) ? (uint32_t)len : params->max_size;
+	uint32_t normal = (n < params->avg_size) ? n : params->avg_size;
+	uint32_t i = params->min_size;
+	uint64_t h = 0;
+
+	for(; i < normal; i++) {
+		h = (h << 1) + cdc_gear[p[i]];
+		if((h & params->mask_s) == 0)
+			return i + 1;
+	}
+	for(; i < n; i++) {
+		h = (h << 1) + cdc_gear[p[i]];
+		if((h & params->mask_l) == 0)
+			return i + 1;
+	}
+	return n;
+}
+
+static inline uint64_t cdc_rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t cdc_fmix(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xFF51AFD7ED558CCDULL;
+	k ^= k >> 33;
+	k *= 0xC4CEB9FE1A85EC53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+/*
+ * 64 bit fingerprint of a chunk (MurmurHash3 style mixing, 16 bytes per round). Only used to count distinct chunks,
+ * so it does not need to be cryptographic
+ */
+uint64_t cdc_fingerprint(const uint8_t *p, uint64_t len) {
+	const uint64_t c1 = 0x87C37B91114253D5ULL, c2 = 0x4CF5AD432745937FULL;
+	uint64_t h1 = len, h2 = len ^ 0x9E3779B97F4A7C15ULL;
+	uint64_t i = 0;
+
+	for(; i + 16 <= len; i += 16) {
+		uint64_t k1 = read_le64(p + i), k2 = read_le64(p + i + 8);
+		h1 ^= cdc_rotl(k1 * c1, 31) * c2;
+		h1 = (cdc_rotl(h1, 27) + h2) * 5 + 0x52DCE729;
+		h2 ^= cdc_rotl(k2 * c2, 33) * c1;
+		h2 = (cdc_rotl(h2, 31) + h1) * 5 + 0x38495AB5;
+	}
+
+	uint64_t k1 = 0, k2 = 0;
+	for(uint64_t j = len; j > i; j--) {
+		if(j - i > 8)
+			k2 = (k2 << 8) | p[j - 1];
+		else
+			k1 = (k1 << 8) | p[j - 1];
+	}
+	h1 ^= cdc_rotl(k1 * c1, 31) * c2;
+	h2 ^= cdc_rotl(k2 * c2, 33) * c1;
+
+	h1 += h2;
+	h2 += h1;
+	h1 = cdc_fmix(h1);
+	h2 = cdc_fmix(h2);
+	return h1 + h2;
+}
+
+/*
+ * Chunks found in one segment, starting from the segment start as if it were a chunk boundary
+ */
+typedef struct cdc_segment_t {
+	uint64_t *cuts; // Absolute end offset of each chunk, ascending. The last one is at or past the segment end
+	uint64_t *fps;
+	uint32_t count;
+	uint32_t cap;
+} cdc_segment;
+
+typedef struct cdc_job_t {
+	const cdc_params *params;
+	const uint8_t *img;
+	uint64_t img_len;
+	zeromap *zeros; // May be NULL
+	uint64_t first; // Segment index of segs[0]
+	cdc_segment *segs;
+} cdc_job;
+
+/*
+ * Cut and fingerprint the chunk starting at pos. Chunks inside zero runs of the zero block map are the all zero
+ * chunk and are not read at all
+ *
+ * @param zero_end End of the zero run last looked up from pos or before, updated here
+ * @return Length of the chunk
+ */
+static uint32_t cdc_chunk(cdc_job *job, uint64_t pos, uint64_t *zero_end, uint64_t *fp) {
+	const cdc_params *params = job->params;
+
+	if(job->zeros != NULL && job->img_len - pos >= params->max_size) {
+		if(pos >= *zero_end)
+			*zero_end = zeromap_zero_end(job->zeros, pos);
+		if(*zero_end - pos >= params->zero_len) {
+			*fp = params->zero_fp;
+			return params->zero_len;
+		}
+	}
+
+	uint32_t len = cdc_next_cut(params, job->img + pos, job->img_len - pos);
+	if(len == params->zero_len && zeromap_all_zero(job->img + pos, len))
+		*fp = params->zero_fp;
+	else
+		*fp = cdc_fingerprint(job->img + pos, len);
+	return len;
+}
+
+static void cdc_segment_task(void *ctx, size_t index, uint32_t thread) {
+	cdc_job *job = (cdc_job*)ctx;
+	cdc_segment *seg = &(job->segs[index]);
+	uint64_t pos = (job->first + index) * CDC_SEGMENT, zero_end = 0, fp = 0;
+	uint64_t end = pos + CDC_SEGMENT;
+	if(end > job->img_len)
+		end = job->img_len;
+
+	seg->count = 0;
+	while(pos < end) {
+		uint32_t len = cdc_chunk(job, pos, &zero_end, &fp);
+		if(seg->count == seg->cap) {
+			seg->cap = (seg->cap == 0) ? 2 * CDC_SEGMENT / job->params->avg_size : seg->cap * 2;
+			seg->cuts = (uint64_t*)realloc(seg->cuts, seg->cap * sizeof(uint64_t));
+			seg->fps = (uint64_t*)realloc(seg->fps, seg->cap * sizeof(uint64_t));
+		}
+		seg->fps[seg->count] = fp;
+		pos += len;
+		seg->cuts[seg->count++] = pos;
+	}
+}
+
+static void cdc_add_chunk(cdc_result *res, uint64_t len, uint64_t fp) {
+	uint32_t b = 0;
+	while(b + 1 < CDC_BINS && (2ULL << b) <= len)
+		b++;
+
+	cdc_bin *bin = &(res->bins[b]);
+	if(bin->hll == NULL)
+		bin->hll = (uint8_t*)calloc(CDC_HLL_REGS, 1);
+
+	// Register: top bits of the fingerprint. Rank: position of the first set bit in the rest
+	uint32_t reg = (uint32_t)(fp >> (64 - CDC_HLL_BITS));
+	uint64_t rest = (fp << CDC_HLL_BITS) | (1ULL << (CDC_HLL_BITS - 1));
+	uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+	if(rank > bin->hll[reg])
+		bin->hll[reg] = rank;
+
+	bin->chunks++;
+	bin->bytes += len;
+	res->chunks++;
+	res->bytes += len;
+}
+
+/*
+ * Find the position of segment i's cuts that the true chunk sequence, currently at pos, runs into. Chunks are cut
+ * sequentially from pos until one ends on a cut of the segment; from there on both sequences are identical
+ *
+ * @return Index of the first cut of the segment after pos to take over. seg->count if the segment was passed
+ */
+static uint32_t cdc_resync(cdc_result *res, cdc_job *job, cdc_segment *seg, uint64_t *pos) {
+	uint64_t zero_end = 0, fp = 0;
+	uint32_t j = 0;
+	while(true) {
+		while(j < seg->count && seg->cuts[j] < *pos)
+			j++;
+		if(j == seg->count)
+			return j;
+		if(seg->cuts[j] == *pos)
+			return j + 1;
+
+		uint32_t len = cdc_chunk(job, *pos, &zero_end, &fp);
+		cdc_add_chunk(res, len, fp);
+		res->resync_chunks++;
+		*pos += len;
+	}
+}
+
+/*
+ * Split an image into content defined chunks and estimate how much of it is unique at chunk granularity.
+ * Segments are chunked in parallel, each from its own start. Chunk boundaries only depend on the bytes since the
+ * previous boundary, so once the chunk sequence coming from the previous segment lands on one of a segment's
+ * boundaries the rest of that segment's chunks are already correct
+ *
+ * @param avg_size Average chunk size, see cdc_params_init()
+ * @param zeros Zero blocks of the image, so zero runs are chunked without reading them. May be NULL
+ * @return Chunk statistics, NULL if avg_size is not valid. Free with cdc_free()
+ */
+cdc_result *cdc_run(const uint8_t *img, uint64_t img_len, uint32_t avg_size, zeromap *zeros) {
+	cdc_result *res = (cdc_result*)malloc(sizeof(cdc_result));
+	memset(res, 0, sizeof(cdc_result));
+	if(!cdc_params_init(&(res->params), avg_size)) {
+		free(res);
+		return NULL;
+	}
+
+	uint64_t num_segs = (img_len + CDC_SEGMENT - 1) / CDC_SEGMENT;
+	uint32_t per_round = par_num_threads() * CDC_SEGMENTS_PER_THREAD;
+	cdc_segment *segs = (cdc_segment*)calloc(per_round, sizeof(cdc_segment));
+	uint64_t pos = 0;
+
+	cdc_job job;
+	job.params = &(res->params);
+	job.img = img;
+	job.img_len = img_len;
+	job.zeros = zeros;
+	job.segs = segs;
+	for(uint64_t first = 0; first < num_segs; first += per_round) {
+		uint32_t count = (num_segs - first < per_round) ? (uint32_t)(num_segs - first) : per_round;
+		job.first = first;
+		par_run(count, cdc_segment_task, &job);
+
+		for(uint32_t s = 0; s < count; s++) {
+			cdc_segment *seg = &(segs[s]);
+			uint32_t j = (first + s == 0) ? 0 : cdc_resync(res, &job, seg, &pos);
+			for(; j < seg->count; j++) {
+				uint64_t start = (j == 0) ? (first + s) * CDC_SEGMENT : seg->cuts[j - 1];
+				cdc_add_chunk(res, seg->cuts[j] - start, seg->fps[j]);
+				pos = seg->cuts[j];
+			}
+		}
+	}
+
+	for(uint32_t s = 0; s < per_round; s++) {
+		free(segs[s].cuts);
+		free(segs[s].fps);
+	}
+	free(segs);
+	return res;
+}
+
+/*
+ * HyperLogLog estimate of the distinct chunks of a bin, with linear counting for small counts
+ */
+double cdc_bin_unique(cdc_bin *bin) {
+	if(bin->hll == NULL)
+		return 0;
+
+	double m = CDC_HLL_REGS, sum = 0;
+	uint32_t zeros = 0;
+	for(uint32_t i = 0; i < CDC_HLL_REGS; i++) {
+		sum += ldexp(1.0, -bin->hll[i]);
+		if(bin->hll[i] == 0)
+			zeros++;
+	}
+
+	double est = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+	if(est <= 2.5 * m && zeros > 0)
+		est = m * log(m / zeros);
+	return (est < (double)bin->chunks) ? est : (double)bin->chunks;
+}
+
+void cdc_free(cdc_result *res) {
+	if(res == NULL)
+		return;
+
+	for(uint32_t b = 0; b < CDC_BINS; b++) {
+		free(res->bins[b].hll);
+	}
+	free(res);
+}
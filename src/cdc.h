@@ -0,0 +1,84 @@
+/**
+   dd_reader
+   cdc.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef _CDC_H_
+#define _CDC_H_
+
+#include "parallel.h"
+#include "shared.h"
+#include "zeromap.h"
+
+// Default average chunk size. Chunks are at least a quarter and at most 8 times the average
+#define CDC_AVG_DEFAULT 8192
+#define CDC_AVG_MIN 1024
+#define CDC_AVG_MAX (1024 * 1024)
+
+// Bytes chunked per parallel task, and segments chunked between merges (per thread), which bounds memory use
+#define CDC_SEGMENT (8 * 1024 * 1024)
+#define CDC_SEGMENTS_PER_THREAD 4
+
+// HyperLogLog: 2^CDC_HLL_BITS one byte registers per histogram bin, ~0.8% standard error
+#define CDC_HLL_BITS 14
+#define CDC_HLL_REGS (1 << CDC_HLL_BITS)
+
+// Chunk size histogram bins: bin b holds sizes in [2^b, 2^(b+1))
+#define CDC_BINS 32
+
+/*
+ * Chunker parameters, see cdc_params_init()
+ */
+typedef struct cdc_params_t {
+	uint32_t min_size;
+	uint32_t avg_size;
+	uint32_t max_size;
+	uint64_t mask_s; // Cut condition before avg_size (harder to meet)
+	uint64_t mask_l; // Cut condition after avg_size (easier to meet)
+	uint32_t zero_len; // Length of the chunk cut from a run of at least max_size zero bytes
+	uint64_t zero_fp; // Fingerprint of that chunk
+} cdc_params;
+
+/*
+ * Chunks of one size class and an estimate of how many of them are distinct
+ */
+typedef struct cdc_bin_t {
+	uint64_t chunks;
+	uint64_t bytes;
+	uint8_t *hll; // CDC_HLL_REGS registers. NULL until the first chunk
+} cdc_bin;
+
+typedef struct cdc_result_t {
+	cdc_params params;
+	uint64_t chunks;
+	uint64_t bytes;
+	uint64_t resync_chunks; // Chunks recomputed at segment boundaries before the segments agreed
+	cdc_bin bins[CDC_BINS];
+} cdc_result;
+
+/*
+ * Content defined chunking functions
+ */
+
+bool cdc_params_init(cdc_params *params, uint32_t avg_size);
+uint32_t cdc_next_cut(const cdc_params *params, const uint8_t *p, uint64_t len);
+uint64_t cdc_fingerprint(const uint8_t *p, uint64_t len);
+cdc_result *cdc_run(const uint8_t *img, uint64_t img_len, uint32_t avg_size, zeromap *zeros);
+double cdc_bin_unique(cdc_bin *bin);
+void cdc_free(cdc_result *res);
+
+#endif
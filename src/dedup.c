@@ -0,0 +1,257 @@
+/**
+   dd_reader
+   dedup.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#include "dedup.h"
+
+static filehash_list *dedup_sort_list;
+
+// Largest size first, then by file order
+static int dedup_size_cmp(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	uint64_t sx = dedup_sort_list->files[x].size, sy = dedup_sort_list->files[y].size;
+	if(sx != sy)
+		return (sx > sy) ? -1 : 1;
+	return (x < y) ? -1 : 1;
+}
+
+// Largest size first, then by digest, then by file order
+static int dedup_file_cmp(const void *a, const void *b) {
+	const dedup_file *x = (const dedup_file*)a, *y = (const dedup_file*)b;
+	uint64_t sx = dedup_sort_list->files[x->file].size, sy = dedup_sort_list->files[y->file].size;
+	if(sx != sy)
+		return (sx > sy) ? -1 : 1;
+	int c = memcmp(x->sha1, y->sha1, sizeof(x->sha1));
+	if(c != 0)
+		return c;
+	return (x->file < y->file) ? -1 : 1;
+}
+
+// On disk order of the first byte, see filehash_location(). Files with nothing to read ahead first
+static int dedup_loc_cmp(const void *a, const void *b) {
+	const dedup_file *x = (const dedup_file*)a, *y = (const dedup_file*)b;
+	if(x->loc != y->loc)
+		return ((uintptr_t)x->loc < (uintptr_t)y->loc) ? -1 : 1;
+	return (x->file < y->file) ? -1 : 1;
+}
+
+static bool dedup_same(filehash_list *list, dedup_file *a, dedup_file *b) {
+	return list->files[a->file].size == list->files[b->file].size && memcmp(a->sha1, b->sha1, sizeof(a->sha1)) == 0;
+}
+
+/*
+ * Sort files by size and digest and keep only those that match at least one other file
+ *
+ * @return New number of files
+ */
+static uint32_t dedup_keep_matches(filehash_list *list, dedup_file *files, uint32_t count) {
+	dedup_sort_list = list;
+	qsort(files, count, sizeof(dedup_file), dedup_file_cmp);
+
+	uint32_t kept = 0;
+	for(uint32_t i = 0; i < count; ) {
+		uint32_t j = i + 1;
+		while(j < count && dedup_same(list, &files[i], &files[j]))
+			j++;
+		if(j - i > 1) {
+			memmove(files + kept, files + i, (j - i) * sizeof(dedup_file));
+			kept += j - i;
+		}
+		i = j;
+	}
+	return kept;
+}
+
+typedef struct dedup_job_t {
+	filehash_list *list;
+	dedup_file *files;
+	uint32_t count;
+	uint64_t *bytes_read; // Per thread
+} dedup_job;
+
+/*
+ * Hash the first and last DEDUP_EDGE bytes of a run of candidates. Files of up to twice that size are read whole
+ */
+static void dedup_partial_task(void *ctx, size_t index, uint32_t thread) {
+	dedup_job *job = (dedup_job*)ctx;
+	uint32_t end = (uint32_t)((index + 1) * DEDUP_CHUNK);
+	if(end > job->count)
+		end = job->count;
+
+	// The candidates of a chunk are neighbours on disk, read their edges ahead in coalesced spans
+	filehash_span span;
+	memset(&span, 0, sizeof(filehash_span));
+	for(uint32_t i = (uint32_t)(index * DEDUP_CHUNK); i < end; i++) {
+		filehash_entry *file = &(job->list->files[job->files[i].file]);
+		filehash_span_add(&span, file, 0, DEDUP_EDGE);
+		if(file->size > DEDUP_EDGE)
+			filehash_span_add(&span, file, (file->size - DEDUP_EDGE > DEDUP_EDGE) ? file->size - DEDUP_EDGE : DEDUP_EDGE, DEDUP_EDGE);
+	}
+	filehash_span_flush(&span);
+
+	digest_ctx dctx;
+	digest_result res;
+	for(uint32_t i = (uint32_t)(index * DEDUP_CHUNK); i < end; i++) {
+		dedup_file *f = &(job->files[i]);
+		filehash_entry *file = &(job->list->files[f->file]);
+		uint64_t head = (file->size < DEDUP_EDGE) ? file->size : DEDUP_EDGE;
+		uint64_t tail = (file->size - head > DEDUP_EDGE) ? file->size - DEDUP_EDGE : head;
+
+		digest_init(&dctx, DIGEST_SHA1);
+		f->complete = filehash_feed(file, 0, head, &dctx);
+		f->complete = filehash_feed(file, tail, file->size - tail, &dctx) && f->complete;
+		digest_final(&dctx, &res);
+		memcpy(f->sha1, res.sha1, sizeof(f->sha1));
+		f->full = (tail == head);
+		job->bytes_read[thread] += head + (file->size - tail);
+	}
+}
+
+/*
+ * Find groups of files with identical contents. Files are first grouped by their size from the directory entries or
+ * MFT, then same-size candidates are compared by a hash of their first and last DEDUP_EDGE bytes, and only files
+ * that still match are hashed in full. Most files are ruled out without reading any of their contents
+ *
+ * @param list Files of the image. Digests in the list are not used
+ * @return Duplicate groups. Free with dedup_free()
+ */
+dedup_result *dedup_find(filehash_list *list) {
+	dedup_result *res = (dedup_result*)malloc(sizeof(dedup_result));
+	memset(res, 0, sizeof(dedup_result));
+
+	// Same-size candidates. Empty files are all equal and left out
+	uint32_t *order = (uint32_t*)malloc((list->count + 1) * sizeof(uint32_t));
+	for(uint32_t i = 0; i < list->count; i++) {
+		order[i] = i;
+	}
+	dedup_sort_list = list;
+	qsort(order, list->count, sizeof(uint32_t), dedup_size_cmp);
+
+	dedup_file *files = (dedup_file*)malloc((list->count + 1) * sizeof(dedup_file));
+	uint32_t count = 0;
+	for(uint32_t i = 0; i < list->count; ) {
+		uint32_t j = i + 1;
+		while(j < list->count && list->files[order[j]].size == list->files[order[i]].size)
+			j++;
+		if(j - i > 1 && list->files[order[i]].size > 0) {
+			for(uint32_t k = i; k < j; k++) {
+				memset(&files[count], 0, sizeof(dedup_file));
+				files[count].file = order[k];
+				files[count++].loc = filehash_location(&(list->files[order[k]]));
+			}
+		}
+		i = j;
+	}
+	free(order);
+	res->candidates = count;
+
+	// First and last bytes, read in on disk order
+	qsort(files, count, sizeof(dedup_file), dedup_loc_cmp);
+	uint32_t num_threads = par_num_threads();
+	dedup_job job;
+	job.list = list;
+	job.files = files;
+	job.count = count;
+	job.bytes_read = (uint64_t*)calloc(num_threads, sizeof(uint64_t));
+	par_run((count + DEDUP_CHUNK - 1) / DEDUP_CHUNK, dedup_partial_task, &job);
+	for(uint32_t t = 0; t < num_threads; t++) {
+		res->bytes_read += job.bytes_read[t];
+	}
+	free(job.bytes_read);
+
+	uint32_t kept = 0;
+	for(uint32_t i = 0; i < count; i++) {
+		if(files[i].complete)
+			files[kept++] = files[i];
+	}
+	count = dedup_keep_matches(list, files, kept);
+	res->partial_matches = count;
+
+	// Whole contents of the files that are still matched, largest first across the thread pool
+	filehash_list *full = filehash_new();
+	for(uint32_t i = 0; i < count; i++) {
+		if(files[i].full)
+			continue;
+		filehash_add_entry(full, &(list->files[files[i].file]));
+	}
+	filehash_run(full, DIGEST_SHA1);
+	res->full_hashed = full->count;
+	res->bytes_read += full->total_bytes;
+
+	kept = 0;
+	for(uint32_t i = 0, f = 0; i < count; i++) {
+		if(!files[i].full) {
+			files[i].complete = full->files[f].complete;
+			memcpy(files[i].sha1, full->files[f].digest.sha1, sizeof(files[i].sha1));
+			files[i].full = true;
+			f++;
+		}
+		if(files[i].complete)
+			files[kept++] = files[i];
+	}
+	filehash_free(full);
+	count = dedup_keep_matches(list, files, kept);
+
+	// Number the groups
+	for(uint32_t i = 0; i < count; i++) {
+		if(i == 0 || !dedup_same(list, &files[i - 1], &files[i])) {
+			res->num_groups++;
+		} else {
+			res->wasted_bytes += list->files[files[i].file].size;
+		}
+		files[i].group = res->num_groups;
+	}
+
+	res->files = files;
+	res->count = count;
+	return res;
+}
+
+/*
+ * Write the duplicate groups as CSV: group, size, SHA1, partition, path
+ *
+ * @return False if the file could not be created
+ */
+bool dedup_write(filehash_list *list, dedup_result *res, const char *path) {
+	FILE *fp = fopen(path, "w");
+	if(fp == NULL)
+		return false;
+
+	fprintf(fp, "Group,Size,SHA1,Partition,Path\n");
+	for(uint32_t i = 0; i < res->count; i++) {
+		dedup_file *f = &(res->files[i]);
+		filehash_entry *file = &(list->files[f->file]);
+
+		fprintf(fp, "%u,%llu,", f->group, (unsigned long long)file->size);
+		digest_fprint_hex(fp, f->sha1, sizeof(f->sha1));
+		fprintf(fp, ",%u,", file->partition);
+		fprint_csv_str(fp, file->path);
+		fprintf(fp, "\n");
+	}
+
+	fclose(fp);
+	return true;
+}
+
+void dedup_free(dedup_result *res) {
+	if(res == NULL)
+		return;
+
+	free(res->files);
+	free(res);
+}
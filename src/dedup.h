@@ -0,0 +1,65 @@
+/**
+   dd_reader
+   dedup.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include "digest.h"
+#include "filehash.h"
+#include "parallel.h"
+#include "shared.h"
+
+// Bytes hashed from the start and from the end of a same-size candidate before deciding whether to read all of it
+#define DEDUP_EDGE (64 * 1024)
+// Candidates partially hashed per parallel task
+#define DEDUP_CHUNK 256
+
+/*
+ * A file that shares its size with at least one other file
+ */
+typedef struct dedup_file_t {
+	uint32_t file; // Index in the filehash_list
+	uint32_t group; // Duplicate group, numbered from 1. 0 if the file turned out to be unique
+	bool complete;
+	bool full; // sha1 covers the whole file, not just its first and last DEDUP_EDGE bytes
+	uint8_t sha1[20];
+	const uint8_t *loc; // Where the contents start in the image, see filehash_location()
+} dedup_file;
+
+typedef struct dedup_result_t {
+	dedup_file *files; // Members of duplicate groups, ordered by group
+	uint32_t count;
+	uint32_t num_groups;
+
+	uint32_t candidates; // Files sharing their size with another file
+	uint32_t partial_matches; // Candidates whose first and last bytes matched another candidate
+	uint32_t full_hashed; // Files read in full after the partial pass
+	uint64_t bytes_read;
+	uint64_t wasted_bytes; // Bytes taken by all but one copy of each group
+} dedup_result;
+
+/*
+ * Duplicate file functions
+ */
+
+dedup_result *dedup_find(filehash_list *list);
+bool dedup_write(filehash_list *list, dedup_result *res, const char *path);
+void dedup_free(dedup_result *res);
+
+#endif
@@ -0,0 +1,176 @@
+/**
+   dd_reader
+   diff.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "diff.h"
+
+/*
+ * Check if two buffers are equal, 64 bytes at a time
+ */
+bool diff_block_equal(const uint8_t *a, const uint8_t *b, size_t len) {
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	for(; i + 64 <= len; i += 64) {
+		__m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+		__m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i + 16)), _mm_loadu_si128((const __m128i*)(b + i + 16)));
+		__m128i x2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i + 32)), _mm_loadu_si128((const __m128i*)(b + i + 32)));
+		__m128i x3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i + 48)), _mm_loadu_si128((const __m128i*)(b + i + 48)));
+		__m128i v = _mm_or_si128(_mm_or_si128(x0, x1), _mm_or_si128(x2, x3));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xFFFF)
+			return false;
+	}
+#endif
+
+	return memcmp(a + i, b + i, len - i) == 0;
+}
+
+// Offset of the first byte that differs. The buffers must differ somewhere
+static size_t diff_first(const uint8_t *a, const uint8_t *b, size_t len) {
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	for(; i + 16 <= len; i += 16) {
+		int eq = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))));
+		if(eq != 0xFFFF)
+			return i + __builtin_ctz(~eq & 0xFFFF);
+	}
+#endif
+
+	while(i < len && a[i] == b[i])
+		i++;
+	return i;
+}
+
+// Offset of the last byte that differs. The buffers must differ somewhere
+static size_t diff_last(const uint8_t *a, const uint8_t *b, size_t len) {
+	size_t i = len;
+
+#if defined(__SSE2__)
+	for(; i >= 16; i -= 16) {
+		int eq = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i - 16)), _mm_loadu_si128((const __m128i*)(b + i - 16))));
+		if(eq != 0xFFFF)
+			return i - 16 + (31 - __builtin_clz(~eq & 0xFFFF));
+	}
+#endif
+
+	while(i > 0 && a[i - 1] == b[i - 1])
+		i--;
+	return i - 1;
+}
+
+/*
+ * Append a changed range, merging it into the previous one if no unchanged block lies between them
+ */
+static void diff_add_range(extent_list *list, uint64_t start, uint64_t end) {
+	if(list->count > 0) {
+		extent *prev = &(list->ext[list->count - 1]);
+		uint64_t prev_end = prev->start + prev->length;
+		if(start / DIFF_BLOCK <= (prev_end - 1) / DIFF_BLOCK + 1) {
+			if(end > prev_end)
+				prev->length = end - prev->start;
+			return;
+		}
+	}
+	extent_list_append(list, start, end - start, false);
+}
+
+typedef struct diff_job_t {
+	const uint8_t *a;
+	const uint8_t *b;
+	uint64_t len; // Length both images have
+	extent_list *ranges; // Per task
+	uint64_t *blocks; // Changed blocks per task
+} diff_job;
+
+static void diff_task(void *ctx, size_t index, uint32_t thread) {
+	diff_job *job = (diff_job*)ctx;
+	uint64_t start = index * (uint64_t)DIFF_TASK;
+	uint64_t end = (start + DIFF_TASK < job->len) ? start + DIFF_TASK : job->len;
+
+	for(uint64_t pos = start; pos < end; pos += DIFF_BLOCK) {
+		size_t n = (end - pos < DIFF_BLOCK) ? (size_t)(end - pos) : DIFF_BLOCK;
+		if(diff_block_equal(job->a + pos, job->b + pos, n))
+			continue;
+
+		job->blocks[index]++;
+		diff_add_range(&(job->ranges[index]), pos + diff_first(job->a + pos, job->b + pos, n), pos + diff_last(job->a + pos, job->b + pos, n) + 1);
+	}
+}
+
+/*
+ * Compare two images block by block across the worker threads
+ *
+ * @param a First image
+ * @param b Second image. If the lengths differ, the bytes past the shorter image count as changed
+ * @return Changed ranges of the images. Free with diff_free()
+ */
+diff_result *diff_images(const uint8_t *a, uint64_t len_a, const uint8_t *b, uint64_t len_b) {
+	diff_result *res = (diff_result*)malloc(sizeof(diff_result));
+	memset(res, 0, sizeof(diff_result));
+	extent_list_init(&(res->ranges));
+	res->len_a = len_a;
+	res->len_b = len_b;
+
+	uint64_t len = (len_a < len_b) ? len_a : len_b;
+	size_t num_tasks = (size_t)((len + DIFF_TASK - 1) / DIFF_TASK);
+
+	diff_job job;
+	job.a = a;
+	job.b = b;
+	job.len = len;
+	job.ranges = (extent_list*)malloc((num_tasks + 1) * sizeof(extent_list));
+	job.blocks = (uint64_t*)calloc(num_tasks + 1, sizeof(uint64_t));
+	for(size_t t = 0; t < num_tasks; t++) {
+		extent_list_init(&(job.ranges[t]));
+	}
+	par_run(num_tasks, diff_task, &job);
+
+	for(size_t t = 0; t < num_tasks; t++) {
+		for(uint32_t i = 0; i < job.ranges[t].count; i++) {
+			diff_add_range(&(res->ranges), job.ranges[t].ext[i].start, job.ranges[t].ext[i].start + job.ranges[t].ext[i].length);
+		}
+		res->changed_blocks += job.blocks[t];
+		extent_list_free(&(job.ranges[t]));
+	}
+	free(job.ranges);
+	free(job.blocks);
+
+	uint64_t longest = (len_a > len_b) ? len_a : len_b;
+	if(longest > len) {
+		diff_add_range(&(res->ranges), len, longest);
+		res->changed_blocks += (longest - len + DIFF_BLOCK - 1) / DIFF_BLOCK;
+	}
+
+	for(uint32_t i = 0; i < res->ranges.count; i++) {
+		res->changed_bytes += res->ranges.ext[i].length;
+	}
+	return res;
+}
+
+void diff_free(diff_result *res) {
+	if(res == NULL)
+		return;
+
+	extent_list_free(&(res->ranges));
+	free(res);
+}
@@ -0,0 +1,49 @@
+/**
+   dd_reader
+   diff.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef _DIFF_H_
+#define _DIFF_H_
+
+#include "extent.h"
+#include "parallel.h"
+#include "shared.h"
+
+#define DIFF_BLOCK 4096 // Bytes compared at a time. Changed ranges separated by an unchanged block are kept apart
+#define DIFF_TASK (16 * 1024 * 1024) // Bytes compared per parallel task, a multiple of DIFF_BLOCK
+
+/*
+ * Changed byte ranges between two images
+ */
+typedef struct diff_result_t {
+	extent_list ranges; // start, length in bytes. Sorted and coalesced
+	uint64_t changed_bytes; // Total length of the ranges
+	uint64_t changed_blocks;
+	uint64_t len_a;
+	uint64_t len_b;
+} diff_result;
+
+/*
+ * Image comparison functions
+ */
+
+bool diff_block_equal(const uint8_t *a, const uint8_t *b, size_t len);
+diff_result *diff_images(const uint8_t *a, uint64_t len_a, const uint8_t *b, uint64_t len_b);
+void diff_free(diff_result *res);
+
+#endif
@@ -0,0 +1,89 @@
+/**
+   dd_reader
+   digest.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#include "digest.h"
+
+/*
+ * Start computing the selected digests
+ *
+ * @param which DIGEST_* flags
+ */
+void digest_init(digest_ctx *ctx, uint8_t which) {
+	ctx->which = which;
+	if(which & DIGEST_MD5)
+		MD5_Init(&(ctx->md5));
+	if(which & DIGEST_SHA1)
+		SHA1Reset(&(ctx->sha1));
+	if(which & DIGEST_SHA256)
+		sha256_init(&(ctx->sha256));
+}
+
+/*
+ * Hash len more bytes with every selected digest. The data is walked once: each piece is run through all of the
+ * hashes while it is still in cache rather than streaming the whole buffer from memory once per hash
+ */
+void digest_update(digest_ctx *ctx, const uint8_t *data, size_t len) {
+	while(len > 0) {
+		size_t n = (len < DIGEST_PIECE) ? len : DIGEST_PIECE;
+		if(ctx->which & DIGEST_MD5)
+			MD5_Update(&(ctx->md5), (void*)data, n);
+		if(ctx->which & DIGEST_SHA1)
+			SHA1Input(&(ctx->sha1), data, (unsigned)n);
+		if(ctx->which & DIGEST_SHA256)
+			sha256_update(&(ctx->sha256), data, n);
+		data += n;
+		len -= n;
+	}
+}
+
+/*
+ * Finish the digests. Digests that were not selected are left zeroed in out
+ */
+void digest_final(digest_ctx *ctx, digest_result *out) {
+	memset(out, 0, sizeof(digest_result));
+	out->which = ctx->which;
+
+	if(ctx->which & DIGEST_MD5)
+		MD5_Final(out->md5, &(ctx->md5));
+	if(ctx->which & DIGEST_SHA1) {
+		if(SHA1Result(&(ctx->sha1)) == 1) {
+			for(int i = 0; i < 5; i++) {
+				out->sha1[i * 4] = (uint8_t)(ctx->sha1.Message_Digest[i] >> 24);
+				out->sha1[i * 4 + 1] = (uint8_t)(ctx->sha1.Message_Digest[i] >> 16);
+				out->sha1[i * 4 + 2] = (uint8_t)(ctx->sha1.Message_Digest[i] >> 8);
+				out->sha1[i * 4 + 3] = (uint8_t)ctx->sha1.Message_Digest[i];
+			}
+		} else {
+			out->which &= ~DIGEST_SHA1;
+		}
+	}
+	if(ctx->which & DIGEST_SHA256)
+		sha256_final(&(ctx->sha256), out->sha256);
+}
+
+// digest_update() in the form of a zeromap_feed() callback. ctx is a digest_ctx
+void digest_feed(void *ctx, const uint8_t *data, size_t len) {
+	digest_update((digest_ctx*)ctx, data, len);
+}
+
+void digest_fprint_hex(FILE *fp, const uint8_t *digest, size_t len) {
+	for(size_t i = 0; i < len; i++) {
+		fprintf(fp, "%02x", digest[i]);
+	}
+}
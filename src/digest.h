@@ -0,0 +1,66 @@
+/**
+   dd_reader
+   digest.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef _DIGEST_H_
+#define _DIGEST_H_
+
+#include "md5.h"
+#include "sha1.h"
+#include "sha256.h"
+#include "shared.h"
+
+/*
+ * Digests computed by a digest_ctx. Combine with |
+ */
+#define DIGEST_MD5 0x01
+#define DIGEST_SHA1 0x02
+#define DIGEST_SHA256 0x04
+#define DIGEST_ALL (DIGEST_MD5 | DIGEST_SHA1 | DIGEST_SHA256)
+
+// Bytes handed to each hash in turn. Small enough that the piece is still in L1/L2 when the next hash reads it
+#define DIGEST_PIECE (16 * 1024)
+
+/*
+ * Several digests of the same data computed in a single pass over it
+ */
+typedef struct digest_ctx_t {
+	uint8_t which; // DIGEST_*
+	MD5_CTX md5;
+	SHA1Context sha1;
+	sha256_ctx sha256;
+} digest_ctx;
+
+typedef struct digest_result_t {
+	uint8_t which; // Digests that were computed
+	uint8_t md5[16];
+	uint8_t sha1[20];
+	uint8_t sha256[SHA256_DIGEST_LEN];
+} digest_result;
+
+/*
+ * Multi-digest functions
+ */
+
+void digest_init(digest_ctx *ctx, uint8_t which);
+void digest_update(digest_ctx *ctx, const uint8_t *data, size_t len);
+void digest_final(digest_ctx *ctx, digest_result *out);
+void digest_feed(void *ctx, const uint8_t *data, size_t len);
+void digest_fprint_hex(FILE *fp, const uint8_t *digest, size_t len);
+
+#endif
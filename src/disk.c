@@ -18,14 +18,60 @@
 
 #include "disk.h"
 
+static void disk_map_image(disk_img *disk);
+static void disk_read_mbr(disk_img *disk);
+static void disk_read_volumes(disk_img *disk);
+static void disk_read_tables(disk_img *disk);
+static void disk_read_directories(disk_img *disk);
+static void disk_find_zero_blocks(disk_img *disk);
+static void disk_compute_checksums(disk_img *disk);
+
 /*
- * Initialize structures for analyzing a disk image.
- * Opens the specified image at path as read only and reads the data into the disk file buffer
+ * A step of the analysis and the steps it depends on
+ */
+typedef struct disk_stage_t {
+	uint32_t stage; // DISK_STAGE_*
+	uint32_t deps;
+	void (*run)(disk_img *disk);
+} disk_stage;
+
+// In dependency order: every stage comes after the stages it depends on
+static const disk_stage disk_stages[] = {
+	{ DISK_STAGE_IMAGE, 0, disk_map_image },
+	{ DISK_STAGE_MBR, DISK_STAGE_IMAGE, disk_read_mbr },
+	{ DISK_STAGE_VOLUMES, DISK_STAGE_MBR, disk_read_volumes },
+	{ DISK_STAGE_TABLES, DISK_STAGE_VOLUMES, disk_read_tables },
+	{ DISK_STAGE_DIRECTORIES, DISK_STAGE_TABLES, disk_read_directories },
+	{ DISK_STAGE_ZEROMAP, DISK_STAGE_IMAGE, disk_find_zero_blocks },
+	{ DISK_STAGE_CHECKSUMS, DISK_STAGE_ZEROMAP, disk_compute_checksums }
+};
+#define DISK_NUM_STAGES (sizeof(disk_stages) / sizeof(disk_stages[0]))
+
+/*
+ * Run the stages the caller needs, and the stages they depend on, that have not run yet. Every output calls this
+ * for what it reads, so a run only does the work its outputs depend on and each stage runs at most once
  *
- * @param path Path to the disk image
- * @return disk_img structure that represents the state of the opened disk image. NULL if unsuccessful
+ * @param stages DISK_STAGE_* flags
  */
-disk_img *disk_init(const char *path) {
+void disk_require(disk_img *disk, uint32_t stages) {
+	// Walking backwards over the ordered table picks up dependencies of dependencies
+	for(size_t i = DISK_NUM_STAGES; i-- > 0;) {
+		if(stages & disk_stages[i].stage)
+			stages |= disk_stages[i].deps;
+	}
+
+	for(size_t i = 0; i < DISK_NUM_STAGES; i++) {
+		const disk_stage *st = &(disk_stages[i]);
+		if(!(stages & st->stage) || (disk->stages & st->stage))
+			continue;
+
+		disk->stages |= st->stage;
+		st->run(disk);
+	}
+}
+
+// Disk state for the image at path, with nothing loaded yet
+static disk_img *disk_new(const char *path) {
 	disk_img *disk = (disk_img*)malloc(sizeof(disk_img));
 	memset(disk, 0, sizeof(disk_img));
 
@@ -36,12 +82,215 @@ disk_img *disk_init(const char *path) {
 	char *lastSlash = strrchr(disk->file_path, '/');
 	disk->image_name = lastSlash ? new_string(lastSlash+1) : new_string(disk->file_path);
 
-	// Wrap a byte buffer around the disk image buffer
-	disk->buffer = bb_new_from_file(disk->file_path, "rb");
+	return disk;
+}
+
+/*
+ * Type of the volume read for MBR partition entry i
+ *
+ * @return The partition type, PT_EMPTY if no volume was read (unsupported type, or outside of the image)
+ */
+static uint8_t disk_volume_type(disk_img *disk, int i) {
+	return (disk->partition[i] != NULL) ? disk->master_boot_record->pentry[i].type : PT_EMPTY;
+}
+
+/*
+ * Initialize structures for analyzing a disk image.
+ * Maps the specified image at path read only. Nothing is read or parsed until an output needs it, see disk_require()
+ *
+ * @param path Path to the disk image
+ * @return disk_img structure that represents the state of the opened disk image. NULL if unsuccessful
+ */
+disk_img *disk_init(const char *path) {
+	disk_img *disk = disk_new(path);
+
+	disk_require(disk, DISK_STAGE_IMAGE);
+	if(disk->buffer == NULL) {
+		disk_destroy(disk);
+		return NULL;
+	}
+
+	return disk;
+}
+
+// Stage: map the image. Pages are only read from the file when they are first touched
+static void disk_map_image(disk_img *disk) {
+	disk->buffer = bb_new_map(disk->file_path);
+}
+
+/*
+ * Open a disk from its metadata index instead of the image. The partition table, volume layouts and file tables come
+ * from the mapped index and the image is only read for checksums the index does not hold, so only the summary,
+ * disk_list() and disk_lookup() may be used
+ *
+ * @param path Path of the image the index describes
+ * @param index_path Index written by disk_write_index()
+ * @return The disk, or NULL if the index is missing, damaged or older than the image
+ */
+disk_img *disk_open_index(const char *path, const char *index_path) {
+	metaidx *idx = metaidx_open(index_path, path);
+	if(idx == NULL)
+		return NULL;
+
+	mbr *m = mbr_new();
+	byte_buffer *bb = bb_new_wrap(idx->image.mbr, sizeof(idx->image.mbr));
+	mbr_read(bb, m);
+	bb_free(bb);
+
+	// Every FAT and NTFS partition of the MBR must have been indexed, unless it lay outside of the image
+	for(int i = 0; i < 4; i++) {
+		uint8_t part_type = m->pentry[i].type;
+		bool supported = (part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32 || part_type == PT_NTFS);
+		if(supported && idx->parts[i].type != part_type && idx->parts[i].type != PT_EMPTY) {
+			mbr_free(m);
+			metaidx_close(idx);
+			return NULL;
+		}
+	}
+
+	disk_img *disk = disk_new(path);
+	disk->index = idx;
+	disk->master_boot_record = m;
+	disk->stages = DISK_STAGE_MBR | DISK_STAGE_VOLUMES;
+
+	// Checksums and zero block counts are only in the index if the run that wrote it computed them. If not they are
+	// computed from the image when needed. The zero block counts come without the block map, which is built from the
+	// image if a scan needs it
+	if(idx->image.digest.which != 0) {
+		disk->image_digest = idx->image.digest;
+
+		zeromap *zm = (zeromap*)malloc(sizeof(zeromap));
+		memset(zm, 0, sizeof(zeromap));
+		zm->block_size = idx->image.zero_block_size;
+		zm->img_len = idx->image.img_len;
+		zm->num_blocks = idx->image.num_blocks;
+		zm->zero_blocks = idx->image.zero_blocks;
+		zm->hole_bytes = idx->image.hole_bytes;
+		disk->zero_map = zm;
+		disk->stages |= DISK_STAGE_CHECKSUMS;
+	}
+
+	// Volumes are read back from the boot sectors kept in the index
+	for(int i = 0; i < 4; i++) {
+		metaidx_part *p = &(idx->parts[i]);
+		uint8_t part_type = m->pentry[i].type;
+		if(p->type == PT_EMPTY)
+			continue; // Outside of the image when the index was written
+
+		bb = bb_new_wrap((uint8_t*)(idx->pool + p->boot_off), p->boot_len);
+
+		if(part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32) {
+			disk->partition[i] = fat_new_partition();
+			fat_read_boot_region(bb, (fat_partition*)(disk->partition[i]));
+		} else if(part_type == PT_NTFS) {
+			ntfs_partition *part = ntfs_new_partition();
+			ntfs_read_partition(bb, part);
+			part->summary = p->ntfs;
+			part->has_summary = true;
+			disk->partition[i] = part;
+		} else {
+			fprintf(stderr, "disk_open_index: Could not read partition of type %i\n", part_type);
+		}
+
+		bb_free(bb);
+	}
 
 	return disk;
 }
 
+/*
+ * Write the partition table, volume layouts, file tables and checksums (if computed) of the disk to a metadata index, so later runs
+ * can open the disk with disk_open_index() without reading the image. Reads every directory tree and MFT
+ *
+ * @return False if the index could not be written
+ */
+bool disk_write_index(disk_img *disk, const char *index_path) {
+	disk_require(disk, DISK_STAGE_DIRECTORIES);
+	metaidx_builder *b = metaidx_builder_new();
+
+	// Checksums and zero block counts are kept if this run computed them, they are not computed just for the index
+	metaidx_image *img = &(b->image);
+	img->img_len = disk->buffer->len;
+	if(disk->stages & DISK_STAGE_CHECKSUMS) {
+		zeromap *zm = disk->zero_map;
+		img->digest = disk->image_digest;
+		img->zero_block_size = zm->block_size;
+		img->zero_blocks = zm->zero_blocks;
+		img->num_blocks = zm->num_blocks;
+		img->hole_bytes = zm->hole_bytes;
+	}
+	memcpy(img->mbr, disk->buffer->buf, (disk->buffer->len < sizeof(img->mbr)) ? disk->buffer->len : sizeof(img->mbr));
+
+	uint8_t part_type = 0;
+	for(int i = 0; i < 4; i++) {
+		part_type = disk_volume_type(disk, i);
+
+		if(part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32)
+			metaidx_builder_add_fat(b, i, (fat_partition*)(disk->partition[i]));
+		else if(part_type == PT_NTFS)
+			metaidx_builder_add_ntfs(b, i, (ntfs_partition*)(disk->partition[i]));
+	}
+
+	bool ok = metaidx_write(b, index_path, disk->file_path);
+	metaidx_builder_free(b);
+	return ok;
+}
+
+/*
+ * Bring the metadata index up to date with this run. A missing or stale index is written in full, and checksums this
+ * run computed are added to an index that lacks them. A current index is otherwise left alone, so runs that do not
+ * need the directory trees never pay for reading them
+ *
+ * @return DISK_INDEX_*
+ */
+int disk_save_index(disk_img *disk, const char *index_path) {
+	metaidx *idx = disk->index;
+	if(idx == NULL)
+		idx = metaidx_open(index_path, disk->file_path);
+	if(idx == NULL)
+		return disk_write_index(disk, index_path) ? DISK_INDEX_WRITTEN : DISK_INDEX_FAILED;
+
+	int ret = DISK_INDEX_CURRENT;
+	if(idx->image.digest.which == 0 && (disk->stages & DISK_STAGE_CHECKSUMS)) {
+		metaidx_image img;
+		memset(&img, 0, sizeof(metaidx_image));
+		img.digest = disk->image_digest;
+		img.zero_block_size = disk->zero_map->block_size;
+		img.zero_blocks = disk->zero_map->zero_blocks;
+		img.num_blocks = disk->zero_map->num_blocks;
+		img.hole_bytes = disk->zero_map->hole_bytes;
+		ret = metaidx_write_checksums(index_path, &img) ? DISK_INDEX_CHECKSUMS : DISK_INDEX_FAILED;
+	}
+
+	if(idx != disk->index)
+		metaidx_close(idx);
+	return ret;
+}
+
+// Stage: MD5 and SHA1 of the whole image, computed together in one pass
+static void disk_compute_checksums(disk_img *disk) {
+	digest_ctx ctx;
+	digest_init(&ctx, DIGEST_MD5 | DIGEST_SHA1);
+	zeromap_feed(disk->zero_map, disk->buffer->buf, digest_feed, &ctx);
+	digest_final(&ctx, &(disk->image_digest));
+}
+
+static digest_result *disk_image_digest(disk_img *disk) {
+	disk_require(disk, DISK_STAGE_CHECKSUMS);
+	return &(disk->image_digest);
+}
+
+// Write a digest to a file as plain hex text
+static bool disk_write_hex_file(const char *path, const uint8_t *digest, size_t len) {
+	FILE *fp = fopen(path, "w+");
+	if(fp == NULL)
+		return false;
+
+	digest_fprint_hex(fp, digest, len);
+	fclose(fp);
+	return true;
+}
+
 /*
  * Generate a SHA1 hash of the contents of the open disk image and output the hash to a file
  *
@@ -49,37 +298,26 @@ disk_img *disk_init(const char *path) {
  * @param out_path File Path to output the SHA1 hash as plain text. If NULL, do not output to a file
  */
 void disk_output_sha1(disk_img *disk, const char *out_path) {
-	SHA1Context ctx;
-	SHA1Reset(&ctx);
-	SHA1Input(&ctx, disk->buffer->buf, disk->buffer->len);
-	if(SHA1Result(&ctx) != 1) {
+	digest_result *res = disk_image_digest(disk);
+	if(!(res->which & DIGEST_SHA1)) {
 		printf("Failed to generate SHA1 hash\n");
 		return;
 	}
 
 	// Output to screen
 	printf("SHA1: ");
-	for(int i = 0; i < 5; i++) {
-		printf("%02x", ctx.Message_Digest[i]);
-	}
+	print_hex2(res->sha1, sizeof(res->sha1));
 	printf("\n");
 
 	// Output to file
 	if(out_path == NULL)
 		return;
 
-	FILE *fp = fopen(out_path, "w+");
-	if(fp == NULL) {
+	if(!disk_write_hex_file(out_path, res->sha1, sizeof(res->sha1))) {
 		printf("Could not open file %s to write sha1 hash\n", out_path);
 		return;
 	}
 
-	for(int i = 0; i < 5; i++) {
-		fprintf(fp, "%02x", ctx.Message_Digest[i]);
-	}
-
-	fclose(fp);
-
 	printf("Wrote SHA1 hash to %s\n", out_path);
 }
 
@@ -90,17 +328,11 @@ void disk_output_sha1(disk_img *disk, const char *out_path) {
  * @param out_path File Path to output the MD5 hash as plain text. If NULL, do not output to a file
  */
 void disk_output_md5(disk_img *disk, const char *out_path) {
-	unsigned char digest[16];
-	memset(digest, 0 , 16);
-
-	MD5_CTX ctx;
-	MD5_Init(&ctx);
-	MD5_Update(&ctx, disk->buffer->buf, disk->buffer->len);
-	MD5_Final(digest, &ctx);
+	digest_result *res = disk_image_digest(disk);
 
 	// Output to screen
 	printf("MD5: ");
-	print_hex2(digest, sizeof(digest));
+	print_hex2(res->md5, sizeof(res->md5));
 	printf("\n");
 
 
@@ -108,72 +340,183 @@ void disk_output_md5(disk_img *disk, const char *out_path) {
 	if(out_path == NULL)
 		return;
 
-	FILE *fp = fopen(out_path, "w+");
-	if(fp == NULL) {
+	if(!disk_write_hex_file(out_path, res->md5, sizeof(res->md5))) {
 		printf("Could not open file %s to write md5 hash\n", out_path);
 		return;
 	}
 
-	for(int i = 0; i < sizeof(digest); i++) {
-		fprintf(fp, "%02x", digest[i]);
-	}
-
-	fclose(fp);
-
 	printf("Wrote MD5 hash to %s\n", out_path);
 }
 
 /*
- * Reads the entire disk image buffer and populates corresponding structures (MBR, File Systems)
+ * Reads the partition table and the boot sectors of the partitions it lists (MBR, File Systems)
  *
  * @param disk Disk Image state structure
  */
 void disk_parse(disk_img *disk) {
-	// MBR
+	disk_require(disk, DISK_STAGE_VOLUMES);
+}
+
+// Stage: partition table
+static void disk_read_mbr(disk_img *disk) {
 	disk->master_boot_record = mbr_new();
+	disk->buffer->pos = 0;
 	mbr_read(disk->buffer, disk->master_boot_record);
+}
 
-	// Create and parse partitions based on their locations in the MBR
+// Stage: create and parse partitions based on their locations in the MBR
+static void disk_read_volumes(disk_img *disk) {
 	uint8_t part_type = 0;
 	for(int i = 0; i < 4; i++) {
 		part_type = disk->master_boot_record->pentry[i].type;
 
+		// Move byte buffer position to the starting posititon of the partition
+		// Calculate this by multiplying the relative sector by 512 (default bytes per sector)
+		uint64_t start = (uint64_t)disk->master_boot_record->pentry[i].relative_sector * 512;
+		bool supported = (part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32 || part_type == PT_NTFS);
+		if(supported && start + 512 > disk->buffer->len) {
+			fprintf(stderr, "Warning: partition %i starts outside of the image, its volume is skipped\n", i);
+			continue;
+		}
+
 		if(part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32) {
 			disk->partition[i] = fat_new_partition();
-
-			// Move byte buffer position to the starting posititon of the partition
-			// Calculate this by multiplying the relative sector by 512 (default bytes per sector)
-			disk->buffer->pos = disk->master_boot_record->pentry[i].relative_sector * 512;
-
+			disk->buffer->pos = (size_t)start;
 			fat_read_partition(disk->buffer, (fat_partition*)(disk->partition[i]));
+		} else if(part_type == PT_NTFS) {
+			disk->partition[i] = ntfs_new_partition();
+			disk->buffer->pos = (size_t)start;
+			ntfs_read_partition(disk->buffer, (ntfs_partition*)(disk->partition[i]));
 		} else {
-			printf("disk_parse: Could not read partition of type %i\n", part_type);
+			fprintf(stderr, "disk_parse: Could not read partition of type %i\n", part_type);
+		}
+	}
+}
+
+// Stage: decode the MFT and data runs of the NTFS partitions. FAT tables are used in place in the image
+static void disk_read_tables(disk_img *disk) {
+	for(int i = 0; i < 4; i++) {
+		if(disk_volume_type(disk, i) != PT_NTFS)
+			continue;
+
+		ntfs_partition *part = (ntfs_partition*)(disk->partition[i]);
+		if(ntfs_load_mft(part))
+			ntfs_build_extent_index(part);
+	}
+}
+
+// Stage: walk the FAT directory trees and build the full paths of the NTFS records
+static void disk_read_directories(disk_img *disk) {
+	uint8_t part_type = 0;
+	for(int i = 0; i < 4; i++) {
+		part_type = disk_volume_type(disk, i);
+
+		if(part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32) {
+			fat_partition *part = (fat_partition*)(disk->partition[i]);
+			fat_read_directory_tree(part);
+			fat_build_extent_index(part);
+		} else if(part_type == PT_NTFS) {
+			ntfs_build_paths((ntfs_partition*)(disk->partition[i]));
 		}
 	}
 }
 
 /*
- * Outputs a human readable representation of the major data structures in the disk image
- *
- * @param disk Disk Image state structure
- * @param verbose If true, display every field in every data structure. If false, only display major elements
+ * Output the checksums and zero block counts of the image as a JSON or CSV section. The MD5-/SHA1- files are still
+ * written, without the messages that would corrupt the output
+ */
+static void disk_output_checksums(disk_img *disk, out_writer *out) {
+	digest_result *res = disk_image_digest(disk);
+	char *md5_name = (char*)malloc(strlen(disk->image_name) + 8 + 1);
+	char *sha1_name = (char*)malloc(strlen(disk->image_name) + 9 + 1);
+	sprintf(md5_name, "MD5-%s.txt", disk->image_name);
+	sprintf(sha1_name, "SHA1-%s.txt", disk->image_name);
+	if(!disk_write_hex_file(sha1_name, res->sha1, sizeof(res->sha1)))
+		fprintf(stderr, "Could not open file %s to write sha1 hash\n", sha1_name);
+	if(!disk_write_hex_file(md5_name, res->md5, sizeof(res->md5)))
+		fprintf(stderr, "Could not open file %s to write md5 hash\n", md5_name);
+	free(md5_name);
+	free(sha1_name);
+
+	zeromap *zm = disk->zero_map; // Counted with the checksums
+	out_section_begin(out, "Checksums", "CHECKSUMS");
+	out_record_begin(out);
+	out_hex(out, "MD5", res->md5, sizeof(res->md5));
+	out_hex(out, "SHA1", res->sha1, sizeof(res->sha1));
+	out_u64(out, "Size", zm->img_len);
+	out_u64(out, "ZeroBlocks", zm->zero_blocks);
+	out_u64(out, "Blocks", zm->num_blocks);
+	out_u64(out, "HoleBytes", zm->hole_bytes);
+	out_record_end(out);
+	out_section_end(out);
+}
+
+/*
+ * Output the partition table and volume layouts (and the checksums if asked for) as JSON or CSV sections
  */
-void disk_print(disk_img *disk, bool verbose) {
+static void disk_output_structured(disk_img *disk, bool verbose, bool checksums, out_writer *out) {
+	if(checksums)
+		disk_output_checksums(disk, out);
+
+	out_section_begin(out, "Partitions", "MBR ANALYSIS");
+	mbr_output(disk->master_boot_record, out, verbose);
+	out_section_end(out);
+
+	out_section_begin(out, "FatVolumes", "FAT VOLUMES");
+	for(int i = 0; i < 4; i++) {
+		uint8_t part_type = disk_volume_type(disk, i);
+		if(part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32)
+			fat_output_partition((fat_partition*)(disk->partition[i]), out, i, verbose);
+	}
+	out_section_end(out);
+
+	out_section_begin(out, "NtfsVolumes", "NTFS VOLUMES");
+	for(int i = 0; i < 4; i++) {
+		if(disk_volume_type(disk, i) == PT_NTFS)
+			ntfs_output_partition((ntfs_partition*)(disk->partition[i]), out, i, verbose);
+	}
+	out_section_end(out);
+}
+
+// Checksums and zero block counts of the image, as text
+static void disk_print_checksums(disk_img *disk) {
 	printf("CHECKSUMS\n");
 	printf("==================================================\n");
 	char *md5_name = (char*)malloc(strlen(disk->image_name) + 8 + 1);
 	char *sha1_name = (char*)malloc(strlen(disk->image_name) + 9 + 1);
-	strncpy(md5_name, "MD5-", 4);
-	strncat(md5_name, disk->image_name, strlen(disk->image_name));
-	strncat(md5_name, ".txt", 4);
-	strncpy(sha1_name, "SHA1-", 5);
-	strncat(sha1_name, disk->image_name, strlen(disk->image_name));
-	strncat(sha1_name, ".txt", 4);
+	sprintf(md5_name, "MD5-%s.txt", disk->image_name);
+	sprintf(sha1_name, "SHA1-%s.txt", disk->image_name);
 	disk_output_sha1(disk, sha1_name);
 	disk_output_md5(disk, md5_name);
 	free(md5_name);
 	free(sha1_name);
+
+	zeromap *zm = disk->zero_map; // Counted with the checksums
+	printf("Zero blocks: %llu of %llu (%.1f%%)", (unsigned long long)zm->zero_blocks, (unsigned long long)zm->num_blocks,
+		(zm->num_blocks > 0) ? 100.0 * zm->zero_blocks / zm->num_blocks : 0.0);
+	if(zm->hole_bytes > 0)
+		printf(", %llu bytes in sparse file holes", (unsigned long long)zm->hole_bytes);
 	printf("\n");
+	printf("\n");
+}
+
+/*
+ * Outputs a human readable representation of the major data structures in the disk image
+ *
+ * @param disk Disk Image state structure
+ * @param verbose If true, display every field in every data structure. If false, only display major elements
+ * @param checksums If true, hash the whole image and count its zero blocks first. Reads every byte of the image
+ * @param out Writer for JSON/CSV output. Text output is printed as before
+ */
+void disk_print(disk_img *disk, bool verbose, bool checksums, out_writer *out) {
+	disk_require(disk, DISK_STAGE_VOLUMES);
+	if(out->format != OUT_FORMAT_TEXT) {
+		disk_output_structured(disk, verbose, checksums, out);
+		return;
+	}
+
+	if(checksums)
+		disk_print_checksums(disk);
 
 	printf("MBR ANALYSIS\n");
 	mbr_print(disk->master_boot_record, verbose);
@@ -189,8 +532,12 @@ void disk_print(disk_img *disk, bool verbose) {
 		printf("Partition %i (%s):\n", i, type_str);
 		free(type_str);
 
-		if(part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32) {
+		if((part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32 || part_type == PT_NTFS) && disk->partition[i] == NULL) {
+			printf("Volume lies outside of the image\n");
+		} else if(part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32) {
 			fat_print_partition((fat_partition*)(disk->partition[i]), verbose);
+		} else if(part_type == PT_NTFS) {
+			ntfs_print_partition((ntfs_partition*)(disk->partition[i]), verbose);
 		} else {
 			printf("Printing for this volume type not yet supported\n");
 		}
@@ -200,26 +547,1114 @@ void disk_print(disk_img *disk, bool verbose) {
 }
 
 /*
- * Release all resources related to the currently open disk image
+ * Scan every FAT partition for deleted directory entries and output what was found
  *
  * @param disk Disk Image state structure
+ * @param unallocated If true, also sweep unallocated clusters for deleted entries and orphaned directories
  */
-void disk_destroy(disk_img *disk) {
-	if(disk->file_path != NULL)
-		free(disk->file_path);
+void disk_recover(disk_img *disk, bool unallocated) {
+	disk_require(disk, DISK_STAGE_VOLUMES);
+	printf("DELETED ENTRY RECOVERY\n");
+	uint8_t part_type = 0;
+	for(int i = 0; i < 4; i++) {
+		part_type = disk_volume_type(disk, i);
+		if(part_type != PT_FAT12 && part_type != PT_FAT16B && part_type != PT_FAT32)
+			continue;
 
-	if(disk->image_name != NULL)
-		free(disk->image_name);
+		printf("==================================================\n");
+		printf("Partition %i:\n", i);
+		recover_result *res = recover_scan((fat_partition*)(disk->partition[i]), unallocated);
+		recover_print((fat_partition*)(disk->partition[i]), res);
+		recover_free(res);
+		printf("==================================================\n\n");
+	}
+}
 
-	if(disk->master_boot_record != NULL)
-		mbr_free(disk->master_boot_record);
+/*
+ * Output a fragmentation and allocation report for every FAT partition
+ *
+ * @param disk Disk Image state structure
+ * @param prefix Path prefix of the CSV/PNM files written for each partition
+ * @param clusters_per_cell Allocation map resolution. 0 to pick one automatically
+ */
+void disk_frag_report(disk_img *disk, const char *prefix, uint32_t clusters_per_cell) {
+	disk_require(disk, DISK_STAGE_VOLUMES);
+	printf("FRAGMENTATION REPORT\n");
+	uint8_t part_type = 0;
+	for(int i = 0; i < 4; i++) {
+		part_type = disk_volume_type(disk, i);
+		if(part_type != PT_FAT12 && part_type != PT_FAT16B && part_type != PT_FAT32)
+			continue;
+
+		printf("==================================================\n");
+		printf("Partition %i:\n", i);
+		frag_report_partition((fat_partition*)(disk->partition[i]), i, prefix, clusters_per_cell);
+		printf("==================================================\n\n");
+	}
+}
+
+/*
+ * Build (once) the reverse map from image byte offsets to the partition structure, file, slack or free space occupying them
+ *
+ * @param disk Disk Image state structure
+ * @return The disk's reverse map
+ */
+revmap *disk_build_revmap(disk_img *disk) {
+	if(disk->reverse_map != NULL)
+		return disk->reverse_map;
+
+	disk_require(disk, DISK_STAGE_DIRECTORIES);
+	revmap *map = revmap_new();
+	revmap_add(map, 0, 512, REVMAP_MBR, REVMAP_NO_PARTITION, REVMAP_NO_OWNER, 0);
 
 	uint8_t part_type = 0;
 	for(int i = 0; i < 4; i++) {
-		part_type = disk->master_boot_record->pentry[i].type;
+		partition_entry *pe = &(disk->master_boot_record->pentry[i]);
+		part_type = pe->type;
+		if(part_type == PT_EMPTY)
+			continue;
 
-		if(part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32) {
-			fat_free_partition((fat_partition*)(disk->partition[i]));
+		revmap_add_partition(map, (uint64_t)pe->relative_sector * 512, ((uint64_t)pe->relative_sector + pe->num_sectors) * 512, i);
+		part_type = disk_volume_type(disk, i);
+		if(part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32)
+			revmap_add_fat(map, (fat_partition*)(disk->partition[i]), i);
+		else if(part_type == PT_NTFS)
+			revmap_add_ntfs(map, (ntfs_partition*)(disk->partition[i]), i);
+	}
+
+	revmap_finalize(map);
+	disk->reverse_map = map;
+	return map;
+}
+
+/*
+ * Build (once) the map of all zero blocks of the image. Holes of a sparse image file are taken from the file system
+ *
+ * @param disk Disk Image state structure
+ * @return The disk's zero block map
+ */
+zeromap *disk_build_zeromap(disk_img *disk) {
+	disk_require(disk, DISK_STAGE_ZEROMAP);
+	return disk->zero_map;
+}
+
+// Stage: zero blocks of the image
+static void disk_find_zero_blocks(disk_img *disk) {
+	// Replaces the counts restored from a metadata index
+	if(disk->zero_map != NULL)
+		zeromap_free(disk->zero_map);
+	disk->zero_map = zeromap_build(disk->buffer->buf, disk->buffer->len, disk->file_path);
+}
+
+/*
+ * The byte ranges a scanner should search: ranges (or the whole image) without its runs of zero blocks
+ *
+ * @param ranges Ranges to restrict the search to, NULL for the whole image
+ * @param out Receives the ranges. Always has at least one (possibly empty) entry so it is never mistaken for the whole image
+ */
+void disk_data_ranges(disk_img *disk, extent_list *ranges, extent_list *out) {
+	if(ranges == NULL || ranges->count > 0)
+		zeromap_data_ranges(disk_build_zeromap(disk), (ranges != NULL) ? ranges->ext : NULL, (ranges != NULL) ? ranges->count : 0, out);
+
+	if(out->count == 0)
+		extent_list_append(out, 0, 0, false);
+}
+
+/*
+ * Write a one line description of what occupies offset (as found by a reverse map lookup)
+ *
+ * @param iv Interval returned by the reverse map for offset
+ * @param offset Absolute byte offset in the image
+ */
+void disk_describe_interval(disk_img *disk, revmap_interval *iv, uint64_t offset, char *dest, size_t dest_len) {
+	const char *kind = revmap_kind_str(iv->kind);
+
+	if(iv->partition == REVMAP_NO_PARTITION) {
+		snprintf(dest, dest_len, "%s", kind);
+		return;
+	}
+
+	if((iv->kind == REVMAP_FILE || iv->kind == REVMAP_SLACK) && iv->owner != REVMAP_NO_OWNER
+			&& disk->master_boot_record->pentry[iv->partition].type == PT_NTFS) {
+		ntfs_partition *part = (ntfs_partition*)(disk->partition[iv->partition]);
+		const char *path = ntfs_record_path(part, iv->owner);
+		snprintf(dest, dest_len, "Partition %u  %s  %s (MFT record %u) +%llu", iv->partition, kind, (path != NULL) ? path : "?", iv->owner,
+			(unsigned long long)(iv->file_pos + (offset - iv->start)));
+		return;
+	}
+
+	if((iv->kind == REVMAP_FILE || iv->kind == REVMAP_SLACK) && iv->owner != REVMAP_NO_OWNER) {
+		fat_partition *part = (fat_partition*)(disk->partition[iv->partition]);
+		snprintf(dest, dest_len, "Partition %u  %s  %s +%llu", iv->partition, kind, part->files[iv->owner].path,
+			(unsigned long long)(iv->file_pos + (offset - iv->start)));
+		return;
+	}
+
+	snprintf(dest, dest_len, "Partition %u  %s", iv->partition, kind);
+}
+
+/*
+ * Output what occupies each of the given image offsets
+ *
+ * @param disk Disk Image state structure
+ * @param offsets Absolute byte offsets in the image
+ * @param count Number of offsets
+ */
+void disk_locate(disk_img *disk, const uint64_t *offsets, size_t count) {
+	revmap *map = disk_build_revmap(disk);
+	revmap_interval *out = (revmap_interval*)malloc((count > 0 ? count : 1) * sizeof(revmap_interval));
+	char desc[FAT_NAME_MAX + 128];
+
+	revmap_lookup_batch(map, offsets, count, out);
+
+	printf("OFFSET LOOKUP\n");
+	printf("==================================================\n");
+	for(size_t i = 0; i < count; i++) {
+		disk_describe_interval(disk, &(out[i]), offsets[i], desc, sizeof(desc));
+		printf("%llu  %s\n", (unsigned long long)offsets[i], desc);
+	}
+	printf("==================================================\n\n");
+
+	free(out);
+}
+
+/*
+ * Output the file at path on each partition of a disk opened from its metadata index, the same way disk_lookup()
+ * does from the image
+ *
+ * @return False if no partition has the path
+ */
+static bool disk_lookup_index(disk_img *disk, const char *path) {
+	metaidx *idx = disk->index;
+	bool found = false;
+
+	// FAT volumes first, then NTFS, as from the image
+	for(int pass = 0; pass < 2; pass++) {
+		for(int i = 0; i < 4; i++) {
+			uint8_t part_type = idx->parts[i].type;
+			bool is_ntfs = (part_type == PT_NTFS);
+			if(part_type == 0 || is_ntfs != (pass == 1))
+				continue;
+
+			uint32_t n = 0;
+			metaidx_file f;
+			if(!metaidx_lookup(idx, i, path, &n) || !metaidx_file_at(idx, n, &f))
+				continue;
+
+			found = true;
+			if(is_ntfs) {
+				printf("Partition %i  %s  Size: %llu  MFT record: %u  Flags: 0x%04x", i, f.path, (unsigned long long)f.size, f.num, f.attr);
+				if(f.attr & NTFS_REC_RESIDENT)
+					printf("  Resident");
+				else
+					printf("  Fragments: %u", f.ext_count);
+			} else {
+				printf("Partition %i  %s  Size: %u  Attributes: 0x%02x  Fragments: %u", i, f.path, (uint32_t)f.size, f.attr, f.ext_count);
+			}
+
+			extent ext;
+			for(uint32_t e = 0; e < f.ext_count && metaidx_extent_at(idx, f.ext_first + e, &ext); e++) {
+				if(ext.start == EXTENT_SPARSE)
+					printf("%ssparse(%llu)", (e == 0) ? "  Clusters: " : ", ", (unsigned long long)ext.length);
+				else
+					printf("%s%llu-%llu", (e == 0) ? "  Clusters: " : ", ", (unsigned long long)ext.start, (unsigned long long)(ext.start + ext.length - 1));
+			}
+			printf("\n");
 		}
 	}
+
+	return found;
+}
+
+/*
+ * Output the directory entry details and extents of each path, searched for in every FAT and NTFS partition
+ *
+ * @param disk Disk Image state structure
+ * @param paths Full paths from the root of the volume, case insensitive
+ * @param count Number of paths
+ */
+void disk_lookup(disk_img *disk, char **paths, size_t count) {
+	printf("PATH LOOKUP\n");
+	printf("==================================================\n");
+
+	if(disk->index != NULL) {
+		for(size_t n = 0; n < count; n++) {
+			if(!disk_lookup_index(disk, paths[n]))
+				printf("Not found: %s\n", paths[n]);
+		}
+
+		printf("==================================================\n\n");
+		return;
+	}
+
+	disk_require(disk, DISK_STAGE_DIRECTORIES);
+	uint8_t part_type = 0;
+	for(size_t n = 0; n < count; n++) {
+		bool found = false;
+
+		for(int i = 0; i < 4; i++) {
+			part_type = disk_volume_type(disk, i);
+			if(part_type != PT_FAT12 && part_type != PT_FAT16B && part_type != PT_FAT32)
+				continue;
+
+			fat_partition *part = (fat_partition*)(disk->partition[i]);
+			fat_build_extent_index(part);
+			fat_file *f = fat_lookup_path(part, paths[n]);
+			if(f == NULL)
+				continue;
+
+			found = true;
+			printf("Partition %i  %s  Size: %u  Attributes: 0x%02x  Fragments: %u", i, f->path, f->de.size, f->de.attr, f->ext_count);
+			for(uint32_t e = 0; e < f->ext_count; e++) {
+				extent *ext = &(part->extents.ext[f->ext_first + e]);
+				printf("%s%llu-%llu", (e == 0) ? "  Clusters: " : ", ", (unsigned long long)ext->start, (unsigned long long)(ext->start + ext->length - 1));
+			}
+			printf("\n");
+		}
+
+		for(int i = 0; i < 4; i++) {
+			if(disk_volume_type(disk, i) != PT_NTFS)
+				continue;
+
+			ntfs_partition *part = (ntfs_partition*)(disk->partition[i]);
+			uint32_t num = 0;
+			if(!ntfs_lookup_path(part, paths[n], &num))
+				continue;
+
+			found = true;
+			ntfs_build_extent_index(part);
+			ntfs_record *r = &(part->records[num]);
+			printf("Partition %i  %s  Size: %llu  MFT record: %u  Flags: 0x%04x", i, ntfs_record_path(part, num), (unsigned long long)r->size, num, r->flags);
+			if(r->flags & NTFS_REC_RESIDENT)
+				printf("  Resident");
+			else
+				printf("  Fragments: %u", r->ext_count);
+			for(uint32_t e = 0; e < r->ext_count; e++) {
+				extent *ext = &(part->extents.ext[r->ext_first + e]);
+				if(ext->start == EXTENT_SPARSE)
+					printf("%ssparse(%llu)", (e == 0) ? "  Clusters: " : ", ", (unsigned long long)ext->length);
+				else
+					printf("%s%llu-%llu", (e == 0) ? "  Clusters: " : ", ", (unsigned long long)ext->start, (unsigned long long)(ext->start + ext->length - 1));
+			}
+			printf("\n");
+		}
+
+		if(!found)
+			printf("Not found: %s\n", paths[n]);
+	}
+
+	printf("==================================================\n\n");
+}
+
+// Extract path from the first NTFS partition containing it. Returns false if no NTFS partition has the path
+static bool disk_extract_ntfs(disk_img *disk, const char *path, uint8_t *buf, size_t buf_len) {
+	ntfs_partition *part = NULL;
+	uint32_t num = 0;
+
+	for(int i = 0; i < 4 && part == NULL; i++) {
+		if(disk_volume_type(disk, i) == PT_NTFS && ntfs_lookup_path((ntfs_partition*)(disk->partition[i]), path, &num))
+			part = (ntfs_partition*)(disk->partition[i]);
+	}
+
+	if(part == NULL)
+		return false;
+
+	const char *full_path = ntfs_record_path(part, num);
+	const char *out_name = strrchr(full_path, '/') + 1;
+	if(*out_name == '\0')
+		out_name = "root";
+
+	FILE *fp = fopen(out_name, "wb");
+	if(fp == NULL) {
+		printf("Could not open file %s to extract %s\n", out_name, path);
+		return true;
+	}
+
+	size_t got = 0;
+	uint64_t total = 0, size = part->records[num].size;
+	while((got = ntfs_read_data(part, num, total, buf, buf_len)) > 0) {
+		fwrite(buf, 1, got, fp);
+		total += got;
+	}
+	fclose(fp);
+
+	if(total < size)
+		printf("Warning: only %llu of %llu bytes of %s could be read\n", (unsigned long long)total, (unsigned long long)size, full_path);
+	printf("Extracted %s (%llu bytes) to %s\n", full_path, (unsigned long long)total, out_name);
+	return true;
+}
+
+/*
+ * Copy files out of the image into the current directory, named after the last component of their path.
+ * The first FAT partition containing a path is used, then the first NTFS partition
+ *
+ * @param disk Disk Image state structure
+ * @param paths Full paths from the root of the volume, case insensitive
+ * @param count Number of paths
+ */
+void disk_extract(disk_img *disk, char **paths, size_t count) {
+	disk_require(disk, DISK_STAGE_DIRECTORIES);
+	uint8_t *buf = (uint8_t*)malloc(65536);
+	uint8_t part_type = 0;
+
+	for(size_t n = 0; n < count; n++) {
+		fat_handle *h = NULL;
+
+		for(int i = 0; i < 4 && h == NULL; i++) {
+			part_type = disk_volume_type(disk, i);
+			if(part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32)
+				h = fat_open((fat_partition*)(disk->partition[i]), paths[n]);
+		}
+
+		if(h == NULL) {
+			if(!disk_extract_ntfs(disk, paths[n], buf, 65536))
+				printf("Not found: %s\n", paths[n]);
+			continue;
+		}
+
+		const char *out_name = strrchr(h->file->path, '/') + 1;
+		if(*out_name == '\0')
+			out_name = "root";
+
+		FILE *fp = fopen(out_name, "wb");
+		if(fp == NULL) {
+			printf("Could not open file %s to extract %s\n", out_name, paths[n]);
+			fat_close(h);
+			continue;
+		}
+
+		size_t got = 0;
+		uint64_t total = 0;
+		while((got = fat_read(h, buf, 65536)) > 0) {
+			fwrite(buf, 1, got, fp);
+			total += got;
+		}
+		fclose(fp);
+
+		if(total < h->size)
+			printf("Warning: only %llu of %llu bytes of %s could be read\n", (unsigned long long)total, (unsigned long long)h->size, h->file->path);
+		printf("Extracted %s (%llu bytes) to %s\n", h->file->path, (unsigned long long)total, out_name);
+		fat_close(h);
+	}
+
+	free(buf);
+}
+
+// One row of the file listing. Directories get a trailing '/'
+static void disk_list_record(out_writer *out, int partition, uint64_t size, const char *path, bool slash) {
+	char *full = NULL;
+	if(slash) {
+		full = (char*)malloc(strlen(path) + 2);
+		sprintf(full, "%s/", path);
+	}
+
+	out_record_begin(out);
+	out_u64(out, "Partition", partition);
+	out_u64(out, "Size", size);
+	out_str(out, "Path", slash ? full : path);
+	out_record_end(out);
+	free(full);
+}
+
+/*
+ * Output the full path and size of every file and directory on every FAT and NTFS partition.
+ * FAT volumes are listed by walking the directory tree. NTFS volumes are listed from one sequential pass over the MFT,
+ * with paths rebuilt from the parent references of the records instead of reading the directory indexes
+ *
+ * @param disk Disk Image state structure
+ * @param out Writer the listing is output through, in any format
+ */
+void disk_list(disk_img *disk, out_writer *out) {
+	out_section_begin(out, "Files", "FILE LISTING");
+
+	if(disk->index != NULL) {
+		metaidx *idx = disk->index;
+		for(int i = 0; i < 4; i++) {
+			metaidx_part *p = &(idx->parts[i]);
+			metaidx_file f;
+			for(uint32_t n = p->first_file; n < p->first_file + p->num_files; n++) {
+				if(metaidx_file_at(idx, n, &f))
+					disk_list_record(out, i, f.size, f.path, (f.flags & METAIDX_FILE_DIR) && !(f.flags & METAIDX_FILE_ROOT));
+			}
+		}
+
+		out_section_end(out);
+		return;
+	}
+
+	disk_require(disk, DISK_STAGE_DIRECTORIES);
+	uint8_t part_type = 0;
+	for(int i = 0; i < 4; i++) {
+		part_type = disk_volume_type(disk, i);
+
+		if(part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32) {
+			fat_partition *part = (fat_partition*)(disk->partition[i]);
+			fat_read_directory_tree(part);
+			for(uint32_t f = 0; f < part->num_files; f++) {
+				bool is_dir = (part->files[f].de.attr & FAT_ATTR_DIRECTORY) != 0;
+				disk_list_record(out, i, part->files[f].de.size, part->files[f].path, is_dir && f != FAT_ROOT_INDEX);
+			}
+		} else if(part_type == PT_NTFS) {
+			ntfs_partition *part = (ntfs_partition*)(disk->partition[i]);
+			if(!ntfs_load_mft(part))
+				continue;
+
+			for(uint32_t r = 0; r < part->num_records; r++) {
+				ntfs_record *rec = &(part->records[r]);
+				if(!(rec->flags & NTFS_REC_IN_USE))
+					continue;
+
+				const char *path = ntfs_record_path(part, r);
+				if(path == NULL)
+					continue;
+
+				bool is_dir = (rec->flags & NTFS_REC_DIRECTORY) != 0;
+				disk_list_record(out, i, rec->size, path, is_dir && r != NTFS_RECORD_ROOT);
+			}
+		}
+	}
+
+	out_section_end(out);
+}
+
+/*
+ * Collect the free space of every FAT and NTFS partition as absolute byte ranges of the image
+ *
+ * @param out List the ranges (start, length in bytes) are appended to, in image order
+ */
+void disk_unallocated_ranges(disk_img *disk, extent_list *out) {
+	disk_require(disk, DISK_STAGE_VOLUMES);
+	uint8_t part_type = 0;
+	for(int i = 0; i < 4; i++) {
+		part_type = disk_volume_type(disk, i);
+
+		if(part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32) {
+			fat_partition *part = (fat_partition*)(disk->partition[i]);
+			if(!part->valid)
+				continue;
+			uint64_t cs = fat_cluster_size(part);
+			uint64_t data = part->start_pos + (uint64_t)fat_data_start_rel(part) * part->boot_sector->bpb.bytes_per_sector;
+			uint32_t c = 2, count = 0;
+
+			fat_build_free_map(part);
+			while(fat_next_free_run(part, &c, &count)) {
+				extent_list_append(out, data + (uint64_t)(c - 2) * cs, (uint64_t)count * cs, false);
+				c += count;
+			}
+		} else if(part_type == PT_NTFS) {
+			ntfs_partition *part = (ntfs_partition*)(disk->partition[i]);
+			uint32_t first = out->count;
+
+			ntfs_unallocated_extents(part, out);
+			for(uint32_t e = first; e < out->count; e++) {
+				out->ext[e].start = part->start_pos + out->ext[e].start * part->cluster_size;
+				out->ext[e].length *= part->cluster_size;
+			}
+		}
+	}
+}
+
+/*
+ * Carve files matching a signature set out of the image, write them to out_dir and list them in out_dir/carve.csv
+ *
+ * @param disk Disk Image state structure
+ * @param set Signatures to search for
+ * @param out_dir Directory receiving the carved files
+ * @param unallocated If true, only carve files whose header lies in the free space of a FAT or NTFS partition
+ */
+void disk_carve(disk_img *disk, carve_set *set, const char *out_dir, bool unallocated) {
+	extent_list unalloc, ranges;
+	extent_list_init(&unalloc);
+	extent_list_init(&ranges);
+	if(unallocated)
+		disk_unallocated_ranges(disk, &unalloc);
+	disk_data_ranges(disk, unallocated ? &unalloc : NULL, &ranges);
+
+	carve_result *res = carve_scan(set, disk->buffer->buf, disk->buffer->len, ranges.ext, ranges.count, out_dir);
+	extent_list_free(&unalloc);
+	extent_list_free(&ranges);
+
+	printf("FILE CARVING\n");
+	printf("==================================================\n");
+	uint32_t counts[CARVE_MAX_SIGS];
+	memset(counts, 0, sizeof(counts));
+	for(uint32_t i = 0; i < res->count; i++) {
+		counts[res->hits[i].sig]++;
+	}
+	// Types with several headers (GIF) are counted together
+	for(uint32_t s = 0; s < set->count; s++) {
+		bool seen = false;
+		uint32_t total = counts[s];
+		for(uint32_t o = 0; o < set->count; o++) {
+			if(o != s && strcmp(set->sigs[o].name, set->sigs[s].name) == 0) {
+				seen |= (o < s);
+				total += counts[o];
+			}
+		}
+		if(!seen)
+			printf("%s (%s): %u\n", set->sigs[s].name, set->sigs[s].ext, total);
+	}
+
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/carve.csv", out_dir);
+	FILE *fp = fopen(path, "w");
+	if(fp == NULL) {
+		printf("Could not open file %s to write the carving report\n", path);
+	} else {
+		revmap *map = disk_build_revmap(disk);
+		char desc[FAT_NAME_MAX + 128];
+
+		fprintf(fp, "Offset,Type,Size,Complete,Location\n");
+		for(uint32_t i = 0; i < res->count; i++) {
+			carve_hit *h = &(res->hits[i]);
+			revmap_interval iv = revmap_lookup(map, h->offset);
+			disk_describe_interval(disk, &iv, h->offset, desc, sizeof(desc));
+			fprintf(fp, "%llu,%s,%llu,%s,", (unsigned long long)h->offset, set->sigs[h->sig].name, (unsigned long long)h->length, h->complete ? "yes" : "no");
+			fprint_csv_str(fp, desc);
+			fprintf(fp, "\n");
+		}
+		fclose(fp);
+		printf("Carved %u files to %s\n", res->count, out_dir);
+	}
+	printf("==================================================\n\n");
+
+	carve_free(res);
+}
+
+/*
+ * Output every ASCII and UTF-16LE string of at least min_len characters in the image, one per line
+ *
+ * @param disk Disk Image state structure
+ * @param min_len Shortest string output, in characters
+ */
+void disk_strings(disk_img *disk, uint64_t min_len) {
+	extent_list ranges;
+	extent_list_init(&ranges);
+	disk_data_ranges(disk, NULL, &ranges);
+	strext_result *res = strext_scan(disk->buffer->buf, disk->buffer->len, ranges.ext, ranges.count, min_len, STREXT_ALL);
+	extent_list_free(&ranges);
+
+	printf("STRINGS\n");
+	printf("==================================================\n");
+	printf("Offset\tEncoding\tText\n");
+	for(uint64_t i = 0; i < res->count; i++) {
+		printf("%llu\t%s\t", (unsigned long long)res->hits[i].offset, strext_encoding_name(res->hits[i].encoding));
+		strext_write(stdout, disk->buffer->buf, &(res->hits[i]));
+		printf("\n");
+	}
+	printf("==================================================\n\n");
+
+	strext_free(res);
+}
+
+/*
+ * Output every keyword and regex match in the image with the partition and file it falls in
+ *
+ * @param disk Disk Image state structure
+ * @param set Compiled patterns. See search_set_compile()
+ */
+void disk_search(disk_img *disk, search_set *set) {
+	extent_list ranges;
+	extent_list_init(&ranges);
+	disk_data_ranges(disk, NULL, &ranges);
+	search_result *res = search_scan(set, disk->buffer->buf, disk->buffer->len, ranges.ext, ranges.count);
+	extent_list_free(&ranges);
+
+	uint64_t *offsets = (uint64_t*)malloc((res->count > 0 ? res->count : 1) * sizeof(uint64_t));
+	revmap_interval *out = (revmap_interval*)malloc((res->count > 0 ? res->count : 1) * sizeof(revmap_interval));
+	uint64_t *counts = (uint64_t*)calloc(set->count, sizeof(uint64_t));
+	for(uint64_t i = 0; i < res->count; i++) {
+		offsets[i] = res->hits[i].offset;
+		counts[res->hits[i].pattern]++;
+	}
+	revmap_lookup_batch(disk_build_revmap(disk), offsets, res->count, out);
+
+	printf("KEYWORD SEARCH\n");
+	printf("==================================================\n");
+	for(uint32_t p = 0; p < set->count; p++) {
+		printf("%s %s: %llu\n", (set->patterns[p].type == SEARCH_REGEX) ? "Regex" : "Keyword", set->patterns[p].text, (unsigned long long)counts[p]);
+	}
+	printf("\nOffset\tPattern\tMatch\tLocation\n");
+
+	char desc[FAT_NAME_MAX + 128];
+	for(uint64_t i = 0; i < res->count; i++) {
+		search_hit *h = &(res->hits[i]);
+		printf("%llu\t%s\t", (unsigned long long)h->offset, set->patterns[h->pattern].text);
+
+		// Show at most 64 bytes of the match, escaping anything unprintable
+		const uint8_t *m = disk->buffer->buf + h->offset;
+		for(uint64_t k = 0; k < h->length && k < 64; k++) {
+			if(m[k] >= 0x20 && m[k] < 0x7F && m[k] != '\\')
+				printf("%c", m[k]);
+			else
+				printf("\\x%02x", m[k]);
+		}
+		if(h->length > 64)
+			printf("...");
+
+		disk_describe_interval(disk, &(out[i]), h->offset, desc, sizeof(desc));
+		printf("\t%s\n", desc);
+	}
+	printf("==================================================\n\n");
+
+	free(counts);
+	free(out);
+	free(offsets);
+	search_free(res);
+}
+
+// Summarize the entropy map over [start, end): zero and high entropy coverage and the largest high entropy regions
+static void disk_entropy_summary(entropy_map *map, const char *label, uint64_t start, uint64_t end) {
+	if(end > map->img_len)
+		end = map->img_len;
+	if(start >= end)
+		return;
+
+	uint64_t zeros = 0, high = 0;
+	for(uint64_t b = start / map->block_size; b < (end + map->block_size - 1) / map->block_size; b++) {
+		zeros += map->zeros[b];
+	}
+
+	extent_list regions;
+	extent_list_init(&regions);
+	entropy_high_regions(map, start, end, ENTROPY_HIGH, &regions);
+
+	// Selection of the largest regions, in the order found
+	extent top[ENTROPY_TOP_REGIONS];
+	uint32_t num_top = 0;
+	for(uint32_t r = 0; r < regions.count; r++) {
+		extent *e = &(regions.ext[r]);
+		high += e->length;
+
+		uint32_t k = num_top;
+		if(num_top < ENTROPY_TOP_REGIONS)
+			num_top++;
+		else if(top[k - 1].length >= e->length)
+			continue;
+		else
+			k--;
+		for(; k > 0 && top[k - 1].length < e->length; k--) {
+			top[k] = top[k - 1];
+		}
+		top[k] = *e;
+	}
+
+	printf("%s: %llu bytes, mean entropy %.3f, %.1f%% zero bytes\n", label, (unsigned long long)(end - start),
+		(double)entropy_mean(map, start, end - start) / ENTROPY_SCALE, 100.0 * zeros / (end - start));
+	printf("\tHigh entropy (>= %.1f): %llu bytes (%.1f%%) in %u regions\n", (double)ENTROPY_HIGH / ENTROPY_SCALE,
+		(unsigned long long)high, 100.0 * high / (end - start), regions.count);
+	for(uint32_t k = 0; k < num_top; k++) {
+		printf("\t\t%llu +%llu  mean entropy %.3f\n", (unsigned long long)top[k].start, (unsigned long long)top[k].length,
+			(double)entropy_mean(map, top[k].start, top[k].length) / ENTROPY_SCALE);
+	}
+
+	extent_list_free(&regions);
+}
+
+/*
+ * Write the per block entropy map of the image to out_path and output a summary of each partition
+ *
+ * @param disk Disk Image state structure
+ * @param out_path File receiving the map
+ * @param format ENTROPY_FORMAT_CSV or ENTROPY_FORMAT_BINARY
+ */
+void disk_entropy(disk_img *disk, const char *out_path, int format) {
+	disk_require(disk, DISK_STAGE_MBR);
+	entropy_map *map = entropy_build(disk->buffer->buf, disk->buffer->len, ENTROPY_BLOCK, disk_build_zeromap(disk));
+
+	printf("ENTROPY MAP\n");
+	printf("==================================================\n");
+	disk_entropy_summary(map, "Image", 0, map->img_len);
+
+	char label[32];
+	for(int i = 0; i < 4; i++) {
+		partition_entry *pe = &(disk->master_boot_record->pentry[i]);
+		if(pe->type == PT_EMPTY)
+			continue;
+
+		snprintf(label, sizeof(label), "Partition %i", i);
+		disk_entropy_summary(map, label, (uint64_t)pe->relative_sector * 512, ((uint64_t)pe->relative_sector + pe->num_sectors) * 512);
+	}
+
+	if(entropy_write(map, out_path, format))
+		printf("Wrote %llu blocks of %u bytes to %s\n", (unsigned long long)map->num_blocks, map->block_size, out_path);
+	printf("==================================================\n\n");
+
+	entropy_free(map);
+}
+
+/*
+ * Split the image into the areas hashed by block matching. The block grid of a file system area starts at its first
+ * cluster and advances by the cluster size (at most a block), so blocks line up with the start of every file.
+ * Everything else is hashed on a plain grid of HASHDB_BLOCK bytes
+ *
+ * @param out Receives the regions in image order. Room for at least 9
+ * @return Number of regions
+ */
+uint32_t disk_block_regions(disk_img *disk, hashdb_region *out) {
+	disk_require(disk, DISK_STAGE_VOLUMES);
+	hashdb_region areas[4];
+	uint32_t num_areas = 0, count = 0;
+
+	for(int i = 0; i < 4; i++) {
+		partition_entry *pe = &(disk->master_boot_record->pentry[i]);
+		hashdb_region *a = &(areas[num_areas]);
+		a->end = ((uint64_t)pe->relative_sector + pe->num_sectors) * 512;
+
+		uint8_t vol_type = disk_volume_type(disk, i);
+		if(vol_type == PT_FAT12 || vol_type == PT_FAT16B || vol_type == PT_FAT32) {
+			fat_partition *part = (fat_partition*)(disk->partition[i]);
+			if(!part->valid)
+				continue;
+			a->start = part->start_pos + (uint64_t)fat_data_start_rel(part) * part->boot_sector->bpb.bytes_per_sector;
+			a->step = fat_cluster_size(part);
+		} else if(vol_type == PT_NTFS) {
+			ntfs_partition *part = (ntfs_partition*)(disk->partition[i]);
+			a->start = part->start_pos;
+			a->step = part->cluster_size;
+		} else {
+			continue;
+		}
+
+		if(a->step == 0 || a->step > HASHDB_BLOCK)
+			a->step = HASHDB_BLOCK;
+		if(a->start < a->end)
+			num_areas++;
+	}
+
+	// In image order, with the gaps between areas filled in
+	for(uint32_t i = 1; i < num_areas; i++) {
+		for(uint32_t k = i; k > 0 && areas[k].start < areas[k - 1].start; k--) {
+			hashdb_region tmp = areas[k];
+			areas[k] = areas[k - 1];
+			areas[k - 1] = tmp;
+		}
+	}
+
+	uint64_t pos = 0;
+	for(uint32_t i = 0; i < num_areas; i++) {
+		if(areas[i].start < pos)
+			areas[i].start = pos;
+		if(areas[i].start >= areas[i].end)
+			continue;
+
+		if(areas[i].start > pos) {
+			out[count].start = pos;
+			out[count].end = areas[i].start;
+			out[count].step = HASHDB_BLOCK;
+			count++;
+		}
+		out[count++] = areas[i];
+		pos = areas[i].end;
+	}
+
+	if(pos < disk->buffer->len) {
+		out[count].start = pos;
+		out[count].end = disk->buffer->len;
+		out[count].step = HASHDB_BLOCK;
+		count++;
+	}
+
+	return count;
+}
+
+/*
+ * Hash every block of the image and output the runs of blocks found in a block hash database
+ *
+ * @param disk Disk Image state structure
+ * @param db Database of MD5 digests of HASHDB_BLOCK byte blocks
+ */
+void disk_block_match(disk_img *disk, hashdb *db) {
+	if(db->block_size != HASHDB_BLOCK || db->digest_len != 16) {
+		printf("The hash database does not hold MD5 digests of %i byte blocks\n", HASHDB_BLOCK);
+		return;
+	}
+
+	hashdb_region regions[9];
+	uint32_t num_regions = disk_block_regions(disk, regions);
+	hashdb_match *m = hashdb_match_blocks(db, disk->buffer->buf, disk->buffer->len, regions, num_regions);
+
+	printf("BLOCK MATCHING\n");
+	printf("==================================================\n");
+	printf("Database: %llu block hashes\n", (unsigned long long)db->count);
+	printf("Blocks hashed: %llu (%llu empty blocks skipped)\n", (unsigned long long)m->blocks_hashed, (unsigned long long)m->blocks_zero);
+	printf("Passed the Bloom filter: %llu\n", (unsigned long long)m->bloom_passed);
+	printf("Matching blocks: %llu\n", (unsigned long long)m->count);
+
+	// Coalesce overlapping and adjacent matches into runs
+	revmap *map = disk_build_revmap(disk);
+	char desc[FAT_NAME_MAX + 128];
+	printf("\nOffset\tLength\tBlocks\tLocation\n");
+	for(uint64_t i = 0; i < m->count;) {
+		uint64_t start = m->offsets[i], end = start + HASHDB_BLOCK, blocks = 0;
+		for(; i < m->count && m->offsets[i] <= end; i++) {
+			end = m->offsets[i] + HASHDB_BLOCK;
+			blocks++;
+		}
+
+		revmap_interval iv = revmap_lookup(map, start);
+		disk_describe_interval(disk, &iv, start, desc, sizeof(desc));
+		printf("%llu\t%llu\t%llu\t%s\n", (unsigned long long)start, (unsigned long long)(end - start), (unsigned long long)blocks, desc);
+	}
+	printf("==================================================\n\n");
+
+	hashdb_match_free(m);
+}
+
+/*
+ * Gather the regular files of every FAT and NTFS partition into a list
+ *
+ * @param disk Disk Image state structure
+ * @return List of files, not yet hashed. Free with filehash_free()
+ */
+filehash_list *disk_file_list(disk_img *disk) {
+	disk_require(disk, DISK_STAGE_DIRECTORIES);
+	filehash_list *list = filehash_new();
+
+	uint8_t part_type = 0;
+	for(int i = 0; i < 4; i++) {
+		part_type = disk_volume_type(disk, i);
+		if(part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32)
+			filehash_add_fat(list, (fat_partition*)(disk->partition[i]), i);
+		else if(part_type == PT_NTFS)
+			filehash_add_ntfs(list, (ntfs_partition*)(disk->partition[i]), i);
+	}
+
+	return list;
+}
+
+/*
+ * Compute the MD5, SHA1 and SHA-256 of every file on every FAT and NTFS partition and write them to a CSV hash list
+ *
+ * @param disk Disk Image state structure
+ * @param out_path Path of the hash list. If NULL, only the summary is printed
+ * @param known Set of SHA1 digests of known files, left out of the hash list. NULL to keep every file
+ */
+void disk_hash_files(disk_img *disk, const char *out_path, hashdb *known) {
+	if(known != NULL && (known->digest_len != 20 || known->block_size != 0)) {
+		printf("The known file set does not hold SHA1 digests of whole files\n");
+		return;
+	}
+
+	filehash_list *list = disk_file_list(disk);
+	filehash_run(list, DIGEST_ALL);
+
+	uint32_t incomplete = 0, num_known = 0;
+	uint64_t known_bytes = 0;
+	for(uint32_t i = 0; i < list->count; i++) {
+		if(!list->files[i].complete)
+			incomplete++;
+	}
+	if(known != NULL) {
+		num_known = filehash_classify(list, known);
+		for(uint32_t i = 0; i < list->count; i++) {
+			if(list->files[i].known)
+				known_bytes += list->files[i].size;
+		}
+	}
+
+	printf("FILE HASHING\n");
+	printf("==================================================\n");
+	printf("Files hashed: %u (%llu bytes)\n", list->count, (unsigned long long)list->total_bytes);
+	printf("Incomplete (data outside of the image): %u\n", incomplete);
+	if(known != NULL) {
+		printf("Known file set: %llu digests\n", (unsigned long long)known->count);
+		printf("Known files discarded: %u (%llu bytes)\n", num_known, (unsigned long long)known_bytes);
+		printf("Unknown files: %u\n", list->count - num_known);
+	}
+	if(out_path != NULL) {
+		if(filehash_write(list, out_path, known != NULL))
+			printf("Wrote file hashes to %s\n", out_path);
+		else
+			printf("Could not open file %s to write file hashes\n", out_path);
+	}
+	printf("==================================================\n\n");
+
+	filehash_free(list);
+}
+
+/*
+ * Find files with identical contents across every FAT and NTFS partition and write the duplicate groups to a CSV file
+ *
+ * @param disk Disk Image state structure
+ * @param out_path Path of the duplicate list
+ */
+void disk_dedup(disk_img *disk, const char *out_path) {
+	filehash_list *list = disk_file_list(disk);
+	dedup_result *res = dedup_find(list);
+
+	printf("DUPLICATE FILES\n");
+	printf("==================================================\n");
+	printf("Files: %u (%llu bytes)\n", list->count, (unsigned long long)list->total_bytes);
+	printf("Same size candidates: %u\n", res->candidates);
+	printf("Matched first and last %i KiB: %u\n", DEDUP_EDGE / 1024, res->partial_matches);
+	printf("Hashed in full: %u\n", res->full_hashed);
+	printf("Bytes read: %llu\n", (unsigned long long)res->bytes_read);
+	printf("Duplicate groups: %u (%u files, %llu redundant bytes)\n", res->num_groups, res->count, (unsigned long long)res->wasted_bytes);
+	if(dedup_write(list, res, out_path))
+		printf("Wrote duplicate groups to %s\n", out_path);
+	else
+		printf("Could not open file %s to write duplicate groups\n", out_path);
+	printf("==================================================\n\n");
+
+	dedup_free(res);
+	filehash_free(list);
+}
+
+/*
+ * Split the whole image into content defined chunks and estimate how well it would deduplicate in a chunk store
+ *
+ * @param disk Disk Image state structure
+ * @param avg_size Average chunk size in bytes
+ */
+void disk_cdc(disk_img *disk, uint32_t avg_size) {
+	cdc_result *res = cdc_run(disk->buffer->buf, disk->buffer->len, avg_size, disk_build_zeromap(disk));
+	if(res == NULL) {
+		printf("Average chunk size must be a power of two between %i and %i\n", CDC_AVG_MIN, CDC_AVG_MAX);
+		return;
+	}
+
+	double unique_chunks = 0, unique_bytes = 0;
+	for(uint32_t b = 0; b < CDC_BINS; b++) {
+		if(res->bins[b].chunks == 0)
+			continue;
+		double u = cdc_bin_unique(&(res->bins[b]));
+		unique_chunks += u;
+		unique_bytes += u * ((double)res->bins[b].bytes / res->bins[b].chunks);
+	}
+
+	printf("CONTENT DEFINED CHUNKING\n");
+	printf("==================================================\n");
+	printf("Chunk size: %u min, %u average, %u max\n", res->params.min_size, res->params.avg_size, res->params.max_size);
+	printf("Chunks: %llu (%llu bytes)\n", (unsigned long long)res->chunks, (unsigned long long)res->bytes);
+	printf("Chunks recut at segment boundaries: %llu\n", (unsigned long long)res->resync_chunks);
+	printf("Unique chunks (estimated): %.0f\n", unique_chunks);
+	printf("Unique bytes (estimated): %.0f (%.1f%%)\n", unique_bytes, (res->bytes > 0) ? 100.0 * unique_bytes / res->bytes : 0.0);
+	printf("Deduplication ratio (estimated): %.2f\n", (unique_bytes > 0) ? res->bytes / unique_bytes : 0.0);
+
+	printf("\nSize\tChunks\tBytes\tUnique chunks\n");
+	for(uint32_t b = 0; b < CDC_BINS; b++) {
+		if(res->bins[b].chunks == 0)
+			continue;
+		printf("%llu-%llu\t%llu\t%llu\t%.0f\n", 1ULL << b, (2ULL << b) - 1, (unsigned long long)res->bins[b].chunks,
+			(unsigned long long)res->bins[b].bytes, cdc_bin_unique(&(res->bins[b])));
+	}
+	printf("==================================================\n\n");
+
+	cdc_free(res);
+}
+
+/*
+ * Compare the image with another image of the same disk and output the changed byte ranges, split by what occupies
+ * them in this image
+ *
+ * @param disk Disk Image state structure
+ * @param other_path Path of the image to compare with
+ */
+void disk_diff(disk_img *disk, const char *other_path) {
+	byte_buffer *other = bb_new_map(other_path);
+	if(other == NULL) {
+		printf("Could not open image %s\n", other_path);
+		return;
+	}
+
+	diff_result *res = diff_images(disk->buffer->buf, disk->buffer->len, other->buf, other->len);
+
+	printf("IMAGE DIFF\n");
+	printf("==================================================\n");
+	printf("Compared with: %s\n", other_path);
+	if(res->len_a != res->len_b)
+		printf("Image sizes differ: %llu and %llu bytes\n", (unsigned long long)res->len_a, (unsigned long long)res->len_b);
+	printf("Changed blocks: %llu (%i bytes each)\n", (unsigned long long)res->changed_blocks, DIFF_BLOCK);
+	printf("Changed ranges: %u (%llu bytes)\n", res->ranges.count, (unsigned long long)res->changed_bytes);
+
+	revmap *map = disk_build_revmap(disk);
+	char desc[FAT_NAME_MAX + 128];
+	printf("\nOffset\tLength\tLocation\n");
+	for(uint32_t i = 0; i < res->ranges.count; i++) {
+		uint64_t off = res->ranges.ext[i].start, end = off + res->ranges.ext[i].length;
+		while(off < end) {
+			revmap_interval iv = revmap_lookup(map, off);
+			uint64_t piece_end = (iv.end > off && iv.end < end) ? iv.end : end;
+			disk_describe_interval(disk, &iv, off, desc, sizeof(desc));
+			printf("%llu\t%llu\t%s\n", (unsigned long long)off, (unsigned long long)(piece_end - off), desc);
+			off = piece_end;
+		}
+	}
+	printf("==================================================\n\n");
+
+	diff_free(res);
+	bb_free(other);
+}
+
+/*
+ * Build a timeline of file system activity across every FAT partition, sort it and write it out
+ *
+ * @param disk Disk Image state structure
+ * @param out_path Path of the timeline file
+ * @param format TL_FORMAT_CSV or TL_FORMAT_BODYFILE
+ */
+void disk_timeline(disk_img *disk, const char *out_path, int format) {
+	disk_require(disk, DISK_STAGE_DIRECTORIES);
+	timeline *tl = timeline_new();
+
+	uint8_t part_type = 0;
+	for(int i = 0; i < 4; i++) {
+		part_type = disk_volume_type(disk, i);
+		if(part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32)
+			timeline_add_fat(tl, (fat_partition*)(disk->partition[i]), i);
+	}
+
+	timeline_sort(tl);
+	if(timeline_write(tl, out_path, format))
+		printf("Wrote %llu timeline events to %s\n", (unsigned long long)tl->count, out_path);
+
+	timeline_free(tl);
+}
+
+/*
+ * Release all resources related to the currently open disk image
+ *
+ * @param disk Disk Image state structure
+ */
+void disk_destroy(disk_img *disk) {
+	if(disk->file_path != NULL)
+		free(disk->file_path);
+
+	if(disk->image_name != NULL)
+		free(disk->image_name);
+
+	if(disk->reverse_map != NULL)
+		revmap_free(disk->reverse_map);
+
+	if(disk->zero_map != NULL)
+		zeromap_free(disk->zero_map);
+
+	if(disk->master_boot_record != NULL) {
+		uint8_t part_type = 0;
+		for(int i = 0; i < 4; i++) {
+			// Partitions are not created until they are needed
+			if(disk->partition[i] == NULL)
+				continue;
+
+			part_type = disk->master_boot_record->pentry[i].type;
+
+			if(part_type == PT_FAT12 || part_type == PT_FAT16B || part_type == PT_FAT32) {
+				fat_free_partition((fat_partition*)(disk->partition[i]));
+			} else if(part_type == PT_NTFS) {
+				ntfs_free_partition((ntfs_partition*)(disk->partition[i]));
+			}
+		}
+
+		mbr_free(disk->master_boot_record);
+	}
+
+	// Restored volumes point into the mapped index
+	if(disk->index != NULL)
+		metaidx_close(disk->index);
+
+	if(disk->buffer != NULL)
+		bb_free(disk->buffer);
+
+	free(disk);
 }
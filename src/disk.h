@@ -20,12 +20,49 @@
 #define _DISK_H_
 
 #include "bytebuffer.h"
+#include "carve.h"
+#include "cdc.h"
+#include "dedup.h"
+#include "diff.h"
+#include "digest.h"
+#include "entropy.h"
+#include "filehash.h"
+#include "hashdb.h"
+#include "search.h"
+#include "strext.h"
+#include "zeromap.h"
 #include "fat.h"
+#include "frag.h"
 #include "mbr.h"
 #include "md5.h"
+#include "metaidx.h"
+#include "ntfs.h"
+#include "out.h"
+#include "recover.h"
+#include "revmap.h"
+#include "timeline.h"
 #include "sha1.h"
 #include "shared.h"
 
+/*
+ * Analysis stages, run on demand by disk_require(). Each stage runs after the stages it depends on
+ */
+#define DISK_STAGE_IMAGE 0x01 // Image mapped
+#define DISK_STAGE_MBR 0x02 // Partition table
+#define DISK_STAGE_VOLUMES 0x04 // Boot sectors of every partition
+#define DISK_STAGE_TABLES 0x08 // NTFS MFT and data runs
+#define DISK_STAGE_DIRECTORIES 0x10 // FAT directory trees and NTFS paths
+#define DISK_STAGE_ZEROMAP 0x20 // Zero blocks
+#define DISK_STAGE_CHECKSUMS 0x40 // MD5 and SHA1 of the whole image
+
+/*
+ * Results of disk_save_index()
+ */
+#define DISK_INDEX_FAILED -1
+#define DISK_INDEX_CURRENT 0 // Left alone
+#define DISK_INDEX_WRITTEN 1
+#define DISK_INDEX_CHECKSUMS 2 // Checksums added
+
 /*
  * Disk state structure
  */
@@ -39,6 +76,19 @@ typedef struct disk_img_t {
 	mbr *master_boot_record;
    //gpt *guid_table;
 	void *partition[4];
+
+	// Byte offset to owner index. Built on first use, see disk_build_revmap()
+	revmap *reverse_map;
+	// All zero blocks. Built on first use, see disk_build_zeromap()
+	zeromap *zero_map;
+	// MD5 and SHA1 of the whole image. See disk_output_md5()
+	digest_result image_digest;
+
+	// DISK_STAGE_* that have run
+	uint32_t stages;
+
+	// Set when the disk was opened from a metadata index instead of the image. See disk_open_index()
+	metaidx *index;
 } disk_img;
 
 /*
@@ -46,10 +96,37 @@ typedef struct disk_img_t {
  */
 
 disk_img *disk_init(const char *path);
+disk_img *disk_open_index(const char *path, const char *index_path);
+void disk_require(disk_img *disk, uint32_t stages);
+bool disk_write_index(disk_img *disk, const char *index_path);
+int disk_save_index(disk_img *disk, const char *index_path);
 void disk_output_sha1(disk_img *disk, const char *out_path);
 void disk_output_md5(disk_img *disk, const char *out_path);
 void disk_parse(disk_img *disk);
-void disk_print(disk_img *disk, bool verbose);
+void disk_print(disk_img *disk, bool verbose, bool checksums, out_writer *out);
+void disk_recover(disk_img *disk, bool unallocated);
+void disk_frag_report(disk_img *disk, const char *prefix, uint32_t clusters_per_cell);
+revmap *disk_build_revmap(disk_img *disk);
+void disk_describe_interval(disk_img *disk, revmap_interval *iv, uint64_t offset, char *dest, size_t dest_len);
+void disk_locate(disk_img *disk, const uint64_t *offsets, size_t count);
+void disk_lookup(disk_img *disk, char **paths, size_t count);
+void disk_extract(disk_img *disk, char **paths, size_t count);
+void disk_list(disk_img *disk, out_writer *out);
+void disk_unallocated_ranges(disk_img *disk, extent_list *out);
+zeromap *disk_build_zeromap(disk_img *disk);
+void disk_data_ranges(disk_img *disk, extent_list *ranges, extent_list *out);
+void disk_carve(disk_img *disk, carve_set *set, const char *out_dir, bool unallocated);
+void disk_strings(disk_img *disk, uint64_t min_len);
+void disk_search(disk_img *disk, search_set *set);
+void disk_entropy(disk_img *disk, const char *out_path, int format);
+uint32_t disk_block_regions(disk_img *disk, hashdb_region *out);
+void disk_block_match(disk_img *disk, hashdb *db);
+filehash_list *disk_file_list(disk_img *disk);
+void disk_hash_files(disk_img *disk, const char *out_path, hashdb *known);
+void disk_dedup(disk_img *disk, const char *out_path);
+void disk_cdc(disk_img *disk, uint32_t avg_size);
+void disk_diff(disk_img *disk, const char *other_path);
+void disk_timeline(disk_img *disk, const char *out_path, int format);
 void disk_destroy(disk_img *disk);
 
 #endif
\ No newline at end of file
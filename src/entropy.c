@@ -0,0 +1,266 @@
+/**
+   dd_reader
+   entropy.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <math.h>
+
+#include "entropy.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define ENTROPY_WRITE_BUFFER (1024 * 1024)
+
+/*
+ * State of one entropy_build() call
+ */
+typedef struct entropy_job_t {
+	entropy_map *map;
+	const uint8_t *img;
+	zeromap *zeros; // Consulted when its block size matches, NULL if none
+	double *clog; // clog[c] = c * log2(c), for c up to the block size
+	uint64_t (*histograms)[256]; // One per worker thread
+} entropy_job;
+
+// True if all len bytes at p equal p[0]. Wiped (zero or pattern filled) blocks skip histogramming
+static bool entropy_uniform(const uint8_t *p, uint32_t len) {
+	uint32_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128i first = _mm_set1_epi8((char)p[0]);
+	__m128i diff = _mm_setzero_si128();
+	for(; i + 64 <= len; i += 64) {
+		__m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(p + i)), first);
+		__m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(p + i + 16)), first);
+		__m128i c = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(p + i + 32)), first);
+		__m128i d = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(p + i + 48)), first);
+		diff = _mm_or_si128(diff, _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF)
+			return false;
+	}
+#endif
+
+	for(; i < len; i++) {
+		if(p[i] != p[0])
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Byte histogram of one block. Four interleaved count tables break the dependency between consecutive increments
+ * of the same counter, which is what limits a single table histogram
+ */
+static void entropy_histogram(const uint8_t *p, uint32_t len, uint32_t *counts) {
+	uint16_t t[4][256];
+	uint32_t i = 0;
+	memset(t, 0, sizeof(t));
+
+	for(; i + 8 <= len; i += 8) {
+		uint64_t w = 0;
+		memcpy(&w, p + i, 8);
+		t[0][w & 0xFF]++;
+		t[1][(w >> 8) & 0xFF]++;
+		t[2][(w >> 16) & 0xFF]++;
+		t[3][(w >> 24) & 0xFF]++;
+		t[0][(w >> 32) & 0xFF]++;
+		t[1][(w >> 40) & 0xFF]++;
+		t[2][(w >> 48) & 0xFF]++;
+		t[3][w >> 56]++;
+	}
+	for(; i < len; i++) {
+		t[0][p[i]]++;
+	}
+
+	for(int b = 0; b < 256; b++) {
+		counts[b] = (uint32_t)t[0][b] + t[1][b] + t[2][b] + t[3][b];
+	}
+}
+
+static void entropy_task(void *ctx, size_t index, uint32_t thread) {
+	entropy_job *job = (entropy_job*)ctx;
+	entropy_map *map = job->map;
+	uint64_t *hist = job->histograms[thread];
+	uint32_t counts[256];
+
+	uint64_t first = (uint64_t)index * ENTROPY_BLOCKS_PER_TASK;
+	uint64_t last = (first + ENTROPY_BLOCKS_PER_TASK < map->num_blocks) ? first + ENTROPY_BLOCKS_PER_TASK : map->num_blocks;
+	for(uint64_t b = first; b < last; b++) {
+		uint64_t off = b * map->block_size;
+		uint32_t len = (map->img_len - off < map->block_size) ? (uint32_t)(map->img_len - off) : map->block_size;
+		const uint8_t *p = job->img + off;
+
+		if(job->zeros != NULL && zeromap_is_zero(job->zeros, b)) {
+			map->entropy[b] = 0;
+			map->zeros[b] = (uint16_t)len;
+			hist[0] += len;
+			continue;
+		}
+
+		if(entropy_uniform(p, len)) {
+			map->entropy[b] = 0;
+			map->zeros[b] = (p[0] == 0) ? (uint16_t)len : 0;
+			hist[p[0]] += len;
+			continue;
+		}
+
+		// H = log2(n) - sum(c * log2(c)) / n
+		entropy_histogram(p, len, counts);
+		double sum = 0;
+		for(int v = 0; v < 256; v++) {
+			sum += job->clog[counts[v]];
+			hist[v] += counts[v];
+		}
+		double h = log2((double)len) - sum / len;
+		map->entropy[b] = (uint16_t)(h * ENTROPY_SCALE + 0.5);
+		map->zeros[b] = (uint16_t)counts[0];
+	}
+}
+
+/*
+ * Profile every block of the image across the worker threads
+ *
+ * @param block_size Bytes per block, at most 65535. 0 for ENTROPY_BLOCK
+ * @param zeros Zero block map. Its blocks are not read again if it has the same block size. May be NULL
+ * @return Map to release with entropy_free()
+ */
+entropy_map *entropy_build(const uint8_t *img, uint64_t img_len, uint32_t block_size, zeromap *zeros) {
+	entropy_map *map = (entropy_map*)malloc(sizeof(entropy_map));
+	memset(map, 0, sizeof(entropy_map));
+
+	map->block_size = (block_size > 0 && block_size <= UINT16_MAX) ? block_size : ENTROPY_BLOCK;
+	map->img_len = img_len;
+	map->num_blocks = (img_len + map->block_size - 1) / map->block_size;
+	map->entropy = (uint16_t*)malloc((map->num_blocks > 0 ? map->num_blocks : 1) * sizeof(uint16_t));
+	map->zeros = (uint16_t*)malloc((map->num_blocks > 0 ? map->num_blocks : 1) * sizeof(uint16_t));
+
+	entropy_job job;
+	uint32_t num_threads = par_num_threads();
+	job.map = map;
+	job.img = img;
+	job.zeros = (zeros != NULL && zeros->block_size == map->block_size) ? zeros : NULL;
+	job.clog = (double*)malloc((map->block_size + 1) * sizeof(double));
+	job.histograms = (uint64_t(*)[256])calloc(num_threads, sizeof(uint64_t[256]));
+	job.clog[0] = 0;
+	for(uint32_t c = 1; c <= map->block_size; c++) {
+		job.clog[c] = c * log2((double)c);
+	}
+
+	par_run((map->num_blocks + ENTROPY_BLOCKS_PER_TASK - 1) / ENTROPY_BLOCKS_PER_TASK, entropy_task, &job);
+
+	for(uint32_t t = 0; t < num_threads; t++) {
+		for(int v = 0; v < 256; v++) {
+			map->histogram[v] += job.histograms[t][v];
+		}
+	}
+
+	free(job.histograms);
+	free(job.clog);
+	return map;
+}
+
+void entropy_free(entropy_map *map) {
+	free(map->entropy);
+	free(map->zeros);
+	free(map);
+}
+
+/*
+ * Write the map as CSV (one line per block) or in the binary layout described in entropy.h
+ *
+ * @return False if the file could not be written
+ */
+bool entropy_write(entropy_map *map, const char *path, int format) {
+	FILE *fp = fopen(path, (format == ENTROPY_FORMAT_BINARY) ? "wb" : "w");
+	if(fp == NULL) {
+		printf("Could not open file %s to write the entropy map\n", path);
+		return false;
+	}
+
+	char *iobuf = (char*)malloc(ENTROPY_WRITE_BUFFER);
+	setvbuf(fp, iobuf, _IOFBF, ENTROPY_WRITE_BUFFER);
+
+	if(format == ENTROPY_FORMAT_BINARY) {
+		uint8_t hdr[32], rec[4];
+		memcpy(hdr, ENTROPY_MAGIC, 8);
+		write_le32(hdr + 8, ENTROPY_VERSION);
+		write_le32(hdr + 12, map->block_size);
+		write_le64(hdr + 16, map->num_blocks);
+		write_le64(hdr + 24, map->img_len);
+		fwrite(hdr, 1, sizeof(hdr), fp);
+
+		for(uint64_t b = 0; b < map->num_blocks; b++) {
+			write_le16(rec, map->entropy[b]);
+			write_le16(rec + 2, map->zeros[b]);
+			fwrite(rec, 1, sizeof(rec), fp);
+		}
+	} else {
+		fprintf(fp, "Offset,Length,Entropy,Zero Fraction\n");
+		for(uint64_t b = 0; b < map->num_blocks; b++) {
+			uint64_t off = b * map->block_size;
+			uint64_t len = (map->img_len - off < map->block_size) ? map->img_len - off : map->block_size;
+			fprintf(fp, "%llu,%llu,%.3f,%.4f\n", (unsigned long long)off, (unsigned long long)len,
+				(double)map->entropy[b] / ENTROPY_SCALE, (double)map->zeros[b] / len);
+		}
+	}
+
+	bool ok = (ferror(fp) == 0);
+	fclose(fp);
+	free(iobuf);
+	if(!ok)
+		printf("Could not write the entropy map to %s\n", path);
+	return ok;
+}
+
+/*
+ * Coalesce the consecutive blocks of [start, end) whose entropy is at least min_entropy into byte ranges
+ *
+ * @param out Ranges (start, length in bytes) are appended in image order
+ */
+void entropy_high_regions(entropy_map *map, uint64_t start, uint64_t end, uint16_t min_entropy, extent_list *out) {
+	if(end > map->img_len)
+		end = map->img_len;
+	uint64_t first = start / map->block_size;
+	uint64_t last = (end + map->block_size - 1) / map->block_size;
+
+	for(uint64_t b = first; b < last; b++) {
+		if(map->entropy[b] < min_entropy)
+			continue;
+
+		uint64_t off = b * map->block_size;
+		uint64_t len = (map->img_len - off < map->block_size) ? map->img_len - off : map->block_size;
+		extent_list_append(out, off, len, true);
+	}
+}
+
+// Mean entropy of the blocks overlapping a byte range, in ENTROPY_SCALE units
+uint32_t entropy_mean(entropy_map *map, uint64_t start, uint64_t length) {
+	uint64_t first = start / map->block_size;
+	uint64_t last = (start + length + map->block_size - 1) / map->block_size;
+	uint64_t sum = 0;
+
+	if(last > map->num_blocks)
+		last = map->num_blocks;
+	if(first >= last)
+		return 0;
+
+	for(uint64_t b = first; b < last; b++) {
+		sum += map->entropy[b];
+	}
+	return (uint32_t)(sum / (last - first));
+}
@@ -0,0 +1,71 @@
+/**
+   dd_reader
+   entropy.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _ENTROPY_H_
+#define _ENTROPY_H_
+
+#include "extent.h"
+#include "parallel.h"
+#include "shared.h"
+#include "zeromap.h"
+
+#define ENTROPY_BLOCK 4096 // Default bytes per block
+#define ENTROPY_BLOCKS_PER_TASK 4096 // Blocks profiled per parallel task
+
+// Entropy is stored in thousandths of a bit per byte, 0 - 8000
+#define ENTROPY_SCALE 1000
+// Blocks at or above this are likely compressed or encrypted
+#define ENTROPY_HIGH 7500
+
+// Largest high entropy regions listed per partition
+#define ENTROPY_TOP_REGIONS 5
+
+// Output formats
+#define ENTROPY_FORMAT_CSV 0
+#define ENTROPY_FORMAT_BINARY 1
+
+/*
+ * Binary map layout (little endian): 8 byte magic, uint32 version, uint32 block size, uint64 block count,
+ * uint64 image size, then per block a uint16 entropy and a uint16 zero byte count
+ */
+#define ENTROPY_MAGIC "DDENTMAP"
+#define ENTROPY_VERSION 1
+
+/*
+ * Per block Shannon entropy and zero byte counts of an image. The last block may be short
+ */
+typedef struct entropy_map_t {
+	uint32_t block_size;
+	uint64_t num_blocks;
+	uint64_t img_len;
+	uint16_t *entropy; // See ENTROPY_SCALE
+	uint16_t *zeros; // Number of 0x00 bytes
+	uint64_t histogram[256]; // Byte value counts over the whole image
+} entropy_map;
+
+/*
+ * Entropy map functions
+ */
+
+entropy_map *entropy_build(const uint8_t *img, uint64_t img_len, uint32_t block_size, zeromap *zeros);
+void entropy_free(entropy_map *map);
+bool entropy_write(entropy_map *map, const char *path, int format);
+void entropy_high_regions(entropy_map *map, uint64_t start, uint64_t end, uint16_t min_entropy, extent_list *out);
+uint32_t entropy_mean(entropy_map *map, uint64_t start, uint64_t length);
+
+#endif
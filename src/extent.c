@@ -0,0 +1,64 @@
+/**
+   dd_reader
+   extent.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "extent.h"
+
+void extent_list_init(extent_list *list) {
+	memset(list, 0, sizeof(extent_list));
+}
+
+void extent_list_free(extent_list *list) {
+	if(list->ext != NULL)
+		free(list->ext);
+
+	memset(list, 0, sizeof(extent_list));
+}
+
+/*
+ * Add a run of clusters to the end of the list
+ *
+ * @param merge If true and the run directly follows the last extent, extend it instead of adding a new one.
+ * Callers pass false when starting a new file so slices never share an extent
+ */
+void extent_list_append(extent_list *list, uint64_t start, uint64_t length, bool merge) {
+	if(merge && list->count > 0) {
+		extent *last = &(list->ext[list->count - 1]);
+		if(start == EXTENT_SPARSE ? last->start == EXTENT_SPARSE : (last->start != EXTENT_SPARSE && last->start + last->length == start)) {
+			last->length += length;
+			return;
+		}
+	}
+
+	if(list->count == list->cap) {
+		list->cap = (list->cap == 0) ? 1024 : list->cap * 2;
+		list->ext = (extent*)realloc(list->ext, list->cap * sizeof(extent));
+	}
+
+	list->ext[list->count].start = start;
+	list->ext[list->count].length = length;
+	list->count++;
+}
+
+// Sum of the lengths (in clusters) of count extents, including sparse runs
+uint64_t extent_total_length(const extent *ext, uint32_t count) {
+	uint64_t total = 0;
+	for(uint32_t i = 0; i < count; i++) {
+		total += ext[i].length;
+	}
+	return total;
+}
@@ -0,0 +1,57 @@
+/**
+   dd_reader
+   extent.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _EXTENT_H_
+#define _EXTENT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Start value of an extent that has no clusters backing it (sparse run)
+#define EXTENT_SPARSE UINT64_MAX
+
+/*
+ * A run of contiguous clusters belonging to a file.
+ * FAT: start is a data cluster number. NTFS: start is a logical cluster number (LCN)
+ */
+typedef struct extent_t {
+	uint64_t start;
+	uint64_t length; // Number of clusters
+} extent;
+
+/*
+ * Growable array of extents. A filesystem keeps one list for the whole volume and each file refers to a slice of it
+ */
+typedef struct extent_list_t {
+	extent *ext;
+	uint32_t count;
+	uint32_t cap;
+} extent_list;
+
+/*
+ * Extent functions
+ */
+
+void extent_list_init(extent_list *list);
+void extent_list_free(extent_list *list);
+void extent_list_append(extent_list *list, uint64_t start, uint64_t length, bool merge);
+uint64_t extent_total_length(const extent *ext, uint32_t count);
+
+#endif
@@ -23,6 +23,7 @@
 fat_partition *fat_new_partition() {
 	fat_partition *part = (fat_partition*)malloc(sizeof(fat_partition));
 	memset(part, 0, sizeof(fat_partition));
+	pthread_mutex_init(&(part->open_lock), NULL);
 
 	return part;
 }
@@ -34,23 +35,76 @@ void fat_free_partition(fat_partition *part) {
 	if(part->fsinfo != NULL)
 		fat_free_fsinfo(part->fsinfo);
 
+	if(part->free_map != NULL)
+		free(part->free_map);
+
+	if(part->files != NULL)
+		free(part->files);
+
+	if(part->paths != NULL)
+		pathidx_free(part->paths);
+
+	if(part->arena != NULL)
+		arena_free(part->arena);
+
+	extent_list_free(&(part->extents));
+
+	if(part->cache != NULL)
+		cache_free(part->cache);
+
+	pthread_mutex_destroy(&(part->open_lock));
 	free(part);
 }
 
-void fat_read_partition(byte_buffer *bb, fat_partition *part) {
+/*
+ * Read the boot sector and, on FAT32, the FSINFO sector of the volume starting at the current position. Enough for the
+ * layout of the volume; fat_read_partition() also locates the FAT and data area in the image
+ */
+void fat_read_boot_region(byte_buffer *bb, fat_partition *part) {
 	// Keep the byte address of the start of the partiton
 	part->start_pos = bb->pos;
 
+	if(bb->pos + 512 > bb->len) {
+		fprintf(stderr, "Warning: FAT boot sector lies outside of the image\n");
+		part->boot_sector = fat_new_boot_sector();
+		return;
+	}
+
 	// Boot sector
 	fat_read_boot_sector(bb, part);
 	
 	// FAT32: Jump to FSINFO and read it
 	if(part->type == PT_FAT32) {
-		// Boot sector is always at sector 0 so skip to the relative sector offset of the FSINFO
-		// We subtract 1 from the fsinfo_sector to account for the boot sector ("first sector")
-		bb_skip(bb, part->boot_sector->bpb.bytes_per_sector * (part->boot_sector->bpb.fsinfo_sector_f32 - 1));
+		// Boot sector is always at sector 0 so the FSINFO is at its relative sector offset
+		uint64_t fsinfo_pos = part->start_pos + (uint64_t)part->boot_sector->bpb.bytes_per_sector * part->boot_sector->bpb.fsinfo_sector_f32;
+		if(part->boot_sector->bpb.fsinfo_sector_f32 == 0 || fsinfo_pos + 512 > bb->len) {
+			fprintf(stderr, "Warning: FAT FSINFO sector lies outside of the image\n");
+			return;
+		}
+		bb->pos = (size_t)fsinfo_pos;
 		fat_read_fsinfo(bb, part);
 	}
+}
+
+void fat_read_partition(byte_buffer *bb, fat_partition *part) {
+	fat_read_boot_region(bb, part);
+
+	// Remember where the volume lives in the image so clusters and the FAT can be accessed directly
+	part->vol = bb->buf + part->start_pos;
+	part->vol_len = (part->start_pos < bb->len) ? bb->len - part->start_pos : 0;
+	if(!part->valid) {
+		bb->pos = part->start_pos;
+		return;
+	}
+	part->max_cluster = fat_count_clusters(part) + 1;
+
+	uint64_t fat_pos = (uint64_t)part->boot_sector->bpb.reserved_sectors * part->boot_sector->bpb.bytes_per_sector;
+	uint64_t fat_len = (uint64_t)fat_sectors_per_fat(part) * part->boot_sector->bpb.bytes_per_sector;
+	if(fat_pos + fat_len <= part->vol_len) {
+		part->fat_table = part->vol + fat_pos;
+		part->fat_table_len = (uint32_t)fat_len;
+	} else
+		fprintf(stderr, "Warning: FAT table lies outside of the image, cluster chains are unavailable\n");
 
 	// Move to the start of the FAT tables
 	bb->pos = part->start_pos + (part->boot_sector->bpb.reserved_sectors * part->boot_sector->bpb.bytes_per_sector);
@@ -61,6 +115,11 @@ void fat_write_partition(byte_buffer *bb, fat_partition *part) {
 }
 
 void fat_print_partition(fat_partition *part, bool verbose) {
+	if(!part->valid) {
+		printf("Volume is unavailable: the boot sector is invalid\n");
+		return;
+	}
+
 	if(verbose) {
 		printf("Boot Sector\n");
 		printf("OEM ID: ");
@@ -105,7 +164,7 @@ void fat_print_partition(fat_partition *part, bool verbose) {
 		print_ascii(part->boot_sector->ebpb.system_id, sizeof(part->boot_sector->ebpb.system_id));
 		printf("\n");
 		
-		if(part->type == PT_FAT32) {
+		if(part->type == PT_FAT32 && part->fsinfo != NULL) {
 			printf("\nFSINFO\n");
 			printf("Free Cluster Count: %u\n", part->fsinfo->free_cluster_count);
 			printf("Next Free Cluster: %u\n", part->fsinfo->next_free_cluster);
@@ -124,6 +183,68 @@ void fat_print_partition(fat_partition *part, bool verbose) {
 	printf("The first sector of cluster 2: %i sectors\n", fat_data_start_abs(part));
 }
 
+/*
+ * Output the layout of the volume as one record. Verbose adds the rest of the BPB and EBPB; FAT32-only fields are 0
+ * on FAT12/16 so every FAT volume has the same fields
+ *
+ * @param out Writer with a section open
+ * @param partition MBR partition entry of the volume
+ */
+void fat_output_partition(fat_partition *part, out_writer *out, uint8_t partition, bool verbose) {
+	fat_bs *bs = part->boot_sector;
+
+	// An unavailable volume keeps the columns of the section, but none of its boot sector is reported
+	fat_bs none;
+	if(!part->valid) {
+		memset(&none, 0, sizeof(fat_bs));
+		bs = &none;
+	}
+	fat_bpb *bpb = &(bs->bpb);
+	fat_ebpb *ebpb = &(bs->ebpb);
+
+	const char *fs = "";
+	if(part->valid)
+		fs = (part->type == PT_FAT32) ? "FAT32" : (part->type == PT_FAT12) ? "FAT12" : "FAT16";
+
+	out_record_begin(out);
+	out_u64(out, "Partition", partition);
+	out_u64(out, "Available", part->valid);
+	out_str(out, "FileSystem", fs);
+	out_ascii(out, "OEMID", bs->oem_id, sizeof(bs->oem_id));
+	out_u64(out, "BytesPerSector", bpb->bytes_per_sector);
+	out_u64(out, "SectorsPerCluster", bpb->sectors_per_cluster);
+	out_u64(out, "ReservedSectors", bpb->reserved_sectors);
+	out_u64(out, "NumFATs", bpb->num_fats);
+	out_u64(out, "SectorsPerFAT", part->valid ? fat_sectors_per_fat(part) : 0);
+	out_u64(out, "FATStart", bpb->reserved_sectors);
+	out_u64(out, "FATEnd", part->valid ? fat_data_start_rel(part) - fat_rootdir_size(part) - 1 : 0);
+	out_u64(out, "RootEntries", bpb->root_entries_f16);
+	out_u64(out, "DataStart", part->valid ? fat_data_start_abs(part) : 0);
+	out_u64(out, "Clusters", part->valid ? fat_count_clusters(part) : 0);
+	out_u64(out, "VolumeSerial", ebpb->volume_serial);
+	out_ascii(out, "VolumeLabel", ebpb->volume_label, sizeof(ebpb->volume_label));
+	if(verbose) {
+		out_u64(out, "TotalSectors16", bpb->total_sectors_16bit);
+		out_u64(out, "TotalSectors32", bpb->total_sectors_32bit);
+		out_u64(out, "Media", bpb->media_descriptor);
+		out_u64(out, "SectorsPerTrack", bpb->sectors_per_track);
+		out_u64(out, "NumHeads", bpb->num_heads);
+		out_u64(out, "HiddenSectors", bpb->hidden_sectors);
+		out_u64(out, "PhysicalDriveNum", ebpb->physical_drive_num);
+		out_u64(out, "Signature", ebpb->eb_sig);
+		out_ascii(out, "SystemID", ebpb->system_id, sizeof(ebpb->system_id));
+		bool f32 = (part->type == PT_FAT32);
+		out_u64(out, "FlagsF32", f32 ? bpb->eflags_f32 : 0);
+		out_u64(out, "VersionF32", f32 ? bpb->version_f32 : 0);
+		out_u64(out, "RootClusterF32", f32 ? bpb->root_cluster_f32 : 0);
+		out_u64(out, "FSInfoSectorF32", f32 ? bpb->fsinfo_sector_f32 : 0);
+		out_u64(out, "BackupSectorF32", f32 ? bpb->backup_sector_f32 : 0);
+		out_u64(out, "FreeClusterCountF32", (f32 && part->fsinfo != NULL) ? part->fsinfo->free_cluster_count : 0);
+		out_u64(out, "NextFreeClusterF32", (f32 && part->fsinfo != NULL) ? part->fsinfo->next_free_cluster : 0);
+	}
+	out_record_end(out);
+}
+
 // Location calculation helper functions
 
 // Return the specified sectors per fat from the BPB
@@ -186,6 +307,705 @@ uint32_t fat_cluster_to_sector_rel(fat_partition *part, uint32_t cluster) {
 	return ((cluster - 2) * part->boot_sector->bpb.sectors_per_cluster) + fat_data_start_rel(part);
 }
 
+// Size of a cluster in bytes
+uint32_t fat_cluster_size(fat_partition *part) {
+	return part->boot_sector->bpb.sectors_per_cluster * part->boot_sector->bpb.bytes_per_sector;
+}
+
+/*
+ * Locate the contents of a data cluster within the image
+ *
+ * @return Pointer to the first byte of the cluster. NULL if the cluster is invalid or not fully present in the image
+ */
+uint8_t *fat_cluster_ptr(fat_partition *part, uint32_t cluster) {
+	if(cluster < 2 || cluster > part->max_cluster)
+		return NULL;
+
+	uint64_t pos = (uint64_t)fat_cluster_to_sector_rel(part, cluster) * part->boot_sector->bpb.bytes_per_sector;
+	if(pos + fat_cluster_size(part) > part->vol_len)
+		return NULL;
+
+	return part->vol + pos;
+}
+
+// File Allocation Table
+
+/*
+ * Decode the FAT entry for a cluster from the first FAT
+ *
+ * @return The next cluster in the chain, an EOC/bad marker or 0 if free. 0 is also returned if the FAT is unavailable
+ */
+uint32_t fat_get_entry(fat_partition *part, uint32_t cluster) {
+	if(part->fat_table == NULL || cluster > part->max_cluster)
+		return 0;
+
+	uint64_t off = 0;
+	switch(part->type) {
+		case PT_FAT12:
+			off = cluster + (cluster / 2);
+			if(off + 2 > part->fat_table_len)
+				return 0;
+			uint16_t v = read_le16(part->fat_table + off);
+			return (cluster & 1) ? (v >> 4) : (v & 0x0FFF);
+
+		case PT_FAT16B:
+			off = (uint64_t)cluster * 2;
+			if(off + 2 > part->fat_table_len)
+				return 0;
+			return read_le16(part->fat_table + off);
+
+		default:
+			off = (uint64_t)cluster * 4;
+			if(off + 4 > part->fat_table_len)
+				return 0;
+			return read_le32(part->fat_table + off) & 0x0FFFFFFF;
+	}
+}
+
+// True if a FAT entry value marks the end of a cluster chain
+bool fat_is_eoc(fat_partition *part, uint32_t value) {
+	switch(part->type) {
+		case PT_FAT12:
+			return value >= 0x0FF8;
+		case PT_FAT16B:
+			return value >= 0xFFF8;
+		default:
+			return value >= 0x0FFFFFF8;
+	}
+}
+
+// True if a FAT entry value (or start cluster from a directory entry) refers to a data cluster on this volume
+bool fat_is_valid_cluster(fat_partition *part, uint32_t value) {
+	return value >= 2 && value <= part->max_cluster;
+}
+
+/*
+ * Build the free cluster bitmap from the first FAT. A set bit means the cluster is unallocated.
+ * Clusters 0 and 1 are reserved and never marked free
+ */
+void fat_build_free_map(fat_partition *part) {
+	if(part->free_map != NULL)
+		return;
+
+	size_t words = (part->max_cluster / 64) + 1;
+	part->free_map = (uint64_t*)calloc(words, sizeof(uint64_t));
+
+	if(part->fat_table == NULL)
+		return;
+
+	for(uint32_t c = 2; c <= part->max_cluster; c++) {
+		if(fat_get_entry(part, c) == 0)
+			part->free_map[c / 64] |= (1ULL << (c % 64));
+	}
+}
+
+// Requires fat_build_free_map(). Out of range clusters are reported as allocated
+bool fat_cluster_is_free(fat_partition *part, uint32_t cluster) {
+	if(cluster < 2 || cluster > part->max_cluster)
+		return false;
+
+	return (part->free_map[cluster / 64] >> (cluster % 64)) & 1;
+}
+
+// Number of free clusters in [start, start + count). Requires fat_build_free_map(). Counts a word of the map at a time
+uint32_t fat_count_free(fat_partition *part, uint32_t start, uint32_t count) {
+	uint32_t free_clusters = 0, c = start, end = start + count;
+
+	while(c < end && (c % 64) != 0) {
+		free_clusters += fat_cluster_is_free(part, c);
+		c++;
+	}
+	while(c + 64 <= end) {
+		free_clusters += __builtin_popcountll(part->free_map[c / 64]);
+		c += 64;
+	}
+	while(c < end) {
+		free_clusters += fat_cluster_is_free(part, c);
+		c++;
+	}
+
+	return free_clusters;
+}
+
+/*
+ * Find the next run of contiguous free clusters. Requires fat_build_free_map()
+ *
+ * @param cluster In: cluster to start searching from. Out: first cluster of the run
+ * @param count Out: number of clusters in the run
+ * @return False if there are no free clusters at or after the starting cluster
+ */
+bool fat_next_free_run(fat_partition *part, uint32_t *cluster, uint32_t *count) {
+	uint64_t end = (uint64_t)part->max_cluster + 1;
+	uint64_t c = (*cluster < 2) ? 2 : *cluster, w = 0;
+
+	// First set bit
+	while(c < end) {
+		w = part->free_map[c / 64] >> (c % 64);
+		if(w != 0) {
+			c += __builtin_ctzll(w);
+			break;
+		}
+		c = (c / 64 + 1) * 64;
+	}
+	if(c >= end)
+		return false;
+
+	// First clear bit after it
+	uint64_t e = c;
+	while(e < end) {
+		w = (~part->free_map[e / 64]) >> (e % 64);
+		if(w != 0) {
+			e += __builtin_ctzll(w);
+			break;
+		}
+		e = (e / 64 + 1) * 64;
+	}
+	if(e > end)
+		e = end;
+
+	*cluster = (uint32_t)c;
+	*count = (uint32_t)(e - c);
+	return true;
+}
+
+// Directories
+
+// Decode a 32 byte short directory entry
+void fat_parse_dirent(const uint8_t *raw, fat_dirent *de) {
+	memcpy(de->name, raw, sizeof(de->name));
+	de->attr = raw[11];
+	de->nt_reserved = raw[12];
+	de->ctime_tenth = raw[13];
+	de->ctime = read_le16(raw + 14);
+	de->cdate = read_le16(raw + 16);
+	de->adate = read_le16(raw + 18);
+	de->cluster_hi = read_le16(raw + 20);
+	de->mtime = read_le16(raw + 22);
+	de->mdate = read_le16(raw + 24);
+	de->cluster_lo = read_le16(raw + 26);
+	de->size = read_le32(raw + 28);
+}
+
+// First cluster of an entry. The high word is only meaningful on FAT32
+uint32_t fat_dirent_cluster(fat_partition *part, const fat_dirent *de) {
+	if(part->type == PT_FAT32)
+		return ((uint32_t)de->cluster_hi << 16) | de->cluster_lo;
+
+	return de->cluster_lo;
+}
+
+/*
+ * Format an 8.3 name as "NAME.EXT"
+ *
+ * @param dest Output buffer of at least 13 bytes
+ */
+void fat_short_name(const uint8_t name[11], char *dest) {
+	int n = 0, end = 8;
+
+	while(end > 0 && name[end-1] == ' ')
+		end--;
+	for(int i = 0; i < end; i++)
+		dest[n++] = (i == 0 && name[i] == FAT_DIRENT_KANJI) ? (char)0xE5 : (char)name[i];
+
+	end = 11;
+	while(end > 8 && name[end-1] == ' ')
+		end--;
+	if(end > 8) {
+		dest[n++] = '.';
+		for(int i = 8; i < end; i++)
+			dest[n++] = (char)name[i];
+	}
+
+	dest[n] = '\0';
+}
+
+// Checksum of the short name stored in each LFN entry that belongs to it
+uint8_t fat_lfn_checksum(const uint8_t name[11]) {
+	uint8_t sum = 0;
+	for(int i = 0; i < 11; i++) {
+		sum = ((sum & 1) ? 0x80 : 0) + (sum >> 1) + name[i];
+	}
+	return sum;
+}
+
+/*
+ * Convert a directory entry timestamp to seconds since the Unix epoch.
+ * FAT stores local time with no zone information, the result treats it as UTC
+ *
+ * @param date Date field. Year from 1980 in bits 15-9, month 8-5, day 4-0
+ * @param time Time field. Hours 15-11, minutes 10-5, seconds/2 4-0. 0 for date only fields (last access)
+ * @param tenth Creation time count of 10ms units (0-199). 0 if not present
+ * @return Epoch seconds or FAT_TIME_NONE if the date is unset or invalid
+ */
+int64_t fat_time_to_epoch(uint16_t date, uint16_t time, uint8_t tenth) {
+	int day = date & 0x1F, month = (date >> 5) & 0x0F, year = 1980 + (date >> 9);
+	int sec = (time & 0x1F) * 2, min = (time >> 5) & 0x3F, hour = time >> 11;
+
+	if(date == 0 || month < 1 || month > 12 || day < 1 || hour > 23 || min > 59 || sec > 59)
+		return FAT_TIME_NONE;
+
+	return epoch_from_civil(year, month, day, hour, min, sec) + (tenth / 100);
+}
+
+/*
+ * Iterate over the blocks making up a directory's entries.
+ * A directory stored in the data region yields one block per cluster in its chain. The fixed FAT12/16 root directory is a single block
+ *
+ * @param first_cluster First cluster of the directory. 0 selects the root directory
+ * @param cb Called for each block. Iteration stops early if it returns false
+ */
+void fat_foreach_dir_block(fat_partition *part, uint32_t first_cluster, fat_dir_block_cb cb, void *ctx) {
+	uint16_t bps = part->boot_sector->bpb.bytes_per_sector;
+	if(!part->valid)
+		return;
+
+	if(first_cluster == 0) {
+		if(part->type == PT_FAT32) {
+			first_cluster = part->boot_sector->bpb.root_cluster_f32;
+		} else {
+			uint64_t pos = (uint64_t)fat_rootdir_start_rel(part) * bps;
+			uint64_t len = (uint64_t)fat_rootdir_size(part) * bps;
+			if(pos + len <= part->vol_len)
+				cb(part, part->vol + pos, (uint32_t)len, pos, ctx);
+			return;
+		}
+	}
+
+	// Follow the chain. The iteration limit guards against loops in a corrupt FAT
+	uint32_t cluster = first_cluster;
+	for(uint32_t n = 0; n < part->max_cluster && fat_is_valid_cluster(part, cluster); n++) {
+		uint8_t *block = fat_cluster_ptr(part, cluster);
+		if(block == NULL)
+			break;
+
+		if(!cb(part, block, fat_cluster_size(part), (uint64_t)(block - part->vol), ctx))
+			break;
+
+		cluster = fat_get_entry(part, cluster);
+	}
+}
+
+/*
+ * State carried across the blocks of a single directory while it is being parsed
+ */
+typedef struct fat_dir_walk_t {
+	uint32_t dir_index; // Index of the directory being read in part->files
+	uint8_t lfn[FAT_LFN_MAX_ENTRIES * FAT_LFN_CHARS * 2]; // Raw UTF-16LE long name assembled so far
+	uint8_t lfn_count; // Number of LFN entries in the current sequence. 0 if there is none
+	uint8_t lfn_checksum;
+} fat_dir_walk;
+
+static uint32_t fat_add_file(fat_partition *part, uint32_t parent, const char *name, const fat_dirent *de, uint64_t dirent_pos) {
+	if(part->num_files == part->files_cap) {
+		part->files_cap = (part->files_cap == 0) ? 256 : part->files_cap * 2;
+		part->files = (fat_file*)realloc(part->files, part->files_cap * sizeof(fat_file));
+	}
+
+	fat_file *f = &(part->files[part->num_files]);
+	memset(f, 0, sizeof(fat_file));
+	f->parent = parent;
+	f->dirent_pos = dirent_pos;
+	if(de != NULL)
+		f->de = *de;
+
+	f->name = arena_strdup(part->arena, name);
+	if(parent == FAT_NO_PARENT) {
+		f->path = arena_strdup(part->arena, "/");
+	} else {
+		const char *ppath = part->files[parent].path;
+		size_t plen = strlen(ppath), nlen = strlen(name);
+		if(plen == 1)
+			plen = 0; // Parent is the root, avoid "//"
+		f->path = (char*)arena_alloc(part->arena, plen + 1 + nlen + 1);
+		memcpy(f->path, ppath, plen);
+		f->path[plen] = '/';
+		memcpy(f->path + plen + 1, name, nlen + 1);
+	}
+
+	if(part->paths != NULL)
+		pathidx_insert(part->paths, f->path, part->num_files);
+
+	return part->num_files++;
+}
+
+// Copy the 13 UTF-16 characters held by an LFN entry into the long name buffer at its sequence position
+static void fat_lfn_copy(const uint8_t *raw, uint8_t *dest) {
+	memcpy(dest, raw + 1, 10); // Characters 1-5
+	memcpy(dest + 10, raw + 14, 12); // Characters 6-11
+	memcpy(dest + 22, raw + 28, 4); // Characters 12-13
+}
+
+static bool fat_read_dir_block(fat_partition *part, uint8_t *block, uint32_t len, uint64_t vol_pos, void *ctx) {
+	fat_dir_walk *walk = (fat_dir_walk*)ctx;
+	char name[FAT_NAME_MAX];
+	fat_dirent de;
+
+	for(uint32_t off = 0; off + FAT_DIRENT_SIZE <= len; off += FAT_DIRENT_SIZE) {
+		uint8_t *raw = block + off;
+
+		if(raw[0] == FAT_DIRENT_END)
+			return false;
+
+		if(raw[0] == FAT_DIRENT_DELETED) {
+			walk->lfn_count = 0;
+			continue;
+		}
+
+		// Long name entries precede their short entry in reverse order
+		if((raw[11] & 0x3F) == FAT_ATTR_LFN) {
+			uint8_t ord = raw[0] & 0x1F;
+			if(ord == 0 || ord > FAT_LFN_MAX_ENTRIES) {
+				walk->lfn_count = 0;
+				continue;
+			}
+
+			if(raw[0] & FAT_LFN_LAST) {
+				walk->lfn_count = ord;
+				walk->lfn_checksum = raw[13];
+				memset(walk->lfn, 0, sizeof(walk->lfn));
+			} else if(walk->lfn_count == 0 || raw[13] != walk->lfn_checksum) {
+				walk->lfn_count = 0;
+				continue;
+			}
+
+			fat_lfn_copy(raw, walk->lfn + (ord - 1) * FAT_LFN_CHARS * 2);
+			continue;
+		}
+
+		fat_parse_dirent(raw, &de);
+
+		// Skip the volume label and the dot entries
+		if((de.attr & FAT_ATTR_VOLUME_ID) || de.name[0] == '.') {
+			walk->lfn_count = 0;
+			continue;
+		}
+
+		if(walk->lfn_count != 0 && walk->lfn_checksum == fat_lfn_checksum(de.name))
+			utf16le_to_utf8(walk->lfn, walk->lfn_count * FAT_LFN_CHARS, name, sizeof(name));
+		else
+			fat_short_name(de.name, name);
+		walk->lfn_count = 0;
+
+		fat_add_file(part, walk->dir_index, name, &de, vol_pos + off);
+	}
+
+	return true;
+}
+
+/*
+ * Walk the directory tree from the root and populate part->files with every live file and directory.
+ * Directories are visited breadth first so a directory's index is always lower than its children's
+ */
+void fat_read_directory_tree(fat_partition *part) {
+	if(part->files != NULL)
+		return;
+
+	part->arena = arena_new(0);
+	if(part->index_paths && part->paths == NULL)
+		part->paths = pathidx_new(0);
+	fat_add_file(part, FAT_NO_PARENT, "", NULL, 0);
+	part->files[FAT_ROOT_INDEX].de.attr = FAT_ATTR_DIRECTORY;
+
+	// Track directory start clusters already read so a corrupt tree can't loop
+	uint64_t *visited = (uint64_t*)calloc((part->max_cluster / 64) + 1, sizeof(uint64_t));
+	fat_dir_walk walk;
+
+	for(uint32_t i = 0; i < part->num_files; i++) {
+		if(!(part->files[i].de.attr & FAT_ATTR_DIRECTORY))
+			continue;
+
+		uint32_t cluster = (i == FAT_ROOT_INDEX) ? 0 : fat_dirent_cluster(part, &(part->files[i].de));
+		if(i != FAT_ROOT_INDEX) {
+			if(!fat_is_valid_cluster(part, cluster) || ((visited[cluster / 64] >> (cluster % 64)) & 1))
+				continue;
+			visited[cluster / 64] |= (1ULL << (cluster % 64));
+		}
+
+		memset(&walk, 0, sizeof(walk));
+		walk.dir_index = i;
+		fat_foreach_dir_block(part, cluster, fat_read_dir_block, &walk);
+	}
+
+	free(visited);
+}
+
+/*
+ * Follow the cluster chain of every file in the directory tree and record it as a list of extents.
+ * Each file's slice of part->extents is set in its ext_first / ext_count. Cost is linear in the number of allocated clusters
+ */
+void fat_build_extent_index(fat_partition *part) {
+	if(part->has_extents)
+		return;
+
+	fat_read_directory_tree(part);
+
+	uint32_t cs = fat_cluster_size(part);
+	for(uint32_t i = 0; i < part->num_files; i++) {
+		fat_file *f = &(part->files[i]);
+		f->ext_first = part->extents.count;
+		f->ext_count = 0;
+
+		uint32_t cluster = 0, limit = part->max_cluster;
+		if(i == FAT_ROOT_INDEX) {
+			if(part->type != PT_FAT32)
+				continue; // Fixed root directory region, not part of the data area
+			cluster = part->boot_sector->bpb.root_cluster_f32;
+		} else {
+			cluster = fat_dirent_cluster(part, &(f->de));
+			// A file's chain can't be longer than its size. This also bounds the walk when the FAT contains loops
+			if(!(f->de.attr & FAT_ATTR_DIRECTORY))
+				limit = (uint32_t)(((uint64_t)f->de.size + cs - 1) / cs);
+		}
+
+		bool merge = false;
+		for(uint32_t n = 0; n < limit && fat_is_valid_cluster(part, cluster); n++) {
+			extent_list_append(&(part->extents), cluster, 1, merge);
+			merge = true;
+			cluster = fat_get_entry(part, cluster);
+		}
+
+		f->ext_count = part->extents.count - f->ext_first;
+	}
+
+	part->has_extents = true;
+}
+
+/*
+ * Index every path in the directory tree for constant time lookups, walking the tree first if needed.
+ * To index during the walk instead, set part->index_paths before fat_read_directory_tree()
+ */
+void fat_build_path_index(fat_partition *part) {
+	if(part->paths != NULL)
+		return;
+
+	if(part->files == NULL) {
+		part->index_paths = true;
+		fat_read_directory_tree(part);
+		return;
+	}
+
+	part->paths = pathidx_new(part->num_files);
+	for(uint32_t i = 0; i < part->num_files; i++) {
+		pathidx_insert(part->paths, part->files[i].path, i);
+	}
+}
+
+/*
+ * Find a file or directory by its full path (case insensitive, '/' separated, starting at the root)
+ *
+ * @return The file, or NULL if no such path exists on the volume
+ */
+fat_file *fat_lookup_path(fat_partition *part, const char *path) {
+	uint32_t index = 0;
+
+	fat_build_path_index(part);
+	if(!pathidx_lookup(part->paths, path, &index))
+		return NULL;
+
+	return &(part->files[index]);
+}
+
+// File access
+
+// Cache fill function: copy a cluster out of the image
+static bool fat_cache_fill(void *ctx, uint64_t cluster, uint8_t *dest) {
+	fat_partition *part = (fat_partition*)ctx;
+	uint8_t *src = fat_cluster_ptr(part, (uint32_t)cluster);
+	if(src == NULL)
+		return false;
+
+	memcpy(dest, src, fat_cluster_size(part));
+	return true;
+}
+
+// Build what handles read from: the directory tree, the extent index and the shared cache. Requires part->open_lock
+static void fat_prepare_open(fat_partition *part) {
+	fat_build_extent_index(part);
+	if(part->cache == NULL)
+		part->cache = cache_new(fat_cluster_size(part), FAT_CACHE_SIZE, fat_cache_fill, part);
+}
+
+// A handle on a file of a partition prepared by fat_prepare_open()
+static fat_handle *fat_new_handle(fat_partition *part, fat_file *file) {
+	fat_handle *h = (fat_handle*)malloc(sizeof(fat_handle));
+	memset(h, 0, sizeof(fat_handle));
+	h->part = part;
+	h->file = file;
+	h->ext = part->extents.ext + file->ext_first;
+	h->num_ext = file->ext_count;
+	h->ext_end = (uint64_t*)malloc((file->ext_count + 1) * sizeof(uint64_t));
+
+	uint64_t total = 0;
+	for(uint32_t i = 0; i < h->num_ext; i++) {
+		total += h->ext[i].length;
+		h->ext_end[i] = total;
+	}
+
+	// Directories have no size, expose all of their clusters instead
+	uint64_t allocated = total * fat_cluster_size(part);
+	h->size = (file->de.attr & FAT_ATTR_DIRECTORY) ? allocated : file->de.size;
+	if(h->size > allocated)
+		h->size = allocated; // Truncated chain
+
+	h->ra_window = 1;
+	return h;
+}
+
+/*
+ * Open a file or directory by its full path for reading. Safe to call from several threads at once
+ *
+ * @return Handle positioned at the start of the file. NULL if the path does not exist or the volume is unavailable
+ */
+fat_handle *fat_open(fat_partition *part, const char *path) {
+	if(!part->valid)
+		return NULL;
+
+	pthread_mutex_lock(&(part->open_lock));
+	fat_prepare_open(part);
+	fat_file *f = fat_lookup_path(part, path);
+	pthread_mutex_unlock(&(part->open_lock));
+
+	if(f == NULL)
+		return NULL;
+	return fat_new_handle(part, f);
+}
+
+/*
+ * Open an entry of part->files for reading. Safe to call from several threads at once
+ *
+ * @return Handle positioned at the start of the file. Release with fat_close(). NULL if the volume is unavailable
+ */
+fat_handle *fat_open_file(fat_partition *part, fat_file *file) {
+	if(!part->valid)
+		return NULL;
+
+	pthread_mutex_lock(&(part->open_lock));
+	fat_prepare_open(part);
+	pthread_mutex_unlock(&(part->open_lock));
+
+	return fat_new_handle(part, file);
+}
+
+/*
+ * Find the extent holding a logical cluster of the file. Checks the extent of the previous read and the next one first,
+ * then binary searches the running totals: O(log extents)
+ */
+static uint32_t fat_handle_extent(fat_handle *h, uint64_t lc) {
+	uint32_t e = h->cur_ext;
+	uint64_t begin = (e == 0) ? 0 : h->ext_end[e - 1];
+	if(lc >= begin && lc < h->ext_end[e])
+		return e;
+	if(e + 1 < h->num_ext && lc >= h->ext_end[e] && lc < h->ext_end[e + 1])
+		return e + 1;
+
+	uint32_t lo = 0, hi = h->num_ext - 1;
+	while(lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if(h->ext_end[mid] <= lc)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// Physical cluster of a logical cluster of the file
+static uint64_t fat_handle_cluster(fat_handle *h, uint64_t lc) {
+	h->cur_ext = fat_handle_extent(h, lc);
+	uint64_t begin = (h->cur_ext == 0) ? 0 : h->ext_end[h->cur_ext - 1];
+	return h->ext[h->cur_ext].start + (lc - begin);
+}
+
+/*
+ * Sequential reads grow a readahead window (doubling up to FAT_READAHEAD_MAX clusters) and prefetch it into the cache.
+ * A seek elsewhere resets the window
+ */
+static void fat_handle_readahead(fat_handle *h, uint64_t lc) {
+	uint64_t num_clusters = h->ext_end[h->num_ext - 1];
+
+	if(lc != h->next_cluster) {
+		h->ra_window = 1;
+		h->ra_end = lc + 1;
+		return;
+	}
+	if(lc + 1 < h->ra_end)
+		return;
+
+	if(h->ra_window < FAT_READAHEAD_MAX)
+		h->ra_window *= 2;
+
+	uint64_t keys[FAT_READAHEAD_MAX];
+	uint32_t n = 0;
+	uint32_t saved_ext = h->cur_ext;
+	for(uint64_t c = lc + 1; c < num_clusters && n < h->ra_window; c++)
+		keys[n++] = fat_handle_cluster(h, c);
+	h->cur_ext = saved_ext;
+
+	cache_prefetch(h->part->cache, keys, n);
+	h->ra_end = lc + 1 + n;
+}
+
+/*
+ * Read from the current position
+ *
+ * @return Number of bytes read. Less than len at the end of the file or if a cluster lies outside of the image
+ */
+size_t fat_read(fat_handle *h, void *buf, size_t len) {
+	uint32_t cs = fat_cluster_size(h->part);
+	uint8_t *dest = (uint8_t*)buf;
+	size_t done = 0;
+
+	while(done < len && h->pos < h->size) {
+		uint64_t lc = h->pos / cs;
+		uint32_t off = (uint32_t)(h->pos % cs);
+		uint64_t n = cs - off;
+		if(n > len - done)
+			n = len - done;
+		if(n > h->size - h->pos)
+			n = h->size - h->pos;
+
+		uint64_t cluster = fat_handle_cluster(h, lc);
+		fat_handle_readahead(h, lc);
+		if(!cache_read(h->part->cache, cluster, off, dest + done, (uint32_t)n))
+			break;
+
+		done += n;
+		h->pos += n;
+		h->next_cluster = (off + n == cs) ? lc + 1 : lc;
+	}
+
+	return done;
+}
+
+/*
+ * Move the read position. Positions past the end are allowed, reads there return 0 bytes
+ *
+ * @param whence FAT_SEEK_SET, FAT_SEEK_CUR or FAT_SEEK_END
+ * @return The new position, or -1 if it would be negative
+ */
+int64_t fat_seek(fat_handle *h, int64_t offset, int whence) {
+	int64_t base = 0;
+	if(whence == FAT_SEEK_CUR)
+		base = (int64_t)h->pos;
+	else if(whence == FAT_SEEK_END)
+		base = (int64_t)h->size;
+
+	if(base + offset < 0)
+		return -1;
+
+	h->pos = (uint64_t)(base + offset);
+	return (int64_t)h->pos;
+}
+
+uint64_t fat_tell(fat_handle *h) {
+	return h->pos;
+}
+
+void fat_close(fat_handle *h) {
+	free(h->ext_end);
+	free(h);
+}
+
 // Reserved Sectors
 
 fat_bs *fat_new_boot_sector() {
@@ -229,8 +1049,15 @@ void fat_read_boot_sector(byte_buffer *bb, fat_partition *part) {
 	bs->bpb.hidden_sectors = bb_get_int(bb);
 	bs->bpb.total_sectors_32bit = bb_get_int(bb);
 
+	// A zeroed or foreign boot sector has no usable sector or cluster size, and every cluster calculation divides by them
+	uint16_t bps = bs->bpb.bytes_per_sector;
+	uint8_t spc = bs->bpb.sectors_per_cluster;
+	part->valid = bps >= 512 && (bps & (bps - 1)) == 0 && spc != 0 && (spc & (spc - 1)) == 0;
+	if(!part->valid)
+		fprintf(stderr, "Warning: FAT boot sector is invalid, the volume is unavailable\n");
+
 	// Make proper determination of the FAT partition type according to MSFT docs
-	uint32_t cluster_count = fat_count_clusters(part);
+	uint32_t cluster_count = part->valid ? fat_count_clusters(part) : 0;
 	if(cluster_count < 4085) {
 		part->type = PT_FAT12;
 	} else if(cluster_count < 65525) {
@@ -270,7 +1097,7 @@ void fat_read_boot_sector(byte_buffer *bb, fat_partition *part) {
 	bs->sig_end1 = bb_get(bb);
 	bs->sig_end2 = bb_get(bb);
 	if(bs->sig_end1 != 0x55 || bs->sig_end2 != 0xAA) {
-		printf("Warning: FAT VBR boot signature does not match 0x55 0xAA!. sig1: %X, sig2: %X\n", bs->sig_end1, bs->sig_end2);
+		fprintf(stderr, "Warning: FAT VBR boot signature does not match 0x55 0xAA!. sig1: %X, sig2: %X\n", bs->sig_end1, bs->sig_end2);
 	}
 }
 
@@ -300,7 +1127,7 @@ void fat_read_fsinfo(byte_buffer *bb, fat_partition *part) {
 	// Read the lead signature to validate this is an FSInfo sector
 	fsi->sig_begin = bb_get_int(bb);
 	if(fsi->sig_begin != 0x41615252) {
-		printf("Warning: FAT FSINFO lead signature does not match 0x41615252. sig_begin: 0x%X\n", fsi->sig_begin);
+		fprintf(stderr, "Warning: FAT FSINFO lead signature does not match 0x41615252. sig_begin: 0x%X\n", fsi->sig_begin);
 	}
 	
 	bb_get_bytes_in(bb, fsi->reserved1, sizeof(fsi->reserved1));
@@ -308,7 +1135,7 @@ void fat_read_fsinfo(byte_buffer *bb, fat_partition *part) {
 	// Structure / Data area signature begin
 	fsi->sig_data_begin = bb_get_int(bb);
 	if(fsi->sig_data_begin != 0x61417272) {
-		printf("Warning: FAT FSINFO data signature does not match 0x61417272. sig_data_begin: 0x%X\n", fsi->sig_data_begin);
+		fprintf(stderr, "Warning: FAT FSINFO data signature does not match 0x61417272. sig_data_begin: 0x%X\n", fsi->sig_data_begin);
 	}
 	
 	fsi->free_cluster_count = bb_get_int(bb);
@@ -318,7 +1145,7 @@ void fat_read_fsinfo(byte_buffer *bb, fat_partition *part) {
 	// End of FSINFO sector marker
 	fsi->sig_end = bb_get_int(bb);
 	if(fsi->sig_end != 0xAA550000) {
-		printf("Warning: FAT FSINFO end signature does not match 0xAA550000. sig_begin: 0x%X\n", fsi->sig_end);
+		fprintf(stderr, "Warning: FAT FSINFO end signature does not match 0xAA550000. sig_begin: 0x%X\n", fsi->sig_end);
 	}
 }
 
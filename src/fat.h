@@ -21,13 +21,56 @@
 
 #include <math.h>
 
+#include "arena.h"
 #include "bytebuffer.h"
+#include "cache.h"
+#include "extent.h"
+#include "out.h"
+#include "pathidx.h"
 #include "shared.h"
 #include "mbr.h"
 
 #define FAT16_BOOTSTRAP_SIZE 448
 #define FAT32_BOOTSTRAP_SIZE 420
 
+/*
+ * Directory entries
+ */
+#define FAT_DIRENT_SIZE 32
+#define FAT_DIRENT_END 0x00 // First byte of name. This and all following entries are unused
+#define FAT_DIRENT_DELETED 0xE5 // First byte of name. Entry was deleted
+#define FAT_DIRENT_KANJI 0x05 // First byte of name. Actual first character is 0xE5
+
+#define FAT_ATTR_READ_ONLY 0x01
+#define FAT_ATTR_HIDDEN 0x02
+#define FAT_ATTR_SYSTEM 0x04
+#define FAT_ATTR_VOLUME_ID 0x08
+#define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_ARCHIVE 0x20
+#define FAT_ATTR_LFN 0x0F // READ_ONLY | HIDDEN | SYSTEM | VOLUME_ID
+
+#define FAT_LFN_LAST 0x40 // Set in the sequence number of the last (physically first) LFN entry
+#define FAT_LFN_CHARS 13 // UTF-16 characters held by one LFN entry
+#define FAT_LFN_MAX_ENTRIES 20
+#define FAT_NAME_MAX 1024 // Max bytes of a UTF-8 encoded name including the terminator
+
+// Index of the root directory in fat_partition.files and parent value of entries that have none
+#define FAT_ROOT_INDEX 0
+#define FAT_NO_PARENT 0xFFFFFFFF
+
+// Memory used by the cluster cache shared by the file handles of a partition
+#define FAT_CACHE_SIZE (16 * 1024 * 1024)
+// Largest readahead window in clusters. The window doubles on each sequential read up to this
+#define FAT_READAHEAD_MAX 64
+
+// Returned by fat_time_to_epoch() for unset or invalid timestamps
+#define FAT_TIME_NONE INT64_MIN
+
+// Whence values for fat_seek()
+#define FAT_SEEK_SET 0
+#define FAT_SEEK_CUR 1
+#define FAT_SEEK_END 2
+
 /*
  * BIOS Parameter Block as part of the Boot Sector
  * Typical values are indicated. Postfix of _f16 indicates FAT12/16 values, _f32 for FAT32
@@ -132,26 +175,109 @@ typedef struct fat_fsinfo_t {
 	uint32_t sig_end; // 0xAA550000 (little). 00 00 55 AA (big). Last 2 bytes match end of sector marker
 } fat_fsinfo;
 
+/*
+ * Short (8.3) directory entry as it is laid out on disk
+ */
+typedef struct fat_dirent_t {
+	uint8_t name[11]; // 8 byte name, 3 byte extension padded with spaces
+	uint8_t attr;
+	uint8_t nt_reserved;
+	uint8_t ctime_tenth; // Creation time, count of 10ms units (0-199)
+	uint16_t ctime; // Creation time. Hours 15-11, minutes 10-5, seconds/2 4-0
+	uint16_t cdate; // Creation date. Year from 1980 15-9, month 8-5, day 4-0
+	uint16_t adate; // Last access date
+	uint16_t cluster_hi; // FAT32 only. High word of the first cluster
+	uint16_t mtime; // Last modification time
+	uint16_t mdate; // Last modification date
+	uint16_t cluster_lo; // Low word of the first cluster
+	uint32_t size; // File size in bytes. 0 for directories
+} fat_dirent;
+
+/*
+ * A live file or directory found while walking the directory tree.
+ * Names and paths are allocated from the partition's arena
+ */
+typedef struct fat_file_t {
+	char *name; // Long name if present, otherwise the 8.3 name
+	char *path; // Full path from the root, '/' separated
+	uint32_t parent; // Index of the parent directory in fat_partition.files
+	uint64_t dirent_pos; // Byte offset of the short directory entry relative to the start of the volume
+	fat_dirent de;
+	uint32_t ext_first; // First extent of this file in fat_partition.extents. See fat_build_extent_index()
+	uint32_t ext_count; // Number of extents (fragments). 0 for empty files and the FAT12/16 root
+} fat_file;
+
 /*
  * FAT partition structure
  */
 typedef struct fat_partition_t {
 	// Not part of the actual layout
 	uint8_t type; // Used for identifying the type of FAT. See Partition Types in shared.h
-	uint32_t start_pos; // byte_buffer position that points to the beginning of the partition
+	uint64_t start_pos; // byte_buffer position that points to the beginning of the partition
+	bool valid; // Boot sector describes a usable geometry. No cluster math is done otherwise
 
 	// Reserved section. Size = Number of reserved sectors
 	fat_bs *boot_sector;
 	fat_fsinfo *fsinfo; // FAT32 only
 
+	// Volume contents within the image buffer. Not owned by the partition
+	uint8_t *vol;
+	uint64_t vol_len; // Bytes of the volume actually present in the image (may be truncated)
+
 	// FATs. Size = Num of FATs * Sectors per FAT
+	uint8_t *fat_table; // First FAT, points into vol. NULL if it lies outside of the image
+	uint32_t fat_table_len; // Size of one FAT in bytes
+	uint32_t max_cluster; // Highest valid cluster number (CountofClusters + 1)
+	uint64_t *free_map; // 1 bit per cluster, set if the cluster is free. See fat_build_free_map()
 
 	// Root Directory (FAT12/16 only). Size = (Num of root entries * 32) / bytes per sector
 
 	// Data Region. Size = Num of Clusters * Sectors per cluster
 
+	// Directory tree. See fat_read_directory_tree()
+	arena *arena;
+	fat_file *files; // files[FAT_ROOT_INDEX] is the root directory
+	uint32_t num_files;
+	uint32_t files_cap;
+	path_index *paths; // Full path to index in files. Optional, see fat_build_path_index()
+	bool index_paths; // If set before the walk, paths are indexed as the tree is read
+
+	// Cluster chains of every file in files, compressed into runs of contiguous clusters
+	extent_list extents;
+	bool has_extents;
+
+	// Cluster cache shared by every open file handle. Created by the first fat_open()
+	block_cache *cache;
+	// Held while fat_open()/fat_open_file() build the directory tree, extent index, path index and cache, so handles
+	// opened from several threads at once don't build them twice
+	pthread_mutex_t open_lock;
 } fat_partition;
 
+/*
+ * Open file on a FAT volume. Reads go through the partition's shared cluster cache
+ */
+typedef struct fat_handle_t {
+	fat_partition *part;
+	fat_file *file;
+	uint64_t size; // Bytes readable. File size, or the allocated size for directories
+	uint64_t pos; // Current read position
+
+	extent *ext; // The file's extents (slice of part->extents)
+	uint32_t num_ext;
+	uint64_t *ext_end; // Logical cluster following each extent (running total of extent lengths)
+	uint32_t cur_ext; // Extent of the last read, checked before searching
+
+	uint64_t next_cluster; // Logical cluster a sequential read would touch next
+	uint64_t ra_end; // Logical clusters before this have already been read ahead
+	uint32_t ra_window; // Current readahead window in clusters
+} fat_handle;
+
+/*
+ * Called for each block of directory entries. vol_pos is the byte offset of block relative to the start of the volume.
+ * Return false to stop iterating
+ */
+typedef bool (*fat_dir_block_cb)(fat_partition *part, uint8_t *block, uint32_t len, uint64_t vol_pos, void *ctx);
+
 /*
  * FAT functions
  */
@@ -159,9 +285,11 @@ typedef struct fat_partition_t {
 // Overall partition
 fat_partition *fat_new_partition();
 void fat_free_partition(fat_partition *part);
+void fat_read_boot_region(byte_buffer *bb, fat_partition *part);
 void fat_read_partition(byte_buffer *bb, fat_partition *part);
 void fat_write_partition(byte_buffer *bb, fat_partition *part);
 void fat_print_partition(fat_partition *part, bool verbose);
+void fat_output_partition(fat_partition *part, out_writer *out, uint8_t partition, bool verbose);
 
 // Location/Size calculation helper functions
 uint32_t fat_sectors_per_fat(fat_partition *part);
@@ -173,6 +301,37 @@ uint32_t fat_data_start_rel(fat_partition *part);
 uint32_t fat_data_start_abs(fat_partition *part);
 uint32_t fat_count_clusters(fat_partition *part);
 uint32_t fat_cluster_to_sector_rel(fat_partition *part, uint32_t cluster);
+uint32_t fat_cluster_size(fat_partition *part);
+uint8_t *fat_cluster_ptr(fat_partition *part, uint32_t cluster);
+
+// File Allocation Table
+uint32_t fat_get_entry(fat_partition *part, uint32_t cluster);
+bool fat_is_eoc(fat_partition *part, uint32_t value);
+bool fat_is_valid_cluster(fat_partition *part, uint32_t value);
+void fat_build_free_map(fat_partition *part);
+bool fat_cluster_is_free(fat_partition *part, uint32_t cluster);
+uint32_t fat_count_free(fat_partition *part, uint32_t start, uint32_t count);
+bool fat_next_free_run(fat_partition *part, uint32_t *cluster, uint32_t *count);
+
+// Directories
+void fat_parse_dirent(const uint8_t *raw, fat_dirent *de);
+uint32_t fat_dirent_cluster(fat_partition *part, const fat_dirent *de);
+void fat_short_name(const uint8_t name[11], char *dest);
+uint8_t fat_lfn_checksum(const uint8_t name[11]);
+void fat_foreach_dir_block(fat_partition *part, uint32_t first_cluster, fat_dir_block_cb cb, void *ctx);
+void fat_read_directory_tree(fat_partition *part);
+int64_t fat_time_to_epoch(uint16_t date, uint16_t time, uint8_t tenth);
+void fat_build_extent_index(fat_partition *part);
+void fat_build_path_index(fat_partition *part);
+fat_file *fat_lookup_path(fat_partition *part, const char *path);
+
+// File access
+fat_handle *fat_open(fat_partition *part, const char *path);
+fat_handle *fat_open_file(fat_partition *part, fat_file *file);
+size_t fat_read(fat_handle *h, void *buf, size_t len);
+int64_t fat_seek(fat_handle *h, int64_t offset, int whence);
+uint64_t fat_tell(fat_handle *h);
+void fat_close(fat_handle *h);
 
 // Reserved Sectors
 fat_bs *fat_new_boot_sector();
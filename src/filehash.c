@@ -0,0 +1,461 @@
+/**
+   dd_reader
+   filehash.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#include "filehash.h"
+
+// Stands in for sparse NTFS runs
+#define FILEHASH_ZERO_CHUNK (64 * 1024)
+static const uint8_t filehash_zeros[FILEHASH_ZERO_CHUNK];
+
+/*
+ * Create an empty file list
+ */
+filehash_list *filehash_new() {
+	filehash_list *list = (filehash_list*)malloc(sizeof(filehash_list));
+	memset(list, 0, sizeof(filehash_list));
+	return list;
+}
+
+void filehash_free(filehash_list *list) {
+	if(list == NULL)
+		return;
+
+	free(list->files);
+	free(list);
+}
+
+static filehash_entry *filehash_add(filehash_list *list, void *part, uint8_t part_type, uint8_t partition, uint32_t num, uint64_t size, const char *path) {
+	if(list->count == list->cap) {
+		list->cap = (list->cap == 0) ? 1024 : list->cap * 2;
+		list->files = (filehash_entry*)realloc(list->files, list->cap * sizeof(filehash_entry));
+	}
+
+	filehash_entry *e = &(list->files[list->count++]);
+	memset(e, 0, sizeof(filehash_entry));
+	e->part = part;
+	e->part_type = part_type;
+	e->partition = partition;
+	e->num = num;
+	e->size = size;
+	e->path = path;
+	list->total_bytes += size;
+	return e;
+}
+
+// Copy a file of another list. Its digests are not copied
+filehash_entry *filehash_add_entry(filehash_list *list, const filehash_entry *src) {
+	return filehash_add(list, src->part, src->part_type, src->partition, src->num, src->size, src->path);
+}
+
+/*
+ * Add every regular file of a FAT volume. Builds the directory tree and extent index if needed
+ */
+void filehash_add_fat(filehash_list *list, fat_partition *part, uint8_t partition) {
+	fat_build_extent_index(part);
+
+	for(uint32_t f = 0; f < part->num_files; f++) {
+		fat_file *file = &(part->files[f]);
+		if(file->de.attr & (FAT_ATTR_DIRECTORY | FAT_ATTR_VOLUME_ID))
+			continue;
+		filehash_add(list, part, part->type, partition, f, file->de.size, file->path);
+	}
+}
+
+/*
+ * Add every in use, non-directory MFT record that has a path. Paths and the extent index are built here so the
+ * parallel hashing only reads partition state
+ */
+void filehash_add_ntfs(filehash_list *list, ntfs_partition *part, uint8_t partition) {
+	if(!ntfs_load_mft(part))
+		return;
+	ntfs_build_extent_index(part);
+
+	for(uint32_t r = 0; r < part->num_records; r++) {
+		ntfs_record *rec = &(part->records[r]);
+		if(!(rec->flags & NTFS_REC_IN_USE) || (rec->flags & (NTFS_REC_DIRECTORY | NTFS_REC_EXTENSION)))
+			continue;
+
+		const char *path = ntfs_record_path(part, r);
+		if(path == NULL)
+			continue;
+		filehash_add(list, part, PT_NTFS, partition, r, (rec->data_off != 0) ? rec->size : 0, path);
+	}
+}
+
+/*
+ * Where a file's extents point within its volume
+ */
+typedef struct filehash_layout_t {
+	const uint8_t *vol;
+	uint64_t vol_len;
+	uint64_t cs; // Cluster size
+	uint64_t data; // Offset of data cluster 2 (FAT only)
+	const extent *ext;
+	uint32_t ext_count;
+	bool fat;
+} filehash_layout;
+
+/*
+ * Look up the extents of a file
+ *
+ * @param resident Set to the contents of a resident NTFS file, in which case the layout is not filled in
+ */
+static void filehash_get_layout(filehash_entry *file, filehash_layout *l, const uint8_t **resident) {
+	memset(l, 0, sizeof(filehash_layout));
+	*resident = NULL;
+
+	if(file->part_type == PT_NTFS) {
+		ntfs_partition *part = (ntfs_partition*)(file->part);
+		ntfs_record *rec = &(part->records[file->num]);
+		if(rec->flags & NTFS_REC_RESIDENT) {
+			*resident = ntfs_resident_data(part, file->num, NULL);
+			return;
+		}
+		l->vol = part->vol;
+		l->vol_len = part->vol_len;
+		l->cs = part->cluster_size;
+		l->ext = part->extents.ext + rec->ext_first;
+		l->ext_count = rec->ext_count;
+	} else {
+		fat_partition *part = (fat_partition*)(file->part);
+		fat_file *f = &(part->files[file->num]);
+		l->vol = part->vol;
+		l->vol_len = part->vol_len;
+		l->cs = fat_cluster_size(part);
+		l->data = (uint64_t)fat_data_start_rel(part) * part->boot_sector->bpb.bytes_per_sector;
+		l->ext = part->extents.ext + f->ext_first;
+		l->ext_count = f->ext_count;
+		l->fat = true;
+	}
+}
+
+// Volume offset of the first byte of a (non sparse) extent. FAT extents hold data cluster numbers, which start at 2
+static uint64_t filehash_ext_offset(const filehash_layout *l, const extent *ext) {
+	return l->fat ? l->data + (ext->start - 2) * l->cs : ext->start * l->cs;
+}
+
+/*
+ * Hash part of a file straight out of the image by walking its extents. Nothing is copied
+ *
+ * @param file File to read
+ * @param offset Logical offset of the first byte to hash
+ * @param len Bytes to hash. Cut to the end of the file
+ * @param ctx Digests to update
+ * @return False if some of the bytes lie outside of the image (the rest is still hashed)
+ */
+bool filehash_feed(filehash_entry *file, uint64_t offset, uint64_t len, digest_ctx *ctx) {
+	if(offset >= file->size)
+		return true;
+	if(len > file->size - offset)
+		len = file->size - offset;
+
+	filehash_layout l;
+	const uint8_t *resident = NULL;
+	filehash_get_layout(file, &l, &resident);
+	if(resident != NULL) {
+		digest_update(ctx, resident + offset, (size_t)len);
+		return true;
+	}
+
+	uint64_t ext_pos = 0;
+	for(uint32_t e = 0; e < l.ext_count && len > 0; e++) {
+		uint64_t ext_len = l.ext[e].length * l.cs;
+		if(offset >= ext_pos + ext_len) {
+			ext_pos += ext_len;
+			continue;
+		}
+
+		uint64_t skip = offset - ext_pos;
+		uint64_t n = (ext_len - skip < len) ? ext_len - skip : len;
+		if(l.ext[e].start == EXTENT_SPARSE) {
+			for(uint64_t done = 0; done < n; done += FILEHASH_ZERO_CHUNK) {
+				digest_update(ctx, filehash_zeros, (n - done < FILEHASH_ZERO_CHUNK) ? (size_t)(n - done) : FILEHASH_ZERO_CHUNK);
+			}
+		} else {
+			uint64_t src = filehash_ext_offset(&l, &(l.ext[e])) + skip;
+			if(src >= l.vol_len)
+				return false;
+			if(src + n > l.vol_len) {
+				digest_update(ctx, l.vol + src, (size_t)(l.vol_len - src));
+				return false;
+			}
+			digest_update(ctx, l.vol + src, (size_t)n);
+		}
+
+		offset += n;
+		len -= n;
+		ext_pos += ext_len;
+	}
+
+	// Extents ran out before the file size (broken chain)
+	return len == 0;
+}
+
+/*
+ * Image address of the first byte of a file's contents, used to read small files in on disk order
+ *
+ * @return NULL if none of the file is in the image: it is empty, resident, sparse or lies past the end of the image
+ */
+const uint8_t *filehash_location(filehash_entry *file) {
+	filehash_layout l;
+	const uint8_t *resident = NULL;
+	filehash_get_layout(file, &l, &resident);
+	if(file->size == 0 || resident != NULL)
+		return NULL;
+
+	for(uint32_t e = 0; e < l.ext_count; e++) {
+		if(l.ext[e].start == EXTENT_SPARSE)
+			continue;
+		uint64_t src = filehash_ext_offset(&l, &(l.ext[e]));
+		return (src < l.vol_len) ? l.vol + src : NULL;
+	}
+	return NULL;
+}
+
+/*
+ * Add the image bytes holding part of a file to a span of prefetched bytes. Neighbouring files are coalesced into one
+ * span, reading through gaps of up to FILEHASH_COALESCE_GAP. When a piece does not fit the span, the span is handed to
+ * the kernel with bb_prefetch() and a new one is started
+ *
+ * @param span Span being gathered. Zeroed to start, see filehash_span_flush()
+ * @param offset Logical offset of the part of the file that will be read
+ */
+void filehash_span_add(filehash_span *span, filehash_entry *file, uint64_t offset, uint64_t len) {
+	filehash_layout l;
+	const uint8_t *resident = NULL;
+	filehash_get_layout(file, &l, &resident);
+	if(resident != NULL || offset >= file->size)
+		return;
+	if(len > file->size - offset)
+		len = file->size - offset;
+
+	uint64_t ext_pos = 0;
+	for(uint32_t e = 0; e < l.ext_count && len > 0; e++) {
+		uint64_t ext_len = l.ext[e].length * l.cs;
+		if(offset >= ext_pos + ext_len) {
+			ext_pos += ext_len;
+			continue;
+		}
+
+		uint64_t skip = offset - ext_pos;
+		uint64_t n = (ext_len - skip < len) ? ext_len - skip : len;
+		uint64_t src = filehash_ext_offset(&l, &(l.ext[e])) + skip;
+		if(l.ext[e].start != EXTENT_SPARSE && src < l.vol_len) {
+			const uint8_t *p = l.vol + src;
+			const uint8_t *p_end = p + ((src + n <= l.vol_len) ? n : l.vol_len - src);
+			if(span->start == NULL || p < span->start || p > span->end + FILEHASH_COALESCE_GAP) {
+				filehash_span_flush(span);
+				span->start = p;
+				span->end = p_end;
+			} else if(p_end > span->end) {
+				span->end = p_end;
+			}
+		}
+
+		offset += n;
+		len -= n;
+		ext_pos += ext_len;
+	}
+}
+
+// Prefetch the gathered span, if any, and empty it
+void filehash_span_flush(filehash_span *span) {
+	if(span->start != NULL)
+		bb_prefetch(span->start, (size_t)(span->end - span->start));
+	span->start = span->end = NULL;
+}
+
+/*
+ * A parallel task: a run of consecutive files in largest-first order
+ */
+typedef struct filehash_task_t {
+	uint32_t first;
+	uint32_t count;
+} filehash_task;
+
+typedef struct filehash_job_t {
+	filehash_list *list;
+	uint32_t *order;
+	filehash_task *tasks;
+	uint8_t which;
+} filehash_job;
+
+static void filehash_task_run(void *ctx, size_t index, uint32_t thread) {
+	filehash_job *job = (filehash_job*)ctx;
+	filehash_task *task = &(job->tasks[index]);
+	digest_ctx dctx;
+
+	// A task of small files covers neighbouring clusters. Ask for all of them up front, in as few reads as possible
+	filehash_span span;
+	memset(&span, 0, sizeof(filehash_span));
+	for(uint32_t i = task->first; i < task->first + task->count; i++) {
+		filehash_entry *file = &(job->list->files[job->order[i]]);
+		if(file->size <= FILEHASH_SMALL_FILE)
+			filehash_span_add(&span, file, 0, file->size);
+	}
+	filehash_span_flush(&span);
+
+	for(uint32_t i = task->first; i < task->first + task->count; i++) {
+		filehash_entry *file = &(job->list->files[job->order[i]]);
+		digest_init(&dctx, job->which);
+		file->complete = filehash_feed(file, 0, file->size, &dctx);
+		digest_final(&dctx, &(file->digest));
+	}
+}
+
+static filehash_list *filehash_sort_list;
+static const uint8_t **filehash_sort_loc;
+
+// Large files first, largest first. Then small files in on disk order, those with nothing to read ahead first
+static int filehash_order_cmp(const void *a, const void *b) {
+	uint32_t ia = *(const uint32_t*)a, ib = *(const uint32_t*)b;
+	uint64_t x = filehash_sort_list->files[ia].size, y = filehash_sort_list->files[ib].size;
+	bool small_x = (x <= FILEHASH_SMALL_FILE), small_y = (y <= FILEHASH_SMALL_FILE);
+	if(small_x != small_y)
+		return small_x ? 1 : -1;
+	if(!small_x && x != y)
+		return (x > y) ? -1 : 1;
+	if(small_x && filehash_sort_loc[ia] != filehash_sort_loc[ib])
+		return ((uintptr_t)filehash_sort_loc[ia] < (uintptr_t)filehash_sort_loc[ib]) ? -1 : 1;
+	return (ia < ib) ? -1 : 1;
+}
+
+/*
+ * Hash every file of the list. Large files are handed out largest first so one big file started last can't hold up
+ * the whole run. Small files follow in the order they lie on disk, and are grouped so each task carries a worthwhile
+ * amount of data and reads it ahead in a few coalesced spans instead of a page fault per file
+ *
+ * @param which DIGEST_* flags of the digests to compute
+ */
+void filehash_run(filehash_list *list, uint8_t which) {
+	if(list->count == 0)
+		return;
+
+	uint32_t *order = (uint32_t*)malloc(list->count * sizeof(uint32_t));
+	for(uint32_t i = 0; i < list->count; i++) {
+		order[i] = i;
+	}
+	const uint8_t **loc = (const uint8_t**)malloc(list->count * sizeof(const uint8_t*));
+	for(uint32_t i = 0; i < list->count; i++) {
+		loc[i] = (list->files[i].size <= FILEHASH_SMALL_FILE) ? filehash_location(&(list->files[i])) : NULL;
+	}
+	filehash_sort_list = list;
+	filehash_sort_loc = loc;
+	qsort(order, list->count, sizeof(uint32_t), filehash_order_cmp);
+	free(loc);
+
+	filehash_task *tasks = (filehash_task*)malloc(list->count * sizeof(filehash_task));
+	uint32_t num_tasks = 0;
+	for(uint32_t i = 0; i < list->count; ) {
+		uint64_t bytes = 0;
+		uint32_t first = i;
+		do {
+			bytes += list->files[order[i]].size;
+			i++;
+		} while(i < list->count && bytes < FILEHASH_BATCH_BYTES && i - first < FILEHASH_BATCH_FILES);
+
+		tasks[num_tasks].first = first;
+		tasks[num_tasks].count = i - first;
+		num_tasks++;
+	}
+
+	filehash_job job;
+	job.list = list;
+	job.order = order;
+	job.tasks = tasks;
+	job.which = which;
+	par_run(num_tasks, filehash_task_run, &job);
+
+	free(tasks);
+	free(order);
+}
+
+typedef struct filehash_classify_job_t {
+	filehash_list *list;
+	hashdb *known;
+} filehash_classify_job;
+
+static void filehash_classify_task(void *ctx, size_t index, uint32_t thread) {
+	filehash_classify_job *job = (filehash_classify_job*)ctx;
+	uint32_t end = (uint32_t)((index + 1) * FILEHASH_CLASSIFY_CHUNK);
+	if(end > job->list->count)
+		end = job->list->count;
+
+	for(uint32_t i = (uint32_t)(index * FILEHASH_CLASSIFY_CHUNK); i < end; i++) {
+		filehash_entry *file = &(job->list->files[i]);
+		file->known = file->complete && (file->digest.which & DIGEST_SHA1) && hashdb_contains(job->known, file->digest.sha1);
+	}
+}
+
+/*
+ * Mark the hashed files whose SHA1 is in a known file set. The set stays memory mapped: the Bloom filter turns away
+ * almost every unknown file and only the rest touch the digest table
+ *
+ * @param known Database of SHA1 digests of whole files
+ * @return Number of known files
+ */
+uint32_t filehash_classify(filehash_list *list, hashdb *known) {
+	filehash_classify_job job;
+	job.list = list;
+	job.known = known;
+	par_run((list->count + FILEHASH_CLASSIFY_CHUNK - 1) / FILEHASH_CLASSIFY_CHUNK, filehash_classify_task, &job);
+
+	uint32_t count = 0;
+	for(uint32_t i = 0; i < list->count; i++) {
+		if(list->files[i].known)
+			count++;
+	}
+	return count;
+}
+
+/*
+ * Write the list as CSV: partition, size, digests, path. Digests that were not computed are left empty
+ *
+ * @param skip_known Leave out the files marked by filehash_classify()
+ * @return False if the file could not be created
+ */
+bool filehash_write(filehash_list *list, const char *path, bool skip_known) {
+	FILE *fp = fopen(path, "w");
+	if(fp == NULL)
+		return false;
+
+	fprintf(fp, "Partition,Size,MD5,SHA1,SHA256,Complete,Path\n");
+	for(uint32_t i = 0; i < list->count; i++) {
+		filehash_entry *file = &(list->files[i]);
+		digest_result *d = &(file->digest);
+		if(skip_known && file->known)
+			continue;
+
+		fprintf(fp, "%u,%llu,", file->partition, (unsigned long long)file->size);
+		if(d->which & DIGEST_MD5)
+			digest_fprint_hex(fp, d->md5, sizeof(d->md5));
+		fprintf(fp, ",");
+		if(d->which & DIGEST_SHA1)
+			digest_fprint_hex(fp, d->sha1, sizeof(d->sha1));
+		fprintf(fp, ",");
+		if(d->which & DIGEST_SHA256)
+			digest_fprint_hex(fp, d->sha256, sizeof(d->sha256));
+		fprintf(fp, ",%s,", file->complete ? "yes" : "no");
+		fprint_csv_str(fp, file->path);
+		fprintf(fp, "\n");
+	}
+
+	fclose(fp);
+	return true;
+}
@@ -0,0 +1,88 @@
+/**
+   dd_reader
+   filehash.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef _FILEHASH_H_
+#define _FILEHASH_H_
+
+#include "digest.h"
+#include "fat.h"
+#include "hashdb.h"
+#include "ntfs.h"
+#include "parallel.h"
+#include "shared.h"
+
+// Files smaller than this are grouped into tasks of about this many bytes so per-task overhead stays small
+#define FILEHASH_BATCH_BYTES (4 * 1024 * 1024)
+// Most files in one task
+#define FILEHASH_BATCH_FILES 1024
+// Files up to this size are hashed in on disk order, and each task reads its files ahead in coalesced spans
+#define FILEHASH_SMALL_FILE (64 * 1024)
+// Largest gap between neighbouring files that a span reads through rather than splitting
+#define FILEHASH_COALESCE_GAP (64 * 1024)
+// Files looked up in a known file set per parallel task
+#define FILEHASH_CLASSIFY_CHUNK 4096
+
+/*
+ * A regular file of a FAT or NTFS volume
+ */
+typedef struct filehash_entry_t {
+	void *part; // fat_partition or ntfs_partition, see part_type
+	uint8_t part_type; // PT_*
+	uint8_t partition; // MBR partition entry
+	uint32_t num; // Index in fat_partition.files or MFT record number
+	uint64_t size;
+	const char *path; // Owned by the partition
+	bool complete; // False if part of the file lies outside of the image. Its digests only cover what was present
+	digest_result digest; // Set by filehash_run()
+	bool known; // SHA1 found in a known file set. See filehash_classify()
+} filehash_entry;
+
+typedef struct filehash_list_t {
+	filehash_entry *files; // In the order they were added
+	uint32_t count;
+	uint32_t cap;
+	uint64_t total_bytes;
+} filehash_list;
+
+/*
+ * Image bytes to read ahead, gathered over neighbouring files. See filehash_span_add()
+ */
+typedef struct filehash_span_t {
+	const uint8_t *start;
+	const uint8_t *end;
+} filehash_span;
+
+/*
+ * Per-file hashing functions
+ */
+
+filehash_list *filehash_new();
+void filehash_free(filehash_list *list);
+void filehash_add_fat(filehash_list *list, fat_partition *part, uint8_t partition);
+void filehash_add_ntfs(filehash_list *list, ntfs_partition *part, uint8_t partition);
+filehash_entry *filehash_add_entry(filehash_list *list, const filehash_entry *src);
+bool filehash_feed(filehash_entry *file, uint64_t offset, uint64_t len, digest_ctx *ctx);
+const uint8_t *filehash_location(filehash_entry *file);
+void filehash_span_add(filehash_span *span, filehash_entry *file, uint64_t offset, uint64_t len);
+void filehash_span_flush(filehash_span *span);
+void filehash_run(filehash_list *list, uint8_t which);
+uint32_t filehash_classify(filehash_list *list, hashdb *known);
+bool filehash_write(filehash_list *list, const char *path, bool skip_known);
+
+#endif
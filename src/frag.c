@@ -0,0 +1,277 @@
+/**
+   dd_reader
+   frag.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "frag.h"
+
+// Histogram bucket for a fragment count. 0, 1 and 2 have their own bucket, then powers of two
+static uint32_t frag_bucket(uint32_t fragments) {
+	if(fragments <= 2)
+		return fragments;
+
+	uint32_t b = 2 + (32 - __builtin_clz(fragments - 1)) - 1;
+	return (b < FRAG_HIST_BUCKETS) ? b : FRAG_HIST_BUCKETS - 1;
+}
+
+// Lower bound of the fragment counts falling in a bucket
+static uint32_t frag_bucket_min(uint32_t b) {
+	return (b <= 2) ? b : (1U << (b - 2)) + 1;
+}
+
+/*
+ * Build the fragmentation report from the extent index and the free cluster map.
+ * Runs in a single pass over the files and a single pass over the free map
+ *
+ * @param part FAT partition
+ * @param clusters_per_cell Resolution of the allocation map. If 0, pick one giving about FRAG_DEFAULT_CELLS cells
+ * @return Report. Release with frag_free()
+ */
+frag_report *frag_analyze(fat_partition *part, uint32_t clusters_per_cell) {
+	frag_report *rep = (frag_report*)malloc(sizeof(frag_report));
+	memset(rep, 0, sizeof(frag_report));
+
+	fat_build_free_map(part);
+	fat_build_extent_index(part);
+
+	// Per file fragment counts
+	for(uint32_t i = FAT_ROOT_INDEX + 1; i < part->num_files; i++) {
+		uint32_t frags = part->files[i].ext_count;
+
+		rep->num_files++;
+		rep->total_fragments += frags;
+		rep->histogram[frag_bucket(frags)]++;
+		if(frags > 1)
+			rep->fragmented_files++;
+		else
+			continue;
+
+		// Insert into the most fragmented list
+		uint32_t pos = rep->num_top_files;
+		while(pos > 0 && part->files[rep->top_files[pos - 1]].ext_count < frags)
+			pos--;
+		if(pos >= FRAG_TOP)
+			continue;
+		if(rep->num_top_files < FRAG_TOP)
+			rep->num_top_files++;
+		memmove(&(rep->top_files[pos + 1]), &(rep->top_files[pos]), (rep->num_top_files - pos - 1) * sizeof(uint32_t));
+		rep->top_files[pos] = i;
+	}
+
+	// Free runs
+	uint32_t c = 2, count = 0;
+	while(fat_next_free_run(part, &c, &count)) {
+		rep->free_clusters += count;
+		rep->num_free_runs++;
+
+		uint32_t pos = rep->num_top_free;
+		while(pos > 0 && rep->top_free[pos - 1].length < count)
+			pos--;
+		if(pos < FRAG_TOP) {
+			if(rep->num_top_free < FRAG_TOP)
+				rep->num_top_free++;
+			memmove(&(rep->top_free[pos + 1]), &(rep->top_free[pos]), (rep->num_top_free - pos - 1) * sizeof(frag_run));
+			rep->top_free[pos].start = c;
+			rep->top_free[pos].length = count;
+		}
+
+		c += count;
+	}
+
+	// Allocation map
+	uint32_t clusters = part->max_cluster - 1;
+	if(clusters_per_cell == 0)
+		clusters_per_cell = (clusters + FRAG_DEFAULT_CELLS - 1) / FRAG_DEFAULT_CELLS;
+	if(clusters_per_cell == 0)
+		clusters_per_cell = 1;
+	rep->clusters_per_cell = clusters_per_cell;
+	rep->num_cells = (clusters + clusters_per_cell - 1) / clusters_per_cell;
+	rep->cell_alloc = (uint32_t*)calloc(rep->num_cells + 1, sizeof(uint32_t));
+
+	for(uint32_t i = 0; i < rep->num_cells; i++) {
+		uint32_t first = 2 + i * clusters_per_cell;
+		uint32_t n = (first + clusters_per_cell - 1 > part->max_cluster) ? part->max_cluster - first + 1 : clusters_per_cell;
+		rep->cell_alloc[i] = n - fat_count_free(part, first, n);
+	}
+
+	return rep;
+}
+
+/*
+ * Outputs a human readable summary of the report
+ */
+void frag_print(fat_partition *part, frag_report *rep) {
+	uint32_t clusters = part->max_cluster - 1;
+
+	printf("Files: %u  Fragmented: %u", rep->num_files, rep->fragmented_files);
+	if(rep->num_files > 0)
+		printf(" (%.2f%%)  Average fragments per file: %.2f", 100.0 * rep->fragmented_files / rep->num_files, (double)rep->total_fragments / rep->num_files);
+	printf("\n");
+
+	printf("Fragment histogram:\n");
+	for(uint32_t b = 0; b < FRAG_HIST_BUCKETS; b++) {
+		if(rep->histogram[b] == 0)
+			continue;
+
+		uint32_t lo = frag_bucket_min(b);
+		if(b == FRAG_HIST_BUCKETS - 1)
+			printf("  %u+: %u\n", lo, rep->histogram[b]);
+		else if(lo == frag_bucket_min(b + 1) - 1)
+			printf("  %u: %u\n", lo, rep->histogram[b]);
+		else
+			printf("  %u-%u: %u\n", lo, frag_bucket_min(b + 1) - 1, rep->histogram[b]);
+	}
+
+	if(rep->num_top_files > 0) {
+		printf("Most fragmented files:\n");
+		for(uint32_t i = 0; i < rep->num_top_files; i++) {
+			fat_file *f = &(part->files[rep->top_files[i]]);
+			printf("  %u fragments  %s\n", f->ext_count, f->path);
+		}
+	}
+
+	printf("Free clusters: %llu of %u", (unsigned long long)rep->free_clusters, clusters);
+	if(clusters > 0)
+		printf(" (%.2f%%)", 100.0 * rep->free_clusters / clusters);
+	printf("  Free runs: %u\n", rep->num_free_runs);
+
+	if(rep->num_top_free > 0) {
+		printf("Largest free runs:\n");
+		for(uint32_t i = 0; i < rep->num_top_free; i++) {
+			printf("  Clusters %u-%u (%u clusters)\n", rep->top_free[i].start, rep->top_free[i].start + rep->top_free[i].length - 1, rep->top_free[i].length);
+		}
+	}
+
+	printf("Allocation map: %u cells of %u clusters\n", rep->num_cells, rep->clusters_per_cell);
+}
+
+// Per file fragment counts as CSV: path,size,clusters,fragments
+bool frag_write_files_csv(fat_partition *part, const char *path) {
+	FILE *fp = fopen(path, "w");
+	if(fp == NULL) {
+		printf("Could not open file %s to write the fragment list\n", path);
+		return false;
+	}
+
+	fprintf(fp, "path,size,clusters,fragments\n");
+	for(uint32_t i = FAT_ROOT_INDEX + 1; i < part->num_files; i++) {
+		fat_file *f = &(part->files[i]);
+		fprint_csv_str(fp, f->path);
+		fprintf(fp, ",%u,%llu,%u\n", f->de.size, (unsigned long long)extent_total_length(part->extents.ext + f->ext_first, f->ext_count), f->ext_count);
+	}
+
+	fclose(fp);
+	return true;
+}
+
+// Allocation map as CSV: cell,first_cluster,clusters,allocated
+bool frag_write_map_csv(fat_partition *part, frag_report *rep, const char *path) {
+	FILE *fp = fopen(path, "w");
+	if(fp == NULL) {
+		printf("Could not open file %s to write the allocation map\n", path);
+		return false;
+	}
+
+	fprintf(fp, "cell,first_cluster,clusters,allocated\n");
+	for(uint32_t i = 0; i < rep->num_cells; i++) {
+		uint32_t first = 2 + i * rep->clusters_per_cell;
+		uint32_t n = (first + rep->clusters_per_cell - 1 > part->max_cluster) ? part->max_cluster - first + 1 : rep->clusters_per_cell;
+		fprintf(fp, "%u,%u,%u,%u\n", i, first, n, rep->cell_alloc[i]);
+	}
+
+	fclose(fp);
+	return true;
+}
+
+/*
+ * Allocation map as a binary PGM (P5) image, FRAG_PNM_WIDTH cells per row.
+ * Fully allocated cells are black, free cells white. Padding after the last cell is mid grey
+ */
+bool frag_write_map_pnm(fat_partition *part, frag_report *rep, const char *path) {
+	FILE *fp = fopen(path, "wb");
+	if(fp == NULL) {
+		printf("Could not open file %s to write the allocation map\n", path);
+		return false;
+	}
+
+	uint32_t width = (rep->num_cells < FRAG_PNM_WIDTH) ? rep->num_cells : FRAG_PNM_WIDTH;
+	if(width == 0)
+		width = 1;
+	uint32_t height = (rep->num_cells + width - 1) / width;
+	if(height == 0)
+		height = 1;
+
+	fprintf(fp, "P5\n%u %u\n255\n", width, height);
+
+	uint8_t *row = (uint8_t*)malloc(width);
+	for(uint32_t y = 0; y < height; y++) {
+		for(uint32_t x = 0; x < width; x++) {
+			uint32_t i = y * width + x;
+			if(i >= rep->num_cells) {
+				row[x] = 128;
+				continue;
+			}
+
+			uint32_t first = 2 + i * rep->clusters_per_cell;
+			uint32_t n = (first + rep->clusters_per_cell - 1 > part->max_cluster) ? part->max_cluster - first + 1 : rep->clusters_per_cell;
+			row[x] = (uint8_t)(255 - ((uint64_t)rep->cell_alloc[i] * 255) / n);
+		}
+		fwrite(row, 1, width, fp);
+	}
+	free(row);
+
+	fclose(fp);
+	return true;
+}
+
+void frag_free(frag_report *rep) {
+	if(rep->cell_alloc != NULL)
+		free(rep->cell_alloc);
+
+	free(rep);
+}
+
+/*
+ * Analyze a partition, print the summary and write the CSV/PNM exports
+ * as PREFIX-pINDEX-files.csv, PREFIX-pINDEX-map.csv and PREFIX-pINDEX-map.pgm
+ */
+void frag_report_partition(fat_partition *part, int index, const char *prefix, uint32_t clusters_per_cell) {
+	if(!part->valid) {
+		printf("Volume is unavailable: the boot sector is invalid\n");
+		return;
+	}
+
+	frag_report *rep = frag_analyze(part, clusters_per_cell);
+	frag_print(part, rep);
+
+	size_t len = strlen(prefix) + 32;
+	char *path = (char*)malloc(len);
+
+	snprintf(path, len, "%s-p%i-files.csv", prefix, index);
+	if(frag_write_files_csv(part, path))
+		printf("Wrote fragment list to %s\n", path);
+
+	snprintf(path, len, "%s-p%i-map.csv", prefix, index);
+	if(frag_write_map_csv(part, rep, path))
+		printf("Wrote allocation map to %s\n", path);
+
+	snprintf(path, len, "%s-p%i-map.pgm", prefix, index);
+	if(frag_write_map_pnm(part, rep, path))
+		printf("Wrote allocation map image to %s\n", path);
+
+	free(path);
+	frag_free(rep);
+}
@@ -0,0 +1,73 @@
+/**
+   dd_reader
+   frag.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _FRAG_H_
+#define _FRAG_H_
+
+#include "fat.h"
+#include "shared.h"
+
+// Histogram buckets: 0 fragments, 1, 2, 3-4, 5-8, ... doubling, last bucket holds everything larger
+#define FRAG_HIST_BUCKETS 12
+// Number of largest free runs and most fragmented files kept
+#define FRAG_TOP 10
+// Default allocation map resolution when the clusters per cell aren't specified
+#define FRAG_DEFAULT_CELLS 4096
+// Cells per row of the PNM allocation map
+#define FRAG_PNM_WIDTH 256
+
+typedef struct frag_run_t {
+	uint32_t start; // First cluster
+	uint32_t length; // Clusters
+} frag_run;
+
+/*
+ * Fragmentation and allocation summary of a FAT volume
+ */
+typedef struct frag_report_t {
+	uint32_t num_files; // Files and directories, not counting the root
+	uint32_t fragmented_files; // Files with more than one extent
+	uint64_t total_fragments;
+	uint32_t histogram[FRAG_HIST_BUCKETS];
+	uint32_t top_files[FRAG_TOP]; // Indices into fat_partition.files, most fragmented first
+	uint32_t num_top_files;
+
+	uint64_t free_clusters;
+	uint32_t num_free_runs;
+	frag_run top_free[FRAG_TOP]; // Largest free runs, largest first
+	uint32_t num_top_free;
+
+	// Downsampled allocation map. Cell i covers clusters [2 + i * clusters_per_cell, 2 + (i + 1) * clusters_per_cell)
+	uint32_t clusters_per_cell;
+	uint32_t num_cells;
+	uint32_t *cell_alloc; // Allocated clusters per cell
+} frag_report;
+
+/*
+ * Fragmentation report functions
+ */
+
+frag_report *frag_analyze(fat_partition *part, uint32_t clusters_per_cell);
+void frag_print(fat_partition *part, frag_report *rep);
+bool frag_write_files_csv(fat_partition *part, const char *path);
+bool frag_write_map_csv(fat_partition *part, frag_report *rep, const char *path);
+bool frag_write_map_pnm(fat_partition *part, frag_report *rep, const char *path);
+void frag_free(frag_report *rep);
+void frag_report_partition(fat_partition *part, int index, const char *prefix, uint32_t clusters_per_cell);
+
+#endif
@@ -0,0 +1,470 @@
+/**
+   dd_reader
+   hashdb.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bytebuffer.h"
+#include "hashdb.h"
+
+/*
+ * Bloom filter probe i of a digest. Digests are already uniformly distributed, so two 64 bit words of the digest
+ * serve as the base hashes (double hashing)
+ */
+static inline uint64_t hashdb_probe(const uint8_t *digest, uint32_t i, uint64_t mask) {
+	uint64_t h1 = read_le64(digest), h2 = read_le64(digest + 8) | 1;
+	return (h1 + i * h2) & mask;
+}
+
+/*
+ * Map a database file into memory and validate its header. Nothing is read beyond the header until a lookup
+ *
+ * @return The database, NULL if the file cannot be mapped or is not a valid database
+ */
+hashdb *hashdb_open(const char *path) {
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		printf("Could not open hash database %s\n", path);
+		return NULL;
+	}
+
+	struct stat sb;
+	if(fstat(fd, &sb) != 0 || sb.st_size < HASHDB_HEADER_SIZE) {
+		printf("Hash database %s is too short\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	uint8_t *map = (uint8_t*)mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		printf("Could not map hash database %s\n", path);
+		return NULL;
+	}
+
+	hashdb *db = (hashdb*)malloc(sizeof(hashdb));
+	memset(db, 0, sizeof(hashdb));
+	db->map = map;
+	db->map_len = (size_t)sb.st_size;
+	db->digest_len = read_le32(map + 12);
+	db->count = read_le64(map + 16);
+	uint32_t bloom_log2 = read_le32(map + 24);
+	db->bloom_k = read_le32(map + 28);
+	uint64_t bloom_off = read_le64(map + 32), table_off = read_le64(map + 40);
+	db->block_size = read_le32(map + 48);
+
+	// Every section must lie within the file
+	bool ok = memcmp(map, HASHDB_MAGIC, 8) == 0 && read_le32(map + 8) == HASHDB_VERSION
+		&& db->digest_len >= 16 && db->digest_len <= HASHDB_MAX_DIGEST && bloom_log2 >= 3 && bloom_log2 < 48
+		&& bloom_off <= db->map_len && (1ULL << bloom_log2) / 8 <= db->map_len - bloom_off
+		&& table_off <= db->map_len && db->count <= (db->map_len - table_off) / db->digest_len;
+	if(!ok) {
+		printf("%s is not a valid hash database\n", path);
+		hashdb_close(db);
+		return NULL;
+	}
+
+	db->bloom = map + bloom_off;
+	db->bloom_mask = (1ULL << bloom_log2) - 1;
+	db->table = map + table_off;
+	return db;
+}
+
+void hashdb_close(hashdb *db) {
+	munmap(db->map, db->map_len);
+	free(db);
+}
+
+static bool hashdb_bloom_test(hashdb *db, const uint8_t *digest) {
+	for(uint32_t i = 0; i < db->bloom_k; i++) {
+		uint64_t bit = hashdb_probe(digest, i, db->bloom_mask);
+		if((db->bloom[bit >> 3] & (1 << (bit & 7))) == 0)
+			return false;
+	}
+	return true;
+}
+
+static inline int hashdb_table_cmp(hashdb *db, uint64_t i, const uint8_t *digest) {
+	return memcmp(db->table + i * db->digest_len, digest, db->digest_len);
+}
+
+/*
+ * Search the sorted digest table. Digests are uniformly distributed, so the leading 8 bytes predict where a digest sits
+ * almost exactly. The search gallops outward from the prediction and finishes with a binary search, touching a page or
+ * two of a large mapped table instead of log2(count) of them
+ */
+static bool hashdb_table_find(hashdb *db, const uint8_t *digest) {
+	if(db->count == 0)
+		return false;
+
+	uint64_t key = 0;
+	for(int i = 0; i < 8; i++) {
+		key = (key << 8) | digest[i];
+	}
+	uint64_t guess = (uint64_t)((double)key / 18446744073709551616.0 * (double)db->count);
+	if(guess >= db->count)
+		guess = db->count - 1;
+
+	uint64_t lo = 0, hi = db->count, step = 1;
+	int c = hashdb_table_cmp(db, guess, digest);
+	if(c == 0)
+		return true;
+	if(c < 0) {
+		lo = guess + 1;
+		while(guess + step < db->count) {
+			c = hashdb_table_cmp(db, guess + step, digest);
+			if(c == 0)
+				return true;
+			if(c > 0) {
+				hi = guess + step;
+				break;
+			}
+			lo = guess + step + 1;
+			step *= 2;
+		}
+	} else {
+		hi = guess;
+		while(step <= guess) {
+			c = hashdb_table_cmp(db, guess - step, digest);
+			if(c == 0)
+				return true;
+			if(c < 0) {
+				lo = guess - step + 1;
+				break;
+			}
+			hi = guess - step;
+			step *= 2;
+		}
+	}
+
+	while(lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		c = hashdb_table_cmp(db, mid, digest);
+		if(c == 0)
+			return true;
+		if(c < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return false;
+}
+
+/*
+ * Check if a digest is in the database. The Bloom filter rules out almost all absent digests before the table is searched
+ */
+bool hashdb_contains(hashdb *db, const uint8_t *digest) {
+	return hashdb_bloom_test(db, digest) && hashdb_table_find(db, digest);
+}
+
+/*
+ * Start a new database
+ *
+ * @param digest_len Bytes per digest (16 for MD5, 20 for SHA1)
+ * @param block_size Bytes per hashed block, 0 if the digests are of whole files
+ */
+hashdb_builder *hashdb_builder_new(uint32_t digest_len, uint32_t block_size) {
+	hashdb_builder *b = (hashdb_builder*)malloc(sizeof(hashdb_builder));
+	memset(b, 0, sizeof(hashdb_builder));
+	b->digest_len = digest_len;
+	b->block_size = block_size;
+
+	return b;
+}
+
+void hashdb_builder_free(hashdb_builder *b) {
+	if(b->digests != NULL)
+		free(b->digests);
+
+	free(b);
+}
+
+void hashdb_builder_add(hashdb_builder *b, const uint8_t *digest) {
+	if(b->count == b->cap) {
+		b->cap = (b->cap == 0) ? 4096 : b->cap * 2;
+		b->digests = (uint8_t*)realloc(b->digests, b->cap * b->digest_len);
+	}
+
+	memcpy(b->digests + b->count * b->digest_len, digest, b->digest_len);
+	b->count++;
+}
+
+/*
+ * Add hex digests from a text file. The first field of each line is the digest, so md5sum/sha1sum output and NSRL
+ * style CSV can be used directly. Blank lines and lines starting with '#' are skipped
+ *
+ * @return False if the file could not be read or has a digest of the wrong length
+ */
+bool hashdb_builder_add_hex_file(hashdb_builder *b, const char *path) {
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL) {
+		printf("Could not open hash list %s\n", path);
+		return false;
+	}
+
+	char line[1024];
+	uint8_t digest[HASHDB_MAX_DIGEST];
+	uint32_t line_num = 0;
+	bool ok = true;
+	while(ok && fgets(line, sizeof(line), fp) != NULL) {
+		line_num++;
+		if(line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+			continue;
+
+		// NSRL style CSV: the digest may be quoted and the first line may be a header
+		char *hex = line;
+		if(*hex == '"')
+			hex++;
+		if(line_num == 1 && !isxdigit((unsigned char)*hex))
+			continue;
+
+		size_t n = 0;
+		while(isxdigit((unsigned char)hex[n]))
+			n++;
+		if(n != b->digest_len * 2 || (hex[n] != '\0' && !isspace((unsigned char)hex[n]) && hex[n] != ',' && hex[n] != '"')) {
+			printf("Invalid digest on line %u of %s\n", line_num, path);
+			ok = false;
+			break;
+		}
+
+		for(uint32_t i = 0; i < b->digest_len; i++) {
+			unsigned int v = 0;
+			sscanf(hex + i * 2, "%2x", &v);
+			digest[i] = (uint8_t)v;
+		}
+		hashdb_builder_add(b, digest);
+	}
+
+	fclose(fp);
+	return ok;
+}
+
+/*
+ * Add the MD5 of every whole block of a reference file. All zero blocks are left out since they match any empty space
+ *
+ * @return False if the file could not be read
+ */
+bool hashdb_builder_add_blocks(hashdb_builder *b, const char *path) {
+	byte_buffer *bb = bb_new_from_file(path, "rb");
+	if(bb == NULL)
+		return false;
+
+	uint8_t digest[16];
+	for(uint64_t off = 0; off + b->block_size <= bb->len; off += b->block_size) {
+		if(zeromap_all_zero(bb->buf + off, b->block_size))
+			continue;
+
+		MD5_CTX ctx;
+		MD5_Init(&ctx);
+		MD5_Update(&ctx, bb->buf + off, b->block_size);
+		MD5_Final(digest, &ctx);
+		hashdb_builder_add(b, digest);
+	}
+
+	bb_free(bb);
+	return true;
+}
+
+static uint32_t hashdb_sort_len;
+
+static int hashdb_digest_cmp(const void *a, const void *b) {
+	return memcmp(a, b, hashdb_sort_len);
+}
+
+/*
+ * Sort and deduplicate the collected digests, build the Bloom filter and write the database
+ *
+ * @return False if the file could not be written
+ */
+bool hashdb_write(hashdb_builder *b, const char *path) {
+	hashdb_sort_len = b->digest_len;
+	qsort(b->digests, b->count, b->digest_len, hashdb_digest_cmp);
+
+	uint64_t unique = 0;
+	for(uint64_t i = 0; i < b->count; i++) {
+		if(unique > 0 && memcmp(b->digests + (unique - 1) * b->digest_len, b->digests + i * b->digest_len, b->digest_len) == 0)
+			continue;
+		memmove(b->digests + unique * b->digest_len, b->digests + i * b->digest_len, b->digest_len);
+		unique++;
+	}
+	b->count = unique;
+
+	uint32_t bloom_log2 = 10;
+	while((1ULL << bloom_log2) < b->count * HASHDB_BLOOM_BITS_PER_ENTRY)
+		bloom_log2++;
+	uint64_t bloom_bytes = (1ULL << bloom_log2) / 8;
+	uint8_t *bloom = (uint8_t*)calloc(bloom_bytes, 1);
+	for(uint64_t i = 0; i < b->count; i++) {
+		for(uint32_t k = 0; k < HASHDB_BLOOM_K; k++) {
+			uint64_t bit = hashdb_probe(b->digests + i * b->digest_len, k, (1ULL << bloom_log2) - 1);
+			bloom[bit >> 3] |= (uint8_t)(1 << (bit & 7));
+		}
+	}
+
+	uint8_t hdr[HASHDB_HEADER_SIZE];
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, HASHDB_MAGIC, 8);
+	write_le32(hdr + 8, HASHDB_VERSION);
+	write_le32(hdr + 12, b->digest_len);
+	write_le64(hdr + 16, b->count);
+	write_le32(hdr + 24, bloom_log2);
+	write_le32(hdr + 28, HASHDB_BLOOM_K);
+	write_le64(hdr + 32, HASHDB_HEADER_SIZE);
+	write_le64(hdr + 40, HASHDB_HEADER_SIZE + bloom_bytes);
+	write_le32(hdr + 48, b->block_size);
+
+	FILE *fp = fopen(path, "wb");
+	if(fp == NULL) {
+		printf("Could not open file %s to write the hash database\n", path);
+		free(bloom);
+		return false;
+	}
+
+	fwrite(hdr, 1, sizeof(hdr), fp);
+	fwrite(bloom, 1, bloom_bytes, fp);
+	fwrite(b->digests, b->digest_len, b->count, fp);
+	bool ok = (ferror(fp) == 0);
+	fclose(fp);
+	free(bloom);
+
+	if(!ok)
+		printf("Could not write the hash database to %s\n", path);
+	return ok;
+}
+
+/*
+ * A run of blocks of one region, the unit of parallel work of hashdb_match_blocks()
+ */
+typedef struct hashdb_task_t {
+	uint64_t start; // Offset of the first block
+	uint64_t count;
+	uint32_t step;
+} hashdb_task;
+
+/*
+ * State of one hashdb_match_blocks() call
+ */
+typedef struct hashdb_job_t {
+	hashdb *db;
+	const uint8_t *img;
+	hashdb_task *tasks;
+	par_list *offsets; // uint64_t lists of par_lists_new()
+	hashdb_match *counters; // Per thread, offsets unused
+} hashdb_job;
+
+static void hashdb_match_task(void *ctx, size_t index, uint32_t thread) {
+	hashdb_job *job = (hashdb_job*)ctx;
+	hashdb_task *task = &(job->tasks[index]);
+	hashdb_match *res = &(job->counters[thread]);
+	uint8_t digest[16];
+
+	for(uint64_t i = 0; i < task->count; i++) {
+		uint64_t off = task->start + i * task->step;
+		const uint8_t *block = job->img + off;
+
+		if(zeromap_all_zero(block, HASHDB_BLOCK)) {
+			res->blocks_zero++;
+			continue;
+		}
+
+		MD5_CTX md5;
+		MD5_Init(&md5);
+		MD5_Update(&md5, (void*)block, HASHDB_BLOCK);
+		MD5_Final(digest, &md5);
+		res->blocks_hashed++;
+
+		if(!hashdb_bloom_test(job->db, digest))
+			continue;
+		res->bloom_passed++;
+
+		if(hashdb_table_find(job->db, digest))
+			*(uint64_t*)par_list_add(&(job->offsets[thread]), sizeof(uint64_t)) = off;
+	}
+}
+
+static int hashdb_offset_cmp(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Hash the blocks of the given image regions in parallel and look each up in a block hash database
+ *
+ * @param db Database of MD5 digests of HASHDB_BLOCK byte blocks
+ * @param regions Areas to hash and the block grid of each
+ * @return Matching block offsets and counters. Release with hashdb_match_free()
+ */
+hashdb_match *hashdb_match_blocks(hashdb *db, const uint8_t *img, uint64_t img_len, const hashdb_region *regions, uint32_t num_regions) {
+	hashdb_match *res = (hashdb_match*)malloc(sizeof(hashdb_match));
+	memset(res, 0, sizeof(hashdb_match));
+
+	// Cut the regions into tasks of HASHDB_BLOCKS_PER_TASK blocks
+	size_t num_tasks = 0, cap = 64;
+	hashdb_task *tasks = (hashdb_task*)malloc(cap * sizeof(hashdb_task));
+	for(uint32_t r = 0; r < num_regions; r++) {
+		uint64_t end = (regions[r].end < img_len) ? regions[r].end : img_len;
+		if(regions[r].start + HASHDB_BLOCK > end || regions[r].step == 0)
+			continue;
+
+		uint64_t blocks = (end - HASHDB_BLOCK - regions[r].start) / regions[r].step + 1;
+		for(uint64_t first = 0; first < blocks; first += HASHDB_BLOCKS_PER_TASK) {
+			if(num_tasks == cap) {
+				cap *= 2;
+				tasks = (hashdb_task*)realloc(tasks, cap * sizeof(hashdb_task));
+			}
+			tasks[num_tasks].start = regions[r].start + first * regions[r].step;
+			tasks[num_tasks].count = (blocks - first < HASHDB_BLOCKS_PER_TASK) ? blocks - first : HASHDB_BLOCKS_PER_TASK;
+			tasks[num_tasks].step = regions[r].step;
+			num_tasks++;
+		}
+	}
+
+	hashdb_job job;
+	uint32_t num_threads = par_num_threads();
+	job.db = db;
+	job.img = img;
+	job.tasks = tasks;
+	job.offsets = par_lists_new();
+	job.counters = (hashdb_match*)calloc(num_threads, sizeof(hashdb_match));
+
+	par_run(num_tasks, hashdb_match_task, &job);
+
+	res->offsets = (uint64_t*)par_lists_merge(job.offsets, sizeof(uint64_t), &(res->count));
+	res->cap = res->count;
+	for(uint32_t t = 0; t < num_threads; t++) {
+		res->blocks_hashed += job.counters[t].blocks_hashed;
+		res->blocks_zero += job.counters[t].blocks_zero;
+		res->bloom_passed += job.counters[t].bloom_passed;
+	}
+	free(job.counters);
+	free(tasks);
+
+	qsort(res->offsets, res->count, sizeof(uint64_t), hashdb_offset_cmp);
+	return res;
+}
+
+void hashdb_match_free(hashdb_match *m) {
+	if(m->offsets != NULL)
+		free(m->offsets);
+
+	free(m);
+}
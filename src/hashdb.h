@@ -0,0 +1,123 @@
+/**
+   dd_reader
+   hashdb.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _HASHDB_H_
+#define _HASHDB_H_
+
+#include "md5.h"
+#include "parallel.h"
+#include "shared.h"
+#include "zeromap.h"
+
+#define HASHDB_MAX_DIGEST 32
+#define HASHDB_BLOCK 4096 // Bytes hashed per block for block matching
+#define HASHDB_BLOCKS_PER_TASK 1024 // Blocks hashed per parallel task
+
+// Bloom filter: about this many bits per digest with HASHDB_BLOOM_K probes gives a ~1% false positive rate
+#define HASHDB_BLOOM_BITS_PER_ENTRY 10
+#define HASHDB_BLOOM_K 7
+
+/*
+ * Database file layout (little endian). The file is mapped as is, so opening it does not depend on its size
+ *
+ * 0   8 byte magic
+ * 8   uint32 version
+ * 12  uint32 digest length in bytes
+ * 16  uint64 digest count
+ * 24  uint32 log2 of the Bloom filter size in bits
+ * 28  uint32 Bloom filter probes
+ * 32  uint64 offset of the Bloom filter
+ * 40  uint64 offset of the digest table (sorted, unique)
+ * 48  uint32 bytes per hashed block, 0 if the digests are of whole files
+ */
+#define HASHDB_MAGIC "DDHASHDB"
+#define HASHDB_VERSION 1
+#define HASHDB_HEADER_SIZE 64
+
+/*
+ * An opened, memory mapped database
+ */
+typedef struct hashdb_t {
+	uint8_t *map;
+	size_t map_len;
+
+	uint32_t digest_len;
+	uint64_t count;
+	uint32_t block_size;
+	const uint8_t *bloom;
+	uint64_t bloom_mask; // Bloom filter size in bits - 1
+	uint32_t bloom_k;
+	const uint8_t *table;
+} hashdb;
+
+/*
+ * Digests collected for a new database
+ */
+typedef struct hashdb_builder_t {
+	uint8_t *digests;
+	uint64_t count;
+	uint64_t cap;
+	uint32_t digest_len;
+	uint32_t block_size;
+} hashdb_builder;
+
+/*
+ * Image area hashed in blocks of HASHDB_BLOCK bytes starting every step bytes from start, so the block grid follows
+ * the cluster grid of the file system the area belongs to
+ */
+typedef struct hashdb_region_t {
+	uint64_t start;
+	uint64_t end;
+	uint32_t step;
+} hashdb_region;
+
+/*
+ * Result of hashdb_match_blocks()
+ */
+typedef struct hashdb_match_t {
+	uint64_t *offsets; // Image offsets of the matching blocks, sorted
+	uint64_t count;
+	uint64_t cap;
+
+	uint64_t blocks_hashed;
+	uint64_t blocks_zero; // Skipped without hashing
+	uint64_t bloom_passed; // Blocks the Bloom filter could not rule out
+} hashdb_match;
+
+/*
+ * Hash database functions
+ */
+
+// Lookup
+hashdb *hashdb_open(const char *path);
+void hashdb_close(hashdb *db);
+bool hashdb_contains(hashdb *db, const uint8_t *digest);
+
+// Creation
+hashdb_builder *hashdb_builder_new(uint32_t digest_len, uint32_t block_size);
+void hashdb_builder_free(hashdb_builder *b);
+void hashdb_builder_add(hashdb_builder *b, const uint8_t *digest);
+bool hashdb_builder_add_hex_file(hashdb_builder *b, const char *path);
+bool hashdb_builder_add_blocks(hashdb_builder *b, const char *path);
+bool hashdb_write(hashdb_builder *b, const char *path);
+
+// Block matching
+hashdb_match *hashdb_match_blocks(hashdb *db, const uint8_t *img, uint64_t img_len, const hashdb_region *regions, uint32_t num_regions);
+void hashdb_match_free(hashdb_match *m);
+
+#endif
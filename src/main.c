@@ -22,6 +22,7 @@
 
 #include "disk.h"
 #include "mbr.h"
+#include "parallel.h"
 
 void print_help() {
 	printf("Usage: dd_reader [OPTIONS] -f FILE\n");
@@ -31,24 +32,250 @@ void print_help() {
 	printf("-p TYPE\tFile is a single partition dump, do not attempt to read an MBR/GPT\n");
 	printf("\tValid Types: FAT, NTFS\n");
 	printf("-v\tVerbose. Print out all fields for all data structures\n");
+	printf("-r, --recover\n\tList deleted FAT directory entries and estimate whether they can be recovered\n");
+	printf("-R, --recover-unalloc\n\tAs --recover, also sweeping unallocated clusters for orphaned entries\n");
+	printf("--frag-report PREFIX\n\tWrite a fragmentation report and allocation map for each FAT partition to PREFIX-pN-*.csv/.pgm\n");
+	printf("--map-cells N\n\tClusters per allocation map cell (default: automatic)\n");
+	printf("--locate OFFSET\n\tShow the partition structure, file, slack or free space containing a byte offset (0x hex, or N's'\n"
+		"\tfor a sector). Repeatable\n");
+	printf("--locate-file FILE\n\tAs --locate, for every offset listed one per line in FILE\n");
+	printf("--lookup PATH\n\tShow the directory entry and clusters of a file by its full path. Repeatable\n");
+	printf("--lookup-file FILE\n\tAs --lookup, for every path listed one per line in FILE\n");
+	printf("--extract PATH\n\tCopy a file out of the image into the current directory. Repeatable\n");
+	printf("--list\n\tList the full path and size of every file. NTFS paths are rebuilt from a single pass over the MFT\n");
+	printf("--timeline FILE\n\tWrite a sorted MAC time timeline of every file to FILE\n");
+	printf("--timeline-format FORMAT\n\tTimeline format. Valid Formats: csv (default), bodyfile\n");
+	printf("--carve DIR\n\tCarve files by signature out of the image into DIR, listed in DIR/carve.csv\n");
+	printf("--carve-types LIST\n\tComma separated types to carve (default: all). Valid Types: jpeg, png, gif, pdf, zip, sqlite\n");
+	printf("--carve-sigs FILE\n\tAlso carve the signatures in FILE, one per line: NAME EXT HEADER_HEX FOOTER_HEX|- MAX_SIZE\n");
+	printf("--carve-unalloc\n\tOnly carve files starting in unallocated space of FAT/NTFS partitions\n");
+	printf("--strings N\n\tOutput the offset, encoding and text of every ASCII and UTF-16LE string of at least N characters\n");
+	printf("--search WORD\n\tSearch the image for a keyword (repeatable). \\xHH is the byte with hex value HH\n");
+	printf("--search-regex RE\n\tSearch the image for a POSIX extended regular expression (repeatable)\n");
+	printf("--search-file FILE\n\tSearch for the keywords in FILE, one per line. Lines starting with re: are regular expressions\n");
+	printf("--search-icase\n\tIgnore case when searching\n");
+	printf("--entropy FILE\n\tWrite the Shannon entropy and zero byte fraction of every 4 KiB block to FILE and summarize high\n"
+		"\tentropy regions\n");
+	printf("--entropy-format FORMAT\n\tEntropy map format. Valid Formats: csv (default), binary\n");
+	printf("--block-match DB\n\tHash every 4 KiB block of the image and report the blocks found in the block hash database DB\n");
+	printf("--build-hashdb DB\n\tWrite a block hash database of the --hashdb-src and --hashdb-hashes inputs to DB. -f is optional\n");
+	printf("--hashdb-src FILE\n\tAdd the MD5 of every 4 KiB block of the reference file FILE (repeatable)\n");
+	printf("--hashdb-hashes FILE\n\tAdd the hex MD5 block digests listed in FILE, one per line (repeatable)\n");
+	printf("--hash-files FILE\n\tWrite the MD5, SHA1 and SHA-256 of every file on the FAT and NTFS partitions to FILE\n");
+	printf("--known DB\n\tHash every file and leave the files whose SHA1 is in the known file set DB out of the --hash-files\n"
+		"\tlist\n");
+	printf("--build-known DB\n\tWrite a known file set of the --known-hashes inputs to DB. -f is optional\n");
+	printf("--known-hashes FILE\n\tAdd the hex SHA1 digests listed in FILE (sha1sum output or NSRL style CSV) to the known file set\n"
+		"\t(repeatable)\n");
+	printf("--dedup FILE\n\tWrite groups of files with identical contents on the FAT and NTFS partitions to FILE\n");
+	printf("--cdc\n\tSplit the image into content defined chunks and estimate its unique bytes with a chunk size\n"
+		"\thistogram\n");
+	printf("--cdc-avg N\n\tAverage chunk size in bytes for --cdc, a power of two (default: 8192)\n");
+	printf("--diff IMAGE\n\tCompare with another image of the same disk and list the changed byte ranges with the partition and\n"
+		"\tfile they belong to\n");
+	printf("--format FORMAT\n\tOutput format of the image summary and --list. Valid Formats: text (default), json, csv\n");
+	printf("--checksums\n\tHash the whole image (MD5 and SHA1, written to MD5-/SHA1- files) and count its zero blocks for the\n"
+		"\tsummary\n");
+	printf("--index FILE\n\tKeep the partition table, volume layouts, file tables and checksums (if computed) of the image in\n"
+		"\tFILE. While FILE matches the image, runs that only show the summary, --list and --lookup read FILE\n"
+		"\tinstead of the image. FILE is rewritten only when it is missing or no longer matches the image, and\n"
+		"\tchecksums are added to it the first time they are computed\n");
+	printf("--threads N\n\tNumber of worker threads (default: one per CPU)\n");
 	printf("\n");
 }
 
+// Long only options
+enum {
+	OPT_FRAG_REPORT = 256,
+	OPT_MAP_CELLS,
+	OPT_LOCATE,
+	OPT_LOCATE_FILE,
+	OPT_LOOKUP,
+	OPT_LOOKUP_FILE,
+	OPT_EXTRACT,
+	OPT_LIST,
+	OPT_TIMELINE,
+	OPT_TIMELINE_FORMAT,
+	OPT_CARVE,
+	OPT_CARVE_TYPES,
+	OPT_CARVE_SIGS,
+	OPT_CARVE_UNALLOC,
+	OPT_STRINGS,
+	OPT_SEARCH,
+	OPT_SEARCH_REGEX,
+	OPT_SEARCH_FILE,
+	OPT_SEARCH_ICASE,
+	OPT_ENTROPY,
+	OPT_ENTROPY_FORMAT,
+	OPT_BLOCK_MATCH,
+	OPT_BUILD_HASHDB,
+	OPT_HASHDB_SRC,
+	OPT_HASHDB_HASHES,
+	OPT_HASH_FILES,
+	OPT_KNOWN,
+	OPT_BUILD_KNOWN,
+	OPT_KNOWN_HASHES,
+	OPT_DEDUP,
+	OPT_CDC,
+	OPT_CDC_AVG,
+	OPT_DIFF,
+	OPT_FORMAT,
+	OPT_INDEX,
+	OPT_CHECKSUMS,
+	OPT_THREADS
+};
+
+static struct option long_opts[] = {
+	{ "file", required_argument, NULL, 'f' },
+	{ "help", no_argument, NULL, 'h' },
+	{ "partition", required_argument, NULL, 'p' },
+	{ "verbose", no_argument, NULL, 'v' },
+	{ "recover", no_argument, NULL, 'r' },
+	{ "recover-unalloc", no_argument, NULL, 'R' },
+	{ "frag-report", required_argument, NULL, OPT_FRAG_REPORT },
+	{ "map-cells", required_argument, NULL, OPT_MAP_CELLS },
+	{ "locate", required_argument, NULL, OPT_LOCATE },
+	{ "locate-file", required_argument, NULL, OPT_LOCATE_FILE },
+	{ "lookup", required_argument, NULL, OPT_LOOKUP },
+	{ "lookup-file", required_argument, NULL, OPT_LOOKUP_FILE },
+	{ "extract", required_argument, NULL, OPT_EXTRACT },
+	{ "list", no_argument, NULL, OPT_LIST },
+	{ "timeline", required_argument, NULL, OPT_TIMELINE },
+	{ "timeline-format", required_argument, NULL, OPT_TIMELINE_FORMAT },
+	{ "carve", required_argument, NULL, OPT_CARVE },
+	{ "carve-types", required_argument, NULL, OPT_CARVE_TYPES },
+	{ "carve-sigs", required_argument, NULL, OPT_CARVE_SIGS },
+	{ "carve-unalloc", no_argument, NULL, OPT_CARVE_UNALLOC },
+	{ "strings", required_argument, NULL, OPT_STRINGS },
+	{ "search", required_argument, NULL, OPT_SEARCH },
+	{ "search-regex", required_argument, NULL, OPT_SEARCH_REGEX },
+	{ "search-file", required_argument, NULL, OPT_SEARCH_FILE },
+	{ "search-icase", no_argument, NULL, OPT_SEARCH_ICASE },
+	{ "entropy", required_argument, NULL, OPT_ENTROPY },
+	{ "entropy-format", required_argument, NULL, OPT_ENTROPY_FORMAT },
+	{ "block-match", required_argument, NULL, OPT_BLOCK_MATCH },
+	{ "build-hashdb", required_argument, NULL, OPT_BUILD_HASHDB },
+	{ "hashdb-src", required_argument, NULL, OPT_HASHDB_SRC },
+	{ "hashdb-hashes", required_argument, NULL, OPT_HASHDB_HASHES },
+	{ "hash-files", required_argument, NULL, OPT_HASH_FILES },
+	{ "known", required_argument, NULL, OPT_KNOWN },
+	{ "build-known", required_argument, NULL, OPT_BUILD_KNOWN },
+	{ "known-hashes", required_argument, NULL, OPT_KNOWN_HASHES },
+	{ "dedup", required_argument, NULL, OPT_DEDUP },
+	{ "cdc", no_argument, NULL, OPT_CDC },
+	{ "cdc-avg", required_argument, NULL, OPT_CDC_AVG },
+	{ "diff", required_argument, NULL, OPT_DIFF },
+	{ "format", required_argument, NULL, OPT_FORMAT },
+	{ "index", required_argument, NULL, OPT_INDEX },
+	{ "checksums", no_argument, NULL, OPT_CHECKSUMS },
+	{ "threads", required_argument, NULL, OPT_THREADS },
+	{ NULL, 0, NULL, 0 }
+};
+
+// Append an offset to a growable list
+static void add_offset(uint64_t **list, size_t *count, size_t *cap, uint64_t offset) {
+	if(*count == *cap) {
+		*cap = (*cap == 0) ? 1024 : *cap * 2;
+		*list = (uint64_t*)realloc(*list, *cap * sizeof(uint64_t));
+	}
+	(*list)[(*count)++] = offset;
+}
+
+// Read one offset per line from a file. Blank lines and lines starting with '#' are skipped
+static bool read_offset_file(const char *path, uint64_t **list, size_t *count, size_t *cap) {
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL) {
+		printf("Could not open offset list %s\n", path);
+		return false;
+	}
+
+	char line[128];
+	uint64_t offset = 0;
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		if(line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+			continue;
+
+		if(parse_offset(line, &offset))
+			add_offset(list, count, cap, offset);
+		else
+			printf("Ignoring invalid offset: %s", line);
+	}
+
+	fclose(fp);
+	return true;
+}
+
+// Append a copy of a string to a growable list
+static void add_string(char ***list, size_t *count, size_t *cap, const char *str) {
+	if(*count == *cap) {
+		*cap = (*cap == 0) ? 64 : *cap * 2;
+		*list = (char**)realloc(*list, *cap * sizeof(char*));
+	}
+	(*list)[(*count)++] = new_string(str);
+}
+
+// Read one entry per line from a file, without the line terminator. Blank lines are skipped
+static bool read_string_file(const char *path, char ***list, size_t *count, size_t *cap) {
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL) {
+		printf("Could not open list %s\n", path);
+		return false;
+	}
+
+	char line[4096];
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if(line[0] != '\0')
+			add_string(list, count, cap, line);
+	}
+
+	fclose(fp);
+	return true;
+}
+
 int main(int argc, char **argv) {
 	int opt;
-	bool verbose = false, img_is_partition = false;
+	bool verbose = false, img_is_partition = false, checksums = false;
+	bool recover = false, recover_unalloc = false, list = false;
 	char *file_path = NULL, *partition_type = NULL;
-
-	printf("dd_reader\n\n");
+	char *frag_prefix = NULL;
+	uint32_t map_cells = 0;
+	uint64_t *locate = NULL, offset = 0, value = 0;
+	size_t num_locate = 0, locate_cap = 0;
+	char **lookup = NULL;
+	size_t num_lookup = 0, lookup_cap = 0;
+	char **extract = NULL;
+	size_t num_extract = 0, extract_cap = 0;
+	char *timeline_path = NULL;
+	int timeline_format = TL_FORMAT_CSV;
+	char *carve_dir = NULL;
+	bool carve_unalloc = false, carve_types = false;
+	carve_set *carve_sigs = carve_set_new();
+	uint64_t strings_min = 0;
+	search_set *search = search_set_new();
+	char *entropy_path = NULL;
+	int entropy_format = ENTROPY_FORMAT_CSV;
+	char *block_db_path = NULL, *build_db_path = NULL;
+	hashdb_builder *block_db = hashdb_builder_new(16, HASHDB_BLOCK);
+	char *hash_files_path = NULL;
+	char *known_path = NULL, *build_known_path = NULL;
+	hashdb_builder *known_db = hashdb_builder_new(20, 0);
+	char *dedup_path = NULL;
+	bool cdc = false;
+	uint32_t cdc_avg = CDC_AVG_DEFAULT;
+	char *diff_path = NULL;
+	int format = OUT_FORMAT_TEXT;
+	char *index_path = NULL;
 
 	// Parse command line options
-	while((opt = getopt(argc, argv, "f:hp:v")) != -1) {
+	while((opt = getopt_long(argc, argv, "f:hp:vrR", long_opts, NULL)) != -1) {
 		switch(opt) {
 			case 'f':
 				file_path = new_string(optarg);
 				break;
 
 			case 'h':
+				printf("dd_reader\n\n");
 				print_help();
 				return 0;
 				break;
@@ -62,6 +289,220 @@ int main(int argc, char **argv) {
 				verbose = true;
 				break;
 
+			case 'R':
+				recover_unalloc = true;
+				// Fall through
+			case 'r':
+				recover = true;
+				break;
+
+			case OPT_FRAG_REPORT:
+				frag_prefix = new_string(optarg);
+				break;
+
+			case OPT_MAP_CELLS:
+				if(!parse_count(optarg, 1, UINT32_MAX, &value)) {
+					printf("Clusters per map cell must be a number of at least 1: %s\n", optarg);
+					print_help();
+					return -1;
+				}
+				map_cells = (uint32_t)value;
+				break;
+
+			case OPT_LOCATE:
+				if(!parse_offset(optarg, &offset)) {
+					printf("Invalid offset: %s\n", optarg);
+					return -1;
+				}
+				add_offset(&locate, &num_locate, &locate_cap, offset);
+				break;
+
+			case OPT_LOCATE_FILE:
+				if(!read_offset_file(optarg, &locate, &num_locate, &locate_cap))
+					return -1;
+				break;
+
+			case OPT_LOOKUP:
+				add_string(&lookup, &num_lookup, &lookup_cap, optarg);
+				break;
+
+			case OPT_LOOKUP_FILE:
+				if(!read_string_file(optarg, &lookup, &num_lookup, &lookup_cap))
+					return -1;
+				break;
+
+			case OPT_EXTRACT:
+				add_string(&extract, &num_extract, &extract_cap, optarg);
+				break;
+
+			case OPT_LIST:
+				list = true;
+				break;
+
+			case OPT_TIMELINE:
+				timeline_path = new_string(optarg);
+				break;
+
+			case OPT_TIMELINE_FORMAT:
+				if(strcmp(optarg, "csv") == 0) {
+					timeline_format = TL_FORMAT_CSV;
+				} else if(strcmp(optarg, "bodyfile") == 0) {
+					timeline_format = TL_FORMAT_BODYFILE;
+				} else {
+					printf("Unknown timeline format: %s\n", optarg);
+					return -1;
+				}
+				break;
+
+			case OPT_CARVE:
+				carve_dir = new_string(optarg);
+				break;
+
+			case OPT_CARVE_TYPES: {
+				char *types = new_string(optarg);
+				for(char *t = strtok(types, ","); t != NULL; t = strtok(NULL, ",")) {
+					if(!carve_set_add_builtin(carve_sigs, t)) {
+						printf("Unknown carving type: %s\n", t);
+						return -1;
+					}
+				}
+				free(types);
+				carve_types = true;
+				break;
+			}
+
+			case OPT_CARVE_SIGS:
+				if(!carve_set_load(carve_sigs, optarg))
+					return -1;
+				carve_types = true;
+				break;
+
+			case OPT_CARVE_UNALLOC:
+				carve_unalloc = true;
+				break;
+
+			case OPT_STRINGS:
+				if(!parse_count(optarg, 1, UINT64_MAX, &strings_min)) {
+					printf("String length must be a number of at least 1: %s\n", optarg);
+					print_help();
+					return -1;
+				}
+				break;
+
+			case OPT_SEARCH:
+				if(!search_add_literal(search, optarg))
+					return -1;
+				break;
+
+			case OPT_SEARCH_REGEX:
+				if(!search_add_regex(search, optarg))
+					return -1;
+				break;
+
+			case OPT_SEARCH_FILE:
+				if(!search_set_load(search, optarg))
+					return -1;
+				break;
+
+			case OPT_SEARCH_ICASE:
+				search->icase = true;
+				break;
+
+			case OPT_ENTROPY:
+				entropy_path = new_string(optarg);
+				break;
+
+			case OPT_ENTROPY_FORMAT:
+				if(strcmp(optarg, "csv") == 0) {
+					entropy_format = ENTROPY_FORMAT_CSV;
+				} else if(strcmp(optarg, "binary") == 0) {
+					entropy_format = ENTROPY_FORMAT_BINARY;
+				} else {
+					printf("Unknown entropy map format: %s\n", optarg);
+					return -1;
+				}
+				break;
+
+			case OPT_BLOCK_MATCH:
+				block_db_path = new_string(optarg);
+				break;
+
+			case OPT_BUILD_HASHDB:
+				build_db_path = new_string(optarg);
+				break;
+
+			case OPT_HASHDB_SRC:
+				if(!hashdb_builder_add_blocks(block_db, optarg))
+					return -1;
+				break;
+
+			case OPT_HASHDB_HASHES:
+				if(!hashdb_builder_add_hex_file(block_db, optarg))
+					return -1;
+				break;
+
+			case OPT_HASH_FILES:
+				hash_files_path = new_string(optarg);
+				break;
+
+			case OPT_KNOWN:
+				known_path = new_string(optarg);
+				break;
+
+			case OPT_BUILD_KNOWN:
+				build_known_path = new_string(optarg);
+				break;
+
+			case OPT_KNOWN_HASHES:
+				if(!hashdb_builder_add_hex_file(known_db, optarg))
+					return -1;
+				break;
+
+			case OPT_DEDUP:
+				dedup_path = new_string(optarg);
+				break;
+
+			case OPT_CDC:
+				cdc = true;
+				break;
+
+			case OPT_CDC_AVG:
+				if(!parse_count(optarg, CDC_AVG_MIN, CDC_AVG_MAX, &value) || (value & (value - 1)) != 0) {
+					printf("Average chunk size must be a power of two from %u to %u: %s\n", CDC_AVG_MIN, CDC_AVG_MAX, optarg);
+					print_help();
+					return -1;
+				}
+				cdc_avg = (uint32_t)value;
+				break;
+
+			case OPT_DIFF:
+				diff_path = new_string(optarg);
+				break;
+
+			case OPT_FORMAT:
+				if(!out_parse_format(optarg, &format)) {
+					printf("Unknown output format: %s\n", optarg);
+					return -1;
+				}
+				break;
+
+			case OPT_INDEX:
+				index_path = new_string(optarg);
+				break;
+
+			case OPT_CHECKSUMS:
+				checksums = true;
+				break;
+
+			case OPT_THREADS:
+				if(!parse_count(optarg, 1, PAR_MAX_THREADS, &value)) {
+					printf("Number of threads must be from 1 to %u: %s\n", PAR_MAX_THREADS, optarg);
+					print_help();
+					return -1;
+				}
+				par_set_threads((uint32_t)value);
+				break;
+
 			default:
 				printf("Unknown argument: %c\n", (char)opt);
 				print_help();
@@ -70,27 +511,141 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	// Reports that read the image itself, rather than what the metadata index keeps
+	bool needs_image = recover || frag_prefix != NULL || num_locate > 0 || num_extract > 0 || carve_dir != NULL || strings_min > 0
+		|| search->count > 0 || entropy_path != NULL || block_db_path != NULL || hash_files_path != NULL || known_path != NULL
+		|| dedup_path != NULL || cdc || diff_path != NULL || timeline_path != NULL;
+
+	// The other reports print text, which would break up a JSON document or CSV sections
+	bool text_only = img_is_partition || needs_image || num_lookup > 0 || build_db_path != NULL || build_known_path != NULL;
+	if(format != OUT_FORMAT_TEXT && text_only) {
+		printf("--format json and csv only cover the image summary and --list\n");
+		return -1;
+	}
+
+	if(format == OUT_FORMAT_TEXT)
+		printf("dd_reader\n\n");
+
+	if(build_db_path != NULL) {
+		if(!hashdb_write(block_db, build_db_path))
+			return -1;
+		printf("Wrote %llu block hashes to %s\n", (unsigned long long)block_db->count, build_db_path);
+		if(file_path == NULL)
+			return 0;
+	}
+
+	if(build_known_path != NULL) {
+		if(!hashdb_write(known_db, build_known_path))
+			return -1;
+		printf("Wrote %llu known file hashes to %s\n", (unsigned long long)known_db->count, build_known_path);
+		if(file_path == NULL)
+			return 0;
+	}
+
 	if(file_path == NULL) {
 		printf("Path to disk image must be set (-f)\n");
 		print_help();
 		return 0;
 	}
 
+	if(!search_set_compile(search))
+		return -1;
+
 	if(!img_is_partition) {
-		disk_img *disk = disk_init(file_path);
-		disk_parse(disk);
-		disk_print(disk, verbose);
+		disk_img *disk = NULL;
+		if(index_path != NULL && !needs_image && (disk = disk_open_index(file_path, index_path)) != NULL && format == OUT_FORMAT_TEXT)
+			printf("Using metadata index %s\n\n", index_path);
+		if(disk == NULL && (disk = disk_init(file_path)) == NULL)
+			return -1;
+
+		out_writer *out = out_new(format, STDOUT_FILENO);
+		out_begin(out);
+		disk_print(disk, verbose, checksums, out);
+		if(index_path != NULL) {
+			int saved = disk_save_index(disk, index_path);
+			if(saved == DISK_INDEX_WRITTEN && format == OUT_FORMAT_TEXT)
+				printf("Wrote metadata index to %s\n\n", index_path);
+			else if(saved == DISK_INDEX_CHECKSUMS && format == OUT_FORMAT_TEXT)
+				printf("Added checksums to metadata index %s\n\n", index_path);
+		}
+		if(recover)
+			disk_recover(disk, recover_unalloc);
+		if(frag_prefix != NULL)
+			disk_frag_report(disk, frag_prefix, map_cells);
+		if(num_locate > 0)
+			disk_locate(disk, locate, num_locate);
+		if(num_lookup > 0)
+			disk_lookup(disk, lookup, num_lookup);
+		if(num_extract > 0)
+			disk_extract(disk, extract, num_extract);
+		if(list)
+			disk_list(disk, out);
+		if(carve_dir != NULL) {
+			if(!carve_types)
+				carve_set_add_builtin(carve_sigs, "all");
+			disk_carve(disk, carve_sigs, carve_dir, carve_unalloc);
+		}
+		if(strings_min > 0)
+			disk_strings(disk, strings_min);
+		if(search->count > 0)
+			disk_search(disk, search);
+		if(entropy_path != NULL)
+			disk_entropy(disk, entropy_path, entropy_format);
+		if(block_db_path != NULL) {
+			hashdb *db = hashdb_open(block_db_path);
+			if(db != NULL) {
+				disk_block_match(disk, db);
+				hashdb_close(db);
+			}
+		}
+		if(hash_files_path != NULL || known_path != NULL) {
+			hashdb *known = NULL;
+			if(known_path == NULL || (known = hashdb_open(known_path)) != NULL)
+				disk_hash_files(disk, hash_files_path, known);
+			if(known != NULL)
+				hashdb_close(known);
+		}
+		if(dedup_path != NULL)
+			disk_dedup(disk, dedup_path);
+		if(cdc)
+			disk_cdc(disk, cdc_avg);
+		if(diff_path != NULL)
+			disk_diff(disk, diff_path);
+		if(timeline_path != NULL)
+			disk_timeline(disk, timeline_path, timeline_format);
+		out_end(out);
+		out_free(out);
 		disk_destroy(disk);
 	} else {
-		if(strcmp(partition_type, "FAT")) {
-			byte_buffer *fat_bb = bb_new_from_file(file_path, "rb");
+		if(strcmp(partition_type, "FAT") == 0) {
+			byte_buffer *fat_bb = bb_new_map(file_path);
+			if(fat_bb == NULL)
+				return -1;
 			fat_partition *fat_par = fat_new_partition();
 
 			fat_read_partition(fat_bb, fat_par);
 			fat_print_partition(fat_par, verbose);
-			
+			if(recover) {
+				recover_result *res = recover_scan(fat_par, recover_unalloc);
+				recover_print(fat_par, res);
+				recover_free(res);
+			}
+			if(frag_prefix != NULL)
+				frag_report_partition(fat_par, 0, frag_prefix, map_cells);
+
 			fat_free_partition(fat_par);
 			bb_free(fat_bb);
+		} else if(strcmp(partition_type, "NTFS") == 0) {
+			byte_buffer *ntfs_bb = bb_new_map(file_path);
+			if(ntfs_bb == NULL)
+				return -1;
+			ntfs_partition *ntfs_par = ntfs_new_partition();
+
+			ntfs_read_partition(ntfs_bb, ntfs_par);
+			ntfs_print_partition(ntfs_par, verbose);
+
+			ntfs_free_partition(ntfs_par);
+			bb_free(ntfs_bb);
 		} else {
 			printf("Unsupported partition type\n");
 		}
@@ -100,6 +655,44 @@ int main(int argc, char **argv) {
 		free(file_path);
 	if(partition_type != NULL)
 		free(partition_type);
+	if(frag_prefix != NULL)
+		free(frag_prefix);
+	if(locate != NULL)
+		free(locate);
+	for(size_t i = 0; i < num_lookup; i++)
+		free(lookup[i]);
+	if(lookup != NULL)
+		free(lookup);
+	for(size_t i = 0; i < num_extract; i++)
+		free(extract[i]);
+	if(extract != NULL)
+		free(extract);
+	if(timeline_path != NULL)
+		free(timeline_path);
+	if(index_path != NULL)
+		free(index_path);
+	if(carve_dir != NULL)
+		free(carve_dir);
+	carve_set_free(carve_sigs);
+	search_set_free(search);
+	if(entropy_path != NULL)
+		free(entropy_path);
+	if(block_db_path != NULL)
+		free(block_db_path);
+	if(build_db_path != NULL)
+		free(build_db_path);
+	hashdb_builder_free(block_db);
+	if(hash_files_path != NULL)
+		free(hash_files_path);
+	if(known_path != NULL)
+		free(known_path);
+	if(build_known_path != NULL)
+		free(build_known_path);
+	hashdb_builder_free(known_db);
+	if(dedup_path != NULL)
+		free(dedup_path);
+	if(diff_path != NULL)
+		free(diff_path);
 
 	return 0;
 }
@@ -54,7 +54,7 @@ void mbr_read(byte_buffer *bb, mbr *m) {
 	m->sig1 = bb_get(bb);
 	m->sig2 = bb_get(bb);
 	if(m->sig1 != 0x55 || m->sig2 != 0xAA) {
-		printf("Warning: MBR boot signature does not match 0x55 0xAA!\n");
+		fprintf(stderr, "Warning: MBR boot signature does not match 0x55 0xAA!\n");
 	}
 }
 
@@ -102,3 +102,35 @@ void mbr_print(mbr* m, bool verbose) {
 		free(part_str);
 	}
 }
+
+/*
+ * Output one record per partition entry
+ *
+ * @param out Writer with a section open
+ * @param verbose Include the CHS addresses
+ */
+void mbr_output(mbr *m, out_writer *out, bool verbose) {
+	for(int i = 0; i < 4; i++) {
+		partition_entry *pe = &(m->pentry[i]);
+		char *part_str = get_partition_str(pe->type);
+
+		out_record_begin(out);
+		out_u64(out, "Partition", i);
+		out_u64(out, "Type", pe->type);
+		out_str(out, "TypeName", part_str);
+		out_u64(out, "BootIndicator", pe->boot_indicator);
+		out_u64(out, "RelativeSector", pe->relative_sector);
+		out_u64(out, "NumSectors", pe->num_sectors);
+		if(verbose) {
+			out_u64(out, "HeadStart", pe->head_start);
+			out_u64(out, "SectorStart", pe->sector_start);
+			out_u64(out, "CylinderStart", pe->cylinder_start);
+			out_u64(out, "HeadEnd", pe->head_end);
+			out_u64(out, "SectorEnd", pe->sector_end);
+			out_u64(out, "CylinderEnd", pe->cylinder_end);
+		}
+		out_record_end(out);
+
+		free(part_str);
+	}
+}
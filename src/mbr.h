@@ -20,6 +20,7 @@
 #define _MBR_H_
 
 #include "bytebuffer.h"
+#include "out.h"
 #include "shared.h"
 
 /*
@@ -59,5 +60,6 @@ void mbr_free(mbr *m);
 void mbr_read(byte_buffer *bb, mbr *m);
 void mbr_write(byte_buffer *bb, mbr *m);
 void mbr_print(mbr *m, bool verbose);
+void mbr_output(mbr *m, out_writer *out, bool verbose);
 
 #endif
\ No newline at end of file
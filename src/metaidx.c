@@ -0,0 +1,545 @@
+/**
+   dd_reader
+   metaidx.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metaidx.h"
+
+// Size, mtime and inode of the image file
+static bool metaidx_identity(const char *img_path, uint64_t *size, int64_t *mtime_sec, uint32_t *mtime_nsec, uint64_t *ino) {
+	struct stat sb;
+	if(stat(img_path, &sb) != 0)
+		return false;
+
+	*size = (uint64_t)sb.st_size;
+	*mtime_sec = (int64_t)sb.st_mtim.tv_sec;
+	*mtime_nsec = (uint32_t)sb.st_mtim.tv_nsec;
+	*ino = (uint64_t)sb.st_ino;
+	return true;
+}
+
+metaidx_builder *metaidx_builder_new() {
+	metaidx_builder *b = (metaidx_builder*)malloc(sizeof(metaidx_builder));
+	memset(b, 0, sizeof(metaidx_builder));
+	extent_list_init(&(b->extents));
+	return b;
+}
+
+void metaidx_builder_free(metaidx_builder *b) {
+	if(b->files != NULL)
+		free(b->files);
+	if(b->pool != NULL)
+		free(b->pool);
+	extent_list_free(&(b->extents));
+	free(b);
+}
+
+// Append bytes to the data pool and return their offset
+static uint64_t metaidx_pool_add(metaidx_builder *b, const void *data, uint64_t len) {
+	if(b->pool_len + len > b->pool_cap) {
+		while(b->pool_len + len > b->pool_cap)
+			b->pool_cap = (b->pool_cap == 0) ? 64 * 1024 : b->pool_cap * 2;
+		b->pool = (uint8_t*)realloc(b->pool, b->pool_cap);
+	}
+
+	uint64_t off = b->pool_len;
+	memcpy(b->pool + off, data, len);
+	b->pool_len += len;
+	return off;
+}
+
+// Add a file with a copy of its path and extents
+static void metaidx_add_file(metaidx_builder *b, metaidx_file *file, const char *path, const extent *ext) {
+	if(b->num_files == b->files_cap) {
+		b->files_cap = (b->files_cap == 0) ? 1024 : b->files_cap * 2;
+		b->files = (metaidx_file*)realloc(b->files, b->files_cap * sizeof(metaidx_file));
+	}
+
+	file->path_off = metaidx_pool_add(b, path, strlen(path) + 1);
+	file->path = NULL;
+	file->ext_first = b->extents.count;
+	for(uint32_t e = 0; e < file->ext_count; e++) {
+		extent_list_append(&(b->extents), ext[e].start, ext[e].length, false);
+	}
+	b->files[b->num_files++] = *file;
+}
+
+/*
+ * Add a FAT volume: its reserved sectors and every file of the directory tree with its clusters
+ *
+ * @param partition MBR partition entry of the volume
+ */
+void metaidx_builder_add_fat(metaidx_builder *b, uint8_t partition, fat_partition *part) {
+	metaidx_part *p = &(b->parts[partition]);
+	p->type = part->type;
+
+	uint64_t boot_len = (uint64_t)part->boot_sector->bpb.reserved_sectors * part->boot_sector->bpb.bytes_per_sector;
+	if(boot_len < METAIDX_SECTOR_SIZE)
+		boot_len = METAIDX_SECTOR_SIZE;
+	if(boot_len > METAIDX_BOOT_MAX)
+		boot_len = METAIDX_BOOT_MAX;
+	if(boot_len > part->vol_len)
+		boot_len = part->vol_len;
+	p->boot_len = (uint32_t)boot_len;
+	p->boot_off = metaidx_pool_add(b, part->vol, boot_len);
+
+	fat_read_directory_tree(part);
+	fat_build_extent_index(part);
+
+	p->first_file = b->num_files;
+	for(uint32_t f = 0; f < part->num_files; f++) {
+		fat_file *ff = &(part->files[f]);
+		metaidx_file file;
+		memset(&file, 0, sizeof(metaidx_file));
+		file.size = ff->de.size;
+		file.ext_count = ff->ext_count;
+		file.num = f;
+		file.attr = ff->de.attr;
+		if(ff->de.attr & FAT_ATTR_DIRECTORY)
+			file.flags |= METAIDX_FILE_DIR;
+		if(f == FAT_ROOT_INDEX)
+			file.flags |= METAIDX_FILE_ROOT;
+		metaidx_add_file(b, &file, ff->path, part->extents.ext + ff->ext_first);
+	}
+	p->num_files = b->num_files - p->first_file;
+}
+
+/*
+ * Add an NTFS volume: its boot sector, MFT summary and every in use record with a path, with its data runs
+ *
+ * @param partition MBR partition entry of the volume
+ */
+void metaidx_builder_add_ntfs(metaidx_builder *b, uint8_t partition, ntfs_partition *part) {
+	metaidx_part *p = &(b->parts[partition]);
+	p->type = part->type;
+
+	uint64_t boot_len = (part->vol_len < METAIDX_SECTOR_SIZE) ? part->vol_len : METAIDX_SECTOR_SIZE;
+	p->boot_len = (uint32_t)boot_len;
+	p->boot_off = metaidx_pool_add(b, part->vol, boot_len);
+	p->ntfs = *ntfs_summarize(part);
+
+	p->first_file = b->num_files;
+	if(ntfs_load_mft(part)) {
+		ntfs_build_extent_index(part);
+		for(uint32_t r = 0; r < part->num_records; r++) {
+			ntfs_record *rec = &(part->records[r]);
+			if(!(rec->flags & NTFS_REC_IN_USE))
+				continue;
+
+			const char *path = ntfs_record_path(part, r);
+			if(path == NULL)
+				continue;
+
+			metaidx_file file;
+			memset(&file, 0, sizeof(metaidx_file));
+			file.size = rec->size;
+			file.ext_count = rec->ext_count;
+			file.num = r;
+			file.attr = rec->flags;
+			if(rec->flags & NTFS_REC_DIRECTORY)
+				file.flags |= METAIDX_FILE_DIR;
+			if(r == NTFS_RECORD_ROOT)
+				file.flags |= METAIDX_FILE_ROOT;
+			metaidx_add_file(b, &file, path, part->extents.ext + rec->ext_first);
+		}
+	}
+	p->num_files = b->num_files - p->first_file;
+}
+
+/*
+ * Fill the path slot tables, one per partition, kept at most half full. A path present twice keeps its last file,
+ * as in a path_index
+ *
+ * @return The slot table, num_slots entries of METAIDX_SLOT_SIZE bytes
+ */
+static uint8_t *metaidx_build_slots(metaidx_builder *b, uint64_t *num_slots) {
+	*num_slots = 0;
+	for(int i = 0; i < 4; i++) {
+		metaidx_part *p = &(b->parts[i]);
+		p->first_slot = *num_slots;
+		p->num_slots = 0;
+		if(p->num_files == 0)
+			continue;
+
+		p->num_slots = 64;
+		while(p->num_slots < p->num_files * 2)
+			p->num_slots *= 2;
+		*num_slots += p->num_slots;
+	}
+
+	uint8_t *slots = (uint8_t*)calloc(*num_slots + 1, METAIDX_SLOT_SIZE);
+	for(int i = 0; i < 4; i++) {
+		metaidx_part *p = &(b->parts[i]);
+		uint8_t *table = slots + p->first_slot * METAIDX_SLOT_SIZE;
+		uint32_t mask = p->num_slots - 1;
+
+		for(uint32_t f = p->first_file; f < p->first_file + p->num_files; f++) {
+			const char *path = (const char*)(b->pool + b->files[f].path_off);
+			size_t len = 0;
+			uint32_t h = pathidx_key_hash(path, &len);
+			uint32_t s = h & mask;
+
+			while(read_le32(table + s * METAIDX_SLOT_SIZE + 4) != 0) {
+				uint8_t *slot = table + s * METAIDX_SLOT_SIZE;
+				const char *key = (const char*)(b->pool + b->files[read_le32(slot + 4) - 1].path_off);
+				if(read_le32(slot) == h && pathidx_key_equal(key, path, len))
+					break;
+				s = (s + 1) & mask;
+			}
+
+			write_le32(table + s * METAIDX_SLOT_SIZE, h);
+			write_le32(table + s * METAIDX_SLOT_SIZE + 4, f + 1);
+		}
+	}
+
+	return slots;
+}
+
+/*
+ * Write the index. The image file is stat()ed for its identity, it is not read
+ *
+ * @param img_path Image the tables were read from
+ */
+bool metaidx_write(metaidx_builder *b, const char *path, const char *img_path) {
+	uint64_t img_size = 0, img_ino = 0;
+	int64_t mtime_sec = 0;
+	uint32_t mtime_nsec = 0;
+	if(!metaidx_identity(img_path, &img_size, &mtime_sec, &mtime_nsec, &img_ino)) {
+		printf("Could not stat %s for the metadata index\n", img_path);
+		return false;
+	}
+
+	uint64_t num_slots = 0;
+	uint8_t *slots = metaidx_build_slots(b, &num_slots);
+
+	// Boot regions are raw bytes, so the pool may end with one. metaidx_open() relies on a final NUL to keep every path
+	// within the pool
+	metaidx_pool_add(b, "", 1);
+
+	uint64_t parts_off = METAIDX_HEADER_SIZE;
+	uint64_t files_off = parts_off + 4 * METAIDX_PART_SIZE;
+	uint64_t extents_off = files_off + (uint64_t)b->num_files * METAIDX_FILE_SIZE;
+	uint64_t slots_off = extents_off + b->extents.count * METAIDX_EXTENT_SIZE;
+	uint64_t pool_off = slots_off + num_slots * METAIDX_SLOT_SIZE;
+
+	metaidx_image *img = &(b->image);
+	uint8_t hdr[METAIDX_HEADER_SIZE];
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, METAIDX_MAGIC, 8);
+	write_le32(hdr + 8, METAIDX_VERSION);
+	write_le32(hdr + 12, b->num_files);
+	write_le64(hdr + 16, img_size);
+	write_le64(hdr + 24, (uint64_t)mtime_sec);
+	write_le32(hdr + 32, mtime_nsec);
+	write_le32(hdr + 36, img->zero_block_size);
+	write_le64(hdr + 40, img_ino);
+	memcpy(hdr + 48, img->digest.md5, sizeof(img->digest.md5));
+	memcpy(hdr + 64, img->digest.sha1, sizeof(img->digest.sha1));
+	write_le32(hdr + 84, (img->digest.which != 0) ? METAIDX_HAS_CHECKSUMS : 0);
+	write_le64(hdr + 88, img->zero_blocks);
+	write_le64(hdr + 96, img->num_blocks);
+	write_le64(hdr + 104, img->hole_bytes);
+	write_le64(hdr + 112, parts_off);
+	write_le64(hdr + 120, files_off);
+	write_le64(hdr + 128, extents_off);
+	write_le64(hdr + 136, b->extents.count);
+	write_le64(hdr + 144, slots_off);
+	write_le64(hdr + 152, num_slots);
+	write_le64(hdr + 160, pool_off);
+	write_le64(hdr + 168, b->pool_len);
+	memcpy(hdr + METAIDX_MBR_OFFSET, img->mbr, METAIDX_SECTOR_SIZE);
+
+	uint8_t parts[4 * METAIDX_PART_SIZE];
+	memset(parts, 0, sizeof(parts));
+	for(int i = 0; i < 4; i++) {
+		metaidx_part *p = &(b->parts[i]);
+		uint8_t *e = parts + i * METAIDX_PART_SIZE;
+		e[0] = p->type;
+		write_le32(e + 4, p->boot_len);
+		write_le64(e + 8, p->boot_off);
+		write_le32(e + 16, p->first_file);
+		write_le32(e + 20, p->num_files);
+		write_le64(e + 24, p->first_slot);
+		write_le32(e + 32, p->num_slots);
+		write_le32(e + 36, p->ntfs.num_records);
+		write_le32(e + 40, p->ntfs.in_use);
+		write_le32(e + 44, p->ntfs.dirs);
+		write_le32(e + 48, p->ntfs.ext);
+		write_le32(e + 52, p->ntfs.bad);
+		e[56] = p->ntfs.has_mft;
+		e[57] = p->ntfs.has_free_map;
+		write_le32(e + 60, p->ntfs.num_free_runs);
+		write_le64(e + 64, p->ntfs.free_clusters);
+		for(uint32_t r = 0; r < p->ntfs.num_free_runs; r++) {
+			write_le64(e + 72 + r * 16, p->ntfs.free_runs[r].start);
+			write_le64(e + 80 + r * 16, p->ntfs.free_runs[r].length);
+		}
+	}
+
+	FILE *fp = fopen(path, "wb");
+	if(fp == NULL) {
+		printf("Could not open file %s to write the metadata index\n", path);
+		free(slots);
+		return false;
+	}
+
+	fwrite(hdr, 1, sizeof(hdr), fp);
+	fwrite(parts, 1, sizeof(parts), fp);
+
+	uint8_t e[METAIDX_FILE_SIZE];
+	for(uint32_t f = 0; f < b->num_files; f++) {
+		metaidx_file *file = &(b->files[f]);
+		memset(e, 0, sizeof(e));
+		write_le64(e, file->size);
+		write_le64(e + 8, file->ext_first);
+		write_le64(e + 16, file->path_off);
+		write_le32(e + 24, file->ext_count);
+		write_le32(e + 28, file->num);
+		write_le16(e + 32, file->attr);
+		e[34] = file->flags;
+		fwrite(e, 1, sizeof(e), fp);
+	}
+
+	for(uint64_t x = 0; x < b->extents.count; x++) {
+		write_le64(e, b->extents.ext[x].start);
+		write_le64(e + 8, b->extents.ext[x].length);
+		fwrite(e, 1, METAIDX_EXTENT_SIZE, fp);
+	}
+
+	fwrite(slots, METAIDX_SLOT_SIZE, num_slots, fp);
+	fwrite(b->pool, 1, b->pool_len, fp);
+	bool ok = (ferror(fp) == 0);
+	fclose(fp);
+	free(slots);
+
+	if(!ok)
+		printf("Could not write the metadata index to %s\n", path);
+	return ok;
+}
+
+/*
+ * Record checksums and zero block counts in an index written without them. The rest of the index is left as is
+ *
+ * @param img Checksums and zero block counts to record
+ * @return False if the index could not be updated
+ */
+bool metaidx_write_checksums(const char *path, const metaidx_image *img) {
+	int fd = open(path, O_WRONLY);
+	if(fd < 0) {
+		printf("Could not open file %s to update the metadata index\n", path);
+		return false;
+	}
+
+	uint8_t hdr[112];
+	memset(hdr, 0, sizeof(hdr));
+	write_le32(hdr + 36, img->zero_block_size);
+	memcpy(hdr + 48, img->digest.md5, sizeof(img->digest.md5));
+	memcpy(hdr + 64, img->digest.sha1, sizeof(img->digest.sha1));
+	write_le32(hdr + 84, METAIDX_HAS_CHECKSUMS);
+	write_le64(hdr + 88, img->zero_blocks);
+	write_le64(hdr + 96, img->num_blocks);
+	write_le64(hdr + 104, img->hole_bytes);
+
+	// The image identity at 40 lies between the two ranges and must not change
+	bool ok = pwrite(fd, hdr + 36, 4, 36) == 4 && pwrite(fd, hdr + 48, 64, 48) == 64;
+	close(fd);
+
+	if(!ok)
+		printf("Could not update the metadata index %s\n", path);
+	return ok;
+}
+
+/*
+ * Map an index and check it against the image
+ *
+ * @param img_path Image the index should describe
+ * @return The index, or NULL if it does not exist, is damaged or the image has changed since it was written
+ */
+metaidx *metaidx_open(const char *path, const char *img_path) {
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return NULL;
+
+	struct stat sb;
+	if(fstat(fd, &sb) != 0 || sb.st_size < METAIDX_HEADER_SIZE + 4 * METAIDX_PART_SIZE) {
+		close(fd);
+		return NULL;
+	}
+
+	uint8_t *map = (uint8_t*)mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return NULL;
+
+	metaidx *idx = (metaidx*)malloc(sizeof(metaidx));
+	memset(idx, 0, sizeof(metaidx));
+	idx->map = map;
+	idx->map_len = (size_t)sb.st_size;
+
+	uint64_t img_size = 0, img_ino = 0;
+	int64_t mtime_sec = 0;
+	uint32_t mtime_nsec = 0;
+	bool ok = memcmp(map, METAIDX_MAGIC, 8) == 0 && read_le32(map + 8) == METAIDX_VERSION
+		&& metaidx_identity(img_path, &img_size, &mtime_sec, &mtime_nsec, &img_ino)
+		&& read_le64(map + 16) == img_size && (int64_t)read_le64(map + 24) == mtime_sec && read_le32(map + 32) == mtime_nsec
+		&& read_le64(map + 40) == img_ino;
+
+	// Every table must lie within the file
+	uint64_t len = idx->map_len;
+	uint64_t parts_off = read_le64(map + 112), files_off = read_le64(map + 120), extents_off = read_le64(map + 128);
+	uint64_t slots_off = read_le64(map + 144), pool_off = read_le64(map + 160);
+	idx->num_files = read_le32(map + 12);
+	idx->num_extents = read_le64(map + 136);
+	idx->num_slots = read_le64(map + 152);
+	idx->pool_len = read_le64(map + 168);
+	ok = ok && parts_off <= len && 4 * METAIDX_PART_SIZE <= len - parts_off
+		&& files_off <= len && idx->num_files <= (len - files_off) / METAIDX_FILE_SIZE
+		&& extents_off <= len && idx->num_extents <= (len - extents_off) / METAIDX_EXTENT_SIZE
+		&& slots_off <= len && idx->num_slots <= (len - slots_off) / METAIDX_SLOT_SIZE
+		&& pool_off <= len && idx->pool_len <= len - pool_off
+		&& (idx->pool_len == 0 || map[pool_off + idx->pool_len - 1] == '\0');
+
+	for(int i = 0; i < 4 && ok; i++) {
+		const uint8_t *e = map + parts_off + i * METAIDX_PART_SIZE;
+		metaidx_part *p = &(idx->parts[i]);
+		p->type = e[0];
+		p->boot_len = read_le32(e + 4);
+		p->boot_off = read_le64(e + 8);
+		p->first_file = read_le32(e + 16);
+		p->num_files = read_le32(e + 20);
+		p->first_slot = read_le64(e + 24);
+		p->num_slots = read_le32(e + 32);
+		p->ntfs.num_records = read_le32(e + 36);
+		p->ntfs.in_use = read_le32(e + 40);
+		p->ntfs.dirs = read_le32(e + 44);
+		p->ntfs.ext = read_le32(e + 48);
+		p->ntfs.bad = read_le32(e + 52);
+		p->ntfs.has_mft = (e[56] != 0);
+		p->ntfs.has_free_map = (e[57] != 0);
+		p->ntfs.num_free_runs = read_le32(e + 60);
+		p->ntfs.free_clusters = read_le64(e + 64);
+
+		ok = p->boot_off <= idx->pool_len && p->boot_len <= idx->pool_len - p->boot_off
+			&& p->first_file <= idx->num_files && p->num_files <= idx->num_files - p->first_file
+			&& p->first_slot <= idx->num_slots && p->num_slots <= idx->num_slots - p->first_slot
+			&& (p->num_slots & (p->num_slots - 1)) == 0 && p->ntfs.num_free_runs <= NTFS_TOP_FREE_RUNS;
+		for(uint32_t r = 0; ok && r < p->ntfs.num_free_runs; r++) {
+			p->ntfs.free_runs[r].start = read_le64(e + 72 + r * 16);
+			p->ntfs.free_runs[r].length = read_le64(e + 80 + r * 16);
+		}
+	}
+
+	if(!ok) {
+		metaidx_close(idx);
+		return NULL;
+	}
+
+	metaidx_image *img = &(idx->image);
+	img->img_len = img_size;
+	uint32_t flags = read_le32(map + 84);
+	img->digest.which = (flags & METAIDX_HAS_CHECKSUMS) ? (DIGEST_MD5 | DIGEST_SHA1) : 0;
+	memcpy(img->digest.md5, map + 48, sizeof(img->digest.md5));
+	memcpy(img->digest.sha1, map + 64, sizeof(img->digest.sha1));
+	img->zero_block_size = read_le32(map + 36);
+	img->zero_blocks = read_le64(map + 88);
+	img->num_blocks = read_le64(map + 96);
+	img->hole_bytes = read_le64(map + 104);
+	memcpy(img->mbr, map + METAIDX_MBR_OFFSET, METAIDX_SECTOR_SIZE);
+
+	idx->files = map + files_off;
+	idx->extents = map + extents_off;
+	idx->slots = map + slots_off;
+	idx->pool = map + pool_off;
+	return idx;
+}
+
+void metaidx_close(metaidx *idx) {
+	munmap(idx->map, idx->map_len);
+	free(idx);
+}
+
+/*
+ * Read entry n of the file table
+ *
+ * @return False if the entry points outside of the index
+ */
+bool metaidx_file_at(metaidx *idx, uint32_t n, metaidx_file *out) {
+	if(n >= idx->num_files)
+		return false;
+
+	const uint8_t *e = idx->files + (uint64_t)n * METAIDX_FILE_SIZE;
+	out->size = read_le64(e);
+	out->ext_first = read_le64(e + 8);
+	out->path_off = read_le64(e + 16);
+	out->ext_count = read_le32(e + 24);
+	out->num = read_le32(e + 28);
+	out->attr = read_le16(e + 32);
+	out->flags = e[34];
+	out->path = (const char*)(idx->pool + out->path_off);
+
+	return out->path_off < idx->pool_len && out->ext_first <= idx->num_extents && out->ext_count <= idx->num_extents - out->ext_first;
+}
+
+bool metaidx_extent_at(metaidx *idx, uint64_t n, extent *out) {
+	if(n >= idx->num_extents)
+		return false;
+
+	const uint8_t *e = idx->extents + n * METAIDX_EXTENT_SIZE;
+	out->start = read_le64(e);
+	out->length = read_le64(e + 8);
+	return true;
+}
+
+/*
+ * Find a file of a partition by its full path, ignoring ASCII case and a trailing '/' like the path indexes of the
+ * filesystems
+ *
+ * @param file Receives the index of the file in the file table
+ * @return False if the path is not on the partition
+ */
+bool metaidx_lookup(metaidx *idx, uint8_t partition, const char *path, uint32_t *file) {
+	metaidx_part *p = &(idx->parts[partition]);
+	if(p->num_slots == 0)
+		return false;
+
+	size_t len = 0;
+	uint32_t h = pathidx_key_hash(path, &len);
+	uint32_t mask = p->num_slots - 1;
+	const uint8_t *table = idx->slots + p->first_slot * METAIDX_SLOT_SIZE;
+
+	// The table is at most half full, so the probe always reaches an empty slot
+	for(uint32_t s = h & mask, probes = 0; probes <= mask; s = (s + 1) & mask, probes++) {
+		const uint8_t *slot = table + (uint64_t)s * METAIDX_SLOT_SIZE;
+		uint32_t f = read_le32(slot + 4);
+		if(f == 0)
+			return false;
+
+		metaidx_file entry;
+		if(read_le32(slot) == h && metaidx_file_at(idx, f - 1, &entry) && pathidx_key_equal(entry.path, path, len)) {
+			*file = f - 1;
+			return true;
+		}
+	}
+
+	return false;
+}
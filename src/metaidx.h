@@ -0,0 +1,199 @@
+/**
+   dd_reader
+   metaidx.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef _METAIDX_H_
+#define _METAIDX_H_
+
+#include "digest.h"
+#include "extent.h"
+#include "fat.h"
+#include "ntfs.h"
+#include "pathidx.h"
+#include "shared.h"
+
+/*
+ * Metadata index file layout (little endian). Every table is a run of fixed size entries read in place from the
+ * mapped file, so opening an index costs the same whatever the size of the image
+ *
+ * Header
+ * 0    8 byte magic
+ * 8    uint32 version
+ * 12   uint32 file count
+ * 16   uint64 image size
+ * 24   int64 image mtime, seconds
+ * 32   uint32 image mtime, nanoseconds
+ * 36   uint32 zero map block size
+ * 40   uint64 image inode
+ * 48   16 byte MD5 of the image
+ * 64   20 byte SHA1 of the image
+ * 84   uint32 flags, METAIDX_HAS_*
+ * 88   uint64 zero blocks
+ * 96   uint64 blocks
+ * 104  uint64 bytes in sparse file holes
+ * 112  uint64 offset of the partition table (one entry per MBR partition entry)
+ * 120  uint64 offset of the file table
+ * 128  uint64 offset of the extent table
+ * 136  uint64 extent count
+ * 144  uint64 offset of the path slot table
+ * 152  uint64 path slot count
+ * 160  uint64 offset of the data pool (boot regions and NUL terminated paths)
+ * 168  uint64 data pool length
+ * 512  MBR sector
+ *
+ * Partition entry
+ * 0    uint8 partition type, 0 if the partition is not indexed
+ * 4    uint32 boot region length
+ * 8    uint64 boot region offset in the data pool. Boot sector (FAT: the reserved sectors, with the FSINFO)
+ * 16   uint32 first file
+ * 20   uint32 file count
+ * 24   uint64 first path slot
+ * 32   uint32 path slot count, a power of 2 (or 0)
+ * 36   uint32 NTFS records, in use, directories, extension records, damaged (5 x uint32)
+ * 56   uint8 MFT loaded, 57 uint8 free map read
+ * 60   uint32 free run count
+ * 64   uint64 free clusters
+ * 72   NTFS_TOP_FREE_RUNS x (uint64 start cluster, uint64 cluster count)
+ *
+ * File entry, in the order of the file listing
+ * 0    uint64 size
+ * 8    uint64 first extent
+ * 16   uint64 path offset in the data pool
+ * 24   uint32 extent count
+ * 28   uint32 MFT record number (NTFS) or index in the directory tree (FAT)
+ * 32   uint16 FAT attributes or ntfs_record.flags
+ * 34   uint8 METAIDX_FILE_*
+ *
+ * Extent: uint64 start cluster (EXTENT_SPARSE for sparse runs), uint64 cluster count
+ * Path slot: uint32 path hash (see pathidx_key_hash()), uint32 file + 1 (0 if empty). One open addressing table per partition
+ *
+ * The size, mtime and inode of the image are compared with stat() before an index is used, so a stale index is
+ * detected without reading the image
+ */
+#define METAIDX_MAGIC "DDMETAIX"
+#define METAIDX_VERSION 2
+#define METAIDX_HEADER_SIZE 1024
+#define METAIDX_MBR_OFFSET 512
+#define METAIDX_PART_SIZE (72 + NTFS_TOP_FREE_RUNS * 16)
+#define METAIDX_FILE_SIZE 40
+#define METAIDX_EXTENT_SIZE 16
+#define METAIDX_SLOT_SIZE 8
+
+#define METAIDX_SECTOR_SIZE 512
+#define METAIDX_BOOT_MAX (64 * 1024) // Most bytes of the reserved sectors of a FAT volume kept
+
+/*
+ * Header flags
+ */
+#define METAIDX_HAS_CHECKSUMS 0x01 // Checksums and zero block counts recorded
+
+/*
+ * metaidx_file.flags
+ */
+#define METAIDX_FILE_DIR 0x01
+#define METAIDX_FILE_ROOT 0x02
+
+/*
+ * What the index records about the image as a whole
+ */
+typedef struct metaidx_image_t {
+	uint64_t img_len;
+	digest_result digest; // MD5 and SHA1. which is 0 if not recorded, the zero block fields are then 0 too
+	uint32_t zero_block_size;
+	uint64_t zero_blocks;
+	uint64_t num_blocks;
+	uint64_t hole_bytes;
+	uint8_t mbr[METAIDX_SECTOR_SIZE];
+} metaidx_image;
+
+typedef struct metaidx_part_t {
+	uint8_t type; // Partition type, 0 if not indexed
+	uint64_t boot_off;
+	uint32_t boot_len;
+	uint32_t first_file;
+	uint32_t num_files;
+	uint64_t first_slot;
+	uint32_t num_slots;
+	ntfs_summary ntfs; // NTFS only
+} metaidx_part;
+
+typedef struct metaidx_file_t {
+	uint64_t size;
+	uint64_t ext_first; // In the extent table of the index
+	uint64_t path_off;
+	const char *path; // Set by metaidx_file_at()
+	uint32_t ext_count;
+	uint32_t num; // MFT record number (NTFS) or index in fat_partition.files (FAT)
+	uint16_t attr; // FAT attributes or ntfs_record.flags
+	uint8_t flags; // METAIDX_FILE_*
+} metaidx_file;
+
+/*
+ * An opened, memory mapped index
+ */
+typedef struct metaidx_t {
+	uint8_t *map;
+	size_t map_len;
+
+	metaidx_image image;
+	metaidx_part parts[4];
+	uint32_t num_files;
+	uint64_t num_extents;
+	uint64_t num_slots;
+	const uint8_t *files;
+	const uint8_t *extents;
+	const uint8_t *slots;
+	const uint8_t *pool;
+	uint64_t pool_len;
+} metaidx;
+
+/*
+ * Tables collected for a new index
+ */
+typedef struct metaidx_builder_t {
+	metaidx_image image;
+	metaidx_part parts[4];
+
+	metaidx_file *files;
+	uint32_t num_files;
+	uint32_t files_cap;
+	extent_list extents;
+
+	uint8_t *pool;
+	uint64_t pool_len;
+	uint64_t pool_cap;
+} metaidx_builder;
+
+/*
+ * Metadata index functions
+ */
+
+metaidx_builder *metaidx_builder_new();
+void metaidx_builder_free(metaidx_builder *b);
+void metaidx_builder_add_fat(metaidx_builder *b, uint8_t partition, fat_partition *part);
+void metaidx_builder_add_ntfs(metaidx_builder *b, uint8_t partition, ntfs_partition *part);
+bool metaidx_write(metaidx_builder *b, const char *path, const char *img_path);
+bool metaidx_write_checksums(const char *path, const metaidx_image *img);
+
+metaidx *metaidx_open(const char *path, const char *img_path);
+void metaidx_close(metaidx *idx);
+bool metaidx_file_at(metaidx *idx, uint32_t n, metaidx_file *out);
+bool metaidx_extent_at(metaidx *idx, uint64_t n, extent *out);
+bool metaidx_lookup(metaidx *idx, uint8_t partition, const char *path, uint32_t *file);
+
+#endif
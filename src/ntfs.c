@@ -0,0 +1,1209 @@
+/**
+   dd_reader
+   ntfs.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "ntfs.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Seconds between the FILETIME epoch (1601-01-01) and the Unix epoch
+#define NTFS_EPOCH_DELTA 11644473600LL
+
+// Overall Partition
+
+ntfs_partition *ntfs_new_partition() {
+	ntfs_partition *part = (ntfs_partition*)malloc(sizeof(ntfs_partition));
+	memset(part, 0, sizeof(ntfs_partition));
+	part->type = PT_NTFS;
+
+	return part;
+}
+
+void ntfs_free_partition(ntfs_partition *part) {
+	if(part->boot_sector != NULL)
+		ntfs_free_boot_sector(part->boot_sector);
+
+	extent_list_free(&(part->mft_extents));
+	extent_list_free(&(part->extents));
+
+	if(part->mft != NULL)
+		free(part->mft);
+
+	if(part->records != NULL)
+		free(part->records);
+
+	if(part->free_map != NULL)
+		free(part->free_map);
+
+	if(part->paths != NULL)
+		free(part->paths);
+
+	if(part->path_arena != NULL)
+		arena_free(part->path_arena);
+
+	if(part->path_idx != NULL)
+		pathidx_free(part->path_idx);
+
+	for(uint32_t i = 0; i < part->num_arenas; i++) {
+		arena_free(part->arenas[i]);
+	}
+	if(part->arenas != NULL)
+		free(part->arenas);
+
+	free(part);
+}
+
+void ntfs_read_partition(byte_buffer *bb, ntfs_partition *part) {
+	// Keep the byte address of the start of the partiton
+	part->start_pos = bb->pos;
+
+	part->vol = bb->buf + part->start_pos;
+	part->vol_len = (part->start_pos < bb->len) ? bb->len - part->start_pos : 0;
+
+	// Boot sector
+	ntfs_read_boot_sector(bb, part);
+	ntfs_bs *bs = part->boot_sector;
+
+	part->cluster_size = (uint32_t)bs->bytes_per_sector * bs->sectors_per_cluster;
+	if(bs->clusters_per_mft_record > 0)
+		part->record_size = (uint32_t)bs->clusters_per_mft_record * part->cluster_size;
+	else if(bs->clusters_per_mft_record < 0 && bs->clusters_per_mft_record > -31)
+		part->record_size = 1U << -(bs->clusters_per_mft_record);
+	if(bs->sectors_per_cluster != 0)
+		part->total_clusters = bs->total_sectors / bs->sectors_per_cluster;
+
+	// A zeroed or foreign boot sector (or one outside of the image) gives no usable sizes
+	uint32_t rs = part->record_size;
+	part->valid = bs->bytes_per_sector != 0 && bs->sectors_per_cluster != 0 && rs >= NTFS_USA_BLOCK && rs % NTFS_USA_BLOCK == 0;
+	if(!part->valid) {
+		fprintf(stderr, "Warning: NTFS boot sector is invalid, the volume is unavailable\n");
+		part->cluster_size = 0;
+		part->record_size = 0;
+		part->total_clusters = 0;
+	}
+}
+
+/*
+ * Count the in use, directory, extension and damaged records and the free clusters of the volume. Loads the MFT and
+ * $Bitmap the first time
+ *
+ * @return The summary, kept with the partition
+ */
+ntfs_summary *ntfs_summarize(ntfs_partition *part) {
+	ntfs_summary *sum = &(part->summary);
+	if(part->has_summary)
+		return sum;
+
+	part->has_summary = true;
+	memset(sum, 0, sizeof(ntfs_summary));
+	if(!part->valid || !ntfs_load_mft(part))
+		return sum;
+
+	sum->has_mft = true;
+	sum->num_records = part->num_records;
+	for(uint32_t i = 0; i < part->num_records; i++) {
+		uint16_t flags = part->records[i].flags;
+		if(flags & NTFS_REC_BAD)
+			sum->bad++;
+		if(!(flags & NTFS_REC_VALID) || !(flags & NTFS_REC_IN_USE))
+			continue;
+
+		sum->in_use++;
+		if(flags & NTFS_REC_EXTENSION)
+			sum->ext++;
+		else if(flags & NTFS_REC_DIRECTORY)
+			sum->dirs++;
+	}
+
+	ntfs_build_free_map(part);
+	if(part->free_map == NULL || part->total_clusters == 0)
+		return sum;
+
+	sum->has_free_map = true;
+	sum->free_clusters = part->free_clusters;
+	sum->num_free_runs = ntfs_largest_free_runs(part, sum->free_runs, NTFS_TOP_FREE_RUNS);
+	return sum;
+}
+
+void ntfs_print_partition(ntfs_partition *part, bool verbose) {
+	ntfs_bs *bs = part->boot_sector;
+
+	if(!part->valid) {
+		printf("Volume is unavailable: the boot sector is invalid\n");
+		return;
+	}
+
+	if(verbose) {
+		printf("Boot Sector\n");
+		printf("OEM ID: ");
+		print_ascii(bs->oem_id, sizeof(bs->oem_id));
+		printf("\n");
+
+		printf("BIOS Parameter Block\n");
+		printf("Bytes per Sector: %u\n", bs->bytes_per_sector);
+		printf("Sectors per Cluster: %u\n", bs->sectors_per_cluster);
+		printf("Media: 0x%02x\n", bs->media_descriptor);
+		printf("Sectors per Track: %u\n", bs->sectors_per_track);
+		printf("Number of Heads: %u\n", bs->num_heads);
+		printf("Hidden Sectors: %u\n", bs->hidden_sectors);
+
+		printf("\nExtended BIOS Parameter Block\n");
+		printf("Total Sectors: %llu\n", (unsigned long long)bs->total_sectors);
+		printf("$MFT Cluster: %llu\n", (unsigned long long)bs->mft_cluster);
+		printf("$MFTMirr Cluster: %llu\n", (unsigned long long)bs->mftmirr_cluster);
+		printf("Clusters per MFT Record: %i\n", bs->clusters_per_mft_record);
+		printf("Clusters per Index Record: %i\n", bs->clusters_per_index_record);
+		printf("Volume Serial: 0x%llX\n", (unsigned long long)bs->volume_serial);
+		printf("Checksum: 0x%X\n", bs->checksum);
+		printf("\n");
+	}
+
+	// Normal output
+
+	printf("Cluster size: %u bytes  Total clusters: %llu\n", part->cluster_size, (unsigned long long)part->total_clusters);
+	printf("$MFT: Start cluster: %llu  Record size: %u bytes\n", (unsigned long long)bs->mft_cluster, part->record_size);
+	printf("$MFTMirr: Start cluster: %llu\n", (unsigned long long)bs->mftmirr_cluster);
+
+	// The record counts and free space need the whole MFT and $Bitmap, only read for a verbose listing
+	if(!verbose)
+		return;
+
+	ntfs_summary *sum = ntfs_summarize(part);
+	if(!sum->has_mft)
+		return;
+
+	printf("MFT records: %u  In use: %u  Directories: %u  Extension records: %u  Damaged: %u\n", sum->num_records, sum->in_use, sum->dirs, sum->ext, sum->bad);
+
+	if(!sum->has_free_map)
+		return;
+
+	uint64_t used = part->total_clusters - sum->free_clusters;
+	printf("Allocated clusters: %llu  Free clusters: %llu (%.1f%% free)\n", (unsigned long long)used, (unsigned long long)sum->free_clusters,
+		100.0 * sum->free_clusters / part->total_clusters);
+
+	printf("Largest free runs:");
+	for(uint32_t i = 0; i < sum->num_free_runs; i++) {
+		extent *run = &(sum->free_runs[i]);
+		printf("%s%llu-%llu (%llu)", (i == 0) ? " " : ", ", (unsigned long long)run->start, (unsigned long long)(run->start + run->length - 1),
+			(unsigned long long)run->length);
+	}
+	printf("\n");
+}
+
+/*
+ * Output the layout of the volume as one record, with the MFT summary when verbose
+ *
+ * @param out Writer with a section open
+ * @param partition MBR partition entry of the volume
+ */
+void ntfs_output_partition(ntfs_partition *part, out_writer *out, uint8_t partition, bool verbose) {
+	ntfs_bs *bs = part->boot_sector;
+
+	// An unavailable volume keeps the columns of the section, but none of its boot sector is reported
+	ntfs_bs none;
+	if(!part->valid) {
+		memset(&none, 0, sizeof(ntfs_bs));
+		bs = &none;
+	}
+
+	out_record_begin(out);
+	out_u64(out, "Partition", partition);
+	out_u64(out, "Available", part->valid);
+	out_ascii(out, "OEMID", bs->oem_id, sizeof(bs->oem_id));
+	out_u64(out, "BytesPerSector", bs->bytes_per_sector);
+	out_u64(out, "ClusterSize", part->cluster_size);
+	out_u64(out, "TotalClusters", part->total_clusters);
+	out_u64(out, "MFTCluster", bs->mft_cluster);
+	out_u64(out, "MFTMirrCluster", bs->mftmirr_cluster);
+	out_u64(out, "RecordSize", part->record_size);
+	out_u64(out, "VolumeSerial", bs->volume_serial);
+	if(verbose) {
+		ntfs_summary *sum = ntfs_summarize(part);
+		out_u64(out, "MFTRecords", sum->num_records);
+		out_u64(out, "InUse", sum->in_use);
+		out_u64(out, "Directories", sum->dirs);
+		out_u64(out, "ExtensionRecords", sum->ext);
+		out_u64(out, "Damaged", sum->bad);
+		out_u64(out, "FreeClusters", sum->free_clusters);
+		out_u64(out, "SectorsPerCluster", bs->sectors_per_cluster);
+		out_u64(out, "Media", bs->media_descriptor);
+		out_u64(out, "SectorsPerTrack", bs->sectors_per_track);
+		out_u64(out, "NumHeads", bs->num_heads);
+		out_u64(out, "HiddenSectors", bs->hidden_sectors);
+		out_u64(out, "TotalSectors", bs->total_sectors);
+		out_i64(out, "ClustersPerMFTRecord", bs->clusters_per_mft_record);
+		out_i64(out, "ClustersPerIndexRecord", bs->clusters_per_index_record);
+		out_u64(out, "Checksum", bs->checksum);
+	}
+	out_record_end(out);
+}
+
+// Boot Sector
+
+ntfs_bs *ntfs_new_boot_sector() {
+	ntfs_bs *bs = (ntfs_bs*)malloc(sizeof(ntfs_bs));
+	memset(bs, 0, sizeof(ntfs_bs));
+
+	return bs;
+}
+
+void ntfs_free_boot_sector(ntfs_bs *bs) {
+	free(bs);
+}
+
+void ntfs_read_boot_sector(byte_buffer *bb, ntfs_partition *part) {
+	part->boot_sector = ntfs_new_boot_sector();
+	ntfs_bs *bs = part->boot_sector;
+
+	if(bb->pos + 512 > bb->len) {
+		fprintf(stderr, "Warning: NTFS boot sector lies outside of the image\n");
+		return;
+	}
+
+	// Jump instruction
+	bb_get_bytes_in(bb, bs->jmp, sizeof(bs->jmp));
+
+	// OEM ID string
+	bb_get_bytes_in(bb, bs->oem_id, sizeof(bs->oem_id));
+	if(memcmp(bs->oem_id, "NTFS    ", sizeof(bs->oem_id)) != 0)
+		fprintf(stderr, "Warning: NTFS OEM ID is not \"NTFS    \"\n");
+
+	// BPB
+	bs->bytes_per_sector = bb_get_short(bb);
+	bs->sectors_per_cluster = bb_get(bb);
+	bb_skip(bb, 7); // Reserved sectors and FAT fields, always 0
+	bs->media_descriptor = bb_get(bb);
+	bb_skip(bb, 2); // Sectors per FAT, always 0
+	bs->sectors_per_track = bb_get_short(bb);
+	bs->num_heads = bb_get_short(bb);
+	bs->hidden_sectors = bb_get_int(bb);
+	bb_skip(bb, 8); // Total sectors (32 bit) and a signature, unused
+
+	// Extended BPB
+	bs->total_sectors = bb_get_long(bb);
+	bs->mft_cluster = bb_get_long(bb);
+	bs->mftmirr_cluster = bb_get_long(bb);
+	bs->clusters_per_mft_record = (int8_t)bb_get(bb);
+	bb_skip(bb, 3);
+	bs->clusters_per_index_record = (int8_t)bb_get(bb);
+	bb_skip(bb, 3);
+	bs->volume_serial = bb_get_long(bb);
+	bs->checksum = bb_get_int(bb);
+
+	// Bootstrap code
+	bb_skip(bb, NTFS_BOOTSTRAP_SIZE);
+
+	// End signature
+	bs->sig_end1 = bb_get(bb);
+	bs->sig_end2 = bb_get(bb);
+	if(bs->sig_end1 != 0x55 || bs->sig_end2 != 0xAA) {
+		fprintf(stderr, "Warning: NTFS VBR boot signature does not match 0x55 0xAA!. sig1: %X, sig2: %X\n", bs->sig_end1, bs->sig_end2);
+	}
+}
+
+// MFT
+
+/*
+ * Convert an NTFS timestamp (100ns intervals since 1601-01-01 UTC) to seconds since the Unix epoch
+ *
+ * @return Epoch seconds or NTFS_TIME_NONE if the timestamp is unset
+ */
+int64_t ntfs_time_to_epoch(uint64_t filetime) {
+	if(filetime == 0)
+		return NTFS_TIME_NONE;
+
+	return (int64_t)(filetime / 10000000ULL) - NTFS_EPOCH_DELTA;
+}
+
+/*
+ * Verify and undo the update sequence of a multi sector record (FILE, INDX) in place.
+ * The last two bytes of every 512 byte block were replaced with the update sequence number when the record was written
+ *
+ * @param rec Record buffer
+ * @param len Size of the record in bytes
+ * @return False if the update sequence array is malformed or a block does not carry the sequence number (torn write)
+ */
+bool ntfs_apply_fixups(uint8_t *rec, uint32_t len) {
+	uint32_t usa_off = read_le16(rec + 4), usa_count = read_le16(rec + 6);
+
+	if(usa_count < 2 || usa_count - 1 > len / NTFS_USA_BLOCK || usa_off + usa_count * 2 > len)
+		return false;
+
+	uint8_t *usa = rec + usa_off;
+	for(uint32_t i = 1; i < usa_count; i++) {
+		uint8_t *end = rec + i * NTFS_USA_BLOCK - 2;
+		if(end[0] != usa[0] || end[1] != usa[1])
+			return false;
+		end[0] = usa[i*2];
+		end[1] = usa[i*2 + 1];
+	}
+
+	return true;
+}
+
+/*
+ * Find the first unnamed attribute of a type in a record that already had its fixups applied
+ *
+ * @param len Size of the record in bytes
+ * @return Pointer to the attribute header, or NULL if there is none
+ */
+uint8_t *ntfs_find_attr(uint8_t *rec, uint32_t len, uint32_t type) {
+	uint32_t used = read_le32(rec + 0x18);
+	if(used > len)
+		used = len;
+
+	uint32_t off = read_le16(rec + 0x14);
+	while(off + 16 <= used) {
+		uint8_t *attr = rec + off;
+		uint32_t attr_type = read_le32(attr), attr_len = read_le32(attr + 4);
+		if(attr_type == NTFS_ATTR_END || attr_len < 16 || attr_len > used - off)
+			break;
+
+		if(attr_type == type && attr[9] == 0)
+			return attr;
+
+		off += attr_len;
+	}
+
+	return NULL;
+}
+
+/*
+ * Locate the value of a resident attribute
+ *
+ * @param attr Attribute header
+ * @param attr_len Length of the attribute including the header
+ * @param value_len Out. Length of the value
+ * @return Pointer to the value, NULL if the attribute is non-resident or malformed
+ */
+static uint8_t *ntfs_resident_value(uint8_t *attr, uint32_t attr_len, uint32_t *value_len) {
+	if(attr[8] != 0 || attr_len < 0x18)
+		return NULL;
+
+	uint32_t len = read_le32(attr + 0x10), off = read_le16(attr + 0x14);
+	if(off > attr_len || len > attr_len - off)
+		return NULL;
+
+	*value_len = len;
+	return attr + off;
+}
+
+// Preference of a $FILE_NAME namespace when a record holds several names. Higher wins
+static int ntfs_namespace_rank(uint8_t ns) {
+	switch(ns) {
+		case NTFS_NAMESPACE_WIN32:
+		case NTFS_NAMESPACE_WIN32_DOS:
+			return 3;
+		case NTFS_NAMESPACE_POSIX:
+			return 2;
+		default:
+			return 1;
+	}
+}
+
+/*
+ * Check the signature of a raw FILE record, apply its fixups and decode the attributes needed for the record table.
+ * Attributes moved into extension records through an $ATTRIBUTE_LIST are not followed
+ *
+ * @param rec Raw record of part->record_size bytes. Modified in place by the fixups
+ * @param out Decoded record. For extension records, parent holds the reference of the base record
+ * @param names Arena the name is allocated from
+ */
+void ntfs_decode_record(ntfs_partition *part, uint8_t *rec, ntfs_record *out, arena *names) {
+	memset(out, 0, sizeof(ntfs_record));
+	out->crtime = out->mtime = out->ctime = out->atime = NTFS_TIME_NONE;
+
+	if(memcmp(rec, "BAAD", 4) == 0) {
+		out->flags = NTFS_REC_BAD;
+		return;
+	}
+	if(memcmp(rec, "FILE", 4) != 0)
+		return;
+	if(!ntfs_apply_fixups(rec, part->record_size)) {
+		out->flags = NTFS_REC_BAD;
+		return;
+	}
+
+	out->seq = read_le16(rec + 0x10);
+	out->flags = NTFS_REC_VALID | (read_le16(rec + 0x16) & (NTFS_REC_IN_USE | NTFS_REC_DIRECTORY));
+
+	uint64_t base = read_le64(rec + 0x20);
+	if(base != 0) {
+		out->flags |= NTFS_REC_EXTENSION;
+		out->parent = base;
+		return;
+	}
+
+	uint32_t used = read_le32(rec + 0x18);
+	if(used > part->record_size)
+		used = part->record_size;
+
+	uint8_t *best_name = NULL;
+	int best_rank = 0;
+	uint32_t off = read_le16(rec + 0x14);
+	while(off + 16 <= used) {
+		uint8_t *attr = rec + off, *value = NULL;
+		uint32_t type = read_le32(attr), attr_len = read_le32(attr + 4), value_len = 0;
+		if(type == NTFS_ATTR_END || attr_len < 16 || attr_len > used - off)
+			break;
+
+		switch(type) {
+			case NTFS_ATTR_STANDARD_INFORMATION:
+				value = ntfs_resident_value(attr, attr_len, &value_len);
+				if(value != NULL && value_len >= 0x20) {
+					out->crtime = ntfs_time_to_epoch(read_le64(value));
+					out->mtime = ntfs_time_to_epoch(read_le64(value + 0x08));
+					out->ctime = ntfs_time_to_epoch(read_le64(value + 0x10));
+					out->atime = ntfs_time_to_epoch(read_le64(value + 0x18));
+				}
+				break;
+
+			case NTFS_ATTR_FILE_NAME:
+				value = ntfs_resident_value(attr, attr_len, &value_len);
+				if(value != NULL && value_len >= 0x42 && 0x42 + value[0x40] * 2U <= value_len) {
+					int rank = ntfs_namespace_rank(value[0x41]);
+					if(rank > best_rank) {
+						best_rank = rank;
+						best_name = value;
+					}
+				}
+				break;
+
+			case NTFS_ATTR_DATA:
+				// Only the unnamed stream, and only its first instance (the one starting at VCN 0)
+				if(attr[9] != 0 || out->data_off != 0)
+					break;
+
+				if(attr[8] == 0) {
+					if(ntfs_resident_value(attr, attr_len, &value_len) != NULL) {
+						out->data_off = off;
+						out->size = value_len;
+						out->flags |= NTFS_REC_RESIDENT;
+					}
+				} else if(attr_len >= 0x40) {
+					out->data_off = off;
+					out->size = read_le64(attr + 0x30);
+				}
+				break;
+
+			default:
+				break;
+		}
+
+		off += attr_len;
+	}
+
+	if(best_name != NULL) {
+		char name[NTFS_NAME_MAX];
+		size_t len = utf16le_to_utf8(best_name + 0x42, best_name[0x40], name, sizeof(name));
+		out->parent = read_le64(best_name);
+		out->name = arena_strndup(names, name, len);
+	}
+}
+
+/*
+ * Copy len bytes starting at byte offset pos of $MFT (in logical order) into dest.
+ * Bytes that are sparse, beyond the extents or outside of the image are zero filled
+ */
+static void ntfs_copy_mft(ntfs_partition *part, uint64_t pos, uint8_t *dest, uint64_t len) {
+	uint64_t ext_pos = 0;
+
+	memset(dest, 0, len);
+	for(uint32_t i = 0; i < part->mft_extents.count && len > 0; i++) {
+		extent *ext = &(part->mft_extents.ext[i]);
+		uint64_t ext_len = ext->length * part->cluster_size;
+		if(pos >= ext_pos + ext_len) {
+			ext_pos += ext_len;
+			continue;
+		}
+
+		uint64_t skip = pos - ext_pos;
+		uint64_t n = ext_len - skip;
+		if(n > len)
+			n = len;
+
+		if(ext->start != EXTENT_SPARSE) {
+			uint64_t src = ext->start * part->cluster_size + skip;
+			if(src < part->vol_len)
+				memcpy(dest, part->vol + src, (src + n <= part->vol_len) ? n : part->vol_len - src);
+		}
+
+		dest += n;
+		pos += n;
+		len -= n;
+		ext_pos += ext_len;
+	}
+}
+
+// Copy in and decode one chunk of NTFS_MFT_CHUNK records
+static void ntfs_mft_task(void *ctx, size_t index, uint32_t thread) {
+	ntfs_partition *part = (ntfs_partition*)ctx;
+	uint32_t first = (uint32_t)(index * NTFS_MFT_CHUNK);
+	uint32_t count = part->num_records - first;
+	if(count > NTFS_MFT_CHUNK)
+		count = NTFS_MFT_CHUNK;
+
+	uint64_t pos = (uint64_t)first * part->record_size;
+	ntfs_copy_mft(part, pos, part->mft + pos, (uint64_t)count * part->record_size);
+
+	for(uint32_t i = 0; i < count; i++) {
+		ntfs_decode_record(part, part->mft + pos + (uint64_t)i * part->record_size, &(part->records[first + i]), part->arenas[thread]);
+	}
+}
+
+/*
+ * Locate $MFT through its own first record, copy every FILE record out of the image and decode them into the record table.
+ * Chunks of records are copied and decoded in parallel. Does nothing if the MFT was already loaded
+ *
+ * @return True if the record table is available
+ */
+bool ntfs_load_mft(ntfs_partition *part) {
+	if(part->has_mft)
+		return true;
+
+	uint32_t rs = part->record_size;
+	// ntfs_read_partition() has already warned
+	if(!part->valid)
+		return false;
+
+	uint64_t mft_pos = part->boot_sector->mft_cluster * part->cluster_size;
+	if(part->boot_sector->mft_cluster >= part->total_clusters || mft_pos + rs > part->vol_len) {
+		fprintf(stderr, "Warning: $MFT lies outside of the image, file records are unavailable\n");
+		return false;
+	}
+
+	// Record 0 describes $MFT itself. Its unnamed $DATA attribute gives the size of the table
+	uint8_t *rec = (uint8_t*)malloc(rs);
+	memcpy(rec, part->vol + mft_pos, rs);
+	uint8_t *data = NULL;
+	if(memcmp(rec, "FILE", 4) == 0 && ntfs_apply_fixups(rec, rs))
+		data = ntfs_find_attr(rec, rs, NTFS_ATTR_DATA);
+	if(data == NULL || data[8] == 0 || read_le32(data + 4) < 0x40) {
+		fprintf(stderr, "Warning: $MFT record is damaged, file records are unavailable\n");
+		free(rec);
+		return false;
+	}
+
+	uint64_t mft_size = read_le64(data + 0x30);
+	bool runs_ok = ntfs_attr_extents(data, read_le32(data + 4), part->total_clusters, &(part->mft_extents));
+	free(rec);
+	if(!runs_ok) {
+		fprintf(stderr, "Warning: $MFT data runs are invalid, file records are unavailable\n");
+		return false;
+	}
+
+	// A damaged size must not claim more records than the data runs hold
+	uint64_t run_clusters = 0;
+	for(uint32_t i = 0; i < part->mft_extents.count; i++) {
+		run_clusters += part->mft_extents.ext[i].length;
+	}
+	if(mft_size / part->cluster_size > run_clusters)
+		mft_size = run_clusters * part->cluster_size;
+
+	uint64_t num = mft_size / rs;
+	if(num > UINT32_MAX)
+		num = UINT32_MAX;
+	uint64_t mft_len = num * rs;
+	uint8_t *mft = (uint8_t*)malloc(mft_len > 0 ? mft_len : 1);
+	ntfs_record *records = (ntfs_record*)malloc((num > 0 ? num : 1) * sizeof(ntfs_record));
+	if(mft == NULL || records == NULL) {
+		fprintf(stderr, "Warning: $MFT is too large to load, file records are unavailable\n");
+		free(mft);
+		free(records);
+		part->mft_extents.count = 0;
+		return false;
+	}
+
+	part->num_records = (uint32_t)num;
+	part->mft_len = mft_len;
+	part->mft = mft;
+	part->records = records;
+
+	part->num_arenas = par_num_threads();
+	part->arenas = (arena**)malloc(part->num_arenas * sizeof(arena*));
+	for(uint32_t i = 0; i < part->num_arenas; i++) {
+		part->arenas[i] = arena_new(0);
+	}
+
+	par_run((num + NTFS_MFT_CHUNK - 1) / NTFS_MFT_CHUNK, ntfs_mft_task, part);
+
+	part->has_mft = true;
+	return true;
+}
+
+/*
+ * Raw record (fixups applied) in the loaded MFT
+ *
+ * @param num MFT record number
+ * @return Pointer to record_size bytes, NULL if the MFT is not loaded or num is out of range
+ */
+uint8_t *ntfs_record_ptr(ntfs_partition *part, uint32_t num) {
+	if(!part->has_mft || num >= part->num_records)
+		return NULL;
+
+	return part->mft + (uint64_t)num * part->record_size;
+}
+
+// Paths
+
+/*
+ * Record number of the directory holding a record, according to the parent reference of its $FILE_NAME
+ *
+ * @return Parent record number, or UINT32_MAX if the parent is missing, not a directory or has since been reused
+ */
+static uint32_t ntfs_parent_of(ntfs_partition *part, uint32_t num) {
+	uint64_t ref = part->records[num].parent;
+	uint64_t parent = NTFS_REF_RECORD(ref);
+	if(parent >= part->num_records)
+		return UINT32_MAX;
+
+	ntfs_record *p = &(part->records[parent]);
+	if((p->flags & (NTFS_REC_VALID | NTFS_REC_DIRECTORY | NTFS_REC_EXTENSION)) != (NTFS_REC_VALID | NTFS_REC_DIRECTORY) || p->name == NULL)
+		return UINT32_MAX;
+
+	// Freeing a record bumps its sequence number, so a deleted parent may be one ahead of the reference
+	uint16_t seq = NTFS_REF_SEQ(ref);
+	if(p->seq != seq && !(!(p->flags & NTFS_REC_IN_USE) && p->seq == (uint16_t)(seq + 1)))
+		return UINT32_MAX;
+
+	return (uint32_t)parent;
+}
+
+/*
+ * Full path of a record, '/' separated from the root of the volume.
+ * Paths are memoized per record: resolving a record walks up its parent chain only until a directory with a known path,
+ * so building every path costs about one step per record. Records with a broken parent chain are placed under NTFS_ORPHAN_DIR
+ *
+ * @param num MFT record number
+ * @return The path, valid until the partition is freed. NULL for records without a name (unused, extension records)
+ */
+const char *ntfs_record_path(ntfs_partition *part, uint32_t num) {
+	if(!ntfs_load_mft(part) || num >= part->num_records)
+		return NULL;
+
+	if(part->paths == NULL) {
+		part->paths = (char**)calloc(part->num_records, sizeof(char*));
+		part->path_arena = arena_new(0);
+		part->paths[NTFS_RECORD_ROOT] = arena_strdup(part->path_arena, "/");
+	}
+
+	if(part->paths[num] != NULL)
+		return part->paths[num];
+	if(part->records[num].name == NULL || (part->records[num].flags & NTFS_REC_EXTENSION))
+		return NULL;
+
+	// Walk up until a directory whose path is already known
+	uint32_t chain[NTFS_PATH_DEPTH_MAX];
+	uint32_t depth = 0, cur = num;
+	const char *prefix = NULL;
+	while(part->paths[cur] == NULL) {
+		if(depth == NTFS_PATH_DEPTH_MAX) {
+			prefix = NTFS_ORPHAN_DIR;
+			break;
+		}
+		chain[depth++] = cur;
+
+		cur = ntfs_parent_of(part, cur);
+		if(cur == UINT32_MAX) {
+			prefix = NTFS_ORPHAN_DIR;
+			break;
+		}
+	}
+	if(prefix == NULL)
+		prefix = part->paths[cur];
+
+	// Build the paths back down the chain, memoizing each directory on the way
+	size_t prefix_len = strlen(prefix);
+	while(depth > 0) {
+		uint32_t n = chain[--depth];
+		const char *name = part->records[n].name;
+		size_t name_len = strlen(name);
+		bool root = (prefix_len == 1 && prefix[0] == '/');
+
+		char *path = (char*)arena_alloc(part->path_arena, prefix_len + name_len + 2);
+		memcpy(path, prefix, prefix_len);
+		size_t len = prefix_len;
+		if(!root)
+			path[len++] = '/';
+		memcpy(path + len, name, name_len + 1);
+
+		part->paths[n] = path;
+		prefix = path;
+		prefix_len = len + name_len;
+	}
+
+	return part->paths[num];
+}
+
+/*
+ * Resolve the path of every named, in use record and index them for ntfs_lookup_path(). Does nothing if already built
+ */
+void ntfs_build_paths(ntfs_partition *part) {
+	if(part->path_idx != NULL || !ntfs_load_mft(part))
+		return;
+
+	part->path_idx = pathidx_new(part->num_records);
+	for(uint32_t i = 0; i < part->num_records; i++) {
+		if(!(part->records[i].flags & NTFS_REC_IN_USE))
+			continue;
+
+		const char *path = ntfs_record_path(part, i);
+		if(path != NULL)
+			pathidx_insert(part->path_idx, path, i);
+	}
+}
+
+/*
+ * Find an in use file or directory by its full path (case insensitive, '/' separated, starting at the root)
+ *
+ * @param num Out. MFT record number of the file
+ * @return False if no such path exists on the volume
+ */
+bool ntfs_lookup_path(ntfs_partition *part, const char *path, uint32_t *num) {
+	ntfs_build_paths(part);
+	if(part->path_idx == NULL)
+		return false;
+
+	return pathidx_lookup(part->path_idx, path, num);
+}
+
+// Data runs
+
+// Mask selecting the low n bytes of a 64 bit value
+static const uint64_t ntfs_run_mask[9] = {
+	0, 0xFFULL, 0xFFFFULL, 0xFFFFFFULL, 0xFFFFFFFFULL, 0xFFFFFFFFFFULL, 0xFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL
+};
+
+// Little endian value of n (0-8) bytes at p. Reads 8 bytes at once if there is room, otherwise byte by byte
+static inline uint64_t ntfs_run_field(const uint8_t *p, uint32_t n, const uint8_t *end) {
+	if(end - p >= 8)
+		return read_le64(p) & ntfs_run_mask[n];
+
+	uint64_t v = 0;
+	for(uint32_t i = 0; i < n; i++) {
+		v |= (uint64_t)p[i] << (i * 8);
+	}
+	return v;
+}
+
+/*
+ * Decode a mapping pairs array (runlist) into extents of absolute logical cluster numbers.
+ * Each run is a header byte (high nibble: size of the LCN delta, low nibble: size of the length) followed by the length and a signed
+ * LCN delta relative to the previous run. Runs without a delta are sparse and added as EXTENT_SPARSE.
+ * Contiguous runs are merged. On error nothing is added to out
+ *
+ * @param runs Start of the runlist
+ * @param len Bytes available at runs
+ * @param num_clusters Clusters in the volume. Runs reaching past it are rejected. 0 to skip the check
+ * @param out List the extents are appended to
+ * @return False if the runlist is truncated or refers to clusters outside of the volume
+ */
+bool ntfs_decode_runlist(const uint8_t *runs, uint32_t len, uint64_t num_clusters, extent_list *out) {
+	const uint8_t *p = runs, *end = runs + len;
+	uint32_t first = out->count;
+	int64_t lcn = 0;
+
+	while(p < end && *p != 0) {
+		uint32_t len_size = *p & 0x0F, off_size = *p >> 4;
+		if(len_size == 0 || len_size > 8 || off_size > 8 || (uint32_t)(end - p) < 1 + len_size + off_size)
+			goto fail;
+		p++;
+
+		uint64_t length = ntfs_run_field(p, len_size, end);
+		p += len_size;
+		if(length == 0 || length > INT64_MAX)
+			goto fail;
+
+		if(off_size == 0) {
+			extent_list_append(out, EXTENT_SPARSE, length, out->count > first);
+			continue;
+		}
+
+		// Sign extend the delta from its top byte
+		uint32_t shift = 64 - off_size * 8;
+		int64_t delta = (int64_t)(ntfs_run_field(p, off_size, end) << shift) >> shift;
+		p += off_size;
+
+		lcn += delta;
+		if(lcn < 0 || (num_clusters != 0 && ((uint64_t)lcn >= num_clusters || length > num_clusters - (uint64_t)lcn)))
+			goto fail;
+
+		extent_list_append(out, (uint64_t)lcn, length, out->count > first);
+	}
+
+	return true;
+
+fail:
+	out->count = first;
+	return false;
+}
+
+/*
+ * Decode the runlist of a non-resident attribute
+ *
+ * @param attr Attribute header
+ * @param attr_len Length of the attribute including the header
+ * @return False if the attribute is resident or its runlist is invalid
+ */
+bool ntfs_attr_extents(const uint8_t *attr, uint32_t attr_len, uint64_t num_clusters, extent_list *out) {
+	if(attr[8] == 0 || attr_len < 0x40)
+		return false;
+
+	uint32_t runs_off = read_le16(attr + 0x20);
+	if(runs_off >= attr_len)
+		return false;
+
+	return ntfs_decode_runlist(attr + runs_off, attr_len - runs_off, num_clusters, out);
+}
+
+/*
+ * State of ntfs_build_extent_index(). Each chunk of records decodes into its own list, which are then concatenated
+ */
+typedef struct ntfs_extent_job_t {
+	ntfs_partition *part;
+	extent_list *lists;
+} ntfs_extent_job;
+
+static void ntfs_extent_task(void *ctx, size_t index, uint32_t thread) {
+	ntfs_extent_job *job = (ntfs_extent_job*)ctx;
+	ntfs_partition *part = job->part;
+	extent_list *list = &(job->lists[index]);
+	uint32_t first = (uint32_t)(index * NTFS_MFT_CHUNK);
+	uint32_t last = (part->num_records - first > NTFS_MFT_CHUNK) ? first + NTFS_MFT_CHUNK : part->num_records;
+
+	for(uint32_t i = first; i < last; i++) {
+		ntfs_record *r = &(part->records[i]);
+		r->ext_first = list->count;
+		r->ext_count = 0;
+		if(!(r->flags & NTFS_REC_VALID) || (r->flags & (NTFS_REC_EXTENSION | NTFS_REC_RESIDENT)) || r->data_off == 0)
+			continue;
+
+		uint8_t *attr = ntfs_record_ptr(part, i) + r->data_off;
+		if(ntfs_attr_extents(attr, read_le32(attr + 4), part->total_clusters, list))
+			r->ext_count = list->count - r->ext_first;
+	}
+}
+
+/*
+ * Decode the data runs of every record's unnamed $DATA attribute into part->extents, in parallel chunks.
+ * Deleted records are included so their former clusters can be located. Does nothing if already built
+ */
+void ntfs_build_extent_index(ntfs_partition *part) {
+	if(part->has_extents || !ntfs_load_mft(part))
+		return;
+
+	size_t num_chunks = (part->num_records + NTFS_MFT_CHUNK - 1) / NTFS_MFT_CHUNK;
+	ntfs_extent_job job;
+	job.part = part;
+	job.lists = (extent_list*)calloc(num_chunks > 0 ? num_chunks : 1, sizeof(extent_list));
+
+	par_run(num_chunks, ntfs_extent_task, &job);
+
+	uint64_t total = 0;
+	for(size_t c = 0; c < num_chunks; c++) {
+		total += job.lists[c].count;
+	}
+
+	extent_list_free(&(part->extents));
+	part->extents.ext = (extent*)malloc((total > 0 ? total : 1) * sizeof(extent));
+	part->extents.cap = (uint32_t)(total > 0 ? total : 1);
+
+	for(size_t c = 0; c < num_chunks; c++) {
+		uint32_t base = part->extents.count;
+		uint32_t first = (uint32_t)(c * NTFS_MFT_CHUNK);
+		uint32_t last = (part->num_records - first > NTFS_MFT_CHUNK) ? first + NTFS_MFT_CHUNK : part->num_records;
+
+		if(job.lists[c].count > 0)
+			memcpy(part->extents.ext + base, job.lists[c].ext, job.lists[c].count * sizeof(extent));
+		part->extents.count += job.lists[c].count;
+		for(uint32_t i = first; i < last; i++) {
+			part->records[i].ext_first += base;
+		}
+		extent_list_free(&(job.lists[c]));
+	}
+
+	free(job.lists);
+	part->has_extents = true;
+}
+
+/*
+ * Read from the unnamed $DATA attribute of a record. Resident data is copied out of the loaded MFT, sparse runs read as zeros
+ *
+ * @param num MFT record number
+ * @param offset Logical offset within the data
+ * @return Bytes read. Short if the end of the data is reached or the clusters lie outside of the image
+ */
+size_t ntfs_read_data(ntfs_partition *part, uint32_t num, uint64_t offset, void *buf, size_t len) {
+	if(!ntfs_load_mft(part) || num >= part->num_records)
+		return 0;
+
+	ntfs_record *r = &(part->records[num]);
+	if(r->data_off == 0 || offset >= r->size)
+		return 0;
+	if(len > r->size - offset)
+		len = (size_t)(r->size - offset);
+
+	if(r->flags & NTFS_REC_RESIDENT) {
+		memcpy(buf, ntfs_resident_data(part, num, NULL) + offset, len);
+		return len;
+	}
+
+	ntfs_build_extent_index(part);
+
+	uint8_t *dest = (uint8_t*)buf;
+	uint64_t cs = part->cluster_size, ext_pos = 0;
+	size_t done = 0;
+	for(uint32_t e = r->ext_first; e < r->ext_first + r->ext_count && done < len; e++) {
+		extent *ext = &(part->extents.ext[e]);
+		uint64_t ext_len = ext->length * cs;
+		if(offset >= ext_pos + ext_len) {
+			ext_pos += ext_len;
+			continue;
+		}
+
+		uint64_t skip = offset - ext_pos;
+		size_t n = (ext_len - skip < len - done) ? (size_t)(ext_len - skip) : len - done;
+		if(ext->start == EXTENT_SPARSE) {
+			memset(dest + done, 0, n);
+		} else {
+			uint64_t src = ext->start * cs + skip;
+			if(src >= part->vol_len)
+				break;
+			if(src + n > part->vol_len)
+				n = (size_t)(part->vol_len - src);
+			memcpy(dest + done, part->vol + src, n);
+		}
+
+		done += n;
+		offset += n;
+		ext_pos += ext_len;
+	}
+
+	return done;
+}
+
+// Resident file contents
+
+/*
+ * Contents of a record's resident unnamed $DATA, straight out of the loaded MFT
+ *
+ * @param len Out (optional). Length of the data
+ * @return Pointer into the MFT buffer, NULL if the data is not resident
+ */
+const uint8_t *ntfs_resident_data(ntfs_partition *part, uint32_t num, uint64_t *len) {
+	if(!ntfs_load_mft(part) || num >= part->num_records || !(part->records[num].flags & NTFS_REC_RESIDENT))
+		return NULL;
+
+	uint8_t *attr = ntfs_record_ptr(part, num) + part->records[num].data_off;
+	if(len != NULL)
+		*len = part->records[num].size;
+	return attr + read_le16(attr + 0x14);
+}
+
+// Cluster allocation
+
+// Number of set bits in n words of a bitmap
+#if defined(__AVX2__)
+static uint64_t ntfs_popcount_words(const uint64_t *w, size_t n) {
+	// Nibble lookup with a byte shuffle, summed per 64 bit lane with SAD
+	const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low = _mm256_set1_epi8(0x0F);
+	__m256i acc = _mm256_setzero_si256();
+	size_t i = 0;
+
+	for(; i + 4 <= n; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(w + i));
+		__m256i lo = _mm256_and_si256(v, low), hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low);
+		__m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo), _mm256_shuffle_epi8(lut, hi));
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+	}
+
+	uint64_t total = (uint64_t)_mm256_extract_epi64(acc, 0) + (uint64_t)_mm256_extract_epi64(acc, 1)
+		+ (uint64_t)_mm256_extract_epi64(acc, 2) + (uint64_t)_mm256_extract_epi64(acc, 3);
+	for(; i < n; i++) {
+		total += __builtin_popcountll(w[i]);
+	}
+	return total;
+}
+#else
+static uint64_t ntfs_popcount_words(const uint64_t *w, size_t n) {
+	// Independent accumulators so consecutive popcounts don't serialize
+	uint64_t a = 0, b = 0, c = 0, d = 0;
+	size_t i = 0;
+
+	for(; i + 4 <= n; i += 4) {
+		a += __builtin_popcountll(w[i]);
+		b += __builtin_popcountll(w[i + 1]);
+		c += __builtin_popcountll(w[i + 2]);
+		d += __builtin_popcountll(w[i + 3]);
+	}
+	for(; i < n; i++) {
+		a += __builtin_popcountll(w[i]);
+	}
+	return a + b + c + d;
+}
+#endif
+
+/*
+ * Read $Bitmap through its data runs and build the free cluster map. Clusters not covered by a readable part of $Bitmap
+ * count as allocated. Does nothing if already built
+ */
+void ntfs_build_free_map(ntfs_partition *part) {
+	if(part->free_map != NULL || !ntfs_load_mft(part) || part->num_records <= NTFS_RECORD_BITMAP)
+		return;
+
+	uint64_t words = (part->total_clusters + 63) / 64;
+	part->free_map = (uint64_t*)calloc(words > 0 ? words : 1, sizeof(uint64_t));
+
+	uint8_t *raw = (uint8_t*)part->free_map;
+	size_t got = ntfs_read_data(part, NTFS_RECORD_BITMAP, 0, raw, words * sizeof(uint64_t));
+	uint64_t valid = (uint64_t)got * 8;
+	if(valid < part->total_clusters)
+		fprintf(stderr, "Warning: $Bitmap is incomplete, %llu clusters are counted as allocated\n", (unsigned long long)(part->total_clusters - valid));
+	else
+		valid = part->total_clusters;
+
+	// $Bitmap sets a bit per allocated cluster. Invert it and clear everything past the readable, in range part
+	for(uint64_t i = 0; i < words; i++) {
+		uint64_t w = ~read_le64(raw + i * 8);
+		if(i * 64 + 64 > valid)
+			w = (i * 64 >= valid) ? 0 : w & ((1ULL << (valid - i * 64)) - 1);
+		part->free_map[i] = w;
+	}
+
+	part->free_clusters = ntfs_popcount_words(part->free_map, words);
+}
+
+// Requires ntfs_build_free_map(). Out of range clusters are reported as allocated
+bool ntfs_cluster_is_free(ntfs_partition *part, uint64_t cluster) {
+	if(cluster >= part->total_clusters)
+		return false;
+
+	return (part->free_map[cluster / 64] >> (cluster % 64)) & 1;
+}
+
+// Number of free clusters in [start, start + count). Requires ntfs_build_free_map()
+uint64_t ntfs_count_free(ntfs_partition *part, uint64_t start, uint64_t count) {
+	uint64_t free_clusters = 0, c = start, end = start + count;
+	if(end > part->total_clusters)
+		end = part->total_clusters;
+
+	while(c < end && (c % 64) != 0) {
+		free_clusters += ntfs_cluster_is_free(part, c);
+		c++;
+	}
+	if(c + 64 <= end) {
+		uint64_t words = (end - c) / 64;
+		free_clusters += ntfs_popcount_words(part->free_map + c / 64, words);
+		c += words * 64;
+	}
+	while(c < end) {
+		free_clusters += ntfs_cluster_is_free(part, c);
+		c++;
+	}
+
+	return free_clusters;
+}
+
+/*
+ * Find the next run of contiguous free clusters. Requires ntfs_build_free_map()
+ *
+ * @param cluster In: cluster to start searching from. Out: first cluster of the run
+ * @param count Out: number of clusters in the run
+ * @return False if there are no free clusters at or after the starting cluster
+ */
+bool ntfs_next_free_run(ntfs_partition *part, uint64_t *cluster, uint64_t *count) {
+	uint64_t end = part->total_clusters;
+	uint64_t c = *cluster, w = 0;
+
+	// First set bit
+	while(c < end) {
+		w = part->free_map[c / 64] >> (c % 64);
+		if(w != 0) {
+			c += __builtin_ctzll(w);
+			break;
+		}
+		c = (c / 64 + 1) * 64;
+	}
+	if(c >= end)
+		return false;
+
+	// First clear bit after it
+	uint64_t e = c;
+	while(e < end) {
+		w = (~part->free_map[e / 64]) >> (e % 64);
+		if(w != 0) {
+			e += __builtin_ctzll(w);
+			break;
+		}
+		e = (e / 64 + 1) * 64;
+	}
+	if(e > end)
+		e = end;
+
+	*cluster = c;
+	*count = e - c;
+	return true;
+}
+
+/*
+ * Find the largest free runs of the volume
+ *
+ * @param out Receives up to max runs, largest first
+ * @return Number of runs written to out
+ */
+uint32_t ntfs_largest_free_runs(ntfs_partition *part, extent *out, uint32_t max) {
+	uint32_t n = 0;
+	uint64_t c = 0, count = 0;
+
+	ntfs_build_free_map(part);
+	if(part->free_map == NULL || max == 0)
+		return 0;
+
+	while(ntfs_next_free_run(part, &c, &count)) {
+		if(n < max || count > out[n - 1].length) {
+			uint32_t i = (n < max) ? n++ : n - 1;
+			while(i > 0 && out[i - 1].length < count) {
+				out[i] = out[i - 1];
+				i--;
+			}
+			out[i].start = c;
+			out[i].length = count;
+		}
+		c += count;
+	}
+
+	return n;
+}
+
+/*
+ * Append every run of free clusters to out in cluster order, in a single pass over the free map
+ */
+void ntfs_unallocated_extents(ntfs_partition *part, extent_list *out) {
+	uint64_t c = 0, count = 0;
+
+	ntfs_build_free_map(part);
+	if(part->free_map == NULL)
+		return;
+
+	while(ntfs_next_free_run(part, &c, &count)) {
+		extent_list_append(out, c, count, false);
+		c += count;
+	}
+}
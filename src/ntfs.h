@@ -0,0 +1,257 @@
+/**
+   dd_reader
+   ntfs.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _NTFS_H_
+#define _NTFS_H_
+
+#include "arena.h"
+#include "bytebuffer.h"
+#include "extent.h"
+#include "out.h"
+#include "parallel.h"
+#include "pathidx.h"
+#include "shared.h"
+
+#define NTFS_BOOTSTRAP_SIZE 426
+
+// Update sequence arrays protect the last two bytes of every 512 byte block of a multi sector record
+#define NTFS_USA_BLOCK 512
+
+// MFT records decoded per parallel task
+#define NTFS_MFT_CHUNK 1024
+
+#define NTFS_NAME_MAX 1024 // Max bytes of a UTF-8 encoded name including the terminator
+
+// Parent of records whose parent directory no longer exists or was reused
+#define NTFS_ORPHAN_DIR "/$OrphanFiles"
+// Deepest directory nesting followed when building a path. Deeper (or looping) chains are treated as orphans
+#define NTFS_PATH_DEPTH_MAX 1024
+
+// Largest free runs shown in the partition summary
+#define NTFS_TOP_FREE_RUNS 5
+
+// Returned by ntfs_time_to_epoch() for unset timestamps
+#define NTFS_TIME_NONE INT64_MIN
+
+/*
+ * File references: 48 bit MFT record number, 16 bit sequence number
+ */
+#define NTFS_REF_RECORD(ref) ((ref) & 0x0000FFFFFFFFFFFFULL)
+#define NTFS_REF_SEQ(ref) ((uint16_t)((ref) >> 48))
+
+/*
+ * Well known MFT record numbers
+ */
+#define NTFS_RECORD_MFT 0
+#define NTFS_RECORD_MFTMIRR 1
+#define NTFS_RECORD_LOGFILE 2
+#define NTFS_RECORD_VOLUME 3
+#define NTFS_RECORD_ATTRDEF 4
+#define NTFS_RECORD_ROOT 5
+#define NTFS_RECORD_BITMAP 6
+#define NTFS_RECORD_BOOT 7
+#define NTFS_RECORD_BADCLUS 8
+#define NTFS_RECORD_SECURE 9
+#define NTFS_RECORD_UPCASE 10
+#define NTFS_RECORD_EXTEND 11
+
+/*
+ * Attribute types
+ */
+#define NTFS_ATTR_STANDARD_INFORMATION 0x10
+#define NTFS_ATTR_ATTRIBUTE_LIST 0x20
+#define NTFS_ATTR_FILE_NAME 0x30
+#define NTFS_ATTR_DATA 0x80
+#define NTFS_ATTR_INDEX_ROOT 0x90
+#define NTFS_ATTR_INDEX_ALLOCATION 0xA0
+#define NTFS_ATTR_BITMAP 0xB0
+#define NTFS_ATTR_END 0xFFFFFFFF
+
+/*
+ * $FILE_NAME namespaces
+ */
+#define NTFS_NAMESPACE_POSIX 0
+#define NTFS_NAMESPACE_WIN32 1
+#define NTFS_NAMESPACE_DOS 2
+#define NTFS_NAMESPACE_WIN32_DOS 3
+
+/*
+ * ntfs_record.flags. The low byte holds the FILE record header flags
+ */
+#define NTFS_REC_IN_USE 0x0001
+#define NTFS_REC_DIRECTORY 0x0002
+#define NTFS_REC_VALID 0x0100 // FILE signature present and update sequence intact
+#define NTFS_REC_EXTENSION 0x0200 // Holds attributes of another (base) record
+#define NTFS_REC_RESIDENT 0x0400 // Unnamed $DATA is stored inside the record
+#define NTFS_REC_BAD 0x0800 // BAAD signature or update sequence mismatch (torn write)
+
+/*
+ * Boot sector of an NTFS volume. The BPB fields that are always 0 on NTFS are skipped
+ */
+typedef struct ntfs_boot_sector_t {
+	uint8_t jmp[3]; // x86 jump instruction
+	uint8_t oem_id[8]; // "NTFS    "
+	uint16_t bytes_per_sector;
+	uint8_t sectors_per_cluster;
+	uint8_t media_descriptor; // 0xF8
+	uint16_t sectors_per_track;
+	uint16_t num_heads;
+	uint32_t hidden_sectors;
+	uint64_t total_sectors;
+	uint64_t mft_cluster; // Logical cluster number of $MFT
+	uint64_t mftmirr_cluster; // Logical cluster number of $MFTMirr
+
+	// Positive: clusters per record. Negative: record size is 2^-n bytes
+	int8_t clusters_per_mft_record;
+	int8_t clusters_per_index_record;
+
+	uint64_t volume_serial;
+	uint32_t checksum;
+	// End of sector marker
+	uint8_t sig_end1;
+	uint8_t sig_end2;
+} ntfs_boot_sector, ntfs_bs;
+
+/*
+ * Compact, decoded form of an MFT FILE record
+ */
+typedef struct ntfs_record_t {
+	char *name; // Preferred (Win32 over DOS) $FILE_NAME, allocated from a partition arena. NULL if none
+	uint64_t parent; // File reference of the parent directory from $FILE_NAME
+	uint64_t size; // Logical size of the unnamed $DATA attribute
+	int64_t crtime, mtime, ctime, atime; // $STANDARD_INFORMATION times as epoch seconds. ctime is the MFT change time
+	uint32_t data_off; // Offset of the unnamed $DATA attribute header within the record. 0 if none
+	uint16_t flags; // NTFS_REC_*
+	uint16_t seq; // Sequence number of the record
+	uint32_t ext_first; // First extent of the unnamed $DATA in ntfs_partition.extents. See ntfs_build_extent_index()
+	uint32_t ext_count; // Number of extents (data runs). 0 for resident data
+} ntfs_record;
+
+/*
+ * MFT and allocation summary of a volume, shown with the partition. See ntfs_summarize()
+ */
+typedef struct ntfs_summary_t {
+	bool has_mft; // False if $MFT could not be loaded, the record counts are then 0
+	bool has_free_map; // False if $Bitmap could not be read, the free cluster fields are then 0
+	uint32_t num_records;
+	uint32_t in_use;
+	uint32_t dirs;
+	uint32_t ext; // Extension records
+	uint32_t bad; // Damaged records
+	uint64_t free_clusters;
+	extent free_runs[NTFS_TOP_FREE_RUNS]; // Largest free runs, longest first
+	uint32_t num_free_runs;
+} ntfs_summary;
+
+/*
+ * NTFS partition structure
+ */
+typedef struct ntfs_partition_t {
+	// Not part of the actual layout
+	uint8_t type; // PT_NTFS
+	uint64_t start_pos; // byte_buffer position that points to the beginning of the partition
+
+	ntfs_bs *boot_sector;
+
+	// Volume contents within the image buffer. Not owned by the partition
+	uint8_t *vol;
+	uint64_t vol_len; // Bytes of the volume actually present in the image (may be truncated)
+
+	uint32_t cluster_size;
+	uint32_t record_size; // Bytes per MFT record
+	uint64_t total_clusters;
+	bool valid; // Boot sector describes a usable geometry. The sizes above are 0 otherwise
+
+	// $MFT, loaded by ntfs_load_mft()
+	extent_list mft_extents; // Clusters of $MFT in logical order
+	uint8_t *mft; // Copy of every record with the update sequence fixups applied
+	uint64_t mft_len;
+	ntfs_record *records; // Indexed by MFT record number
+	uint32_t num_records;
+	bool has_mft;
+
+	// Data runs of every record's unnamed $DATA attribute
+	extent_list extents;
+	bool has_extents;
+
+	// Cluster allocation, from $Bitmap. 1 bit per cluster, set if the cluster is free. See ntfs_build_free_map()
+	uint64_t *free_map;
+	uint64_t free_clusters;
+
+	// Full paths by record number, built on demand from the parent references. See ntfs_record_path()
+	char **paths;
+	arena *path_arena;
+	path_index *path_idx; // Full path to record number. See ntfs_build_paths()
+
+	// Built on first use, or restored from a metadata index. See ntfs_summarize()
+	ntfs_summary summary;
+	bool has_summary;
+
+	// One arena per worker thread for record names
+	arena **arenas;
+	uint32_t num_arenas;
+} ntfs_partition;
+
+/*
+ * NTFS functions
+ */
+
+// Overall partition
+ntfs_partition *ntfs_new_partition();
+void ntfs_free_partition(ntfs_partition *part);
+void ntfs_read_partition(byte_buffer *bb, ntfs_partition *part);
+void ntfs_print_partition(ntfs_partition *part, bool verbose);
+void ntfs_output_partition(ntfs_partition *part, out_writer *out, uint8_t partition, bool verbose);
+ntfs_summary *ntfs_summarize(ntfs_partition *part);
+
+// Boot sector
+ntfs_bs *ntfs_new_boot_sector();
+void ntfs_free_boot_sector(ntfs_bs *bs);
+void ntfs_read_boot_sector(byte_buffer *bb, ntfs_partition *part);
+
+// MFT
+bool ntfs_apply_fixups(uint8_t *rec, uint32_t len);
+uint8_t *ntfs_find_attr(uint8_t *rec, uint32_t len, uint32_t type);
+void ntfs_decode_record(ntfs_partition *part, uint8_t *rec, ntfs_record *out, arena *names);
+bool ntfs_load_mft(ntfs_partition *part);
+uint8_t *ntfs_record_ptr(ntfs_partition *part, uint32_t num);
+int64_t ntfs_time_to_epoch(uint64_t filetime);
+
+// Paths
+const char *ntfs_record_path(ntfs_partition *part, uint32_t num);
+void ntfs_build_paths(ntfs_partition *part);
+bool ntfs_lookup_path(ntfs_partition *part, const char *path, uint32_t *num);
+
+// Data runs
+bool ntfs_decode_runlist(const uint8_t *runs, uint32_t len, uint64_t num_clusters, extent_list *out);
+bool ntfs_attr_extents(const uint8_t *attr, uint32_t attr_len, uint64_t num_clusters, extent_list *out);
+void ntfs_build_extent_index(ntfs_partition *part);
+size_t ntfs_read_data(ntfs_partition *part, uint32_t num, uint64_t offset, void *buf, size_t len);
+
+// Resident file contents
+const uint8_t *ntfs_resident_data(ntfs_partition *part, uint32_t num, uint64_t *len);
+
+// Cluster allocation
+void ntfs_build_free_map(ntfs_partition *part);
+bool ntfs_cluster_is_free(ntfs_partition *part, uint64_t cluster);
+uint64_t ntfs_count_free(ntfs_partition *part, uint64_t start, uint64_t count);
+bool ntfs_next_free_run(ntfs_partition *part, uint64_t *cluster, uint64_t *count);
+uint32_t ntfs_largest_free_runs(ntfs_partition *part, extent *out, uint32_t max);
+void ntfs_unallocated_extents(ntfs_partition *part, extent_list *out);
+
+#endif
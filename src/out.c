@@ -0,0 +1,353 @@
+/**
+   dd_reader
+   out.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <unistd.h>
+
+#include "out.h"
+
+// Parse a --format argument
+bool out_parse_format(const char *str, int *format) {
+	if(strcmp(str, "text") == 0)
+		*format = OUT_FORMAT_TEXT;
+	else if(strcmp(str, "json") == 0)
+		*format = OUT_FORMAT_JSON;
+	else if(strcmp(str, "csv") == 0)
+		*format = OUT_FORMAT_CSV;
+	else
+		return false;
+	return true;
+}
+
+/*
+ * Create a writer
+ *
+ * @param format OUT_FORMAT_*
+ * @param fd File descriptor the output is written to
+ */
+out_writer *out_new(int format, int fd) {
+	out_writer *w = (out_writer*)malloc(sizeof(out_writer));
+	memset(w, 0, sizeof(out_writer));
+	w->format = format;
+	w->fd = fd;
+	w->cap = OUT_BUFFER_SIZE;
+	w->buf = (char*)malloc(w->cap);
+	return w;
+}
+
+// Write out anything still buffered and release the writer
+void out_free(out_writer *w) {
+	if(w == NULL)
+		return;
+
+	out_flush(w);
+	free(w->buf);
+	free(w->header);
+	free(w);
+}
+
+/*
+ * Write the buffer out. stdio output is flushed first so text printed around the writer stays in order
+ */
+void out_flush(out_writer *w) {
+	fflush(stdout);
+
+	size_t done = 0;
+	while(done < w->len) {
+		ssize_t n = write(w->fd, w->buf + done, w->len - done);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			break;
+		done += (size_t)n;
+	}
+	w->len = 0;
+	w->row_start = 0;
+}
+
+// Make room for len more bytes. A record larger than the buffer grows it instead of being split
+static void out_reserve(out_writer *w, size_t len) {
+	if(w->len + len <= w->cap)
+		return;
+
+	while(w->len + len > w->cap)
+		w->cap *= 2;
+	w->buf = (char*)realloc(w->buf, w->cap);
+}
+
+static void out_write(out_writer *w, const char *data, size_t len) {
+	out_reserve(w, len);
+	memcpy(w->buf + w->len, data, len);
+	w->len += len;
+}
+
+static void out_puts(out_writer *w, const char *str) {
+	out_write(w, str, strlen(str));
+}
+
+static void out_putc(out_writer *w, char c) {
+	out_reserve(w, 1);
+	w->buf[w->len++] = c;
+}
+
+static void out_header_add(out_writer *w, const char *key) {
+	size_t len = strlen(key);
+	if(w->header_len + len + 1 > w->header_cap) {
+		w->header_cap = (w->header_len + len + 1) * 2;
+		w->header = (char*)realloc(w->header, w->header_cap);
+	}
+	if(w->num_fields > 0)
+		w->header[w->header_len++] = (w->format == OUT_FORMAT_CSV) ? ',' : '\t';
+	memcpy(w->header + w->header_len, key, len);
+	w->header_len += len;
+}
+
+/*
+ * Length of the well formed UTF-8 sequence at s, 0 if the bytes there are not one (stray continuation byte, overlong
+ * form, surrogate or past U+10FFFF)
+ */
+static size_t out_utf8_len(const unsigned char *s, size_t len) {
+	size_t n;
+	uint32_t cp;
+	if(s[0] >= 0xC2 && s[0] <= 0xDF) {
+		n = 2;
+		cp = s[0] & 0x1F;
+	} else if(s[0] >= 0xE0 && s[0] <= 0xEF) {
+		n = 3;
+		cp = s[0] & 0x0F;
+	} else if(s[0] >= 0xF0 && s[0] <= 0xF4) {
+		n = 4;
+		cp = s[0] & 0x07;
+	} else {
+		return 0;
+	}
+
+	if(n > len)
+		return 0;
+	for(size_t i = 1; i < n; i++) {
+		if((s[i] & 0xC0) != 0x80)
+			return 0;
+		cp = (cp << 6) | (s[i] & 0x3F);
+	}
+
+	if((n == 3 && cp < 0x800) || (n == 4 && (cp < 0x10000 || cp > 0x10FFFF)) || (cp >= 0xD800 && cp <= 0xDFFF))
+		return 0;
+	return n;
+}
+
+// JSON string literal. Bytes that are not valid UTF-8 (such as code page bytes of FAT short names) are escaped as \u00XX
+static void out_json_str(out_writer *w, const char *str, size_t len) {
+	out_reserve(w, len * 6 + 3);
+	w->buf[w->len++] = '"';
+	for(size_t i = 0; i < len; i++) {
+		unsigned char c = (unsigned char)str[i];
+		if(c == '"' || c == '\\') {
+			w->buf[w->len++] = '\\';
+			w->buf[w->len++] = (char)c;
+		} else if(c < 0x20) {
+			w->len += (size_t)sprintf(w->buf + w->len, "\\u%04x", c);
+		} else if(c < 0x80) {
+			w->buf[w->len++] = (char)c;
+		} else {
+			size_t n = out_utf8_len((const unsigned char*)str + i, len - i);
+			if(n == 0) {
+				w->len += (size_t)sprintf(w->buf + w->len, "\\u%04x", c);
+			} else {
+				memcpy(w->buf + w->len, str + i, n);
+				w->len += n;
+				i += n - 1;
+			}
+		}
+	}
+	w->buf[w->len++] = '"';
+}
+
+// CSV field, quoted if it contains a separator, quote or line break
+static void out_csv_str(out_writer *w, const char *str, size_t len) {
+	bool quote = false;
+	for(size_t i = 0; i < len && !quote; i++) {
+		quote = (str[i] == ',' || str[i] == '"' || str[i] == '\n' || str[i] == '\r');
+	}
+	if(!quote) {
+		out_write(w, str, len);
+		return;
+	}
+
+	out_putc(w, '"');
+	for(size_t i = 0; i < len; i++) {
+		if(str[i] == '"')
+			out_putc(w, '"');
+		out_putc(w, str[i]);
+	}
+	out_putc(w, '"');
+}
+
+// Start a field: separator, and the key (JSON) or header column (first record of a CSV/text section)
+static void out_key(out_writer *w, const char *key) {
+	if(w->format == OUT_FORMAT_JSON) {
+		if(w->num_fields > 0)
+			out_putc(w, ',');
+		out_json_str(w, key, strlen(key));
+		out_putc(w, ':');
+	} else {
+		if(w->num_records == 0)
+			out_header_add(w, key);
+		if(w->num_fields > 0)
+			out_putc(w, (w->format == OUT_FORMAT_CSV) ? ',' : '\t');
+	}
+	w->num_fields++;
+}
+
+// Start the output document
+void out_begin(out_writer *w) {
+	if(w->format == OUT_FORMAT_JSON)
+		out_putc(w, '{');
+}
+
+// End the output document and write it out
+void out_end(out_writer *w) {
+	if(w->format == OUT_FORMAT_JSON)
+		out_puts(w, "}\n");
+	out_flush(w);
+}
+
+/*
+ * Start a section of records
+ *
+ * @param key JSON key of the section
+ * @param title Heading of the section in text output
+ */
+void out_section_begin(out_writer *w, const char *key, const char *title) {
+	if(w->format == OUT_FORMAT_JSON) {
+		if(w->num_sections > 0)
+			out_putc(w, ',');
+		out_json_str(w, key, strlen(key));
+		out_puts(w, ":[");
+	} else if(w->format == OUT_FORMAT_CSV) {
+		if(w->num_sections > 0)
+			out_putc(w, '\n');
+	} else {
+		out_puts(w, title);
+		out_puts(w, "\n==================================================\n");
+	}
+
+	w->num_sections++;
+	w->num_records = 0;
+	w->header_len = 0;
+}
+
+void out_section_end(out_writer *w) {
+	if(w->format == OUT_FORMAT_JSON)
+		out_putc(w, ']');
+	else if(w->format == OUT_FORMAT_TEXT)
+		out_puts(w, "==================================================\n\n");
+	out_flush(w);
+}
+
+void out_record_begin(out_writer *w) {
+	if(w->format == OUT_FORMAT_JSON) {
+		if(w->num_records > 0)
+			out_putc(w, ',');
+		out_putc(w, '{');
+	}
+	w->row_start = w->len;
+	w->num_fields = 0;
+}
+
+/*
+ * Finish a record. The header row is slipped in ahead of the first record of a CSV/text section once its fields
+ * are known. The buffer is written out when it is full
+ */
+void out_record_end(out_writer *w) {
+	if(w->format == OUT_FORMAT_JSON) {
+		out_putc(w, '}');
+	} else {
+		out_putc(w, '\n');
+		if(w->num_records == 0) {
+			out_reserve(w, w->header_len + 1);
+			memmove(w->buf + w->row_start + w->header_len + 1, w->buf + w->row_start, w->len - w->row_start);
+			memcpy(w->buf + w->row_start, w->header, w->header_len);
+			w->buf[w->row_start + w->header_len] = '\n';
+			w->len += w->header_len + 1;
+		}
+	}
+
+	w->num_records++;
+	if(w->len >= w->cap - w->cap / 8)
+		out_flush(w);
+}
+
+void out_str(out_writer *w, const char *key, const char *value) {
+	out_key(w, key);
+	if(w->format == OUT_FORMAT_JSON)
+		out_json_str(w, value, strlen(value));
+	else if(w->format == OUT_FORMAT_CSV)
+		out_csv_str(w, value, strlen(value));
+	else
+		out_puts(w, value);
+}
+
+/*
+ * Fixed size on-disk text field (OEM ID, volume label). Ends at the first NUL, trailing spaces are dropped and
+ * unprintable bytes shown as '.'
+ */
+void out_ascii(out_writer *w, const char *key, const uint8_t *value, size_t len) {
+	char str[256];
+	size_t n = 0;
+	for(; n < len && n < sizeof(str) - 1 && value[n] != '\0'; n++) {
+		str[n] = (value[n] >= 0x20 && value[n] < 0x7F) ? (char)value[n] : '.';
+	}
+	while(n > 0 && str[n - 1] == ' ')
+		n--;
+	str[n] = '\0';
+	out_str(w, key, str);
+}
+
+void out_u64(out_writer *w, const char *key, uint64_t value) {
+	out_key(w, key);
+	out_reserve(w, 24);
+	w->len += (size_t)sprintf(w->buf + w->len, "%llu", (unsigned long long)value);
+}
+
+void out_i64(out_writer *w, const char *key, int64_t value) {
+	out_key(w, key);
+	out_reserve(w, 24);
+	w->len += (size_t)sprintf(w->buf + w->len, "%lld", (long long)value);
+}
+
+void out_f64(out_writer *w, const char *key, double value) {
+	out_key(w, key);
+	out_reserve(w, 64);
+	int n = snprintf(w->buf + w->len, 64, "%.3f", value);
+	w->len += (n < 64) ? (size_t)n : 63;
+}
+
+// Bytes as a hex string
+void out_hex(out_writer *w, const char *key, const uint8_t *value, size_t len) {
+	out_key(w, key);
+	out_reserve(w, len * 2 + 3);
+	if(w->format == OUT_FORMAT_JSON)
+		w->buf[w->len++] = '"';
+	for(size_t i = 0; i < len; i++) {
+		w->len += (size_t)sprintf(w->buf + w->len, "%02x", value[i]);
+	}
+	if(w->format == OUT_FORMAT_JSON)
+		w->buf[w->len++] = '"';
+}
@@ -0,0 +1,84 @@
+/**
+   dd_reader
+   out.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef _OUT_H_
+#define _OUT_H_
+
+#include "shared.h"
+
+/*
+ * Output formats
+ */
+#define OUT_FORMAT_TEXT 0
+#define OUT_FORMAT_JSON 1
+#define OUT_FORMAT_CSV 2
+
+#define OUT_BUFFER_SIZE (1024 * 1024) // Output is collected up to about this many bytes before it is written
+
+/*
+ * Streaming writer of sections of records. Records are rendered straight into one reusable buffer that is written
+ * out with a single write() whenever it fills, so a section of any size is never held in memory as a whole.
+ *
+ * JSON: one object, each section is an array of objects under its key.
+ * CSV: each section is a header row named after the fields of its first record, then one row per record. Sections
+ *      are separated by a blank line.
+ * Text: each section is a title, a tab separated header row and one tab separated row per record
+ */
+typedef struct out_writer_t {
+	int format; // OUT_FORMAT_*
+	int fd;
+
+	char *buf;
+	size_t len;
+	size_t cap;
+
+	char *header; // Field names of the first record of the current section (CSV, text)
+	size_t header_len;
+	size_t header_cap;
+
+	size_t row_start; // Offset of the current record in buf
+	uint32_t num_sections;
+	uint32_t num_records; // In the current section
+	uint32_t num_fields; // In the current record
+} out_writer;
+
+/*
+ * Output functions
+ */
+
+bool out_parse_format(const char *str, int *format);
+out_writer *out_new(int format, int fd);
+void out_free(out_writer *w);
+void out_flush(out_writer *w);
+
+void out_begin(out_writer *w);
+void out_end(out_writer *w);
+void out_section_begin(out_writer *w, const char *key, const char *title);
+void out_section_end(out_writer *w);
+void out_record_begin(out_writer *w);
+void out_record_end(out_writer *w);
+
+void out_str(out_writer *w, const char *key, const char *value);
+void out_ascii(out_writer *w, const char *key, const uint8_t *value, size_t len);
+void out_u64(out_writer *w, const char *key, uint64_t value);
+void out_i64(out_writer *w, const char *key, int64_t value);
+void out_f64(out_writer *w, const char *key, double value);
+void out_hex(out_writer *w, const char *key, const uint8_t *value, size_t len);
+
+#endif
@@ -0,0 +1,152 @@
+/**
+   dd_reader
+   parallel.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+// Number of threads set with par_set_threads(). 0 = one per online CPU
+static uint32_t par_threads = 0;
+
+/*
+ * Shared state of one par_run() call
+ */
+typedef struct par_job_t {
+	par_task_fn fn;
+	void *ctx;
+	size_t count;
+	size_t next; // Next task index to hand out, advanced atomically
+} par_job;
+
+typedef struct par_worker_t {
+	par_job *job;
+	uint32_t thread;
+} par_worker;
+
+// Set the number of worker threads used by par_run(). 0 selects one per online CPU
+void par_set_threads(uint32_t n) {
+	par_threads = (n > PAR_MAX_THREADS) ? PAR_MAX_THREADS : n;
+}
+
+uint32_t par_num_threads() {
+	if(par_threads != 0)
+		return par_threads;
+
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if(n < 1)
+		return 1;
+	return (n > PAR_MAX_THREADS) ? PAR_MAX_THREADS : (uint32_t)n;
+}
+
+static void *par_worker_main(void *arg) {
+	par_worker *w = (par_worker*)arg;
+	par_job *job = w->job;
+	size_t i = 0;
+
+	while((i = __sync_fetch_and_add(&(job->next), 1)) < job->count) {
+		job->fn(job->ctx, i, w->thread);
+	}
+
+	return NULL;
+}
+
+/*
+ * Run fn for every index in [0, count) across the worker threads and wait for all of them to finish.
+ * Indices are handed out one at a time as workers become free, so uneven tasks balance themselves.
+ * The calling thread works as thread 0
+ */
+void par_run(size_t count, par_task_fn fn, void *ctx) {
+	uint32_t num_threads = par_num_threads();
+	if(num_threads > count)
+		num_threads = (count > 0) ? (uint32_t)count : 1;
+
+	par_job job;
+	job.fn = fn;
+	job.ctx = ctx;
+	job.count = count;
+	job.next = 0;
+
+	par_worker workers[PAR_MAX_THREADS];
+	pthread_t tids[PAR_MAX_THREADS];
+	uint32_t started = 1;
+
+	for(uint32_t t = 1; t < num_threads; t++) {
+		workers[t].job = &job;
+		workers[t].thread = t;
+		if(pthread_create(&tids[t], NULL, par_worker_main, &workers[t]) != 0)
+			break;
+		started++;
+	}
+
+	workers[0].job = &job;
+	workers[0].thread = 0;
+	par_worker_main(&workers[0]);
+
+	for(uint32_t t = 1; t < started; t++) {
+		pthread_join(tids[t], NULL);
+	}
+}
+
+// One empty list per worker thread. Release with par_lists_merge()
+par_list *par_lists_new() {
+	return (par_list*)calloc(par_num_threads(), sizeof(par_list));
+}
+
+/*
+ * Append an item to a list
+ *
+ * @return The new, uninitialized item
+ */
+void *par_list_add(par_list *list, size_t item_size) {
+	if(list->count == list->cap) {
+		list->cap = (list->cap == 0) ? 256 : list->cap * 2;
+		list->items = (uint8_t*)realloc(list->items, list->cap * item_size);
+	}
+
+	return list->items + (list->count++) * item_size;
+}
+
+/*
+ * Concatenate the per thread lists of par_lists_new() in thread order and free them
+ *
+ * @param count Set to the number of items returned
+ * @return Every item, never NULL. Release with free()
+ */
+void *par_lists_merge(par_list *lists, size_t item_size, uint64_t *count) {
+	uint32_t num_threads = par_num_threads();
+	uint64_t total = 0;
+	for(uint32_t t = 0; t < num_threads; t++) {
+		total += lists[t].count;
+	}
+
+	uint8_t *items = (uint8_t*)malloc((total > 0 ? total : 1) * item_size);
+	uint64_t done = 0;
+	for(uint32_t t = 0; t < num_threads; t++) {
+		if(lists[t].items == NULL)
+			continue;
+		memcpy(items + done * item_size, lists[t].items, lists[t].count * item_size);
+		done += lists[t].count;
+		free(lists[t].items);
+	}
+	free(lists);
+
+	*count = total;
+	return items;
+}
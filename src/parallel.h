@@ -0,0 +1,56 @@
+/**
+   dd_reader
+   parallel.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Upper bound on worker threads
+#define PAR_MAX_THREADS 256
+
+/*
+ * Work function run for each task index. thread is the zero based worker number, usable for per thread state
+ */
+typedef void (*par_task_fn)(void *ctx, size_t index, uint32_t thread);
+
+/*
+ * Growable array of fixed size items. par_lists_new() gives one per worker thread, indexed by the thread number, so
+ * tasks append results without locking
+ */
+typedef struct par_list_t {
+	uint8_t *items;
+	uint64_t count;
+	uint64_t cap;
+} par_list;
+
+/*
+ * Parallel execution functions
+ */
+
+void par_set_threads(uint32_t n);
+uint32_t par_num_threads();
+void par_run(size_t count, par_task_fn fn, void *ctx);
+par_list *par_lists_new();
+void *par_list_add(par_list *list, size_t item_size);
+void *par_lists_merge(par_list *lists, size_t item_size, uint64_t *count);
+
+#endif
@@ -0,0 +1,156 @@
+/**
+   dd_reader
+   pathidx.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "pathidx.h"
+
+static inline uint8_t pathidx_fold(uint8_t c) {
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+/*
+ * Length of a path once normalized for lookups: a trailing '/' (other than the root itself) is ignored
+ */
+static size_t pathidx_len(const char *path) {
+	size_t len = strlen(path);
+	while(len > 1 && path[len-1] == '/')
+		len--;
+	return len;
+}
+
+// FNV-1a over the ASCII case folded path
+static uint32_t pathidx_hash(const char *path, size_t len) {
+	uint32_t h = 2166136261U;
+	for(size_t i = 0; i < len; i++) {
+		h ^= pathidx_fold((uint8_t)path[i]);
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static bool pathidx_equal(const char *key, const char *path, size_t len) {
+	for(size_t i = 0; i < len; i++) {
+		if(key[i] == '\0' || pathidx_fold((uint8_t)key[i]) != pathidx_fold((uint8_t)path[i]))
+			return false;
+	}
+	return key[len] == '\0';
+}
+
+static void pathidx_resize(path_index *idx, uint32_t num_slots) {
+	path_slot *old = idx->slots;
+	uint32_t old_slots = (old != NULL) ? idx->mask + 1 : 0;
+
+	idx->slots = (path_slot*)calloc(num_slots, sizeof(path_slot));
+	idx->mask = num_slots - 1;
+
+	for(uint32_t i = 0; i < old_slots; i++) {
+		if(old[i].key == NULL)
+			continue;
+
+		uint32_t s = old[i].hash & idx->mask;
+		while(idx->slots[s].key != NULL)
+			s = (s + 1) & idx->mask;
+		idx->slots[s] = old[i];
+	}
+
+	if(old != NULL)
+		free(old);
+}
+
+/*
+ * Create an empty path index
+ *
+ * @param expected Number of paths expected, used to size the table up front
+ */
+path_index *pathidx_new(uint32_t expected) {
+	path_index *idx = (path_index*)malloc(sizeof(path_index));
+	memset(idx, 0, sizeof(path_index));
+
+	uint32_t num_slots = 64;
+	while(num_slots < expected * 2)
+		num_slots *= 2;
+	pathidx_resize(idx, num_slots);
+
+	return idx;
+}
+
+void pathidx_free(path_index *idx) {
+	free(idx->slots);
+	free(idx);
+}
+
+/*
+ * Add a path. The string must outlive the index. Inserting a path that is already present replaces its value
+ */
+void pathidx_insert(path_index *idx, const char *path, uint32_t value) {
+	if((idx->count + 1) * 2 > idx->mask + 1)
+		pathidx_resize(idx, (idx->mask + 1) * 2);
+
+	size_t len = pathidx_len(path);
+	uint32_t h = pathidx_hash(path, len);
+	uint32_t s = h & idx->mask;
+
+	while(idx->slots[s].key != NULL) {
+		if(idx->slots[s].hash == h && pathidx_equal(idx->slots[s].key, path, len)) {
+			idx->slots[s].value = value;
+			return;
+		}
+		s = (s + 1) & idx->mask;
+	}
+
+	idx->slots[s].key = path;
+	idx->slots[s].hash = h;
+	idx->slots[s].value = value;
+	idx->count++;
+}
+
+/*
+ * Find a path, ignoring ASCII case and a trailing '/'
+ *
+ * @param value Receives the value stored with the path
+ * @return False if the path is not in the index
+ */
+bool pathidx_lookup(path_index *idx, const char *path, uint32_t *value) {
+	size_t len = pathidx_len(path);
+	uint32_t h = pathidx_hash(path, len);
+	uint32_t s = h & idx->mask;
+
+	while(idx->slots[s].key != NULL) {
+		if(idx->slots[s].hash == h && pathidx_equal(idx->slots[s].key, path, len)) {
+			*value = idx->slots[s].value;
+			return true;
+		}
+		s = (s + 1) & idx->mask;
+	}
+
+	return false;
+}
+
+/*
+ * Hash of a path as used by the index, for tables of paths kept outside of a path_index (see metaidx.c)
+ *
+ * @param len Receives the length of the path that is compared, see pathidx_key_equal()
+ */
+uint32_t pathidx_key_hash(const char *path, size_t *len) {
+	*len = pathidx_len(path);
+	return pathidx_hash(path, *len);
+}
+
+// True if key is the first len bytes of path, ignoring ASCII case
+bool pathidx_key_equal(const char *key, const char *path, size_t len) {
+	return pathidx_equal(key, path, len);
+}
@@ -0,0 +1,57 @@
+/**
+   dd_reader
+   pathidx.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _PATHIDX_H_
+#define _PATHIDX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Slot of the path index. key points at a path string owned by the filesystem (arena allocated), never copied
+ */
+typedef struct path_slot_t {
+	const char *key; // NULL if the slot is empty
+	uint32_t hash; // Case folded hash of key, compared before the string itself
+	uint32_t value; // Index of the file in its filesystem's file table
+} path_slot;
+
+/*
+ * Open addressing (linear probing) hash table from case folded full path to file index.
+ * Kept at most half full so a lookup is almost always a single probe
+ */
+typedef struct path_index_t {
+	path_slot *slots;
+	uint32_t mask; // Number of slots - 1. Slot count is a power of 2
+	uint32_t count;
+} path_index;
+
+/*
+ * Path index functions
+ */
+
+path_index *pathidx_new(uint32_t expected);
+void pathidx_free(path_index *idx);
+void pathidx_insert(path_index *idx, const char *path, uint32_t value);
+bool pathidx_lookup(path_index *idx, const char *path, uint32_t *value);
+uint32_t pathidx_key_hash(const char *path, size_t *len);
+bool pathidx_key_equal(const char *key, const char *path, size_t len);
+
+#endif
@@ -0,0 +1,364 @@
+/**
+   dd_reader
+   recover.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "recover.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Characters that may never appear in a short name
+static const char *recover_bad_chars = "\"*+,./:;<=>?[\\]|";
+
+// Directory entry slots checked by one recover_sweep()
+#define RECOVER_SWEEP_SLOTS 16
+
+/*
+ * First pass filter over RECOVER_SWEEP_SLOTS consecutive 32 byte slots (one 512 byte sector). The first byte of every
+ * slot is gathered into one vector and compared with the deleted marker at once, so sectors without deleted entries,
+ * which is nearly all of them, are passed over without looking at each slot
+ *
+ * @return Bit k set if slot k starts with the deleted marker
+ */
+static inline uint32_t recover_sweep(const uint8_t *raw) {
+#if defined(__SSE2__)
+	__m128i v[RECOVER_SWEEP_SLOTS];
+	for(int k = 0; k < RECOVER_SWEEP_SLOTS; k++) {
+		v[k] = _mm_loadu_si128((const __m128i*)(raw + k * FAT_DIRENT_SIZE));
+	}
+
+	// Interleave pairwise until byte k holds the first byte of slot k
+	for(int k = 0; k < RECOVER_SWEEP_SLOTS; k += 2)
+		v[k] = _mm_unpacklo_epi8(v[k], v[k + 1]);
+	for(int k = 0; k < RECOVER_SWEEP_SLOTS; k += 4)
+		v[k] = _mm_unpacklo_epi16(v[k], v[k + 2]);
+	for(int k = 0; k < RECOVER_SWEEP_SLOTS; k += 8)
+		v[k] = _mm_unpacklo_epi32(v[k], v[k + 4]);
+	__m128i first = _mm_unpacklo_epi64(v[0], v[8]);
+
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(first, _mm_set1_epi8((char)FAT_DIRENT_DELETED)));
+#else
+	uint32_t mask = 0;
+	for(int k = 0; k < RECOVER_SWEEP_SLOTS; k++) {
+		if(raw[k * FAT_DIRENT_SIZE] == FAT_DIRENT_DELETED)
+			mask |= (1U << k);
+	}
+	return mask;
+#endif
+}
+
+/*
+ * Per slot check of a slot that starts with the deleted marker: LFN entries pass, short entries need printable name
+ * bytes. Only slots passing this are examined further
+ */
+static bool recover_filter(const uint8_t *raw) {
+	if(raw[11] == FAT_ATTR_LFN)
+		return true;
+
+	for(int i = 1; i < 11; i++) {
+		if(raw[i] < 0x20)
+			return false;
+	}
+	return true;
+}
+
+// Stricter validation for a short entry, used on data that is not known to be a directory
+static bool recover_plausible(fat_partition *part, const fat_dirent *de) {
+	if(de->attr & 0xC8) // Reserved bits or a volume label
+		return false;
+
+	for(int i = 1; i < 11; i++) {
+		if(de->name[i] > 0x7E || (de->name[i] >= 'a' && de->name[i] <= 'z') || strchr(recover_bad_chars, de->name[i]) != NULL)
+			return false;
+	}
+
+	// Dates are either unset or have a valid month and day
+	uint16_t dates[2] = { de->cdate, de->mdate };
+	for(int i = 0; i < 2; i++) {
+		uint16_t month = (dates[i] >> 5) & 0x0F, day = dates[i] & 0x1F;
+		if(dates[i] != 0 && (month < 1 || month > 12 || day < 1))
+			return false;
+	}
+
+	uint32_t cluster = fat_dirent_cluster(part, de);
+	return cluster == 0 || fat_is_valid_cluster(part, cluster);
+}
+
+// Estimate the contiguous range the entry occupied and check it against the free cluster map
+static void recover_estimate(fat_partition *part, recover_entry *e) {
+	uint32_t cs = fat_cluster_size(part);
+
+	e->start_cluster = fat_dirent_cluster(part, &(e->de));
+	if(e->de.attr & FAT_ATTR_DIRECTORY)
+		e->num_clusters = 1;
+	else
+		e->num_clusters = (uint32_t)(((uint64_t)e->de.size + cs - 1) / cs);
+
+	if(e->num_clusters == 0) {
+		e->status = RECOVER_EMPTY;
+		return;
+	}
+
+	if(!fat_is_valid_cluster(part, e->start_cluster) || (uint64_t)e->start_cluster + e->num_clusters - 1 > part->max_cluster) {
+		e->status = RECOVER_INVALID;
+		return;
+	}
+
+	e->alloc_clusters = e->num_clusters - fat_count_free(part, e->start_cluster, e->num_clusters);
+	if(e->alloc_clusters == 0)
+		e->status = RECOVER_OK;
+	else if(!fat_cluster_is_free(part, e->start_cluster))
+		e->status = RECOVER_OVERWRITTEN;
+	else
+		e->status = RECOVER_PARTIAL;
+}
+
+/*
+ * Rebuild the long name of a deleted short entry from the deleted LFN entries directly before it in the block.
+ * The sequence numbers were overwritten by the deleted marker, so the order is taken from position:
+ * the entry immediately before the short entry holds the first 13 characters
+ *
+ * @return True if a long name was written to dest
+ */
+static bool recover_lfn(const uint8_t *block, uint64_t idx, fat_dirent *de, char *dest, size_t dest_len) {
+	uint8_t lfn[FAT_LFN_MAX_ENTRIES * FAT_LFN_CHARS * 2];
+	uint32_t n = 0;
+	uint8_t checksum = 0;
+
+	while(idx > 0 && n < FAT_LFN_MAX_ENTRIES) {
+		const uint8_t *raw = block + (idx - 1) * FAT_DIRENT_SIZE;
+		if(raw[0] != FAT_DIRENT_DELETED || raw[11] != FAT_ATTR_LFN)
+			break;
+		if(n > 0 && raw[13] != checksum)
+			break;
+
+		checksum = raw[13];
+		memcpy(lfn + n * FAT_LFN_CHARS * 2, raw + 1, 10);
+		memcpy(lfn + n * FAT_LFN_CHARS * 2 + 10, raw + 14, 12);
+		memcpy(lfn + n * FAT_LFN_CHARS * 2 + 22, raw + 28, 4);
+		n++;
+		idx--;
+	}
+
+	if(n == 0 || utf16le_to_utf8(lfn, n * FAT_LFN_CHARS, dest, dest_len) == 0)
+		return false;
+
+	// The short name checksum lets us restore the lost first character. Try the long name's first character
+	uint8_t first = (uint8_t)dest[0];
+	if(first >= 'a' && first <= 'z')
+		first -= 0x20;
+	uint8_t name[11];
+	memcpy(name, de->name, sizeof(name));
+	name[0] = first;
+	if(fat_lfn_checksum(name) == checksum)
+		de->name[0] = first;
+
+	return true;
+}
+
+static void recover_add(fat_partition *part, recover_result *res, const uint8_t *block, uint64_t idx, uint64_t vol_pos, bool orphan) {
+	char name[FAT_NAME_MAX], short_name[13];
+	recover_entry *e = NULL;
+
+	if(res->num_entries == res->entries_cap) {
+		res->entries_cap = (res->entries_cap == 0) ? 64 : res->entries_cap * 2;
+		res->entries = (recover_entry*)realloc(res->entries, res->entries_cap * sizeof(recover_entry));
+	}
+
+	e = &(res->entries[res->num_entries++]);
+	memset(e, 0, sizeof(recover_entry));
+	fat_parse_dirent(block + idx * FAT_DIRENT_SIZE, &(e->de));
+	e->dirent_pos = vol_pos + idx * FAT_DIRENT_SIZE;
+	e->orphan = orphan;
+
+	bool has_lfn = (e->de.name[0] == FAT_DIRENT_DELETED) && recover_lfn(block, idx, &(e->de), name, sizeof(name));
+	if(e->de.name[0] == FAT_DIRENT_DELETED)
+		e->de.name[0] = '_';
+	fat_short_name(e->de.name, short_name);
+	e->name = arena_strdup(res->arena, has_lfn ? name : short_name);
+
+	recover_estimate(part, e);
+}
+
+// Examine a slot that starts with the deleted marker and record it if it is a deleted short entry
+static void recover_check_entry(fat_partition *part, recover_result *res, const uint8_t *block, uint64_t idx, uint64_t vol_pos, bool strict, bool orphan) {
+	const uint8_t *raw = block + idx * FAT_DIRENT_SIZE;
+	if(!recover_filter(raw) || raw[11] == FAT_ATTR_LFN)
+		return;
+
+	fat_dirent de;
+	fat_parse_dirent(raw, &de);
+	if(de.attr & FAT_ATTR_VOLUME_ID)
+		return;
+	if(strict && !recover_plausible(part, &de))
+		return;
+
+	recover_add(part, res, block, idx, vol_pos, orphan);
+}
+
+/*
+ * Scan a run of directory entries for deleted short entries
+ *
+ * @param strict Apply the stricter plausibility checks. Used for data not known to belong to a directory
+ */
+static void recover_scan_entries(fat_partition *part, recover_result *res, const uint8_t *block, uint64_t len, uint64_t vol_pos, bool strict, bool orphan) {
+	uint64_t count = len / FAT_DIRENT_SIZE;
+	uint64_t i = 0;
+
+	for(; i + RECOVER_SWEEP_SLOTS <= count; i += RECOVER_SWEEP_SLOTS) {
+		uint32_t mask = recover_sweep(block + i * FAT_DIRENT_SIZE);
+		while(mask != 0) {
+			recover_check_entry(part, res, block, i + __builtin_ctz(mask), vol_pos, strict, orphan);
+			mask &= mask - 1;
+		}
+	}
+
+	// Slots after the last whole sector
+	for(; i < count; i++) {
+		if(block[i * FAT_DIRENT_SIZE] == FAT_DIRENT_DELETED)
+			recover_check_entry(part, res, block, i, vol_pos, strict, orphan);
+	}
+}
+
+static bool recover_dir_block(fat_partition *part, uint8_t *block, uint32_t len, uint64_t vol_pos, void *ctx) {
+	recover_scan_entries(part, (recover_result*)ctx, block, len, vol_pos, false, false);
+	return true;
+}
+
+// A cluster that begins with "." and ".." directory entries is the first cluster of a directory
+static bool recover_is_dir_cluster(const uint8_t *c) {
+	return memcmp(c, ".          ", 11) == 0 && (c[11] & FAT_ATTR_DIRECTORY) &&
+		memcmp(c + FAT_DIRENT_SIZE, "..         ", 11) == 0 && (c[FAT_DIRENT_SIZE + 11] & FAT_ATTR_DIRECTORY);
+}
+
+/*
+ * Sweep a run of contiguous unallocated clusters. Deleted entries are picked up anywhere in the run.
+ * Clusters that look like the start of an orphaned directory have their live looking entries reported as well
+ */
+static void recover_scan_free_run(fat_partition *part, recover_result *res, uint32_t first, uint32_t count) {
+	uint32_t cs = fat_cluster_size(part);
+	uint8_t *start = fat_cluster_ptr(part, first);
+	if(start == NULL)
+		return;
+
+	// Clamp the run to the part of the volume present in the image
+	uint64_t vol_pos = (uint64_t)(start - part->vol);
+	uint64_t len = (uint64_t)count * cs;
+	if(vol_pos + len > part->vol_len)
+		len = ((part->vol_len - vol_pos) / cs) * cs;
+
+	recover_scan_entries(part, res, start, len, vol_pos, true, true);
+
+	fat_dirent de;
+	for(uint64_t off = 0; off < len; off += cs) {
+		if(!recover_is_dir_cluster(start + off))
+			continue;
+
+		for(uint32_t i = 2; i < cs / FAT_DIRENT_SIZE; i++) {
+			const uint8_t *raw = start + off + i * FAT_DIRENT_SIZE;
+			if(raw[0] == FAT_DIRENT_END)
+				break;
+			if(raw[0] == FAT_DIRENT_DELETED || raw[11] == FAT_ATTR_LFN)
+				continue;
+
+			fat_parse_dirent(raw, &de);
+			if(recover_plausible(part, &de))
+				recover_add(part, res, start + off, i, vol_pos + off, true);
+		}
+	}
+}
+
+/*
+ * Scan a FAT volume for deleted directory entries and estimate how much of each file can be recovered
+ *
+ * @param part FAT partition
+ * @param unallocated Also sweep every unallocated cluster for deleted entries and orphaned directory blocks
+ * @return Scan results. Release with recover_free()
+ */
+recover_result *recover_scan(fat_partition *part, bool unallocated) {
+	recover_result *res = (recover_result*)malloc(sizeof(recover_result));
+	memset(res, 0, sizeof(recover_result));
+	res->arena = arena_new(0);
+
+	fat_build_free_map(part);
+	fat_read_directory_tree(part);
+
+	// Every live directory, including the root
+	for(uint32_t i = 0; i < part->num_files; i++) {
+		fat_file *f = &(part->files[i]);
+		if(!(f->de.attr & FAT_ATTR_DIRECTORY))
+			continue;
+
+		uint32_t cluster = (i == FAT_ROOT_INDEX) ? 0 : fat_dirent_cluster(part, &(f->de));
+		if(i != FAT_ROOT_INDEX && !fat_is_valid_cluster(part, cluster))
+			continue;
+		fat_foreach_dir_block(part, cluster, recover_dir_block, res);
+	}
+
+	if(!unallocated)
+		return res;
+
+	// Unallocated space, one contiguous free run at a time
+	uint32_t c = 2, count = 0;
+	while(fat_next_free_run(part, &c, &count)) {
+		recover_scan_free_run(part, res, c, count);
+		c += count;
+	}
+
+	return res;
+}
+
+const char *recover_status_str(uint8_t status) {
+	switch(status) {
+		case RECOVER_OK:
+			return "Recoverable";
+		case RECOVER_PARTIAL:
+			return "Partial";
+		case RECOVER_OVERWRITTEN:
+			return "Overwritten";
+		case RECOVER_EMPTY:
+			return "Empty";
+		default:
+			return "Invalid";
+	}
+}
+
+/*
+ * Outputs a human readable listing of the deleted entries found by recover_scan()
+ */
+void recover_print(fat_partition *part, recover_result *res) {
+	printf("Deleted entries: %u\n", res->num_entries);
+
+	for(uint32_t i = 0; i < res->num_entries; i++) {
+		recover_entry *e = &(res->entries[i]);
+		printf("%s%s  %-11s  Entry: %llu  Start cluster: %u  Clusters: %u (%u allocated)  Size: %u  %s\n",
+			(e->de.attr & FAT_ATTR_DIRECTORY) ? "D" : "F",
+			e->orphan ? "O" : " ",
+			recover_status_str(e->status),
+			(unsigned long long)(part->start_pos + e->dirent_pos),
+			e->start_cluster, e->num_clusters, e->alloc_clusters, e->de.size, e->name);
+	}
+}
+
+void recover_free(recover_result *res) {
+	if(res->entries != NULL)
+		free(res->entries);
+
+	arena_free(res->arena);
+	free(res);
+}
@@ -0,0 +1,65 @@
+/**
+   dd_reader
+   recover.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _RECOVER_H_
+#define _RECOVER_H_
+
+#include "arena.h"
+#include "fat.h"
+#include "shared.h"
+
+/*
+ * Recoverability estimate for a deleted entry, based on the contiguous cluster range it would have occupied
+ */
+#define RECOVER_OK 0 // Every cluster in the range is still free
+#define RECOVER_PARTIAL 1 // Some clusters in the range have been reallocated
+#define RECOVER_OVERWRITTEN 2 // The start cluster has been reallocated
+#define RECOVER_EMPTY 3 // Zero length file, nothing to recover
+#define RECOVER_INVALID 4 // Start cluster or range lies outside the data region
+
+/*
+ * A deleted (or orphaned) directory entry found by the recovery scanner
+ */
+typedef struct recover_entry_t {
+	char *name; // Long name if the deleted LFN entries survived, otherwise the 8.3 name with the first character lost
+	uint64_t dirent_pos; // Byte offset of the short entry relative to the start of the volume
+	fat_dirent de;
+	bool orphan; // Found in an unallocated cluster rather than a live directory
+	uint32_t start_cluster;
+	uint32_t num_clusters; // Estimated clusters occupied by the file
+	uint32_t alloc_clusters; // Clusters in the estimated range that are currently allocated
+	uint8_t status; // See RECOVER_*
+} recover_entry;
+
+typedef struct recover_result_t {
+	arena *arena;
+	recover_entry *entries;
+	uint32_t num_entries;
+	uint32_t entries_cap;
+} recover_result;
+
+/*
+ * Recovery functions
+ */
+
+recover_result *recover_scan(fat_partition *part, bool unallocated);
+void recover_print(fat_partition *part, recover_result *res);
+void recover_free(recover_result *res);
+const char *recover_status_str(uint8_t status);
+
+#endif
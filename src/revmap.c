@@ -0,0 +1,324 @@
+/**
+   dd_reader
+   revmap.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "revmap.h"
+
+revmap *revmap_new() {
+	revmap *map = (revmap*)malloc(sizeof(revmap));
+	memset(map, 0, sizeof(revmap));
+
+	return map;
+}
+
+void revmap_free(revmap *map) {
+	if(map->iv != NULL)
+		free(map->iv);
+
+	free(map);
+}
+
+/*
+ * Add a byte range to the map. revmap_finalize() must be called before the next lookup
+ */
+void revmap_add(revmap *map, uint64_t start, uint64_t end, uint8_t kind, uint8_t partition, uint32_t owner, uint64_t file_pos) {
+	if(end <= start)
+		return;
+
+	if(map->count == map->cap) {
+		map->cap = (map->cap == 0) ? 1024 : map->cap * 2;
+		map->iv = (revmap_interval*)realloc(map->iv, map->cap * sizeof(revmap_interval));
+	}
+
+	revmap_interval *iv = &(map->iv[map->count++]);
+	iv->start = start;
+	iv->end = end;
+	iv->file_pos = file_pos;
+	iv->owner = owner;
+	iv->kind = kind;
+	iv->partition = partition;
+	map->sorted = false;
+}
+
+// Record the bounds of a partition so unclaimed offsets inside it can be attributed to it
+void revmap_add_partition(revmap *map, uint64_t start, uint64_t end, uint8_t partition) {
+	if(map->num_parts >= 4)
+		return;
+
+	revmap_interval *p = &(map->parts[map->num_parts++]);
+	memset(p, 0, sizeof(revmap_interval));
+	p->start = start;
+	p->end = end;
+	p->kind = REVMAP_PARTITION;
+	p->partition = partition;
+	p->owner = REVMAP_NO_OWNER;
+}
+
+/*
+ * Add the system areas, file contents, file slack and free space of a FAT volume.
+ * Builds the extent index and free cluster map if they don't exist yet
+ *
+ * @param part FAT partition
+ * @param partition Index of the partition in the MBR
+ */
+void revmap_add_fat(revmap *map, fat_partition *part, uint8_t partition) {
+	// Without a usable geometry the volume stays one unattributed partition range
+	if(!part->valid)
+		return;
+
+	uint64_t base = part->start_pos;
+	uint64_t bps = part->boot_sector->bpb.bytes_per_sector;
+	uint64_t cs = fat_cluster_size(part);
+	uint64_t data = base + (uint64_t)fat_data_start_rel(part) * bps;
+
+	fat_build_free_map(part);
+	fat_build_extent_index(part);
+
+	revmap_add(map, base, base + part->boot_sector->bpb.reserved_sectors * bps, REVMAP_RESERVED, partition, REVMAP_NO_OWNER, 0);
+	revmap_add(map, base + part->boot_sector->bpb.reserved_sectors * bps, base + (uint64_t)fat_rootdir_start_rel(part) * bps, REVMAP_FAT, partition, REVMAP_NO_OWNER, 0);
+	revmap_add(map, base + (uint64_t)fat_rootdir_start_rel(part) * bps, data, REVMAP_ROOTDIR, partition, REVMAP_NO_OWNER, 0);
+
+	// File contents. The part of the last cluster past the file size is slack
+	for(uint32_t i = 0; i < part->num_files; i++) {
+		fat_file *f = &(part->files[i]);
+		bool is_dir = (f->de.attr & FAT_ATTR_DIRECTORY) != 0;
+		uint64_t pos = 0;
+
+		for(uint32_t e = f->ext_first; e < f->ext_first + f->ext_count; e++) {
+			extent *ext = &(part->extents.ext[e]);
+			uint64_t start = data + (ext->start - 2) * cs;
+			uint64_t len = ext->length * cs;
+
+			if(is_dir || pos + len <= f->de.size) {
+				revmap_add(map, start, start + len, REVMAP_FILE, partition, i, pos);
+			} else if(pos >= f->de.size) {
+				revmap_add(map, start, start + len, REVMAP_SLACK, partition, i, pos);
+			} else {
+				uint64_t used = f->de.size - pos;
+				revmap_add(map, start, start + used, REVMAP_FILE, partition, i, pos);
+				revmap_add(map, start + used, start + len, REVMAP_SLACK, partition, i, pos + used);
+			}
+			pos += len;
+		}
+	}
+
+	// Free space
+	uint32_t c = 2, count = 0;
+	while(fat_next_free_run(part, &c, &count)) {
+		uint64_t start = data + (uint64_t)(c - 2) * cs;
+		revmap_add(map, start, start + (uint64_t)count * cs, REVMAP_UNALLOCATED, partition, REVMAP_NO_OWNER, 0);
+		c += count;
+	}
+}
+
+/*
+ * Add the boot sector, the clusters of every in use file and the free clusters of an NTFS partition.
+ * MFT, $Bitmap and the other metadata files are regular records and show up as files
+ */
+void revmap_add_ntfs(revmap *map, ntfs_partition *part, uint8_t partition) {
+	uint64_t base = part->start_pos;
+	uint64_t cs = part->cluster_size;
+
+	revmap_add(map, base, base + part->boot_sector->bytes_per_sector, REVMAP_RESERVED, partition, REVMAP_NO_OWNER, 0);
+
+	ntfs_build_extent_index(part);
+	if(!part->has_extents)
+		return;
+
+	// File contents. The part of the last cluster past the data size is slack
+	for(uint32_t i = 0; i < part->num_records; i++) {
+		ntfs_record *r = &(part->records[i]);
+		if(!(r->flags & NTFS_REC_IN_USE))
+			continue;
+
+		uint64_t pos = 0;
+		for(uint32_t e = r->ext_first; e < r->ext_first + r->ext_count; e++) {
+			extent *ext = &(part->extents.ext[e]);
+			uint64_t len = ext->length * cs;
+			if(ext->start == EXTENT_SPARSE) {
+				pos += len;
+				continue;
+			}
+
+			uint64_t start = base + ext->start * cs;
+			if(pos + len <= r->size) {
+				revmap_add(map, start, start + len, REVMAP_FILE, partition, i, pos);
+			} else if(pos >= r->size) {
+				revmap_add(map, start, start + len, REVMAP_SLACK, partition, i, pos);
+			} else {
+				uint64_t used = r->size - pos;
+				revmap_add(map, start, start + used, REVMAP_FILE, partition, i, pos);
+				revmap_add(map, start + used, start + len, REVMAP_SLACK, partition, i, pos + used);
+			}
+			pos += len;
+		}
+	}
+
+	// Free space
+	extent_list free_runs;
+	extent_list_init(&free_runs);
+	ntfs_unallocated_extents(part, &free_runs);
+	for(uint32_t i = 0; i < free_runs.count; i++) {
+		uint64_t start = base + free_runs.ext[i].start * cs;
+		revmap_add(map, start, start + free_runs.ext[i].length * cs, REVMAP_UNALLOCATED, partition, REVMAP_NO_OWNER, 0);
+	}
+	extent_list_free(&free_runs);
+}
+
+static int revmap_cmp(const void *a, const void *b) {
+	const revmap_interval *x = (const revmap_interval*)a, *y = (const revmap_interval*)b;
+	if(x->start != y->start)
+		return (x->start < y->start) ? -1 : 1;
+	return (x->end < y->end) ? -1 : (x->end > y->end);
+}
+
+/*
+ * Sort the intervals and make them disjoint. Where ranges overlap (cross linked chains) the earlier one wins
+ */
+void revmap_finalize(revmap *map) {
+	if(map->sorted)
+		return;
+
+	qsort(map->iv, map->count, sizeof(revmap_interval), revmap_cmp);
+
+	uint32_t n = 0;
+	for(uint32_t i = 0; i < map->count; i++) {
+		revmap_interval iv = map->iv[i];
+		if(n > 0 && iv.start < map->iv[n-1].end) {
+			uint64_t clip = map->iv[n-1].end - iv.start;
+			if(iv.end <= map->iv[n-1].end)
+				continue;
+			iv.start += clip;
+			if(iv.kind == REVMAP_FILE || iv.kind == REVMAP_SLACK)
+				iv.file_pos += clip;
+		}
+		map->iv[n++] = iv;
+	}
+	map->count = n;
+	map->sorted = true;
+}
+
+// Describe an offset that isn't covered by any interval. prev/next are the neighbouring intervals or -1/count
+static revmap_interval revmap_gap(revmap *map, uint64_t offset, int64_t prev) {
+	revmap_interval gap;
+	memset(&gap, 0, sizeof(revmap_interval));
+	gap.start = (prev >= 0) ? map->iv[prev].end : 0;
+	gap.end = ((uint64_t)(prev + 1) < map->count) ? map->iv[prev + 1].start : UINT64_MAX;
+	gap.kind = REVMAP_UNPARTITIONED;
+	gap.partition = REVMAP_NO_PARTITION;
+	gap.owner = REVMAP_NO_OWNER;
+
+	for(uint32_t p = 0; p < map->num_parts; p++) {
+		if(offset >= map->parts[p].start && offset < map->parts[p].end) {
+			gap.kind = REVMAP_PARTITION;
+			gap.partition = map->parts[p].partition;
+			if(gap.start < map->parts[p].start)
+				gap.start = map->parts[p].start;
+			if(gap.end > map->parts[p].end)
+				gap.end = map->parts[p].end;
+			break;
+		}
+	}
+
+	return gap;
+}
+
+// Index of the last interval starting at or before offset, -1 if there is none
+static int64_t revmap_search(revmap *map, uint64_t offset) {
+	int64_t lo = 0, hi = (int64_t)map->count - 1, found = -1;
+	while(lo <= hi) {
+		int64_t mid = lo + (hi - lo) / 2;
+		if(map->iv[mid].start <= offset) {
+			found = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return found;
+}
+
+/*
+ * Find what occupies a byte of the image. O(log n)
+ *
+ * @param offset Absolute byte offset in the image
+ * @return The interval containing offset. Offsets not claimed by anything get a synthesized
+ * REVMAP_PARTITION or REVMAP_UNPARTITIONED interval spanning the gap
+ */
+revmap_interval revmap_lookup(revmap *map, uint64_t offset) {
+	revmap_finalize(map);
+
+	int64_t i = revmap_search(map, offset);
+	if(i >= 0 && offset < map->iv[i].end)
+		return map->iv[i];
+
+	return revmap_gap(map, offset, i);
+}
+
+/*
+ * Look up many offsets at once. Hits from scanners arrive mostly in ascending order,
+ * so the interval found for the previous offset (and the one after it) are tried before falling back to a binary search
+ *
+ * @param out Receives the interval for each offset, in the same order
+ */
+void revmap_lookup_batch(revmap *map, const uint64_t *offsets, size_t count, revmap_interval *out) {
+	revmap_finalize(map);
+
+	int64_t hint = -1;
+	for(size_t n = 0; n < count; n++) {
+		uint64_t offset = offsets[n];
+		int64_t i = -1;
+
+		if(hint >= 0 && map->iv[hint].start <= offset) {
+			if((uint64_t)(hint + 1) >= map->count || offset < map->iv[hint + 1].start)
+				i = hint;
+			else if((uint64_t)(hint + 2) >= map->count || offset < map->iv[hint + 2].start)
+				i = hint + 1;
+		}
+		if(i < 0)
+			i = revmap_search(map, offset);
+		hint = i;
+
+		if(i >= 0 && offset < map->iv[i].end)
+			out[n] = map->iv[i];
+		else
+			out[n] = revmap_gap(map, offset, i);
+	}
+}
+
+const char *revmap_kind_str(uint8_t kind) {
+	switch(kind) {
+		case REVMAP_PARTITION:
+			return "Unclaimed";
+		case REVMAP_MBR:
+			return "MBR";
+		case REVMAP_RESERVED:
+			return "Reserved";
+		case REVMAP_FAT:
+			return "FAT";
+		case REVMAP_ROOTDIR:
+			return "Root directory";
+		case REVMAP_FILE:
+			return "File";
+		case REVMAP_SLACK:
+			return "Slack";
+		case REVMAP_UNALLOCATED:
+			return "Unallocated";
+		default:
+			return "Unpartitioned";
+	}
+}
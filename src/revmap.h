@@ -0,0 +1,86 @@
+/**
+   dd_reader
+   revmap.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _REVMAP_H_
+#define _REVMAP_H_
+
+#include "fat.h"
+#include "ntfs.h"
+#include "shared.h"
+
+/*
+ * What occupies a byte range of the image
+ */
+#define REVMAP_UNPARTITIONED 0 // Outside of every partition
+#define REVMAP_PARTITION 1 // Inside a partition but not claimed by any known structure or file
+#define REVMAP_MBR 2
+#define REVMAP_RESERVED 3 // FAT reserved sectors (boot sector, FSINFO, backup boot sector), NTFS boot sector
+#define REVMAP_FAT 4 // File allocation tables
+#define REVMAP_ROOTDIR 5 // FAT12/16 fixed root directory
+#define REVMAP_FILE 6 // File or directory contents
+#define REVMAP_SLACK 7 // Past the end of a file, within its last cluster
+#define REVMAP_UNALLOCATED 8 // Free clusters
+
+// Partition value of intervals that don't belong to a partition
+#define REVMAP_NO_PARTITION 0xFF
+// Owner value of intervals that don't belong to a file
+#define REVMAP_NO_OWNER 0xFFFFFFFF
+
+/*
+ * A byte range of the image and what occupies it. Offsets are absolute byte offsets in the image
+ */
+typedef struct revmap_interval_t {
+	uint64_t start;
+	uint64_t end; // Exclusive
+	uint64_t file_pos; // For FILE and SLACK: logical offset within the file of the first byte of the interval
+	uint32_t owner; // Index of the owning file in its partition's file table (FAT) or MFT record number (NTFS)
+	uint8_t kind; // See REVMAP_*
+	uint8_t partition; // Partition index or REVMAP_NO_PARTITION
+} revmap_interval;
+
+/*
+ * Sorted, non overlapping intervals covering the known structures and files of an image.
+ * Built once, then answers point lookups with a binary search
+ */
+typedef struct revmap_t {
+	revmap_interval *iv;
+	uint32_t count;
+	uint32_t cap;
+	bool sorted;
+
+	// Partition bounds, used to classify offsets that fall between intervals
+	revmap_interval parts[4];
+	uint32_t num_parts;
+} revmap;
+
+/*
+ * Reverse map functions
+ */
+
+revmap *revmap_new();
+void revmap_free(revmap *map);
+void revmap_add(revmap *map, uint64_t start, uint64_t end, uint8_t kind, uint8_t partition, uint32_t owner, uint64_t file_pos);
+void revmap_add_partition(revmap *map, uint64_t start, uint64_t end, uint8_t partition);
+void revmap_add_fat(revmap *map, fat_partition *part, uint8_t partition);
+void revmap_add_ntfs(revmap *map, ntfs_partition *part, uint8_t partition);
+void revmap_finalize(revmap *map);
+revmap_interval revmap_lookup(revmap *map, uint64_t offset);
+void revmap_lookup_batch(revmap *map, const uint64_t *offsets, size_t count, revmap_interval *out);
+const char *revmap_kind_str(uint8_t kind);
+
+#endif
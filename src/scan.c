@@ -0,0 +1,91 @@
+/**
+   dd_reader
+   scan.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "scan.h"
+
+/*
+ * State of one scan_image() call
+ */
+typedef struct scan_job_t {
+	scan_chunk *chunks;
+	scan_fn fn;
+	void *ctx;
+} scan_job;
+
+static void scan_task(void *ctx, size_t index, uint32_t thread) {
+	scan_job *job = (scan_job*)ctx;
+	scan_chunk chunk = job->chunks[index];
+	chunk.thread = thread;
+	job->fn(job->ctx, &chunk);
+}
+
+/*
+ * Split byte ranges of an image into SCAN_CHUNK_SIZE chunks and hand them to fn across the worker threads
+ *
+ * @param img Image contents
+ * @param ranges Byte ranges to scan (start, length in bytes), in any order. NULL to scan the whole image
+ * @param num_ranges Number of ranges
+ * @param fn Called for every chunk
+ */
+void scan_image(const uint8_t *img, uint64_t img_len, const extent *ranges, uint32_t num_ranges, scan_fn fn, void *ctx) {
+	extent whole;
+	whole.start = 0;
+	whole.length = img_len;
+	if(ranges == NULL) {
+		ranges = &whole;
+		num_ranges = 1;
+	}
+
+	size_t count = 0, cap = 64;
+	scan_chunk *chunks = (scan_chunk*)malloc(cap * sizeof(scan_chunk));
+	for(uint32_t i = 0; i < num_ranges; i++) {
+		uint64_t start = ranges[i].start;
+		if(start >= img_len)
+			continue;
+		uint64_t end = (ranges[i].length > img_len - start) ? img_len : start + ranges[i].length;
+
+		for(uint64_t pos = start; pos < end; pos += SCAN_CHUNK_SIZE) {
+			if(count == cap) {
+				cap *= 2;
+				chunks = (scan_chunk*)realloc(chunks, cap * sizeof(scan_chunk));
+			}
+
+			scan_chunk *c = &(chunks[count++]);
+			c->img = img;
+			c->img_len = img_len;
+			c->start = pos;
+			c->end = (end - pos > SCAN_CHUNK_SIZE) ? pos + SCAN_CHUNK_SIZE : end;
+			c->range_start = start;
+			c->range_end = end;
+			c->thread = 0;
+		}
+	}
+
+	scan_job job;
+	job.chunks = chunks;
+	job.fn = fn;
+	job.ctx = ctx;
+	par_run(count, scan_task, &job);
+
+	free(chunks);
+}
+
+// End of the bytes a chunk should examine to find matches of up to overlap + 1 bytes starting in it
+uint64_t scan_window_end(const scan_chunk *chunk, uint64_t overlap) {
+	return (chunk->img_len - chunk->end > overlap) ? chunk->end + overlap : chunk->img_len;
+}
@@ -0,0 +1,57 @@
+/**
+   dd_reader
+   scan.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "extent.h"
+#include "parallel.h"
+
+// Bytes of the image owned by one parallel scan task
+#define SCAN_CHUNK_SIZE (16 * 1024 * 1024)
+
+/*
+ * One unit of work of scan_image(). The task owns [start, end): matches are reported by the task they start in.
+ * The whole image stays readable so matches may run past end (the overlap window) without being split
+ */
+typedef struct scan_chunk_t {
+	const uint8_t *img;
+	uint64_t img_len;
+	uint64_t start; // First owned byte
+	uint64_t end; // One past the last owned byte
+	uint64_t range_start, range_end; // Scanned range the chunk was cut from
+	uint32_t thread; // Worker number, for per thread state
+} scan_chunk;
+
+/*
+ * Called once per chunk, from any worker thread
+ */
+typedef void (*scan_fn)(void *ctx, const scan_chunk *chunk);
+
+/*
+ * Scanner functions
+ */
+
+void scan_image(const uint8_t *img, uint64_t img_len, const extent *ranges, uint32_t num_ranges, scan_fn fn, void *ctx);
+uint64_t scan_window_end(const scan_chunk *chunk, uint64_t overlap);
+
+#endif
@@ -0,0 +1,375 @@
+/**
+   dd_reader
+   search.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <ctype.h>
+
+#include "search.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static inline uint8_t search_lower(uint8_t c) {
+	return (c >= 'A' && c <= 'Z') ? (uint8_t)(c + 32) : c;
+}
+
+static inline uint8_t search_upper(uint8_t c) {
+	return (c >= 'a' && c <= 'z') ? (uint8_t)(c - 32) : c;
+}
+
+search_set *search_set_new() {
+	search_set *set = (search_set*)malloc(sizeof(search_set));
+	memset(set, 0, sizeof(search_set));
+
+	return set;
+}
+
+void search_set_free(search_set *set) {
+	for(uint32_t i = 0; i < set->count; i++) {
+		for(uint32_t t = 0; t < set->patterns[i].num_re; t++) {
+			regfree(&(set->patterns[i].re[t]));
+		}
+		if(set->patterns[i].re != NULL)
+			free(set->patterns[i].re);
+		free(set->patterns[i].text);
+	}
+	if(set->patterns != NULL)
+		free(set->patterns);
+
+	free(set);
+}
+
+static search_pattern *search_next(search_set *set, const char *text, uint8_t type) {
+	if(set->count == set->cap) {
+		set->cap = (set->cap == 0) ? 16 : set->cap * 2;
+		set->patterns = (search_pattern*)realloc(set->patterns, set->cap * sizeof(search_pattern));
+	}
+
+	search_pattern *p = &(set->patterns[set->count++]);
+	memset(p, 0, sizeof(search_pattern));
+	p->text = new_string(text);
+	p->type = type;
+	return p;
+}
+
+/*
+ * Add a literal keyword. \xHH is the byte with hex value HH and \\ is a backslash
+ *
+ * @return False if the keyword is empty, longer than SEARCH_MAX_LITERAL or has an invalid escape
+ */
+bool search_add_literal(search_set *set, const char *text) {
+	uint8_t lit[SEARCH_MAX_LITERAL];
+	uint32_t n = 0;
+
+	for(const char *c = text; *c != '\0'; c++) {
+		if(n == SEARCH_MAX_LITERAL) {
+			printf("Keyword longer than %i bytes: %s\n", SEARCH_MAX_LITERAL, text);
+			return false;
+		}
+
+		if(*c != '\\') {
+			lit[n++] = (uint8_t)*c;
+		} else if(c[1] == '\\') {
+			lit[n++] = '\\';
+			c++;
+		} else {
+			unsigned int v = 0;
+			if(c[1] != 'x' || !isxdigit((unsigned char)c[2]) || !isxdigit((unsigned char)c[3]) || sscanf(c + 2, "%2x", &v) != 1) {
+				printf("Invalid escape in keyword: %s\n", text);
+				return false;
+			}
+			lit[n++] = (uint8_t)v;
+			c += 3;
+		}
+	}
+
+	if(n == 0) {
+		printf("Keywords may not be empty\n");
+		return false;
+	}
+
+	search_pattern *p = search_next(set, text, SEARCH_LITERAL);
+	memcpy(p->lit, lit, n);
+	p->lit_len = n;
+	return true;
+}
+
+// Add a POSIX extended regular expression. It is compiled by search_set_compile()
+bool search_add_regex(search_set *set, const char *text) {
+	if(*text == '\0') {
+		printf("Regular expressions may not be empty\n");
+		return false;
+	}
+
+	search_next(set, text, SEARCH_REGEX);
+	set->has_regex = true;
+	return true;
+}
+
+/*
+ * Add keywords from a text file, one per line. Lines starting with "re:" are regular expressions.
+ * Blank lines are skipped
+ *
+ * @return False if the file could not be read or has an invalid line
+ */
+bool search_set_load(search_set *set, const char *path) {
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL) {
+		printf("Could not open keyword file %s\n", path);
+		return false;
+	}
+
+	char line[4096];
+	bool ok = true;
+	while(ok && fgets(line, sizeof(line), fp) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if(line[0] == '\0')
+			continue;
+
+		if(strncmp(line, "re:", 3) == 0)
+			ok = search_add_regex(set, line + 3);
+		else
+			ok = search_add_literal(set, line);
+	}
+
+	fclose(fp);
+	return ok;
+}
+
+/*
+ * Compile the regexes and build the literal prefilter. Must be called after the last pattern is added
+ *
+ * @return False if a regex is invalid
+ */
+bool search_set_compile(search_set *set) {
+	set->overlap = 0;
+
+	for(uint32_t i = 0; i < set->count; i++) {
+		search_pattern *p = &(set->patterns[i]);
+
+		if(p->type == SEARCH_LITERAL) {
+			if(set->icase) {
+				for(uint32_t k = 0; k < p->lit_len; k++) {
+					p->lit[k] = search_lower(p->lit[k]);
+				}
+			}
+			p->first[0] = p->lit[0];
+			p->first[1] = set->icase ? search_upper(p->lit[0]) : p->lit[0];
+			p->last[0] = p->lit[p->lit_len - 1];
+			p->last[1] = set->icase ? search_upper(p->lit[p->lit_len - 1]) : p->lit[p->lit_len - 1];
+			if(p->lit_len - 1 > set->overlap)
+				set->overlap = p->lit_len - 1;
+			continue;
+		}
+
+		if(p->re != NULL)
+			continue;
+		uint32_t num_threads = par_num_threads();
+		p->re = (regex_t*)malloc(num_threads * sizeof(regex_t));
+		for(uint32_t t = 0; t < num_threads; t++) {
+			int err = regcomp(&(p->re[t]), p->text, REG_EXTENDED | (set->icase ? REG_ICASE : 0));
+			if(err != 0) {
+				char msg[256];
+				regerror(err, &(p->re[t]), msg, sizeof(msg));
+				printf("Invalid regular expression %s: %s\n", p->text, msg);
+				return false;
+			}
+			p->num_re++;
+		}
+	}
+
+	if(set->has_regex)
+		set->overlap = SEARCH_MAX_MATCH;
+	return true;
+}
+
+/*
+ * State of one search_scan() call
+ */
+typedef struct search_job_t {
+	search_set *set;
+	par_list *hits; // search_hit lists of par_lists_new()
+} search_job;
+
+static void search_add_hit(par_list *hits, uint64_t offset, uint64_t length, uint32_t pattern) {
+	search_hit *hit = (search_hit*)par_list_add(hits, sizeof(search_hit));
+	hit->offset = offset;
+	hit->length = length;
+	hit->pattern = pattern;
+}
+
+static bool search_verify(const search_pattern *p, const uint8_t *s, bool icase) {
+	if(!icase)
+		return memcmp(s, p->lit, p->lit_len) == 0;
+
+	for(uint32_t k = 0; k < p->lit_len; k++) {
+		if(search_lower(s[k]) != p->lit[k])
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Find a literal at every position of [pos, end). Candidates must match both the first and the last byte of the
+ * keyword, which is tested 16 positions at a time, before the full compare
+ *
+ * @param limit Matches must end at or before limit
+ */
+static void search_literal(search_job *job, par_list *res, uint32_t idx, const uint8_t *img, uint64_t pos, uint64_t end, uint64_t limit) {
+	const search_pattern *p = &(job->set->patterns[idx]);
+	uint64_t last = p->lit_len - 1;
+
+	if(limit < p->lit_len)
+		return;
+	if(end > limit - last)
+		end = limit - last;
+
+#if defined(__SSE2__)
+	const __m128i f0 = _mm_set1_epi8((char)p->first[0]), f1 = _mm_set1_epi8((char)p->first[1]);
+	const __m128i l0 = _mm_set1_epi8((char)p->last[0]), l1 = _mm_set1_epi8((char)p->last[1]);
+	for(; pos + 16 <= end; pos += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(img + pos));
+		__m128i b = _mm_loadu_si128((const __m128i*)(img + pos + last));
+		__m128i m = _mm_and_si128(_mm_or_si128(_mm_cmpeq_epi8(a, f0), _mm_cmpeq_epi8(a, f1)),
+			_mm_or_si128(_mm_cmpeq_epi8(b, l0), _mm_cmpeq_epi8(b, l1)));
+
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(m);
+		while(mask != 0) {
+			uint64_t at = pos + __builtin_ctz(mask);
+			if(search_verify(p, img + at, job->set->icase))
+				search_add_hit(res, at, p->lit_len, idx);
+			mask &= mask - 1;
+		}
+	}
+#endif
+
+	for(; pos < end; pos++) {
+		if((img[pos] == p->first[0] || img[pos] == p->first[1]) && search_verify(p, img + pos, job->set->icase))
+			search_add_hit(res, pos, p->lit_len, idx);
+	}
+}
+
+/*
+ * Find the leftmost longest, non overlapping matches of a regex starting in [pos, end). Matching resumes at from, which
+ * may lie before pos so a match that began earlier is stepped over rather than matched again from its middle
+ *
+ * @param from Where matching resumes: the end of the previous match, or a point before pos to look back from
+ * @param limit Matches must end at or before limit
+ * @return Where matching resumes for the next block
+ */
+static uint64_t search_regex(search_job *job, par_list *res, uint32_t idx, uint32_t thread, const uint8_t *img, uint64_t from, uint64_t pos, uint64_t end, uint64_t limit) {
+	search_pattern *p = &(job->set->patterns[idx]);
+	uint64_t base = from, cur = from;
+	uint64_t stop = (end + SEARCH_MAX_MATCH < limit) ? end + SEARCH_MAX_MATCH : limit;
+	regmatch_t m;
+
+	while(cur < end) {
+		// REG_STARTEND bounds the search by offsets instead of a terminator so NUL bytes can be searched
+		m.rm_so = (regoff_t)(cur - base);
+		m.rm_eo = (regoff_t)(stop - base);
+		if(regexec(&(p->re[thread]), (const char*)(img + base), 1, &m, REG_STARTEND) != 0)
+			return end;
+
+		uint64_t at = base + (uint64_t)m.rm_so;
+		if(at >= end)
+			return end;
+		uint64_t len = (uint64_t)(m.rm_eo - m.rm_so);
+		if(len > SEARCH_MAX_MATCH)
+			len = SEARCH_MAX_MATCH;
+		// Matches that began before pos belong to the previous chunk
+		if(at >= pos)
+			search_add_hit(res, at, len, idx);
+
+		cur = at + ((len > 0) ? len : 1);
+	}
+
+	return cur;
+}
+
+/*
+ * Search one chunk in SEARCH_WINDOW blocks. Only matches starting inside the chunk are reported, but they may
+ * end up to the set's overlap past it. Regex matching looks back up to SEARCH_MAX_MATCH bytes before the chunk and
+ * carries on across blocks, so a match running over a boundary is not reported again from its middle
+ */
+static void search_chunk(void *ctx, const scan_chunk *chunk) {
+	search_job *job = (search_job*)ctx;
+	search_set *set = job->set;
+	par_list *res = &(job->hits[chunk->thread]);
+	uint64_t limit = scan_window_end(chunk, set->overlap);
+
+	uint64_t lead = (chunk->start - chunk->range_start > SEARCH_MAX_MATCH) ? chunk->start - SEARCH_MAX_MATCH : chunk->range_start;
+	uint64_t *next = (uint64_t*)malloc((set->count > 0 ? set->count : 1) * sizeof(uint64_t));
+	for(uint32_t i = 0; i < set->count; i++) {
+		next[i] = lead;
+	}
+
+	for(uint64_t pos = chunk->start; pos < chunk->end; pos += SEARCH_WINDOW) {
+		uint64_t end = (chunk->end - pos > SEARCH_WINDOW) ? pos + SEARCH_WINDOW : chunk->end;
+
+		for(uint32_t i = 0; i < set->count; i++) {
+			if(set->patterns[i].type == SEARCH_LITERAL)
+				search_literal(job, res, i, chunk->img, pos, end, limit);
+			else
+				next[i] = search_regex(job, res, i, chunk->thread, chunk->img, next[i], pos, end, limit);
+		}
+	}
+
+	free(next);
+}
+
+static int search_hit_cmp(const void *a, const void *b) {
+	const search_hit *x = (const search_hit*)a, *y = (const search_hit*)b;
+	if(x->offset != y->offset)
+		return (x->offset < y->offset) ? -1 : 1;
+	return (x->pattern > y->pattern) - (x->pattern < y->pattern);
+}
+
+/*
+ * Search the image for every pattern of the set, in parallel chunks
+ *
+ * @param set Compiled patterns. See search_set_compile()
+ * @param ranges Byte ranges matches may start in (start, length in bytes). NULL to search the whole image
+ * @param num_ranges Number of ranges
+ * @return Hits sorted by offset. Release with search_free()
+ */
+search_result *search_scan(search_set *set, const uint8_t *img, uint64_t img_len, const extent *ranges, uint32_t num_ranges) {
+	search_result *res = (search_result*)malloc(sizeof(search_result));
+	memset(res, 0, sizeof(search_result));
+
+	if(set->count == 0)
+		return res;
+
+	search_job job;
+	job.set = set;
+	job.hits = par_lists_new();
+
+	scan_image(img, img_len, ranges, num_ranges, search_chunk, &job);
+
+	res->hits = (search_hit*)par_lists_merge(job.hits, sizeof(search_hit), &(res->count));
+	res->cap = res->count;
+
+	qsort(res->hits, res->count, sizeof(search_hit), search_hit_cmp);
+	return res;
+}
+
+void search_free(search_result *res) {
+	if(res->hits != NULL)
+		free(res->hits);
+
+	free(res);
+}
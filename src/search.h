@@ -0,0 +1,92 @@
+/**
+   dd_reader
+   search.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _SEARCH_H_
+#define _SEARCH_H_
+
+#include <regex.h>
+
+#include "extent.h"
+#include "scan.h"
+#include "shared.h"
+
+#define SEARCH_LITERAL 0
+#define SEARCH_REGEX 1
+
+// Longest literal keyword, in bytes
+#define SEARCH_MAX_LITERAL 256
+// Longest regex match. Matches are cut at this length so chunks only need to overlap by this much
+#define SEARCH_MAX_MATCH 4096
+// Bytes handed to one regexec() call. Literals are searched over blocks of this size so they stay in cache
+#define SEARCH_WINDOW (256 * 1024)
+
+/*
+ * A keyword or regular expression
+ */
+typedef struct search_pattern_t {
+	char *text; // As given, for output
+	uint8_t type; // SEARCH_LITERAL or SEARCH_REGEX
+
+	// Literals: bytes after escape decoding, and the first and last byte in both cases for the prefilter
+	uint8_t lit[SEARCH_MAX_LITERAL];
+	uint32_t lit_len;
+	uint8_t first[2], last[2];
+
+	// Regexes: compiled by search_set_compile(), once per worker thread since regexec() serializes callers of the same regex_t
+	regex_t *re;
+	uint32_t num_re;
+} search_pattern;
+
+typedef struct search_set_t {
+	search_pattern *patterns;
+	uint32_t count;
+	uint32_t cap;
+	bool icase; // Case insensitive (ASCII letters only for literals)
+	bool has_regex;
+	uint32_t overlap; // Bytes a chunk's window extends past its end. Set by search_set_compile()
+} search_set;
+
+/*
+ * A match. Regex matches report the leftmost longest match, at most SEARCH_MAX_MATCH bytes
+ */
+typedef struct search_hit_t {
+	uint64_t offset; // Absolute byte offset in the image
+	uint64_t length;
+	uint32_t pattern;
+} search_hit;
+
+typedef struct search_result_t {
+	search_hit *hits; // Sorted by offset
+	uint64_t count;
+	uint64_t cap;
+} search_result;
+
+/*
+ * Search functions
+ */
+
+search_set *search_set_new();
+void search_set_free(search_set *set);
+bool search_add_literal(search_set *set, const char *text);
+bool search_add_regex(search_set *set, const char *text);
+bool search_set_load(search_set *set, const char *path);
+bool search_set_compile(search_set *set);
+search_result *search_scan(search_set *set, const uint8_t *img, uint64_t img_len, const extent *ranges, uint32_t num_ranges);
+void search_free(search_result *res);
+
+#endif
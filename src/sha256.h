@@ -0,0 +1,47 @@
+/**
+   dd_reader
+   sha256.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_LEN 32
+#define SHA256_BLOCK_LEN 64
+
+/*
+ * SHA-256 (FIPS 180-4) hashing state
+ */
+typedef struct sha256_ctx_t {
+	uint32_t state[8];
+	uint64_t length; // Message length in bytes
+	uint8_t block[SHA256_BLOCK_LEN];
+	uint32_t block_len; // Bytes buffered in block
+} sha256_ctx;
+
+/*
+ * SHA-256 functions
+ */
+
+void sha256_init(sha256_ctx *ctx);
+void sha256_update(sha256_ctx *ctx, const uint8_t *data, size_t len);
+void sha256_final(sha256_ctx *ctx, uint8_t *digest);
+
+#endif
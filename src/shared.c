@@ -16,6 +16,8 @@
    limitations under the License.
 */
 
+#include <errno.h>
+
 #include "shared.h"
 
 void print_ascii(uint8_t *buf, size_t len) {
@@ -73,3 +75,170 @@ char *get_partition_str(uint8_t type) {
 
    return str;
 }
+
+/*
+ * Parse an image offset given on the command line or in a list file.
+ * Accepts decimal or 0x prefixed hex byte offsets. A trailing 's' means the value is a 512 byte sector number
+ *
+ * @return False if str is not a valid offset
+ */
+bool parse_offset(const char *str, uint64_t *out) {
+	char *end = NULL;
+
+	while(*str == ' ' || *str == '\t')
+		str++;
+	if(*str == '\0' || *str == '-')
+		return false;
+
+	uint64_t v = strtoull(str, &end, 0);
+	if(end == str)
+		return false;
+
+	if(*end == 's' || *end == 'S') {
+		v *= 512;
+		end++;
+	}
+
+	while(*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n')
+		end++;
+	if(*end != '\0')
+		return false;
+
+	*out = v;
+	return true;
+}
+
+/*
+ * Parse a decimal count given on the command line
+ *
+ * @param min Smallest accepted value
+ * @param max Largest accepted value
+ * @return False if str is not a number in [min, max]
+ */
+bool parse_count(const char *str, uint64_t min, uint64_t max, uint64_t *out) {
+	char *end = NULL;
+
+	if(*str < '0' || *str > '9')
+		return false;
+
+	errno = 0;
+	uint64_t v = strtoull(str, &end, 10);
+	if(*end != '\0' || errno == ERANGE || v < min || v > max)
+		return false;
+
+	*out = v;
+	return true;
+}
+
+/*
+ * Seconds since 1970-01-01 00:00:00 UTC of a proleptic Gregorian date and time, without consulting the C library's time zone.
+ * See: http://howardhinnant.github.io/date_algorithms.html (days_from_civil)
+ */
+int64_t epoch_from_civil(int year, int month, int day, int hour, int min, int sec) {
+	int64_t y = year - (month <= 2);
+	int64_t era = (y >= 0 ? y : y - 399) / 400;
+	int64_t yoe = y - era * 400;
+	int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	int64_t days = era * 146097 + doe - 719468;
+
+	return days * 86400 + hour * 3600 + min * 60 + sec;
+}
+
+// Format epoch seconds as "YYYY-MM-DD HH:MM:SS" (UTC). Inverse of epoch_from_civil()
+void format_epoch(int64_t t, char *dest, size_t dest_len) {
+	int64_t days = (t >= 0 ? t : t - 86399) / 86400;
+	int64_t secs = t - days * 86400;
+
+	days += 719468;
+	int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+	int64_t doe = days - era * 146097;
+	int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	int64_t mp = (5 * doy + 2) / 153;
+	int64_t day = doy - (153 * mp + 2) / 5 + 1;
+	int64_t month = mp < 10 ? mp + 3 : mp - 9;
+	int64_t year = yoe + era * 400 + (month <= 2);
+
+	snprintf(dest, dest_len, "%04lld-%02lld-%02lld %02lld:%02lld:%02lld", (long long)year, (long long)month, (long long)day,
+		(long long)(secs / 3600), (long long)((secs / 60) % 60), (long long)(secs % 60));
+}
+
+// Write str as a CSV field, quoting it if it contains a separator, quote or line break
+void fprint_csv_str(FILE *fp, const char *str) {
+	if(strpbrk(str, ",\"\r\n") == NULL) {
+		fputs(str, fp);
+		return;
+	}
+
+	fputc('"', fp);
+	for(const char *c = str; *c != '\0'; c++) {
+		if(*c == '"')
+			fputc('"', fp);
+		fputc(*c, fp);
+	}
+	fputc('"', fp);
+}
+
+/*
+ * Convert a little endian UTF-16 string (as stored in FAT LFN entries and NTFS attributes) to UTF-8.
+ * Conversion stops at the first NUL or 0xFFFF padding character. Unpaired surrogates are replaced with '?'
+ *
+ * @param src UTF-16LE code units
+ * @param num_chars Maximum number of code units to read from src
+ * @param dest Output buffer. Always NUL terminated if dest_len > 0
+ * @param dest_len Size of dest in bytes
+ * @return Number of bytes written to dest, not including the terminator
+ */
+size_t utf16le_to_utf8(const uint8_t *src, size_t num_chars, char *dest, size_t dest_len) {
+	size_t out = 0;
+	uint32_t cp = 0;
+
+	if(dest_len == 0)
+		return 0;
+
+	for(size_t i = 0; i < num_chars; i++) {
+		cp = read_le16(src + i*2);
+		if(cp == 0x0000 || cp == 0xFFFF)
+			break;
+
+		// Surrogate pair
+		if(cp >= 0xD800 && cp <= 0xDBFF && i+1 < num_chars) {
+			uint32_t lo = read_le16(src + (i+1)*2);
+			if(lo >= 0xDC00 && lo <= 0xDFFF) {
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+				i++;
+			} else {
+				cp = '?';
+			}
+		} else if(cp >= 0xD800 && cp <= 0xDFFF) {
+			cp = '?';
+		}
+
+		char enc[4];
+		size_t n = 0;
+		if(cp < 0x80) {
+			enc[n++] = (char)cp;
+		} else if(cp < 0x800) {
+			enc[n++] = (char)(0xC0 | (cp >> 6));
+			enc[n++] = (char)(0x80 | (cp & 0x3F));
+		} else if(cp < 0x10000) {
+			enc[n++] = (char)(0xE0 | (cp >> 12));
+			enc[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+			enc[n++] = (char)(0x80 | (cp & 0x3F));
+		} else {
+			enc[n++] = (char)(0xF0 | (cp >> 18));
+			enc[n++] = (char)(0x80 | ((cp >> 12) & 0x3F));
+			enc[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+			enc[n++] = (char)(0x80 | (cp & 0x3F));
+		}
+
+		if(out + n >= dest_len)
+			break;
+		memcpy(dest + out, enc, n);
+		out += n;
+	}
+
+	dest[out] = '\0';
+	return out;
+}
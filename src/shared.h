@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <stdbool.h>
 
 /*
  * Partition Types
@@ -35,6 +36,36 @@
 #define PT_NTFS 0x07
 #define PT_FAT32 0x0B
 
+/*
+ * Little endian field access on raw (possibly unaligned) on-disk structures
+ */
+static inline uint16_t read_le16(const uint8_t *p) {
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t read_le32(const uint8_t *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t read_le64(const uint8_t *p) {
+	return (uint64_t)read_le32(p) | ((uint64_t)read_le32(p + 4) << 32);
+}
+
+static inline void write_le16(uint8_t *p, uint16_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void write_le32(uint8_t *p, uint32_t v) {
+	write_le16(p, (uint16_t)v);
+	write_le16(p + 2, (uint16_t)(v >> 16));
+}
+
+static inline void write_le64(uint8_t *p, uint64_t v) {
+	write_le32(p, (uint32_t)v);
+	write_le32(p + 4, (uint32_t)(v >> 32));
+}
+
 /*
  * Shared functions
  */
@@ -44,5 +75,11 @@ void print_hex(uint8_t *buf, size_t len);
 void print_hex2(uint8_t *buf, size_t len);
 char *new_string(const char *str);
 char *get_partition_str(uint8_t type);
+void fprint_csv_str(FILE *fp, const char *str);
+bool parse_offset(const char *str, uint64_t *out);
+bool parse_count(const char *str, uint64_t min, uint64_t max, uint64_t *out);
+int64_t epoch_from_civil(int year, int month, int day, int hour, int min, int sec);
+void format_epoch(int64_t t, char *dest, size_t dest_len);
+size_t utf16le_to_utf8(const uint8_t *src, size_t num_chars, char *dest, size_t dest_len);
 
 #endif
@@ -0,0 +1,215 @@
+/**
+   dd_reader
+   strext.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "strext.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define STREXT_EVEN_BITS 0x5555555555555555ULL
+
+static inline bool strext_printable(uint8_t b) {
+	return (uint8_t)(b - 0x20) < 0x5F;
+}
+
+/*
+ * Classify up to 64 bytes
+ *
+ * @param n Number of bytes at p, at most 64. A multiple of unit
+ * @param unit 1 for ASCII, 2 for UTF-16LE
+ * @return Bit i set if a printable character starts at p + i. For UTF-16LE only even bits are used
+ */
+static uint64_t strext_mask(const uint8_t *p, uint32_t n, uint32_t unit) {
+	uint64_t printable = 0, zero = 0;
+	uint32_t i = 0;
+
+#if defined(__SSE2__)
+	// Shifting by 0x60 maps 0x20 - 0x7E onto the signed range -128 - -34, so one compare classifies 16 bytes
+	const __m128i shift = _mm_set1_epi8(0x60), limit = _mm_set1_epi8(-33), zeros = _mm_setzero_si128();
+	for(; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+		printable |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmplt_epi8(_mm_add_epi8(v, shift), limit)) << i;
+		if(unit == 2)
+			zero |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zeros)) << i;
+	}
+#endif
+
+	for(; i < n; i++) {
+		printable |= (uint64_t)strext_printable(p[i]) << i;
+		zero |= (uint64_t)(p[i] == 0) << i;
+	}
+
+	if(unit == 1)
+		return printable;
+	return printable & (zero >> 1) & STREXT_EVEN_BITS;
+}
+
+/*
+ * Advance *pos by whole units to the first character that is (or is not) printable
+ *
+ * @param limit Characters must end at or before limit
+ * @return False if none was found before limit. *pos is then the end of the last whole unit
+ */
+static bool strext_find(const uint8_t *img, uint64_t *pos, uint64_t limit, uint32_t unit, bool printable) {
+	uint64_t p = *pos;
+
+	while(p + unit <= limit) {
+		uint32_t n = (limit - p > 64) ? 64 : (uint32_t)(limit - p);
+		n -= n % unit;
+
+		uint64_t valid = (n == 64) ? UINT64_MAX : ((1ULL << n) - 1);
+		if(unit == 2)
+			valid &= STREXT_EVEN_BITS;
+
+		uint64_t m = strext_mask(img + p, n, unit);
+		if(!printable)
+			m = ~m & valid;
+		if(m != 0) {
+			*pos = p + __builtin_ctzll(m);
+			return true;
+		}
+		p += n;
+	}
+
+	*pos = p;
+	return false;
+}
+
+static bool strext_char_at(const uint8_t *img, uint64_t pos, uint32_t unit) {
+	return strext_printable(img[pos]) && (unit == 1 || img[pos + 1] == 0);
+}
+
+/*
+ * State of one strext_scan() call
+ */
+typedef struct strext_job_t {
+	uint64_t min_len;
+	uint8_t encodings;
+	par_list *hits; // strext_hit lists of par_lists_new()
+} strext_job;
+
+static void strext_add_hit(par_list *hits, uint64_t offset, uint64_t length, uint8_t encoding) {
+	strext_hit *hit = (strext_hit*)par_list_add(hits, sizeof(strext_hit));
+	hit->offset = offset;
+	hit->length = length;
+	hit->encoding = encoding;
+}
+
+/*
+ * Find the runs of one encoding and alignment that start in the chunk. A run that began in the previous chunk
+ * belongs to it, and a run that reaches the end of the chunk is followed to the end of the range
+ *
+ * @param first First position of the chunk with the wanted alignment
+ */
+static void strext_runs(strext_job *job, const scan_chunk *chunk, uint64_t first, uint32_t unit, uint8_t encoding) {
+	const uint8_t *img = chunk->img;
+	uint64_t pos = first, run = 0;
+	// A run must start before the end of the chunk, but its first character may end past it
+	uint64_t start_limit = (chunk->end + unit - 1 < chunk->range_end) ? chunk->end + unit - 1 : chunk->range_end;
+	// The 0x00 of a UTF-16LE character ending a range may be the first byte past it
+	uint64_t run_limit = (chunk->range_end + unit - 1 < chunk->img_len) ? chunk->range_end + unit - 1 : chunk->img_len;
+
+	if(first >= chunk->range_start + unit && strext_char_at(img, first - unit, unit))
+		strext_find(img, &pos, run_limit, unit, false);
+
+	while(strext_find(img, &pos, start_limit, unit, true)) {
+		run = pos;
+		strext_find(img, &pos, run_limit, unit, false);
+		if((pos - run) / unit >= job->min_len)
+			strext_add_hit(&(job->hits[chunk->thread]), run, (pos - run) / unit, encoding);
+	}
+}
+
+static void strext_chunk(void *ctx, const scan_chunk *chunk) {
+	strext_job *job = (strext_job*)ctx;
+
+	if(job->encodings & STREXT_ASCII)
+		strext_runs(job, chunk, chunk->start, 1, STREXT_ASCII);
+
+	// UTF-16 strings may start at either byte alignment
+	if(job->encodings & STREXT_UTF16LE) {
+		strext_runs(job, chunk, chunk->start, 2, STREXT_UTF16LE);
+		strext_runs(job, chunk, chunk->start + 1, 2, STREXT_UTF16LE);
+	}
+}
+
+static int strext_hit_cmp(const void *a, const void *b) {
+	const strext_hit *x = (const strext_hit*)a, *y = (const strext_hit*)b;
+	if(x->offset != y->offset)
+		return (x->offset < y->offset) ? -1 : 1;
+	return (x->encoding > y->encoding) - (x->encoding < y->encoding);
+}
+
+/*
+ * Extract every run of at least min_len printable characters from the image, in parallel chunks
+ *
+ * @param ranges Byte ranges to search (start, length in bytes). Runs end at range boundaries, but for the 0x00 of a final
+ * UTF-16LE character. NULL to search the whole image
+ * @param num_ranges Number of ranges
+ * @param min_len Shortest run reported, in characters
+ * @param encodings STREXT_* flags
+ * @return Runs sorted by offset. Release with strext_free()
+ */
+strext_result *strext_scan(const uint8_t *img, uint64_t img_len, const extent *ranges, uint32_t num_ranges, uint64_t min_len, uint8_t encodings) {
+	strext_result *res = (strext_result*)malloc(sizeof(strext_result));
+	memset(res, 0, sizeof(strext_result));
+
+	strext_job job;
+	job.min_len = (min_len > 0) ? min_len : 1;
+	job.encodings = encodings;
+	job.hits = par_lists_new();
+
+	scan_image(img, img_len, ranges, num_ranges, strext_chunk, &job);
+
+	res->hits = (strext_hit*)par_lists_merge(job.hits, sizeof(strext_hit), &(res->count));
+	res->cap = res->count;
+
+	qsort(res->hits, res->count, sizeof(strext_hit), strext_hit_cmp);
+	return res;
+}
+
+// Write the text of a run to fp. UTF-16LE characters are written as their low (ASCII) byte
+void strext_write(FILE *fp, const uint8_t *img, const strext_hit *hit) {
+	if(hit->encoding == STREXT_ASCII) {
+		fwrite(img + hit->offset, 1, hit->length, fp);
+		return;
+	}
+
+	char buf[512];
+	uint64_t done = 0;
+	while(done < hit->length) {
+		uint32_t n = (hit->length - done > sizeof(buf)) ? sizeof(buf) : (uint32_t)(hit->length - done);
+		for(uint32_t i = 0; i < n; i++) {
+			buf[i] = (char)img[hit->offset + (done + i) * 2];
+		}
+		fwrite(buf, 1, n, fp);
+		done += n;
+	}
+}
+
+const char *strext_encoding_name(uint8_t encoding) {
+	return (encoding == STREXT_ASCII) ? "ascii" : "utf16le";
+}
+
+void strext_free(strext_result *res) {
+	if(res->hits != NULL)
+		free(res->hits);
+
+	free(res);
+}
@@ -0,0 +1,57 @@
+/**
+   dd_reader
+   strext.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _STREXT_H_
+#define _STREXT_H_
+
+#include "extent.h"
+#include "scan.h"
+#include "shared.h"
+
+/*
+ * Encodings searched for. A character is a printable ASCII byte (0x20 - 0x7E), alone or followed by 0x00
+ */
+#define STREXT_ASCII 0x01
+#define STREXT_UTF16LE 0x02
+#define STREXT_ALL (STREXT_ASCII | STREXT_UTF16LE)
+
+/*
+ * A run of printable characters. The text is read back from the image, see strext_write()
+ */
+typedef struct strext_hit_t {
+	uint64_t offset; // Absolute byte offset of the first character
+	uint64_t length; // In characters
+	uint8_t encoding; // STREXT_ASCII or STREXT_UTF16LE
+} strext_hit;
+
+typedef struct strext_result_t {
+	strext_hit *hits; // Sorted by offset
+	uint64_t count;
+	uint64_t cap;
+} strext_result;
+
+/*
+ * String extraction functions
+ */
+
+strext_result *strext_scan(const uint8_t *img, uint64_t img_len, const extent *ranges, uint32_t num_ranges, uint64_t min_len, uint8_t encodings);
+void strext_write(FILE *fp, const uint8_t *img, const strext_hit *hit);
+const char *strext_encoding_name(uint8_t encoding);
+void strext_free(strext_result *res);
+
+#endif
@@ -0,0 +1,294 @@
+/**
+   dd_reader
+   timeline.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "timeline.h"
+
+// Output is formatted straight into a stdio buffer of this size, nothing else is kept in memory
+#define TL_WRITE_BUFFER (1024 * 1024)
+// Runs shorter than this are sorted by insertion before merging
+#define TL_INSERTION_RUN 32
+
+timeline *timeline_new() {
+	timeline *tl = (timeline*)malloc(sizeof(timeline));
+	memset(tl, 0, sizeof(timeline));
+
+	return tl;
+}
+
+void timeline_free(timeline *tl) {
+	if(tl->events != NULL)
+		free(tl->events);
+
+	free(tl);
+}
+
+static void timeline_add(timeline *tl, int64_t time, uint8_t partition, uint32_t file, uint8_t type) {
+	if(tl->count == tl->cap) {
+		tl->cap = (tl->cap == 0) ? 4096 : tl->cap * 2;
+		tl->events = (timeline_event*)realloc(tl->events, tl->cap * sizeof(timeline_event));
+	}
+
+	timeline_event *ev = &(tl->events[tl->count++]);
+	ev->time = time;
+	ev->file = file;
+	ev->partition = partition;
+	ev->type = type;
+	ev->reserved = 0;
+}
+
+/*
+ * Add the modified, accessed and created times of every file on a FAT volume. Walks the directory tree if needed
+ *
+ * @param partition Index of the partition in the MBR
+ */
+void timeline_add_fat(timeline *tl, fat_partition *part, uint8_t partition) {
+	fat_read_directory_tree(part);
+	tl->parts[partition] = part;
+
+	for(uint32_t i = FAT_ROOT_INDEX + 1; i < part->num_files; i++) {
+		fat_dirent *de = &(part->files[i].de);
+		int64_t t[3] = {
+			fat_time_to_epoch(de->mdate, de->mtime, 0),
+			fat_time_to_epoch(de->adate, 0, 0),
+			fat_time_to_epoch(de->cdate, de->ctime, de->ctime_tenth)
+		};
+		uint8_t bits[3] = { TL_MODIFIED, TL_ACCESSED, TL_BORN };
+
+		// Fold identical timestamps into a single event
+		for(int a = 0; a < 3; a++) {
+			if(t[a] == FAT_TIME_NONE)
+				continue;
+
+			uint8_t type = bits[a];
+			for(int b = a + 1; b < 3; b++) {
+				if(t[b] == t[a]) {
+					type |= bits[b];
+					t[b] = FAT_TIME_NONE;
+				}
+			}
+			timeline_add(tl, t[a], partition, i, type);
+		}
+	}
+}
+
+// Strict weak ordering of events: time, then partition and file so equal times come out in a stable order
+static inline bool tl_less(const timeline_event *a, const timeline_event *b) {
+	if(a->time != b->time)
+		return a->time < b->time;
+	if(a->partition != b->partition)
+		return a->partition < b->partition;
+	return a->file < b->file;
+}
+
+// Merge sorted runs a[0, na) and b[0, nb) into dest
+static void tl_merge(const timeline_event *a, size_t na, const timeline_event *b, size_t nb, timeline_event *dest) {
+	size_t i = 0, j = 0, k = 0;
+	while(i < na && j < nb) {
+		if(tl_less(&b[j], &a[i]))
+			dest[k++] = b[j++];
+		else
+			dest[k++] = a[i++];
+	}
+	memcpy(dest + k, a + i, (na - i) * sizeof(timeline_event));
+	k += na - i;
+	memcpy(dest + k, b + j, (nb - j) * sizeof(timeline_event));
+}
+
+/*
+ * Bottom up merge sort of ev[0, n) using tmp (n events) as scratch space. The result always ends up in ev
+ */
+static void tl_sort_range(timeline_event *ev, timeline_event *tmp, size_t n) {
+	// Insertion sort small runs
+	for(size_t lo = 0; lo < n; lo += TL_INSERTION_RUN) {
+		size_t hi = (lo + TL_INSERTION_RUN < n) ? lo + TL_INSERTION_RUN : n;
+		for(size_t i = lo + 1; i < hi; i++) {
+			timeline_event v = ev[i];
+			size_t j = i;
+			while(j > lo && tl_less(&v, &ev[j - 1])) {
+				ev[j] = ev[j - 1];
+				j--;
+			}
+			ev[j] = v;
+		}
+	}
+
+	timeline_event *src = ev, *dest = tmp, *swap = NULL;
+	for(size_t width = TL_INSERTION_RUN; width < n; width *= 2) {
+		for(size_t lo = 0; lo < n; lo += 2 * width) {
+			size_t mid = (lo + width < n) ? lo + width : n;
+			size_t hi = (lo + 2 * width < n) ? lo + 2 * width : n;
+			tl_merge(src + lo, mid - lo, src + mid, hi - mid, dest + lo);
+		}
+		swap = src;
+		src = dest;
+		dest = swap;
+	}
+
+	if(src != ev)
+		memcpy(ev, src, n * sizeof(timeline_event));
+}
+
+/*
+ * Shared state of the parallel sort. The events are split into one chunk per thread, each chunk is sorted,
+ * then neighbouring runs are merged pairwise, one merge per task, doubling the run length each round
+ */
+typedef struct tl_sort_job_t {
+	timeline_event *src;
+	timeline_event *dest;
+	size_t n;
+	size_t run; // Length of the sorted runs being merged this round
+} tl_sort_job;
+
+static void tl_sort_chunk_task(void *ctx, size_t index, uint32_t thread) {
+	tl_sort_job *job = (tl_sort_job*)ctx;
+	size_t lo = index * job->run;
+	size_t hi = (lo + job->run < job->n) ? lo + job->run : job->n;
+	tl_sort_range(job->src + lo, job->dest + lo, hi - lo);
+}
+
+static void tl_merge_task(void *ctx, size_t index, uint32_t thread) {
+	tl_sort_job *job = (tl_sort_job*)ctx;
+	size_t lo = index * 2 * job->run;
+	size_t mid = (lo + job->run < job->n) ? lo + job->run : job->n;
+	size_t hi = (lo + 2 * job->run < job->n) ? lo + 2 * job->run : job->n;
+	tl_merge(job->src + lo, mid - lo, job->src + mid, hi - mid, job->dest + lo);
+}
+
+/*
+ * Sort the events by time with a parallel merge sort
+ */
+void timeline_sort(timeline *tl) {
+	size_t n = tl->count;
+	if(n < 2)
+		return;
+
+	timeline_event *tmp = (timeline_event*)malloc(n * sizeof(timeline_event));
+	uint32_t chunks = (n < TL_PARALLEL_MIN) ? 1 : par_num_threads();
+
+	tl_sort_job job;
+	job.src = tl->events;
+	job.dest = tmp;
+	job.n = n;
+	job.run = (n + chunks - 1) / chunks;
+	par_run(chunks, tl_sort_chunk_task, &job);
+
+	// Pairwise merge rounds, alternating between the two buffers
+	while(job.run < n) {
+		size_t pairs = (n + 2 * job.run - 1) / (2 * job.run);
+		par_run(pairs, tl_merge_task, &job);
+
+		timeline_event *swap = job.src;
+		job.src = job.dest;
+		job.dest = swap;
+		job.run *= 2;
+	}
+
+	if(job.src != tl->events) {
+		free(tl->events);
+		tl->events = job.src;
+		tl->cap = n;
+	} else {
+		free(tmp);
+	}
+}
+
+// "macb" style type column, '.' for absent bits
+static void tl_type_str(uint8_t type, char *dest) {
+	dest[0] = (type & TL_MODIFIED) ? 'm' : '.';
+	dest[1] = (type & TL_ACCESSED) ? 'a' : '.';
+	dest[2] = (type & TL_CHANGED) ? 'c' : '.';
+	dest[3] = (type & TL_BORN) ? 'b' : '.';
+	dest[4] = '\0';
+}
+
+static void tl_write_bodyfile_line(FILE *fp, fat_partition *part, uint8_t partition, uint32_t index) {
+	fat_file *f = &(part->files[index]);
+	fat_dirent *de = &(f->de);
+	int64_t atime = fat_time_to_epoch(de->adate, 0, 0);
+	int64_t mtime = fat_time_to_epoch(de->mdate, de->mtime, 0);
+	int64_t crtime = fat_time_to_epoch(de->cdate, de->ctime, de->ctime_tenth);
+	bool dir = (de->attr & FAT_ATTR_DIRECTORY) != 0;
+	const char *perm = (de->attr & FAT_ATTR_READ_ONLY) ? "r-xr-xr-x" : "rwxrwxrwx";
+
+	// MD5|name|inode|mode_as_string|UID|GID|size|atime|mtime|ctime|crtime
+	fprintf(fp, "0|p%u%s|%u|%s/%s%s|0|0|%u|%lld|%lld|0|%lld\n", partition, f->path, index,
+		dir ? "d" : "r", dir ? "d" : "r", perm, de->size,
+		(long long)(atime == FAT_TIME_NONE ? 0 : atime),
+		(long long)(mtime == FAT_TIME_NONE ? 0 : mtime),
+		(long long)(crtime == FAT_TIME_NONE ? 0 : crtime));
+}
+
+/*
+ * Stream the sorted timeline to a file. Each record is formatted directly into the stdio buffer as it is written.
+ * CSV: one row per event. Bodyfile: one TSK bodyfile record per file, in the order of each file's earliest event
+ *
+ * @param format TL_FORMAT_CSV or TL_FORMAT_BODYFILE
+ * @return False if the output could not be opened
+ */
+bool timeline_write(timeline *tl, const char *path, int format) {
+	FILE *fp = fopen(path, "w");
+	if(fp == NULL) {
+		printf("Could not open file %s to write the timeline\n", path);
+		return false;
+	}
+
+	char *iobuf = (char*)malloc(TL_WRITE_BUFFER);
+	setvbuf(fp, iobuf, _IOFBF, TL_WRITE_BUFFER);
+
+	// Bodyfile: bitmap per partition of files already written
+	uint64_t *written[4] = { NULL, NULL, NULL, NULL };
+	if(format == TL_FORMAT_BODYFILE) {
+		for(int p = 0; p < 4; p++) {
+			if(tl->parts[p] != NULL)
+				written[p] = (uint64_t*)calloc((tl->parts[p]->num_files / 64) + 1, sizeof(uint64_t));
+		}
+	} else {
+		fprintf(fp, "Date,Size,Type,Mode,Partition,Meta,File Name\n");
+	}
+
+	char date[32], type[5];
+	for(size_t i = 0; i < tl->count; i++) {
+		timeline_event *ev = &(tl->events[i]);
+		fat_partition *part = tl->parts[ev->partition];
+
+		if(format == TL_FORMAT_BODYFILE) {
+			uint64_t *bits = written[ev->partition];
+			if((bits[ev->file / 64] >> (ev->file % 64)) & 1)
+				continue;
+			bits[ev->file / 64] |= (1ULL << (ev->file % 64));
+			tl_write_bodyfile_line(fp, part, ev->partition, ev->file);
+			continue;
+		}
+
+		fat_file *f = &(part->files[ev->file]);
+		format_epoch(ev->time, date, sizeof(date));
+		tl_type_str(ev->type, type);
+		fprintf(fp, "%s,%u,%s,%s,%u,%u,", date, f->de.size, type, (f->de.attr & FAT_ATTR_DIRECTORY) ? "d" : "r", ev->partition, ev->file);
+		fprint_csv_str(fp, f->path);
+		fputc('\n', fp);
+	}
+
+	for(int p = 0; p < 4; p++) {
+		if(written[p] != NULL)
+			free(written[p]);
+	}
+
+	fclose(fp);
+	free(iobuf);
+	return true;
+}
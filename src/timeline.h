@@ -0,0 +1,68 @@
+/**
+   dd_reader
+   timeline.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _TIMELINE_H_
+#define _TIMELINE_H_
+
+#include "fat.h"
+#include "parallel.h"
+#include "shared.h"
+
+// Event type bits. A file with several timestamps at the same second gets one event with several bits
+#define TL_MODIFIED 0x01
+#define TL_ACCESSED 0x02
+#define TL_CHANGED 0x04 // Metadata change. Not recorded by FAT
+#define TL_BORN 0x08 // Creation
+
+// Output formats
+#define TL_FORMAT_CSV 0
+#define TL_FORMAT_BODYFILE 1
+
+// Below this many events the sort runs on the calling thread only
+#define TL_PARALLEL_MIN 65536
+
+/*
+ * One timeline event. Fixed width so millions of them sort quickly; names are only looked up when writing
+ */
+typedef struct timeline_event_t {
+	int64_t time; // Seconds since the Unix epoch
+	uint32_t file; // Index of the file in its partition's file table
+	uint8_t partition;
+	uint8_t type; // TL_* bits
+	uint16_t reserved;
+} timeline_event;
+
+typedef struct timeline_t {
+	timeline_event *events;
+	size_t count;
+	size_t cap;
+
+	fat_partition *parts[4]; // Partitions the events refer to, for names and sizes
+} timeline;
+
+/*
+ * Timeline functions
+ */
+
+timeline *timeline_new();
+void timeline_free(timeline *tl);
+void timeline_add_fat(timeline *tl, fat_partition *part, uint8_t partition);
+void timeline_sort(timeline *tl);
+bool timeline_write(timeline *tl, const char *path, int format);
+
+#endif
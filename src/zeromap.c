@@ -0,0 +1,267 @@
+/**
+   dd_reader
+   zeromap.c
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#define _GNU_SOURCE // SEEK_DATA and SEEK_HOLE
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "zeromap.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Zero bytes handed to zeromap_feed() callbacks in place of zero runs of the image
+#define ZEROMAP_FEED_CHUNK (64 * 1024)
+static const uint8_t zeromap_zeros[ZEROMAP_FEED_CHUNK];
+
+/*
+ * Check if every byte of a buffer is 0x00
+ */
+bool zeromap_all_zero(const uint8_t *p, size_t len) {
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	for(; i + 64 <= len; i += 64) {
+		__m128i v = _mm_or_si128(_mm_or_si128(_mm_loadu_si128((const __m128i*)(p + i)), _mm_loadu_si128((const __m128i*)(p + i + 16))),
+			_mm_or_si128(_mm_loadu_si128((const __m128i*)(p + i + 32)), _mm_loadu_si128((const __m128i*)(p + i + 48))));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xFFFF)
+			return false;
+	}
+#endif
+
+	for(; i < len; i++) {
+		if(p[i] != 0)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Mark the blocks lying entirely within holes of a sparse file. Nothing is marked if the file system does not
+ * report holes
+ */
+static void zeromap_mark_holes(zeromap *map, const char *path) {
+#if defined(SEEK_HOLE) && defined(SEEK_DATA)
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return;
+
+	off_t pos = 0, data = 0;
+	while((uint64_t)pos < map->img_len) {
+		data = lseek(fd, pos, SEEK_DATA);
+		if(data < 0 || (uint64_t)data > map->img_len)
+			data = (off_t)map->img_len; // No data after pos (ENXIO)
+
+		// Whole blocks within the hole [pos, data)
+		uint64_t first = ((uint64_t)pos + map->block_size - 1) / map->block_size;
+		uint64_t last = ((uint64_t)data == map->img_len) ? map->num_blocks : (uint64_t)data / map->block_size;
+		for(uint64_t b = first; b < last; b++) {
+			map->bits[b / 64] |= (1ULL << (b % 64));
+		}
+		map->hole_bytes += (uint64_t)(data - pos);
+
+		if((uint64_t)data >= map->img_len)
+			break;
+		pos = lseek(fd, data, SEEK_HOLE);
+		if(pos < 0)
+			break;
+	}
+
+	close(fd);
+#endif
+}
+
+/*
+ * State of one zeromap_build() call
+ */
+typedef struct zeromap_job_t {
+	zeromap *map;
+	const uint8_t *img;
+	uint64_t *counts; // Zero blocks found, per worker thread
+} zeromap_job;
+
+static void zeromap_task(void *ctx, size_t index, uint32_t thread) {
+	zeromap_job *job = (zeromap_job*)ctx;
+	zeromap *map = job->map;
+
+	uint64_t first = (uint64_t)index * ZEROMAP_BLOCKS_PER_TASK;
+	uint64_t last = (first + ZEROMAP_BLOCKS_PER_TASK < map->num_blocks) ? first + ZEROMAP_BLOCKS_PER_TASK : map->num_blocks;
+	for(uint64_t b = first; b < last; b++) {
+		uint64_t bit = 1ULL << (b % 64);
+
+		// Blocks in holes are already known to be zero
+		if((map->bits[b / 64] & bit) == 0) {
+			uint64_t off = b * map->block_size;
+			size_t len = (map->img_len - off < map->block_size) ? (size_t)(map->img_len - off) : map->block_size;
+			if(!zeromap_all_zero(job->img + off, len))
+				continue;
+			map->bits[b / 64] |= bit;
+		}
+		job->counts[thread]++;
+	}
+}
+
+/*
+ * Find the all zero blocks of the image across the worker threads
+ *
+ * @param path Image file, queried for holes when it is sparse. NULL to test every block
+ * @return Map to release with zeromap_free()
+ */
+zeromap *zeromap_build(const uint8_t *img, uint64_t img_len, const char *path) {
+	zeromap *map = (zeromap*)malloc(sizeof(zeromap));
+	memset(map, 0, sizeof(zeromap));
+
+	map->block_size = ZEROMAP_BLOCK;
+	map->img_len = img_len;
+	map->num_blocks = (img_len + ZEROMAP_BLOCK - 1) / ZEROMAP_BLOCK;
+	map->bits = (uint64_t*)calloc(map->num_blocks / 64 + 1, sizeof(uint64_t));
+
+	if(path != NULL)
+		zeromap_mark_holes(map, path);
+
+	zeromap_job job;
+	uint32_t num_threads = par_num_threads();
+	job.map = map;
+	job.img = img;
+	job.counts = (uint64_t*)calloc(num_threads, sizeof(uint64_t));
+
+	par_run((map->num_blocks + ZEROMAP_BLOCKS_PER_TASK - 1) / ZEROMAP_BLOCKS_PER_TASK, zeromap_task, &job);
+
+	for(uint32_t t = 0; t < num_threads; t++) {
+		map->zero_blocks += job.counts[t];
+	}
+	free(job.counts);
+	return map;
+}
+
+void zeromap_free(zeromap *map) {
+	free(map->bits);
+	free(map);
+}
+
+bool zeromap_is_zero(zeromap *map, uint64_t block) {
+	return block < map->num_blocks && ((map->bits[block / 64] >> (block % 64)) & 1);
+}
+
+// First block in [block, end) whose zero bit equals zero, or end if there is none
+static uint64_t zeromap_next(zeromap *map, uint64_t block, uint64_t end, bool zero) {
+	while(block < end) {
+		uint64_t w = map->bits[block / 64];
+		if(!zero)
+			w = ~w;
+		w &= ~0ULL << (block % 64);
+		if(w != 0) {
+			uint64_t b = (block & ~63ULL) + __builtin_ctzll(w);
+			return (b < end) ? b : end;
+		}
+		block = (block & ~63ULL) + 64;
+	}
+	return end;
+}
+
+/*
+ * End of the zero bytes known from the map at and after an offset
+ *
+ * @return Offset of the first block after offset's zero run, or offset itself if its block is not all zero
+ */
+uint64_t zeromap_zero_end(zeromap *map, uint64_t offset) {
+	uint64_t b = offset / map->block_size;
+	if(!zeromap_is_zero(map, b))
+		return offset;
+
+	uint64_t end = zeromap_next(map, b, map->num_blocks, false) * map->block_size;
+	return (end < map->img_len) ? end : map->img_len;
+}
+
+/*
+ * Remove the zero runs of at least ZEROMAP_MIN_GAP blocks from byte ranges of the image
+ *
+ * @param ranges Byte ranges (start, length in bytes). NULL for the whole image
+ * @param out Remaining ranges are appended, in the order of the input
+ */
+void zeromap_data_ranges(zeromap *map, const extent *ranges, uint32_t num_ranges, extent_list *out) {
+	extent whole;
+	whole.start = 0;
+	whole.length = map->img_len;
+	if(ranges == NULL) {
+		ranges = &whole;
+		num_ranges = 1;
+	}
+
+	for(uint32_t r = 0; r < num_ranges; r++) {
+		if(ranges[r].start >= map->img_len)
+			continue;
+		uint64_t start = ranges[r].start;
+		uint64_t end = (ranges[r].length > map->img_len - start) ? map->img_len : start + ranges[r].length;
+
+		// Only whole blocks inside the range can be cut out
+		uint64_t pos = start;
+		uint64_t b = (start + map->block_size - 1) / map->block_size;
+		uint64_t b_end = end / map->block_size;
+		if(end == map->img_len)
+			b_end = map->num_blocks;
+
+		while(b < b_end) {
+			uint64_t z = zeromap_next(map, b, b_end, true);
+			uint64_t nz = zeromap_next(map, z, b_end, false);
+			if(nz - z >= ZEROMAP_MIN_GAP || nz == map->num_blocks) {
+				uint64_t gap_start = z * map->block_size;
+				uint64_t gap_end = (nz * map->block_size < end) ? nz * map->block_size : end;
+				if(gap_start > pos)
+					extent_list_append(out, pos, gap_start - pos, true);
+				pos = gap_end;
+			}
+			b = nz;
+		}
+
+		if(end > pos)
+			extent_list_append(out, pos, end - pos, true);
+	}
+}
+
+/*
+ * Pass the whole image to fn in order. Zero runs are passed from a static zero buffer instead of the image, so
+ * digests of mostly empty images do not stream the empty space through memory
+ */
+void zeromap_feed(zeromap *map, const uint8_t *img, zeromap_feed_fn fn, void *ctx) {
+	uint64_t b = 0;
+
+	while(b < map->num_blocks) {
+		uint64_t z = zeromap_next(map, b, map->num_blocks, true);
+		uint64_t nz = zeromap_next(map, z, map->num_blocks, false);
+
+		uint64_t start = b * map->block_size, gap = z * map->block_size;
+		uint64_t gap_end = (nz * map->block_size < map->img_len) ? nz * map->block_size : map->img_len;
+		if(gap > map->img_len)
+			gap = map->img_len;
+
+		// Data, in pieces that fit the callback's size type
+		for(uint64_t pos = start; pos < gap; pos += ZEROMAP_FEED_CHUNK * 256ULL) {
+			uint64_t n = (gap - pos < ZEROMAP_FEED_CHUNK * 256ULL) ? gap - pos : ZEROMAP_FEED_CHUNK * 256ULL;
+			fn(ctx, img + pos, (size_t)n);
+		}
+		for(uint64_t pos = gap; pos < gap_end; pos += ZEROMAP_FEED_CHUNK) {
+			uint64_t n = (gap_end - pos < ZEROMAP_FEED_CHUNK) ? gap_end - pos : ZEROMAP_FEED_CHUNK;
+			fn(ctx, zeromap_zeros, (size_t)n);
+		}
+
+		b = nz;
+	}
+}
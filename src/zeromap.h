@@ -0,0 +1,60 @@
+/**
+   dd_reader
+   zeromap.h
+   Copyright 2013 Ramsey Kant
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _ZEROMAP_H_
+#define _ZEROMAP_H_
+
+#include "extent.h"
+#include "parallel.h"
+#include "shared.h"
+
+#define ZEROMAP_BLOCK 4096
+#define ZEROMAP_BLOCKS_PER_TASK 4096 // Blocks tested per parallel task. A multiple of 64 so tasks never share a bitmap word
+// Shortest run of zero blocks cut out of scan ranges. Shorter runs are scanned through to keep the range count down
+#define ZEROMAP_MIN_GAP 16
+
+/*
+ * All zero blocks of an image. The last block may be short
+ */
+typedef struct zeromap_t {
+	uint32_t block_size;
+	uint64_t num_blocks;
+	uint64_t img_len;
+	uint64_t *bits; // 1 bit per block, set if every byte of the block is 0x00
+	uint64_t zero_blocks;
+	uint64_t hole_bytes; // Bytes found in holes of the sparse image file, known to be zero without reading them
+} zeromap;
+
+/*
+ * Called by zeromap_feed() with consecutive pieces of the image
+ */
+typedef void (*zeromap_feed_fn)(void *ctx, const uint8_t *data, size_t len);
+
+/*
+ * Zero block map functions
+ */
+
+bool zeromap_all_zero(const uint8_t *p, size_t len);
+zeromap *zeromap_build(const uint8_t *img, uint64_t img_len, const char *path);
+void zeromap_free(zeromap *map);
+bool zeromap_is_zero(zeromap *map, uint64_t block);
+uint64_t zeromap_zero_end(zeromap *map, uint64_t offset);
+void zeromap_data_ranges(zeromap *map, const extent *ranges, uint32_t num_ranges, extent_list *out);
+void zeromap_feed(zeromap *map, const uint8_t *img, zeromap_feed_fn fn, void *ctx);
+
+#endif